@@ -1,7 +1,11 @@
 // filesystem user-level calls
 
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "filesystem.h"
@@ -9,138 +13,73 @@
 #include "../util/util.h"
 #include "../util/p-errno.h"
 #include "../kernel/PCB.h"
+#include "../kernel/kernel-functions.h"
+#include "../pennfat/defrag.h"
 #include "../pennfat/fat.h"
 #include "../pennfat/safe.h"
 
-int next_file_id = 0; // next available file_id for a newly opened file
 file_t* open_files = NULL; // global list of files currently open by any process
+ofd_t* ofd_table = NULL; // open file descriptions, indexed by the values in PCB fd tables
+int ofd_cap = 0; // slots in `ofd_table`
+int ofd_free = -1; // first free slot of `ofd_table`, or `-1` if it is full
 extern PCB* current_pcb; // updated globally
 
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #define BETWEEN_INCL(value, lower, upper) ((value) >= (lower) && (value) <= (upper))
+#define OFD_WRITABLE(ofd) ((ofd)->mode == F_WRITE || (ofd)->mode == F_APPEND)
 
 /**
- * create & insert a file pointer into the fileptr list
- * @param fileptr_head the head of the fileptr list
- * @param pid the process id for the fileptr
- * @param ptr the pointer/offset
+ * block SIGALRM around a filesystem update, so that no other process runs between the
+ * update's journal records & its commit
+ * @param prev_mask where the previous signal mask is saved, for `unblock_alarm`
  * @return none
 */
-void create_fileptr(fileptr_t** fileptr_head, int pid, int ptr) {
-    fileptr_t* new_fileptr = malloc(sizeof(fileptr_t));
-    new_fileptr->pid = pid;
-    new_fileptr->ptr = ptr;
-    if (*fileptr_head == NULL) {
-        new_fileptr->next = NULL;
-    } else {
-        new_fileptr->next = *fileptr_head;
-    }
-    *fileptr_head = new_fileptr;
+static void block_alarm(sigset_t* prev_mask) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &mask, prev_mask);
 }
 
 /**
- * delete the specified file pointer from the fileptr list
- * @param fileptr_head the head of the fileptr list
- * @param pid the process id whose fileptr should be deleted
+ * restore the signal mask saved by `block_alarm`
+ * @param prev_mask the saved signal mask
  * @return none
 */
-void delete_fileptr(fileptr_t** fileptr_head, int pid) {
-    fileptr_t* curr = *fileptr_head;
-    fileptr_t* prev = NULL;
-    while (curr != NULL && curr->pid != pid) { // set curr to the fileptr
-        prev = curr;
-        curr = curr->next;
-    }
-    if (curr != NULL) { // fileptr found
-        if (prev == NULL) *fileptr_head = curr->next; // first file_entry was deleted
-        else prev->next = curr->next; // trailing file_entry was deleted
-        free(curr);
-    } else { // fileptr not found
-        // fprintf(stderr, "fileptr not found (pid:[%d])\n", pid);
-    }
+static void unblock_alarm(const sigset_t* prev_mask) {
+    sigprocmask(SIG_SETMASK, prev_mask, NULL);
 }
 
-/**
- * get a file pointer struct for a process
- * @param fileptr_head the head of the fileptr list
- * @param pid the process id to find a fileptr for
- * @return the file pointer struct, or `NULL` if `pid` was not found
-*/
-fileptr_t* get_fileptr(fileptr_t* fileptr_head, int pid) {
-    fileptr_t* curr = fileptr_head;
-    // printf("Looking for: %d\n", pid);
-    // printf("curr: %ld\n", (long)fileptr_head);
-    while (curr != NULL) {
-        // printf("PID: %d\n", curr->pid);
-        if (pid == curr->pid) return curr;
-        curr = curr->next;
-    }
-    return NULL;
-}
-
-/**
- * get a file pointer for a process
- * @param fileptr_head the head of the fileptr list
- * @param pid the process id to find a fileptr for
- * @return the file pointer, or `-1` if `pid` was not found
-*/
-int get_fileptr_ptr(fileptr_t* fileptr_head, int pid) {
-    fileptr_t* fileptr = get_fileptr(fileptr_head, pid);
-    if (!fileptr) return -1;
-    return fileptr->ptr;
-}
-
-
-
 /**
  * create & insert a file entry into `open_files`
  * @param filename the file name
- * @param mode the open mode
- * @param dir_entry the file's fat directory entry
- * @return the file_id
+ * @return the file entry
 */
-int create_file_entry(const char* filename, int mode, dir_entry_t* dir_entry) {
+file_t* create_file_entry(const char* filename) {
     file_t* new_file_entry = malloc(sizeof(file_t));
     strcpy(new_file_entry->filename, filename);
-    new_file_entry->file_id = next_file_id++;
-    new_file_entry->fileptr_head = NULL;
-    switch (mode) {
-        case F_WRITE:
-            create_fileptr(&new_file_entry->fileptr_head, current_pcb->pid, 0);
-            new_file_entry->wr_pid = current_pcb->pid; break;
-        case F_READ:
-            create_fileptr(&new_file_entry->fileptr_head, current_pcb->pid, 0);
-            new_file_entry->wr_pid = -1; break;
-        case F_APPEND:
-            create_fileptr(&new_file_entry->fileptr_head, current_pcb->pid, dir_entry->size);
-            new_file_entry->wr_pid = current_pcb->pid; break;
-    }
+    new_file_entry->wr_pid = -1;
+    new_file_entry->n_writers = 0;
+    new_file_entry->n_ofds = 0;
+    new_file_entry->unlinked = false;
+    new_file_entry->prev = NULL;
     new_file_entry->next = open_files;
+    if (open_files != NULL) open_files->prev = new_file_entry;
     open_files = new_file_entry;
-
-    return new_file_entry->file_id;
+    return new_file_entry;
 }
 
 /**
- * delete the specified file entry from `open_files`;
- * call when `file_entry.fileptr_head == NULL`
- * @param file_id the file id
+ * delete a file entry from `open_files`;
+ * call when `file_entry->n_ofds == 0`
+ * @param file_entry the file entry
  * @return none
 */
-void delete_file_entry(int file_id) {
-    file_t* curr = open_files;
-    file_t* prev = NULL;
-    while (curr != NULL && curr->file_id != file_id) { // set curr to the file
-        prev = curr;
-        curr = curr->next;
-    }
-    if (curr != NULL) { // file found
-        if (prev == NULL) open_files = curr->next; // first file_entry was deleted
-        else prev->next = curr->next; // trailing file_entry was deleted
-        free(curr);
-    } else { // file not found
-        // fprintf(stderr, "file not found (file_id:[%d])\n", file_id);
-    }
+void delete_file_entry(file_t* file_entry) {
+    if (file_entry->prev == NULL) open_files = file_entry->next; // first file_entry was deleted
+    else file_entry->prev->next = file_entry->next;
+    if (file_entry->next != NULL) file_entry->next->prev = file_entry->prev;
+    free(file_entry);
 }
 
 #define F_HASPERM(perm, mask) (((perm) & (mask)) != 0) // check if `perm` matches a permission `mask` bitwise
@@ -160,149 +99,410 @@ bool valid_perm(uint8_t perm, int mode) {
     );
 }
 
-file_t* find_file_entry_by_file_id(int file_id) {
+/**
+ * find an open file by name; files unlinked while open can't be found
+ * @param filename the file name
+ * @return the file entry, or `NULL` if no process has the file open
+*/
+file_t* find_file_entry_by_filename(const char* filename) {
     file_t* curr = open_files;
     while (curr != NULL) {
-        if (curr->file_id == file_id) {
-            return curr;
-        }
+        if (!curr->unlinked && strcmp(curr->filename, filename) == 0) return curr;
         curr = curr->next;
     }
     return NULL;
 }
 
-file_t* find_file_entry_by_filename(const char* filename) {
-    file_t* curr = open_files;
-    while (curr != NULL) {
-        if (strcmp(curr->filename, filename) == 0) return curr;
-        curr = curr->next;
+/**
+ * take a slot of `ofd_table` with one reference, doubling the table if it is full;
+ * pointers into the table are invalid afterwards
+ * @param mode the open mode
+ * @return the index of the slot
+*/
+int ofd_alloc(int mode) {
+    if (ofd_free == -1) { // table is full
+        int new_cap = (ofd_cap == 0) ? 64 : ofd_cap * 2;
+        ofd_table = realloc(ofd_table, new_cap * sizeof(ofd_t));
+        for (int i = new_cap - 1; i >= ofd_cap; i--) { // chain the new slots, lowest first
+            ofd_table[i].refs = 0;
+            ofd_table[i].next_free = ofd_free;
+            ofd_free = i;
+        }
+        ofd_cap = new_cap;
     }
-    return false;
+    int id = ofd_free;
+    ofd_t* ofd = &ofd_table[id];
+    ofd_free = ofd->next_free;
+
+    ofd->file = NULL;
+    ofd->pipe = NULL;
+    ofd->mq = NULL;
+    ofd->child_exits = false;
+    ofd->mode = mode;
+    ofd->offset = 0;
+    ofd->refs = 1;
+    return id;
 }
 
 /**
- * find a file by `fd`
- * @param file_id_ptr set to the file id, if the file is found
- * @param file_entry set to the file entry, if the file is found
- * @return `true` if the file is found, `false` & print otherwise
+ * take a slot of `ofd_table` for a new open file description of `file_entry`, with one reference
+ * @param file_entry the open file
+ * @param mode the open mode
+ * @param offset the initial file pointer
+ * @param location the location of the file's directory entry
+ * @return the index of the description
 */
-bool find_file_entry(int fd, int* file_id_ptr, file_t* file_entry) {
-    *file_id_ptr = current_pcb->fileDescriptors[fd];
-    *file_entry = *find_file_entry_by_file_id(*file_id_ptr);
-    if (file_entry == NULL) {
-        // fprintf(stderr, "file does not exist (fd:[%d] file_id:[%d])\n", fd, *file_id_ptr);
-        ERRNO = ERR_FS_FILE_NOT_FOUND;
-        return false;
-    }
-    return true;
+int ofd_create(file_t* file_entry, int mode, int offset, point_t location) {
+    int id = ofd_alloc(mode);
+    ofd_t* ofd = &ofd_table[id];
+    ofd->file = file_entry;
+    ofd->offset = offset;
+    ofd->location = location;
+    file_entry->n_ofds++;
+    return id;
 }
 
 /**
- * create file pointers for each unique file_id (called by `p_spawn`)
- * @param pcb the process PCB
+ * drop a reference to an open file description, & free it with its last one;
+ * the file entry is deleted with its last description, a pipe with its last end, & a message
+ * queue with its last description
+ * @param id the index of the description
  * @return none
 */
-void process_create_fileptrs(PCB* pcb) {
-    if (next_file_id == 0) return;
-    int unique_file_ptrs[next_file_id];
-    for (int i = 0; i < next_file_id; i++) { // initialize to -1
-        unique_file_ptrs[i] = -1;
-    }
-    for (int fd = 3; fd < MAX_FDS; fd++) { // mark used file_id
-        int file_id = pcb->fileDescriptors[fd];
-        if (file_id >= 0) {
-            file_t* file_entry = find_file_entry_by_file_id(file_id);
-            if (file_entry == NULL) continue; // not open
-            int fileptr_ptr = get_fileptr_ptr(file_entry->fileptr_head, pcb->parent_pid);
-            unique_file_ptrs[file_id] = fileptr_ptr;
+void ofd_put(int id) {
+    ofd_t* ofd = &ofd_table[id];
+    if (--ofd->refs > 0) return;
+    file_t* file_entry = ofd->file;
+    if (ofd->pipe != NULL) { // pipe end: wakes the processes blocked on the other end
+        k_pipe_close(ofd->pipe, ofd->mode == F_WRITE);
+    } else if (ofd->mq != NULL) {
+        k_mq_close(ofd->mq);
+    } else if (file_entry != NULL && --file_entry->n_ofds == 0) { // no more descriptions of the file
+        if (file_entry->unlinked) {
+            sigset_t prev_mask;
+            block_alarm(&prev_mask);
+            fs_reclaim(fat, fs_fd, ofd->location);
+            unblock_alarm(&prev_mask);
         }
+        delete_file_entry(file_entry);
     }
-    for (int fid = 0; fid < next_file_id; fid++) { // add fileptr for each unique fd
-        if (unique_file_ptrs[fid] == -1) continue;
-        file_t* file_entry = find_file_entry_by_file_id(fid);
-        create_fileptr(&file_entry->fileptr_head, pcb->pid, unique_file_ptrs[fid]);
+    ofd->file = NULL;
+    ofd->pipe = NULL;
+    ofd->mq = NULL;
+    ofd->next_free = ofd_free;
+    ofd_free = id;
+}
+
+/**
+ * give a process its own fd table before it changes it, if it shares the table with its
+ * parent or children; the copy takes a reference to each description in it
+ * @param pcb the process PCB
+ * @return the process's fd table
+*/
+fd_table_t* own_fds(PCB* pcb) {
+    fd_table_t* table = pcb->fds;
+    if (table->refs == 1) return table;
+    fd_table_t* copy = fd_table_copy(table);
+    for (int fd = fd_table_next_used(copy, 0); fd != -1; fd = fd_table_next_used(copy, fd + 1)) {
+        if (copy->ids[fd] >= 0) ofd_table[copy->ids[fd]].refs++;
     }
+    table->refs--;
+    pcb->fds = copy;
+    return copy;
 }
 
 /**
- * delete file pointers of each unique file_id (called by `p_kill`)
+ * account for a process letting go of one of its fds: write access is given up with the
+ * writer's last fd to a writable description of the file
  * @param pcb the process PCB
+ * @param id the description the fd referred to
  * @return none
 */
-void process_delete_fileptrs(PCB* pcb) {
-    if (next_file_id == 0) return;
-    bool unique_file_ids[next_file_id];
-    for (int i = 0; i < next_file_id; i++) { // initialize to false
-        unique_file_ids[i] = false;
-    }
-    for (int fd = 3; fd < MAX_FDS; fd++) { // mark used file_id
-        int file_id = pcb->fileDescriptors[fd];
-        if (file_id >= 0 && file_id < next_file_id) {
-            unique_file_ids[file_id] = true;
-        }
+void release_write(PCB* pcb, int id) {
+    ofd_t* ofd = &ofd_table[id];
+    file_t* file_entry = ofd->file;
+    if (file_entry == NULL) return; // pipe ends can be written by any process that has them
+    if (OFD_WRITABLE(ofd) && pcb->pid == file_entry->wr_pid && --file_entry->n_writers == 0) {
+        file_entry->wr_pid = -1; // writer no longer has the file open for writing
+    }
+}
+
+/**
+ * get the open file description behind a fd of the current process
+ * @param fd the file descriptor
+ * @return the description, or `NULL` & set ERRNO if `fd` isn't open to a file or a pipe
+*/
+ofd_t* find_ofd(int fd) {
+    int id = fd_table_get(current_pcb->fds, fd);
+    if (id < 0 || id >= ofd_cap || ofd_table[id].refs == 0) {
+        ERRNO = ERR_FS_FILE_NOT_FOUND;
+        return NULL;
     }
-    for (int fid = 0; fid < next_file_id; fid++) { // delete fileptr for each unique fd
-        if (!unique_file_ids[fid]) continue;
-        file_t* file_entry = find_file_entry_by_file_id(fid);
-        delete_fileptr(&file_entry->fileptr_head, pcb->pid);
-        if (file_entry->wr_pid == pcb->pid) file_entry->wr_pid = -1; // current process is no longer writing
+    return &ofd_table[id];
+}
+
+/**
+ * get the directory entry of an open file description from its cached location; if the entry
+ * was moved since (inline files move when they grow), look it up by name & update the cache
+ * @param ofd the description
+ * @param entry set to the directory entry, if the file still exists
+ * @return `true` if the file still exists, `false` & set ERRNO otherwise (or if `ofd` is a pipe end
+ * or a message queue)
+*/
+bool ofd_entry(ofd_t* ofd, dir_entry_t* entry) {
+    file_t* file_entry = ofd->file;
+    if (file_entry == NULL) { // pipes & queues have no directory entry
+        ERRNO = (ofd->mq != NULL) ? ERR_FS_MQ : (ofd->pipe != NULL) ? ERR_FS_PIPE : ERR_FS_CHILD_FD;
+        return false;
     }
+    read_entry(fat, fs_fd, ofd->location, entry);
+    if (file_entry->unlinked) { // only reachable through the cached location
+        if (entry->name[0] == FILENAME_DEL_INUSE && strcmp(&entry->name[1], &file_entry->filename[1]) == 0) return true;
+    } else {
+        if (entry->type != FILETYPE_SNAPSHOT && strcmp(entry->name, file_entry->filename) == 0) return true;
+        if (find_file(fat, fs_fd, fs_root(fat), file_entry->filename, &ofd->location, entry)) return true;
+    }
+    ERRNO = ERR_FS_FILE_NOT_FOUND;
+    return false;
 }
 
 /**
- * DEBUG: print all file pointers & their pids
+ * get the directory entry of an open file description that the current process writes through;
+ * files unlinked while open can't be written, since writes find the file by name
+ * @param ofd the description
+ * @param entry set to the directory entry, if the file can be written
+ * @param err_ronly ERRNO to set if the process doesn't have write access through `ofd`
+ * @return `true` if the file can be written, `false` & set ERRNO otherwise
+*/
+bool ofd_write_entry(ofd_t* ofd, dir_entry_t* entry, int err_ronly) {
+    if (ofd->file == NULL) { // pipes & queues have no directory entry
+        ERRNO = (ofd->mq != NULL) ? ERR_FS_MQ : (ofd->pipe != NULL) ? ERR_FS_PIPE : ERR_FS_CHILD_FD;
+        return false;
+    }
+    if (!OFD_WRITABLE(ofd) || ofd->file->wr_pid != current_pcb->pid) { // current process only has read access
+        ERRNO = err_ronly;
+        return false;
+    }
+    if (ofd->file->unlinked) {
+        ERRNO = ERR_FS_FILE_NOT_FOUND;
+        return false;
+    }
+    return ofd_entry(ofd, entry);
+}
+
+/**
+ * set up the fds of a spawned process (called by `p_spawn`); it shares its parent's fd table &
+ * open file descriptions until either of them opens or closes a file; if its F_STDIN or F_STDOUT
+ * is redirected, it gets its own table, & if its F_STDOUT is redirected to a writable file,
+ * write access to that file is passed from the parent to the child
+ * @param pcb the process PCB, sharing its parent's fd table
+ * @param fd0 the parent's fd to use as F_STDIN
+ * @param fd1 the parent's fd to use as F_STDOUT
  * @return none
 */
-void print_fileptr_pids_all() {
-    file_t* curr = open_files;
-    while (curr != NULL) {
-        fprintf(stderr, "file:[%s] id:[%d] - wr:[%d]", curr->filename, curr->file_id, curr->wr_pid);
-        fileptr_t* curr_ptr = curr->fileptr_head;
-        int hard_cap = 0;
-        while (curr_ptr != NULL && hard_cap++ < 10) {
-            fprintf(stderr, " %d", curr_ptr->pid);
-            curr_ptr = curr_ptr->next;
+void process_copy_fds(PCB* pcb, int fd0, int fd1) {
+    if (fd0 == F_STDIN && fd1 == F_STDOUT) return; // nothing to change, keep sharing
+    fd_table_t* table = own_fds(pcb);
+    int ids[2] = { fd_table_get(table, fd0), fd_table_get(table, fd1) };
+    for (int fd = F_STDIN; fd <= F_STDOUT; fd++) {
+        int old_id = fd_table_get(table, fd);
+        if (ids[fd] >= 0) ofd_table[ids[fd]].refs++;
+        if (ids[fd] == NOFILE) fd_table_clear(table, fd);
+        else fd_table_set(table, fd, ids[fd]);
+        if (old_id >= 0) ofd_put(old_id);
+    }
+
+    int out_id = ids[F_STDOUT];
+    if (out_id >= 0 && ofd_table[out_id].file != NULL && OFD_WRITABLE(&ofd_table[out_id])) { // redirected output to a file
+        file_t* file_entry = ofd_table[out_id].file;
+        file_entry->wr_pid = pcb->pid;
+        file_entry->n_writers = 0;
+        for (int fd = fd_table_next_used(table, 0); fd != -1; fd = fd_table_next_used(table, fd + 1)) {
+            int id = table->ids[fd];
+            if (id >= 0 && ofd_table[id].file == file_entry && OFD_WRITABLE(&ofd_table[id])) file_entry->n_writers++;
         }
-        fprintf(stderr, "\n");
-        curr = curr->next;
     }
 }
 
 /**
- * get the first unused file descriptor (for `f_open`)
- * @param pcb the calling process
- * @return the first unused fd, or `-1` if the fd table is full
+ * close every fd of a process (called by `p_exit`, `p_kill` & `k_free`), in time proportional
+ * to the number of fds it has open
+ * @param pcb the process PCB
+ * @return none
 */
-int find_unused_fd(PCB* pcb) {
-    for (int i = 3; i < MAX_FDS; i++) {
-        if (pcb->fileDescriptors[i] == NOFILE) return i;
+void process_close_fds(PCB* pcb) {
+    fd_table_t* table = pcb->fds;
+    if (table == NULL) return;
+    for (int fd = fd_table_next_used(table, 0); fd != -1; fd = fd_table_next_used(table, fd + 1)) {
+        if (table->ids[fd] >= 0) release_write(pcb, table->ids[fd]);
     }
-    return -1;
+    if (--table->refs == 0) { // last process using the table
+        for (int fd = fd_table_next_used(table, 0); fd != -1; fd = fd_table_next_used(table, fd + 1)) {
+            if (table->ids[fd] >= 0) ofd_put(table->ids[fd]);
+        }
+        free(table);
+    }
+    pcb->fds = NULL;
 }
 
 /**
- * check if a process already has the file open;
- * use this to check whether to create a file pointer
+ * give a process fds for both ends of a new pipe (called by `p_pipe`); each end gets its own
+ * open file description, which holds the pipe's count of read or write ends
  * @param pcb the process PCB
- * @param file_id the file id (from `file_t.file_id`)
- * @return `true` if `file_id` is already in the file descriptor table of `pcb`,
- * `false` otherwise
+ * @param pipe the pipe, with one read end & one write end open
+ * @param fds set to the read end's fd & the write end's fd
+ * @return `0` on success, `-1` if the process has no free fds (the pipe is left as it was)
 */
-bool is_duplicate_fd(PCB* pcb, int file_id) {
-    for (int i = 3; i < MAX_FDS; i++) {
-        if (pcb->fileDescriptors[i] == file_id) return true;
+int process_open_pipe(PCB* pcb, pipe_t* pipe, int fds[2]) {
+    fd_table_t* table = own_fds(pcb);
+    fds[0] = fd_table_first_unused(table, 3);
+    fds[1] = (fds[0] == -1) ? -1 : fd_table_first_unused(table, fds[0] + 1);
+    if (fds[1] == -1) return -1;
+
+    int ids[2] = { ofd_alloc(F_READ), ofd_alloc(F_WRITE) };
+    for (int end = 0; end < 2; end++) {
+        ofd_table[ids[end]].pipe = pipe;
+        fd_table_set(table, fds[end], ids[end]);
     }
-    return false;
+    return 0;
+}
+
+/**
+ * give a process a fd for a message queue (called by `p_mq_open`); the fd's open file description
+ * holds one of the queue's references
+ * @param pcb the process PCB
+ * @param mq the queue, with a reference taken for the description
+ * @return the fd on success, `-1` if the process has no free fds (the reference is left as it was)
+*/
+int process_open_mq(PCB* pcb, mq_t* mq) {
+    fd_table_t* table = own_fds(pcb);
+    int fd = fd_table_first_unused(table, 3);
+    if (fd == -1) return -1;
+
+    int id = ofd_alloc(F_APPEND); // queues are read & written through the same description
+    ofd_table[id].mq = mq;
+    fd_table_set(table, fd, id);
+    return fd;
+}
+
+/**
+ * get the message queue behind a fd of a process
+ * @param pcb the process PCB
+ * @param fd the file descriptor
+ * @return the queue, or `NULL` if `fd` isn't open to a message queue
+*/
+mq_t* process_fd_mq(PCB* pcb, int fd) {
+    int id = fd_table_get(pcb->fds, fd);
+    if (id < 0 || id >= ofd_cap || ofd_table[id].refs == 0) return NULL;
+    return ofd_table[id].mq;
+}
+
+/**
+ * give a process a child exit fd (called by `p_child_fd`), which polls readable while the polling
+ * process has a child that has exited & not been waited for
+ * @param pcb the process PCB
+ * @return the fd on success, `-1` if the process has no free fds
+*/
+int process_open_child_fd(PCB* pcb) {
+    fd_table_t* table = own_fds(pcb);
+    int fd = fd_table_first_unused(table, 3);
+    if (fd == -1) return -1;
+
+    int id = ofd_alloc(F_READ);
+    ofd_table[id].child_exits = true;
+    fd_table_set(table, fd, id);
+    return fd;
 }
 
 /**
- * check whether a fd refers to the terminal
+ * check which of `events` a fd of a process is ready for (called by `p_poll`), & which wait queues
+ * wake its pollers when it may become ready for the rest; files are always ready
+ * @param pcb the process PCB
  * @param fd the file descriptor
- * @return `true` if `fd` is either `F_STDIN`, `F_STDOUT`, or `F_STDERR`; `false` otherwise
+ * @param events `F_POLLIN` and/or `F_POLLOUT`
+ * @param queues set to the queues to poll if `fd` isn't ready
+ * @param n_queues set to the number of queues in `queues`
+ * @return the events `fd` is ready for, or `-1` if it isn't open
+*/
+int process_poll_fd(PCB* pcb, int fd, int events, wait_queue_t* queues[2], int* n_queues) {
+    *n_queues = 0;
+    int id = fd_table_get(pcb->fds, fd);
+    if (id == STDIN_ID) { // terminal input: ask the host, & let `k_tick` check again each tick
+        struct pollfd host = { STDIN_FILENO, POLLIN, 0 };
+        if ((events & F_POLLIN) && poll(&host, 1, 0) > 0) return F_POLLIN;
+        if (events & F_POLLIN) queues[(*n_queues)++] = &terminal_input;
+        return 0;
+    }
+    if (id == STDOUT_ID || id == STDERR_ID) return events & F_POLLOUT;
+    if (id < 0 || id >= ofd_cap || ofd_table[id].refs == 0) return -1;
+
+    ofd_t* ofd = &ofd_table[id];
+    int ready = 0;
+    if (ofd->pipe != NULL) {
+        pipe_t* pipe = ofd->pipe;
+        if (ofd->mode == F_READ && (events & F_POLLIN)) {
+            if (pipe->count > 0 || pipe->n_writers == 0) ready |= F_POLLIN;
+            else queues[(*n_queues)++] = &pipe->readers;
+        }
+        if (ofd->mode == F_WRITE && (events & F_POLLOUT)) {
+            if (pipe->count < PIPE_SIZE || pipe->n_readers == 0) ready |= F_POLLOUT;
+            else queues[(*n_queues)++] = &pipe->writers;
+        }
+    } else if (ofd->mq != NULL) {
+        mq_t* mq = ofd->mq;
+        if (events & F_POLLIN) {
+            if (mq->count > 0) ready |= F_POLLIN;
+            else queues[(*n_queues)++] = &mq->receivers;
+        }
+        if (events & F_POLLOUT) {
+            if (mq->free != -1) ready |= F_POLLOUT;
+            else queues[(*n_queues)++] = &mq->senders;
+        }
+    } else if (ofd->child_exits) {
+        if (events & F_POLLIN) {
+            if (k_has_exited_child(pcb)) ready |= F_POLLIN;
+            else queues[(*n_queues)++] = &child_exits;
+        }
+    } else { // files never block
+        ready = events & (F_POLLIN | F_POLLOUT);
+    }
+    return ready;
+}
+
+/**
+ * DEBUG: print all open files & their open file descriptions, then the open pipe ends & queues
+ * @return none
+*/
+void print_open_files() {
+    for (file_t* curr = open_files; curr != NULL; curr = curr->next) {
+        fprintf(stderr, "file:[%s] wr:[%d]%s", curr->filename, curr->wr_pid, curr->unlinked ? " (unlinked)" : "");
+        for (int id = 0; id < ofd_cap; id++) {
+            if (ofd_table[id].file != curr) continue;
+            fprintf(stderr, " %d:refs %d@%d", id, ofd_table[id].refs, ofd_table[id].offset);
+        }
+        fprintf(stderr, "\n");
+    }
+    for (int id = 0; id < ofd_cap; id++) {
+        ofd_t* ofd = &ofd_table[id];
+        if (ofd->refs == 0) continue;
+        if (ofd->pipe != NULL) {
+            fprintf(stderr, "pipe:[%p] %s %d:refs %d buffered %d\n", (void*) ofd->pipe,
+                    ofd->mode == F_READ ? "read" : "write", id, ofd->refs, ofd->pipe->count);
+        } else if (ofd->mq != NULL) {
+            fprintf(stderr, "mq:[%s] %d:refs %d queued %d/%d\n", ofd->mq->name, id, ofd->refs,
+                    ofd->mq->count, ofd->mq->capacity);
+        }
+    }
+}
+
+/**
+ * check whether a fd refers to the terminal; `F_STDIN` & `F_STDOUT` don't, if they are redirected
+ * @param fd the file descriptor
+ * @return `true` if `fd` refers to the terminal's input or output; `false` otherwise
 */
 bool f_isatty(int fd) {
-    if (fd == F_STDIN || fd == F_STDOUT || fd == F_STDERR) return true;
-    else return false;
+    int id = fd_table_get(current_pcb->fds, fd);
+    return id == STDIN_ID || id == STDOUT_ID || id == STDERR_ID;
 }
 
 // user commands
@@ -317,67 +517,54 @@ bool f_isatty(int fd) {
  * @note If the file already exists, the function checks permissions and handles
  * multiple processes attempting to open the same file.
  *
- * @note If the file does not exist, it is created, and the open files list is updated.
+ * @note If the file does not exist, it is created. Each call adds a new open file description,
+ * with its own file pointer, to the table that the process's fds index, & takes the lowest
+ * unused fd from the process's fd bitmap.
  */
 int f_open(const char *fname, int mode) {
+    if (mode != F_WRITE && mode != F_READ && mode != F_APPEND) { // invalid mode
+        ERRNO = ERR_F_OPEN_INVALID_MODE;
+        return -1;
+    }
     file_t* file_entry = find_file_entry_by_filename(fname);
-    bool inuse = !(file_entry == NULL);
     point_t loc;
     dir_entry_t dir_entry;
-    bool found = find_file(fat, fs_fd, ROOTDIR, fname, &loc, &dir_entry);
+    bool found = find_file(fat, fs_fd, fs_root(fat), fname, &loc, &dir_entry);
 
-    if (inuse) { // don't add another entry
-        if (!valid_perm(dir_entry.perm, mode)) { // invalid permissions
-            ERRNO = ERR_F_OPEN_INVALID_PERMS;
-            return -1;
-        }
-        if (mode == F_WRITE && file_entry->wr_pid != current_pcb->pid && file_entry->wr_pid != -1) { // another process already has write access
-            ERRNO = ERR_F_OPEN_WRITE_INUSE;
-            // fprintf(stderr, "another process already has write access:[%d]\n", file_entry->wr_pid);
-            // fprintf(stderr, "current pid:[%d]\n", current_pcb->pid);
-            return -1;
-        }
-        if (mode != F_WRITE && mode != F_READ && mode != F_APPEND) { // invalid mode
-            ERRNO = ERR_F_OPEN_INVALID_MODE;
-            return -1;
-        }
-        
-        fs_touch(fat, fs_fd, fname); // touch file
-        // update fileptr & wr_pid if necessary
-        int new_fileptr = -1;
-        switch (mode) {
-            case F_WRITE:
-                new_fileptr = 0;
-                file_entry->wr_pid = current_pcb->pid; break;
-            case F_READ:
-                new_fileptr = 0; break;
-            case F_APPEND:
-                new_fileptr = dir_entry.size;
-                file_entry->wr_pid = current_pcb->pid; break;
-        }
-        if (is_duplicate_fd(current_pcb, file_entry->file_id)) { // process already has file open
-            fileptr_t* fp_struct = get_fileptr(file_entry->fileptr_head, current_pcb->pid);
-            fp_struct->ptr = new_fileptr;
-        } else { // process's first fd for this file
-            create_fileptr(&file_entry->fileptr_head, current_pcb->pid, new_fileptr);
-        }
+    if (!found && mode == F_READ) { // file doesn't exist in directory & can't create
+        ERRNO = ERR_F_OPEN_CREATE_READ;
+        return -1;
+    }
+    if (found && !valid_perm(dir_entry.perm, mode)) { // invalid permissions
+        ERRNO = ERR_F_OPEN_INVALID_PERMS;
+        return -1;
+    }
+    if (mode != F_READ && file_entry != NULL &&
+        file_entry->wr_pid != current_pcb->pid && file_entry->wr_pid != -1) { // another process already has write access
+        ERRNO = ERR_F_OPEN_WRITE_INUSE;
+        return -1;
+    }
+    int fd = fd_table_first_unused(current_pcb->fds, 3);
+    if (fd == -1) {
+        ERRNO = ERR_F_OPEN_NO_FDS;
+        return -1;
+    }
 
-        int fd = find_unused_fd(current_pcb);
-        current_pcb->fileDescriptors[fd] = file_entry->file_id;
-        return fd;
-    } else { // add another entry
-        if (!found && mode == F_READ) { // file doesn't exist in directory & can't create
-            ERRNO = ERR_F_OPEN_CREATE_READ;
-            return -1;
-        }
-        
-        fs_touch(fat, fs_fd, fname); // touch file, create if file doesn't exist
+    sigset_t prev_mask;
+    block_alarm(&prev_mask);
+    fs_touch(fat, fs_fd, fname); // touch file, create if file doesn't exist
+    find_file(fat, fs_fd, fs_root(fat), fname, &loc, &dir_entry);
+    unblock_alarm(&prev_mask);
 
-        // update open files list
-        int fd = find_unused_fd(current_pcb);
-        current_pcb->fileDescriptors[fd] = create_file_entry(fname, mode, &dir_entry);
-        return fd;
+    // add a description, & the file to the open files list if it is its first
+    if (file_entry == NULL) file_entry = create_file_entry(fname);
+    if (mode != F_READ) { // current process gets or keeps write access
+        file_entry->wr_pid = current_pcb->pid;
+        file_entry->n_writers++;
     }
+    int offset = (mode == F_APPEND) ? (int) dir_entry.size : 0;
+    fd_table_set(own_fds(current_pcb), fd, ofd_create(file_entry, mode, offset, loc));
+    return fd;
 }
 
 /**
@@ -386,7 +573,9 @@ int f_open(const char *fname, int mode) {
  * This function reads data from the specified file descriptor and stores it in the provided buffer.
  * If the file descriptor represents STDIN, data is read from the terminal input. If it represents
  * STDOUT or STDERR, an error is returned. For regular file descriptors, the corresponding file entry
- * is located, and data is read from the file into a temporary buffer.
+ * is located, and data is read from the file into a temporary buffer. Reading the read end of a pipe
+ * blocks the process until the pipe has data, and returns 0 once it is empty and every write end of
+ * it is closed.
  *
  * @param fd The file descriptor to read from.
  * @param n The number of bytes to read.
@@ -395,7 +584,7 @@ int f_open(const char *fname, int mode) {
  * global variable ERRNO is set accordingly. If the end of the file is reached (EOF), 0 is returned.
  */
 int f_read(int fd, int n, char* buf) {
-    if (current_pcb->fileDescriptors[fd] == STDIN_ID) { // input from terminal
+    if (fd_table_get(current_pcb->fds, fd) == STDIN_ID) { // input from terminal
         char input_buf[IOBUFFER_SIZE + 1];
         int input_size = safe_read(STDIN_FILENO, input_buf, IOBUFFER_SIZE);
         if (input_size <= 0) return 0; // EOF
@@ -407,45 +596,41 @@ int f_read(int fd, int n, char* buf) {
         }
         buf[bytes_to_read] = '\0'; // add null terminator
         return bytes_to_read;
-    } else if (current_pcb->fileDescriptors[fd] == STDOUT_ID ||
-               current_pcb->fileDescriptors[fd] == STDERR_ID) {
+    } else if (fd_table_get(current_pcb->fds, fd) == STDOUT_ID ||
+               fd_table_get(current_pcb->fds, fd) == STDERR_ID) {
         ERRNO = ERR_F_READ_TERM_OUT;
         return -1;
     }
 
-    // find file entry in open files, if it exists
-    int file_id;
-    file_t file_entry;
-    if (!find_file_entry(fd, &file_id, &file_entry)) return -1;
-
-    // printf("file_entry.fileptr_head: %ld\n", (long)file_entry.fileptr_head);
-    // printf("file_entry.filename: %s\n", file_entry.filename);
-
-    // find directory entry in pennfat
-    point_t loc;
+    // find the open file description & its directory entry
+    ofd_t* ofd = find_ofd(fd);
+    if (ofd == NULL) return -1;
+    if (ofd->pipe != NULL) { // blocks until there is data, or EOF once every write end is closed
+        if (ofd->mode != F_READ) {
+            ERRNO = ERR_FS_PIPE_END;
+            return -1;
+        }
+        int bytes_read = k_pipe_read(ofd->pipe, buf, n);
+        buf[bytes_read] = '\0'; // add null terminator
+        return bytes_read;
+    }
     dir_entry_t entry;
-    find_file(fat, fs_fd, ROOTDIR, file_entry.filename, &loc, &entry);
-
-    // read entire file into a temp buffer
-    char* temp_buf = malloc(entry.size);
-    read_chain(fat, fs_fd, entry.firstBlock, temp_buf, entry.size);
-
-    fileptr_t* fp_struct = get_fileptr(file_entry.fileptr_head, current_pcb->pid);
-    // printf("fp_struct: %ld\n", (long)fp_struct);
+    if (!ofd_entry(ofd, &entry)) return -1;
 
     int bytes_to_read;
-    if (fp_struct->ptr + n > entry.size) { // read all remaining bytes
-        bytes_to_read = entry.size - fp_struct->ptr;
+    if (ofd->offset + n > entry.size) { // read all remaining bytes
+        bytes_to_read = entry.size - ofd->offset;
     } else { // read n bytes
         bytes_to_read = n;
     }
-    for (int i = 0; i < bytes_to_read; i++) { // copy into buf
-        buf[i] = temp_buf[fp_struct->ptr + i];
+    // read only the requested range (compressed files decode only the chunks it overlaps)
+    if (!read_file_range(fat, fs_fd, ofd->location, &entry, ofd->offset, buf, bytes_to_read)) {
+        ERRNO = ERR_F_READ_CHECKSUM;
+        return -1;
     }
     buf[bytes_to_read] = '\0'; // add null terminator
-    fp_struct->ptr += bytes_to_read;
+    ofd->offset += bytes_to_read;
 
-    free(temp_buf);
     return bytes_to_read;
 }
 /**
@@ -454,7 +639,11 @@ int f_read(int fd, int n, char* buf) {
  * This function writes data to the specified file descriptor based on the given parameters.
  * If the file descriptor represents STDOUT or STDERR, the data is output to the terminal.
  * For regular file descriptors, the function locates the corresponding file entry, checks for
- * write access, and updates the file content accordingly.
+ * write access, and writes the data at the file pointer: bytes that fall inside the file's chain
+ * (including blocks reserved by f_fallocate) are overwritten in place, and the rest is appended.
+ * Writing to the write end of a pipe
+ * blocks the process while the pipe is full, until everything is written or every read end of
+ * it is closed.
  *
  * @param fd The file descriptor to write to.
  * @param str The string containing the data to be written.
@@ -463,8 +652,8 @@ int f_read(int fd, int n, char* buf) {
  * global variable ERRNO is set accordingly.
  */
 int f_write(int fd, const char *str, int n) {
-    if (current_pcb->fileDescriptors[fd] == STDOUT_ID ||
-        current_pcb->fileDescriptors[fd] == STDERR_ID) {  // output to terminal
+    if (fd_table_get(current_pcb->fds, fd) == STDOUT_ID ||
+        fd_table_get(current_pcb->fds, fd) == STDERR_ID) {  // output to terminal
         char output_buf[IOBUFFER_SIZE+1];
         int bytes_to_write = MIN(n, IOBUFFER_SIZE);
         for (int i = 0; i < bytes_to_write; i++) { // copy into output_buf
@@ -473,66 +662,49 @@ int f_write(int fd, const char *str, int n) {
         output_buf[bytes_to_write] = '\0'; // add null terminator
         fprintf(stderr, "%s", output_buf);
         return bytes_to_write;
-    } else if (current_pcb->fileDescriptors[fd] == STDIN_ID) {
+    } else if (fd_table_get(current_pcb->fds, fd) == STDIN_ID) {
         ERRNO = ERR_F_WRITE_TERM_IN;
         return -1;
     }
 
-    // find file entry in open files, if it exists
-    int file_id;
-    file_t file_entry;
-    if (!find_file_entry(fd, &file_id, &file_entry)) return -1;
-    if (file_entry.wr_pid != current_pcb->pid) { // current process only has read access
-        ERRNO = ERR_F_WRITE_RONLY;
-        return -1;
+    // find the open file description & its directory entry
+    ofd_t* ofd = find_ofd(fd);
+    if (ofd == NULL) return -1;
+    if (ofd->pipe != NULL) { // blocks while the pipe is full
+        if (ofd->mode != F_WRITE) {
+            ERRNO = ERR_FS_PIPE_END;
+            return -1;
+        }
+        int bytes_written = k_pipe_write(ofd->pipe, str, n);
+        if (bytes_written == -1) ERRNO = ERR_F_WRITE_PIPE_CLOSED;
+        return bytes_written;
     }
-
-    // find directory entry in pennfat
-    point_t loc;
     dir_entry_t entry;
-    find_file(fat, fs_fd, ROOTDIR, file_entry.filename, &loc, &entry);
+    if (!ofd_write_entry(ofd, &entry, ERR_F_WRITE_RONLY)) return -1;
 
-    fileptr_t* fp_struct = get_fileptr(file_entry.fileptr_head, current_pcb->pid);
-    int bytes_to_write = n;
-    int new_file_size;
-    if (fp_struct->ptr + bytes_to_write > entry.size) { // need to allocate more space than current file size
-        new_file_size = fp_struct->ptr + bytes_to_write;
-        bytes_to_write += 1; // space for null terminator
-    } else { // file size won't change post-write
-        new_file_size = entry.size;
-    }
-
-    // read entire file into a temp buffer
-    char* temp_buf = malloc(new_file_size+1);
-    for (int i = 0; i <= new_file_size; i++) {
-        temp_buf[i] = '\0';
-    }
-    read_chain(fat, fs_fd, entry.firstBlock, temp_buf, entry.size);
-    for (int i = 0; i < bytes_to_write; i++) { // write str
-        temp_buf[fp_struct->ptr + i] = str[i];
+    // blocks the file already has (e.g. reserved by f_fallocate) are overwritten in place
+    sigset_t prev_mask;
+    block_alarm(&prev_mask);
+    bool written = fs_pwrite(fat, fs_fd, ofd->file->filename, ofd->offset, str, n);
+    unblock_alarm(&prev_mask);
+    if (!written) {
+        ERRNO = ERR_F_WRITE_NOSPACE;
+        return -1;
     }
-    temp_buf[fp_struct->ptr + bytes_to_write] = '\0';
-    // if (new_file_size != entry.size) { // add null terminator if file size was increased
-    //     temp_buf[fp_struct->ptr + bytes_to_write] = '\0';
-    // }
-    fs_cat(fat ,fs_fd, 0, 1, temp_buf, NULL, file_entry.filename); // write to memory
-
-    fp_struct->ptr += bytes_to_write;
-    free(temp_buf);
-
-    // printf("bytes alleged to have been written: %d\n", bytes_to_write);
-    return bytes_to_write;
+    ofd->offset += n;
+    return n;
 }
 
 /**
  * @brief Closes a file descriptor.
  *
  * This function closes the specified file descriptor, releasing associated resources.
- * If the file descriptor represents a terminal, an error is returned. The function then
- * finds the corresponding file entry in open files, updates the process's file descriptor
- * table, and deallocates file pointers if this is the last instance of the file descriptor
- * for the process. If the process had write access, it is revoked when the last instance is closed.
- * If no process is using the file, the file entry is deleted.
+ * If the file descriptor represents a terminal, an error is returned. The fd is removed from the
+ * process's file descriptor table (which is copied first if the process still shares it with its
+ * parent or children), and the open file description it refers to is freed when no other fd
+ * refers to it. If the process had write access, it is revoked when it closes its last fd to a
+ * writable description of the file. If no process is using the file, the file entry is deleted,
+ * and a file unlinked while open is freed in the file system.
  *
  * @param fd The file descriptor to close.
  * @return On success, returns 0. On failure, returns -1, and the global variable ERRNO is set accordingly.
@@ -543,50 +715,40 @@ int f_close(int fd) {
         return -1;
     }
 
-    // find file entry in open files, if it exists
-    int file_id;
-    file_t file_entry;
-    if (!find_file_entry(fd, &file_id, &file_entry)) return -1;
+    // find the open file description, if it exists
+    ofd_t* ofd = find_ofd(fd);
+    if (ofd == NULL) return -1;
 
-    current_pcb->fileDescriptors[fd] = NOFILE; // mark fd as open
-    bool last_fd_instance = !is_duplicate_fd(current_pcb, file_id); // process has no more fds for this file
-    if (last_fd_instance) delete_fileptr(&file_entry.fileptr_head, current_pcb->pid);
-    if (file_entry.wr_pid == current_pcb->pid && last_fd_instance) { // process had write access & no longer has it open
-        file_entry.wr_pid = -1;
-    }
-    if (file_entry.fileptr_head == NULL) delete_file_entry(file_id); // no more process is using the file
+    int id = fd_table_get(current_pcb->fds, fd);
+    fd_table_clear(own_fds(current_pcb), fd); // mark fd as unused
+    release_write(current_pcb, id);
+    ofd_put(id); // freed if no other fd refers to the description
     return 0;
 }
 
 /**
  * @brief Unlinks (deletes) a file.
  *
- * This function unlinks (deletes) the specified file, releasing associated resources.
- * It first locates the file entry by filename and checks if the current process is accessing
- * the file. If so, it removes the file pointer and updates the write access status. If no more
- * processes are accessing the file, the file entry is deleted, and the file system is updated.
- * If the file is still in use by another process, it is marked as deleted in the file system.
+ * This function unlinks (deletes) the specified file. If no process has the file open, it is
+ * removed from the file system right away. Otherwise it is marked as deleted in the file system,
+ * so that it can't be opened anew, while the open file descriptions of it can still read it; it
+ * is freed when the last of them is closed.
  *
  * @param fname The name of the file to unlink.
  * @return On success, returns 0. On failure, returns -1, and the global variable ERRNO is set accordingly.
  */
 int f_unlink(const char *fname) {
     file_t* file_entry = find_file_entry_by_filename(fname);
-    if (file_entry == NULL) { // no file entry
+    sigset_t prev_mask;
+    block_alarm(&prev_mask);
+    bool removed = (file_entry == NULL) ? fs_rm(fat, fs_fd, fname) : fs_mark_deleted(fat, fs_fd, fname);
+    unblock_alarm(&prev_mask);
+    if (!removed) {
         ERRNO = ERR_F_UNLINK_NOT_FOUND;
         return -1;
     }
-
-    if (get_fileptr(file_entry->fileptr_head, current_pcb->pid) != NULL) { // current process is accessing file
-        delete_fileptr(&file_entry->fileptr_head, current_pcb->pid);
-        if (file_entry->wr_pid == current_pcb->pid) file_entry->wr_pid = -1; // current process is no longer writing
-    }
-    if (file_entry->fileptr_head == NULL) { // no more processes are accessing the file
-        delete_file_entry(file_entry->file_id);
-        fs_rm(fat, fs_fd, fname);
-    } else { // file is still in use by another process
-        fs_mark_deleted(fat, fs_fd, fname);
-    }
+    if (file_entry == NULL) return 0; // not open: freed right away
+    file_entry->unlinked = true; // descriptions find it at their cached locations from now on
     return 0;
 }
 
@@ -612,17 +774,14 @@ int f_lseek(int fd, int offset, int whence) {
         return -1;
     }
 
-    // find file entry in open files, if it exists
-    int file_id;
-    file_t file_entry;
-    if (!find_file_entry(fd, &file_id, &file_entry)) return -1;
-    point_t loc;
+    // find the open file description & its directory entry
+    ofd_t* ofd = find_ofd(fd);
+    if (ofd == NULL) return -1;
     dir_entry_t dir_entry;
-    find_file(fat, fs_fd, ROOTDIR, file_entry.filename, &loc, &dir_entry);
+    if (!ofd_entry(ofd, &dir_entry)) return -1;
 
-    // find next fileptr position
-    fileptr_t* fp_struct = get_fileptr(file_entry.fileptr_head, current_pcb->pid);
-    int new_offset = fp_struct->ptr;
+    // find next file pointer position
+    int new_offset = ofd->offset;
     if (whence == F_SEEK_CURR) {
         new_offset += offset;
     } else if (whence == F_SEEK_END) {
@@ -631,13 +790,110 @@ int f_lseek(int fd, int offset, int whence) {
         new_offset = offset;
     }
 
-    if (!BETWEEN_INCL(new_offset, 0, dir_entry.size)) { // offset puts fileptr out of bounds
+    if (!BETWEEN_INCL(new_offset, 0, dir_entry.size)) { // offset puts the file pointer out of bounds
         ERRNO = ERR_F_LSEEK_OOB;
         return -1;
     }
-    // new fileptr is valid
-    fp_struct->ptr = new_offset;
-    return fp_struct->ptr;
+    // new file pointer is valid
+    ofd->offset = new_offset;
+    return ofd->offset;
+}
+
+/**
+ * @brief Preallocates a range of a file.
+ *
+ * This function makes sure the bytes from `offset` to `offset + len` of the file behind the
+ * specified file descriptor are allocated, so that later writes don't have to grow the chain a
+ * block at a time. If the file is shorter, it is extended with zeros; the new blocks are taken
+ * as one contiguous run next to the file's last block where possible. The file pointer is unchanged.
+ *
+ * @param fd The file descriptor of the file.
+ * @param offset The start of the range.
+ * @param len The length of the range.
+ * @return On success, returns 0. On failure, returns -1, and the global variable ERRNO is set accordingly.
+ */
+int f_fallocate(int fd, int offset, int len) {
+    if (f_isatty(fd)) {
+        ERRNO = ERR_F_FALLOCATE_TERMINAL;
+        return -1;
+    }
+    if (offset < 0 || len <= 0 || offset > INT_MAX - len) {
+        ERRNO = ERR_F_FALLOCATE_INVALID;
+        return -1;
+    }
+
+    // find the open file description, if it exists
+    ofd_t* ofd = find_ofd(fd);
+    if (ofd == NULL) return -1;
+    dir_entry_t entry;
+    if (!ofd_write_entry(ofd, &entry, ERR_F_FALLOCATE_RONLY)) return -1;
+    sigset_t prev_mask;
+    block_alarm(&prev_mask);
+    bool allocated = fs_fallocate(fat, fs_fd, ofd->file->filename, offset, len);
+    unblock_alarm(&prev_mask);
+    if (!allocated) {
+        ERRNO = ERR_F_FALLOCATE_NOSPACE;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies bytes from one file to another inside the file system.
+ *
+ * This function copies up to `n` bytes from the file pointer of `fd_in` to the file pointer of
+ * `fd_out`, and moves both file pointers past the copied bytes. When both file pointers are at the
+ * start of their files and `n` covers the whole source, the destination is replaced by an exact
+ * copy: the source's chain is copied run by run inside the image (copy_file_range on the image),
+ * so the data never passes through a user buffer, or, with `F_COPY_SHARE`, the destination simply
+ * shares the source's blocks until one of the files is changed. Other ranges are read from the
+ * source and written with `f_write`.
+ *
+ * @param fd_in The file descriptor to copy from.
+ * @param fd_out The file descriptor to copy to.
+ * @param n The number of bytes to copy.
+ * @param flags Either 0 or `F_COPY_SHARE`.
+ * @return On success, returns the number of bytes copied (0 at the end of the source). On failure,
+ * returns -1, and the global variable ERRNO is set accordingly.
+ */
+int f_copy_range(int fd_in, int fd_out, int n, int flags) {
+    if (f_isatty(fd_in) || f_isatty(fd_out)) {
+        ERRNO = ERR_F_COPY_RANGE_TERMINAL;
+        return -1;
+    }
+
+    // find the open file descriptions & their directory entries
+    ofd_t* in = find_ofd(fd_in);
+    ofd_t* out = find_ofd(fd_out);
+    if (in == NULL || out == NULL) return -1;
+    dir_entry_t entry;
+    dir_entry_t out_entry;
+    if (!ofd_write_entry(out, &out_entry, ERR_F_COPY_RANGE_RONLY)) return -1;
+    if (!ofd_entry(in, &entry)) return -1;
+    if (n <= 0 || in->offset >= (int) entry.size) return 0;
+
+    if (in->offset == 0 && out->offset == 0 && n >= (int) entry.size && !in->file->unlinked) { // whole file: copy the chain inside the image
+        sigset_t prev_mask;
+        block_alarm(&prev_mask);
+        bool copied = fs_copy(fat, fs_fd, in->file->filename, out->file->filename, (flags & F_COPY_SHARE) != 0);
+        unblock_alarm(&prev_mask);
+        if (!copied) {
+            ERRNO = ERR_F_COPY_RANGE_NOSPACE;
+            return -1;
+        }
+        in->offset = entry.size;
+        out->offset = entry.size;
+        return entry.size;
+    }
+
+    int bytes_to_copy = MIN(n, (int) entry.size - in->offset);
+    char* buffer = malloc(bytes_to_copy);
+    read_file_range(fat, fs_fd, in->location, &entry, in->offset, buffer, bytes_to_copy);
+    int written = f_write(fd_out, buffer, bytes_to_copy);
+    free(buffer);
+    if (written == -1) return -1;
+    in->offset += bytes_to_copy;
+    return bytes_to_copy;
 }
 
 /**
@@ -655,11 +911,11 @@ void f_ls(const char *filename) {
     else { // list current
         point_t loc;
         dir_entry_t entry;
-        if (!find_file(fat, fs_fd, ROOTDIR, filename, &loc, &entry)) {
+        if (!find_file(fat, fs_fd, fs_root(fat), filename, &loc, &entry)) {
             ERRNO = ERR_FS_FILE_NOT_FOUND;
             return;
         }
-        fs_ls_single(&entry);
+        fs_ls_single(fat, &entry);
     }
 }
 
@@ -670,7 +926,10 @@ void f_ls(const char *filename) {
  */
 void f_touch(char* filenames[], int n) {
     for (int i = 0; i < n; i++) {
+        sigset_t prev_mask;
+        block_alarm(&prev_mask);
         fs_touch(fat, fs_fd, filenames[i]);
+        unblock_alarm(&prev_mask);
     }
 }
 
@@ -699,29 +958,56 @@ void f_unmount(uint16_t** fat, int fs_fd) {
     fs_unmount(fat, fs_fd);
 }
 
-/** @brief Moves or renames a file or directory.
+/** @brief Makes every completed filesystem update durable (commits the running journal group).
+ *  SIGALRM is blocked, so the commit isn't interrupted by another process's operation.
+ */
+void f_sync() {
+    sigset_t prev_mask;
+    block_alarm(&prev_mask);
+    fs_sync(fat);
+    unblock_alarm(&prev_mask);
+}
+
+/** @brief Moves or renames a file or directory; open file descriptions of it follow it.
  *  @param src The source path of the file or directory.
  *  @param dest The destination path for the file or directory.
  */
 void f_mv(char* src, char* dest) {
-    fs_mv(fat, fs_fd, src, dest);
+    file_t* file_entry = find_file_entry_by_filename(src);
+    sigset_t prev_mask;
+    block_alarm(&prev_mask);
+    bool moved = fs_mv(fat, fs_fd, src, dest);
+    unblock_alarm(&prev_mask);
+    if (moved && file_entry != NULL) {
+        snprintf(file_entry->filename, sizeof(file_entry->filename), "%s", dest);
+    }
 }
 
-/** @brief Copies a file or directory.
+/** @brief Copies a file or directory, inside the image with `f_copy_range`.
  *  @param src The source path of the file or directory.
  *  @param dest The destination path for the copied file or directory.
+ *  @param share Whether the copy shares the source's blocks (copy-on-write) instead of duplicating them.
  */
-void f_cp(char* src, char* dest) {
-    fs_cp(fat, fs_fd, src, dest);
+void f_cp(char* src, char* dest, bool share) {
+    int fd_in = f_open(src, F_READ);
+    if (fd_in == -1) return;
+    int fd_out = f_open(dest, F_WRITE);
+    if (fd_out == -1) {
+        f_close(fd_in);
+        return;
+    }
+    f_copy_range(fd_in, fd_out, INT_MAX, share ? F_COPY_SHARE : 0);
+    f_close(fd_out);
+    f_close(fd_in);
 }
 
-/** @brief Removes (deletes) files or directories.
+/** @brief Removes (deletes) files or directories, with `f_unlink`.
  *  @param filenames An array of strings containing the names of the files or directories to be removed.
  *  @param n The number of filenames in the array.
  */
 void f_rm(char* filenames[], int n) {
     for (int i = 0; i < n; i++) {
-        fs_rm(fat, fs_fd, filenames[i]);
+        f_unlink(filenames[i]);
     }
 }
 
@@ -730,5 +1016,62 @@ void f_rm(char* filenames[], int n) {
  *  @param perms The new permissions to set for the file or directory.
  */
 void f_chmod(char* filename, int perms) {
+    sigset_t prev_mask;
+    block_alarm(&prev_mask);
     fs_chmod(fat, fs_fd, filename, (uint8_t)perms);
-}
\ No newline at end of file
+    unblock_alarm(&prev_mask);
+}
+
+/**
+ * @brief Defragments the file system.
+ *
+ * This function moves the chain of every fragmented file into one run of free blocks, most
+ * fragmented file first, and prints the fragmentation before and after. SIGALRM is blocked
+ * while a file is checked against the open files and moved, so no other process runs in
+ * the middle of a move, and files that any process has open (including deleted files that are
+ * still in use) are left where they are. Between files, the process can be preempted as usual.
+ *
+ * @return The number of files moved.
+ */
+int f_defrag() {
+    sigset_t mask, prev_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    char buffer[ERRBUFFER_SIZE];
+
+    defrag_report_t report;
+    memset(&report, 0, sizeof(report));
+    sigprocmask(SIG_BLOCK, &mask, &prev_mask);
+    fs_frag_stats(fat, fs_fd, &report.before);
+    defrag_candidate_t* plan;
+    int n_files = defrag_plan(fat, fs_fd, &plan);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    frag_format(buffer, ERRBUFFER_SIZE, "before", &report.before);
+    f_print(buffer);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int f = 0; f < n_files; f++) {
+        sigprocmask(SIG_BLOCK, &mask, &prev_mask);
+        if (find_file_entry_by_filename(plan[f].name) != NULL) { // open; readers hold its chain
+            report.n_busy++;
+        } else {
+            int n_blocks;
+            defrag_result_t result = defrag_move(fat, fs_fd, plan[f].name, &n_blocks);
+            defrag_count(&report, result, n_blocks);
+        }
+        sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    }
+    free(plan);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    defrag_format(buffer, ERRBUFFER_SIZE, &report);
+    f_print(buffer);
+    sigprocmask(SIG_BLOCK, &mask, &prev_mask);
+    fs_frag_stats(fat, fs_fd, &report.after);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    frag_format(buffer, ERRBUFFER_SIZE, "after", &report.after);
+    f_print(buffer);
+    return report.n_moved;
+}
@@ -1,28 +1,38 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "../kernel/PCB.h"
+#include "../kernel/pipe.h"
+#include "../kernel/mq.h"
+#include "../pennfat/fat.h"
 
 // filesystem user-level calls interface
 
-typedef struct fileptr fileptr_t;
-typedef struct fileptr {
-    int pid;
-    int ptr;
-    fileptr_t* next;
-} fileptr_t;
-
-struct file;
-typedef struct file { // file information
+typedef struct file { // file information, shared by all of its open file descriptions
     char filename[32];
-    int file_id; // global file id
-    int wr_pid; // -1 if no file is writing, else pid of the only file with write access
-    struct fileptr* fileptr_head; // linkedlist of fileptrs
+    int wr_pid; // -1 if no process is writing, else pid of the only process with write access
+    int n_writers; // fds of `wr_pid` that refer to writable open file descriptions of the file
+    int n_ofds; // open file descriptions of the file
+    bool unlinked; // removed while open; freed when the last description is closed
+    struct file* prev; // previous in list
     struct file* next; // next in list
 } file_t;
 
+typedef struct ofd { // open file description; PCB fd tables index the table of these directly
+    file_t* file; // the open file, or `NULL` for a pipe end, a message queue, or a child exit fd
+    pipe_t* pipe; // the pipe, for a pipe end
+    mq_t* mq; // the queue, for a message queue
+    bool child_exits; // a child exit fd (see `p_child_fd`)
+    int mode; // `F_WRITE`, `F_READ`, or `F_APPEND`
+    int offset; // file pointer, shared by every fd that refers to the description
+    int refs; // fd tables that refer to the description (a table shared by processes counts once); `0` if the slot is free
+    point_t location; // cached location of the directory entry, checked on each use
+    int next_free; // next slot in the free list, if the slot is free
+} ofd_t;
+
 #define F_STDIN     0
 #define F_STDOUT    1
 #define F_STDERR    2
@@ -30,6 +40,10 @@ typedef struct file { // file information
 #define F_WRITE     0
 #define F_READ      1
 #define F_APPEND    2
+
+#define F_POLLIN    0b01 // poll event: the fd can be read without blocking (it has data, or is at EOF)
+#define F_POLLOUT   0b10 // poll event: the fd can be written without blocking
+
 /**
  * open a file name fname with the mode `mode` and return a file descriptor
  * @param fname the filename to open
@@ -47,7 +61,8 @@ int f_open(const char *fname, int mode);
  * @param fd the file descriptor to read from
  * @param n number of bytes to read
  * @param buf buffer to read into
- * @return number of bytes read (including `\0`) on success, `0` if EOF is reached, `-1` on error
+ * @return number of bytes read on success, `0` if EOF is reached, `-1` on error;
+ * reading a pipe blocks until it has data, & is at EOF once all of its write ends are closed
 */
 int f_read(int fd, int n, char *buf);
 
@@ -56,7 +71,8 @@ int f_read(int fd, int n, char *buf);
  * @param fd the file descriptor to write to
  * @param str the string to write from
  * @param n number of bytes to write
- * @return number of bytes written (including `\0`) on success, `-1` on error
+ * @return number of bytes written on success, `-1` on error;
+ * writing to a pipe blocks while it is full, & fails once all of its read ends are closed
 */
 int f_write(int fd, const char *str, int n);
 
@@ -68,7 +84,7 @@ int f_write(int fd, const char *str, int n);
 int f_close(int fd);
 
 /**
- * remove a file, if it exists & is not in use
+ * remove a file; if it is still open, it is freed once the last description of it is closed
  * @param fname the file to remove
  * @return `0` on success, `-1` otherwise
 */
@@ -89,6 +105,30 @@ int f_unlink(const char *fname);
 */
 int f_lseek(int fd, int offset, int whence);
 
+/**
+ * allocate the bytes `[offset, offset + len)` of a file up front, as one contiguous run of blocks
+ * next to the file's last block where possible; the file grows (with zeros) if it is shorter
+ * @param fd the file descriptor; must have write access
+ * @param offset start of the range
+ * @param len length of the range
+ * @return `0` on success, `-1` on error
+*/
+int f_fallocate(int fd, int offset, int len);
+
+#define F_COPY_SHARE 1 // `f_copy_range` flag: share blocks copy-on-write instead of copying them
+/**
+ * copy bytes from one file to another inside the filesystem, from & to the file pointers, which
+ * are both moved past the copied bytes; when the copy starts at the beginning of both files and
+ * covers the whole source, the destination becomes an exact copy of it (its chain is copied block
+ * run by block run inside the image, or shared with `F_COPY_SHARE`)
+ * @param fd_in the file descriptor to copy from
+ * @param fd_out the file descriptor to copy to; must have write access
+ * @param n number of bytes to copy
+ * @param flags `0` or `F_COPY_SHARE`
+ * @return number of bytes copied on success, `0` if `fd_in` is at EOF, `-1` on error
+*/
+int f_copy_range(int fd_in, int fd_out, int n, int flags);
+
 /**
  * list a file in the current directory
  * @param filename the file to list, or `NULL` to list all files in the current directory
@@ -104,10 +144,18 @@ void f_ls(const char *filename);
 */
 void f_touch(char* filenames[], int n);
 
+/**
+ * check whether a fd of the current process refers to the terminal
+ * @param fd the file descriptor
+ * @return `true` if `fd` is the terminal's input or output, even if it isn't `F_STDIN`,
+ * `F_STDOUT`, or `F_STDERR`; `false` if it refers to a file or a pipe, or isn't open
+*/
+bool f_isatty(int fd);
+
 /**
  * print to terminal (F_STDERR)
  * @param str the string to print (use `snprintf` to format)
- * @return number of bytes written (including `\0`) on success, `-1` on error
+ * @return number of bytes written on success, `-1` on error
 */
 int f_print(const char* str);
 
@@ -117,11 +165,17 @@ int f_mount(char* fs_name, uint16_t** fat);
 // unmount
 void f_unmount(uint16_t** fat, int fs_fd);
 
+/**
+ * make every completed filesystem update durable, e.g. before the shell goes idle at its prompt
+ * @return none
+*/
+void f_sync();
+
 // rename src to dest
 void f_mv(char* src, char* dest); 
 
-// copy src to dest
-void f_cp(char* src, char* dest);
+// copy src to dest, sharing its blocks copy-on-write if `share`
+void f_cp(char* src, char* dest, bool share);
 
 // remove filenames
 void f_rm(char* filenames[], int n);
@@ -132,10 +186,21 @@ void f_rm(char* filenames[], int n);
 // change permissions
 void f_chmod(char* filename, int perms);
 
-void print_fileptr_pids_all();
+/**
+ * defragment the filesystem, most fragmented file first, printing fragmentation before & after;
+ * each file is moved with the alarm blocked, and files that are open are left where they are
+ * @return the number of files moved
+*/
+int f_defrag();
+
+void print_open_files();
 
 
 // TODO: these should go in a kernel-level filesystem header
-void process_create_fileptrs(PCB* pcb);
-void process_delete_fileptrs(PCB* pcb);
-file_t* find_file_entry_by_file_id(int file_id);
\ No newline at end of file
+void process_copy_fds(PCB* pcb, int fd0, int fd1);
+void process_close_fds(PCB* pcb);
+int process_open_pipe(PCB* pcb, pipe_t* pipe, int fds[2]);
+int process_open_mq(PCB* pcb, mq_t* mq);
+mq_t* process_fd_mq(PCB* pcb, int fd);
+int process_open_child_fd(PCB* pcb);
+int process_poll_fd(PCB* pcb, int fd, int events, wait_queue_t* queues[2], int* n_queues);
@@ -0,0 +1,231 @@
+// journal crash-replay tests (`make crashtest`, then `./bin/crashtest [ IMAGE ]`)
+//
+// Every case makes a fresh journaled v2 image and sets it up through the `f_` calls as a single
+// process, unmounting cleanly. A forked child then mounts the image, runs the operations under
+// test and kills itself with SIGKILL without unmounting, which leaves the image the way a crash
+// does: committed groups are in the journal, the running group & the privately mapped FAT are
+// gone, but data blocks written in place are not. The parent mounts the image again, which
+// replays the journal, and checks what survived. One line per case goes to stdout; the exit
+// status is the number of cases that failed.
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../filesystem/filesystem.h"
+#include "../kernel/PCB.h"
+#include "../logger/logger.h"
+#include "../pennfat/checksum.h"
+#include "../pennfat/fat.h"
+#include "../pennfat/journal.h"
+#include "../util/globals.h"
+#include "../util/util.h"
+
+#define CRASH_FILE_BLOCKS 8 // length of the files the cases write, in blocks
+
+extern PCB* current_pcb;
+
+static char image[4096] = "/tmp/crashtest.img";
+
+/**
+ * mount the test image the way PennOS does, with fresh file descriptors
+ * @return none
+*/
+static void mount_image() {
+    fs_fd = fs_mount(image, &fat);
+    current_pcb = createPCB(NULL);
+}
+
+/**
+ * write a whole file of one repeated byte
+ * @param name the file
+ * @param fill the byte
+ * @return none
+*/
+static void write_pattern(char* name, char fill) {
+    int n_bytes = CRASH_FILE_BLOCKS * fs_block_size(fat);
+    char* buffer = safe_malloc(n_bytes);
+    memset(buffer, fill, n_bytes);
+    int fd = f_open(name, F_WRITE);
+    f_write(fd, buffer, n_bytes);
+    f_close(fd);
+    free(buffer);
+}
+
+/**
+ * check that a file holds one repeated byte, all the way through
+ * @param name the file
+ * @param fill the byte
+ * @return `true` if it exists & holds exactly what `write_pattern` wrote
+*/
+static bool check_pattern(char* name, char fill) {
+    int n_bytes = CRASH_FILE_BLOCKS * fs_block_size(fat);
+    char* buffer = safe_malloc(n_bytes + 1);
+    int fd = f_open(name, F_READ);
+    if (fd < 0) {
+        free(buffer);
+        return false;
+    }
+    int n_read = 0;
+    int res;
+    while (n_read <= n_bytes && (res = f_read(fd, n_bytes + 1 - n_read, &buffer[n_read])) > 0) n_read += res;
+    f_close(fd);
+    bool ok = n_read == n_bytes;
+    for (int i = 0; ok && i < n_bytes; i++) ok = buffer[i] == fill;
+    free(buffer);
+    return ok;
+}
+
+/**
+ * check whether a file exists
+ * @param name the file
+ * @return `true` if it does
+*/
+static bool exists(const char* name) {
+    point_t location;
+    dir_entry_t entry;
+    return find_file(fat, fs_fd, fs_root(fat), name, &location, &entry);
+}
+
+/**
+ * run `crash` in a child that mounts the image & is killed before it can unmount, then mount
+ * the image again (replaying the journal)
+ * @param crash the operations to run before the crash
+ * @return none
+*/
+static void crash_and_replay(void (*crash)()) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        mount_image();
+        crash();
+        kill(getpid(), SIGKILL);
+    }
+    waitpid(pid, NULL, 0);
+    mount_image();
+}
+
+// freed blocks aren't reused before the free commits
+
+static void reuse_setup() {
+    write_pattern("old", 'o');
+}
+
+static void reuse_crash() {
+    char* names[1] = { "old" };
+    f_rm(names, 1); // the free is only in the running group...
+    write_pattern("new", 'n'); // ...so these blocks must come from elsewhere
+}
+
+static bool reuse_check() {
+    return check_pattern("old", 'o') && !exists("new");
+}
+
+// a group whose operations are done commits by its deadline, even with nothing after it
+
+static void deadline_setup() {
+}
+
+static void deadline_crash() {
+    char* names[1] = { "empty" };
+    f_touch(names, 1);
+    write_pattern("full", 'f');
+    struct timespec wait = { 0, (COMMIT_INTERVAL_MS + 100) * 1000000L };
+    nanosleep(&wait, NULL);
+    fs_tick(fat); // what PennOS does on every tick
+}
+
+static bool deadline_check() {
+    return exists("empty") && check_pattern("full", 'f');
+}
+
+// a committed free gives the blocks back
+
+static int free_before;
+
+static void free_setup() {
+    free_before = fs_free_blocks(fat);
+    write_pattern("gone", 'g');
+}
+
+static void free_crash() {
+    char* names[1] = { "gone" };
+    f_rm(names, 1);
+    fs_sync(fat);
+}
+
+static bool free_check() {
+    return !exists("gone") && fs_free_blocks(fat) == free_before;
+}
+
+// checksums are replayed along with the FAT they belong to
+
+static int checked_before;
+
+static void csum_setup() {
+    write_pattern("kept", 'k');
+    scrub_report_t report;
+    fs_scrub(fat, fs_fd, 1, &report);
+    checked_before = report.n_checked;
+}
+
+static void csum_crash() {
+    char* names[1] = { "kept" };
+    f_rm(names, 1); // clears the checksums, but only in the running group
+    write_pattern("lost", 'l');
+}
+
+static bool csum_check() {
+    scrub_report_t report;
+    bool ok = fs_scrub(fat, fs_fd, 1, &report);
+    return ok && report.n_checked == checked_before && check_pattern("kept", 'k') && !exists("lost");
+}
+
+typedef struct crash_case {
+    const char* name;
+    bool checksums; // the test image has FEATURE_CHECKSUM as well as FEATURE_JOURNAL
+    void (*setup)();
+    void (*crash)();
+    bool (*check)();
+} crash_case_t;
+
+static const crash_case_t cases[] = {
+    { "freed blocks are not reused before the commit", false, reuse_setup, reuse_crash, reuse_check },
+    { "an idle group commits by its deadline", false, deadline_setup, deadline_crash, deadline_check },
+    { "a committed free releases the blocks", false, free_setup, free_crash, free_check },
+    { "checksums match the replayed FAT", true, csum_setup, csum_crash, csum_check },
+};
+
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [ IMAGE ]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc == 2) snprintf(image, sizeof(image), "%s", argv[1]);
+    logfile = fopen("/dev/null", "w");
+
+    int n_failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        fs_mkfs(image, 8, 1, FS_VERSION_2, FEATURE_JOURNAL | (cases[i].checksums ? FEATURE_CHECKSUM : 0));
+        mount_image();
+        cases[i].setup();
+        fs_unmount(&fat, fs_fd);
+
+        crash_and_replay(cases[i].crash);
+        bool ok = cases[i].check();
+        fs_unmount(&fat, fs_fd);
+        printf("%s: %s\n", ok ? "PASS" : "FAIL", cases[i].name);
+        if (!ok) n_failed++;
+    }
+    unlink(image);
+    return n_failed;
+}
@@ -0,0 +1,411 @@
+// filesystem micro-benchmarks (`make fsbench`, then `./bin/fsbench [ options ]`)
+//
+// Makes a fresh image for every geometry asked for (block size config x FAT blocks), mounts
+// it the way PennOS does, and drives it through the `f_` calls as a single process. Every
+// result is one CSV line on stdout:
+//     format,block_size,fat_blocks,benchmark,param,metric,value,unit
+// so runs can be diffed or loaded into a spreadsheet; progress goes to stderr.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../filesystem/filesystem.h"
+#include "../kernel/PCB.h"
+#include "../logger/logger.h"
+#include "../pennfat/defrag.h"
+#include "../pennfat/fat.h"
+#include "../util/globals.h"
+#include "../util/p-errno.h"
+#include "../util/util.h"
+
+#define BENCH_IO_CHUNK (64 * 1024) // bytes per `f_write`/`f_read` in the sequential benchmarks
+#define BENCH_RANDOM_SIZE 4096 // bytes per random read
+#define BENCH_RANDOM_OPS 2000
+#define BENCH_MAX_SMALL_FILES 1000
+#define BENCH_AGING_OPS 2000 // at least; larger images get more
+#define BENCH_AGING_MAX_FILES 8192
+#define BENCH_AGING_MAX_BLOCKS 16 // largest new file of the aging workload, in blocks
+#define BENCH_AGING_APPEND_BLOCKS 4 // largest append of the aging workload, in blocks
+
+extern PCB* current_pcb;
+
+typedef struct bench_options {
+    char image[4096]; // scratch image path
+    int configs[5]; // block size configs to run
+    int n_configs;
+    int fat_sizes[32]; // FAT blocks to run
+    int n_fat_sizes;
+    int file_mb; // size of the sequential file (capped at a quarter of the data region)
+    int max_files; // largest directory of the lookup benchmark
+    int version;
+    uint32_t features;
+} bench_options_t;
+
+static const char* format_name = "v1"; // of the running image, for `emit`
+static int bench_block_size;
+static int bench_fat_blocks;
+
+static double now_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * print one result
+ * @param benchmark what was measured
+ * @param param the setting it was measured with
+ * @param metric what the value is
+ * @param value the value
+ * @param unit its unit
+ * @return none
+*/
+static void emit(const char* benchmark, const char* param, const char* metric, double value, const char* unit) {
+    printf("%s,%d,%d,%s,%s,%s,%.6g,%s\n", format_name, bench_block_size, bench_fat_blocks, benchmark, param, metric, value, unit);
+    fflush(stdout);
+}
+
+static void emit_rate(const char* benchmark, const char* param, long long ops, long long bytes, double seconds) {
+    emit(benchmark, param, "ops", ops, "count");
+    emit(benchmark, param, "seconds", seconds, "s");
+    if (seconds <= 0) return;
+    emit(benchmark, param, "ops_per_s", ops / seconds, "op/s");
+    emit(benchmark, param, "latency", seconds * 1e6 / ops, "us");
+    if (bytes > 0) emit(benchmark, param, "throughput", bytes / seconds / (1024.0 * 1024.0), "MB/s");
+}
+
+static void bench_name(char* buffer, int i) {
+    sprintf(buffer, "bench%05d", i);
+}
+
+/**
+ * create & remove empty files
+ * @param n_files how many
+ * @return none
+*/
+static void bench_small_files(int n_files) {
+    char name[32];
+    char* names[1] = { name };
+    char param[32];
+    sprintf(param, "files=%d", n_files);
+
+    double start = now_seconds();
+    for (int i = 0; i < n_files; i++) {
+        bench_name(name, i);
+        f_touch(names, 1);
+    }
+    emit_rate("create", param, n_files, 0, now_seconds() - start);
+
+    start = now_seconds();
+    for (int i = 0; i < n_files; i++) {
+        bench_name(name, i);
+        f_rm(names, 1);
+    }
+    emit_rate("delete", param, n_files, 0, now_seconds() - start);
+}
+
+/**
+ * time `find_file` hits & misses as the directory grows
+ * @param max_files the largest directory
+ * @return none
+*/
+static void bench_lookup(int max_files) {
+    char name[32];
+    char* names[1] = { name };
+    char param[32];
+    int n_files = 0;
+    for (int size = 16; size <= max_files; size *= 4) {
+        for (; n_files < size; n_files++) {
+            bench_name(name, n_files);
+            f_touch(names, 1);
+        }
+        sprintf(param, "files=%d", size);
+        int n_lookups = 4 * size;
+        if (n_lookups < 1000) n_lookups = 1000;
+
+        point_t location;
+        dir_entry_t entry;
+        double start = now_seconds();
+        for (int i = 0; i < n_lookups; i++) {
+            bench_name(name, rand() % size);
+            find_file(fat, fs_fd, fs_root(fat), name, &location, &entry);
+        }
+        emit_rate("lookup_hit", param, n_lookups, 0, now_seconds() - start);
+
+        start = now_seconds();
+        for (int i = 0; i < n_lookups; i++) {
+            sprintf(name, "missing%05d", i % 1000);
+            find_file(fat, fs_fd, fs_root(fat), name, &location, &entry);
+        }
+        emit_rate("lookup_miss", param, n_lookups, 0, now_seconds() - start);
+    }
+    for (int i = 0; i < n_files; i++) {
+        bench_name(name, i);
+        f_rm(names, 1);
+    }
+}
+
+/**
+ * write a file sequentially, read it back sequentially & at random offsets, then remove it
+ * @param file_bytes size of the file
+ * @return none
+*/
+static void bench_sequential(int file_bytes) {
+    char* buffer = safe_malloc(BENCH_IO_CHUNK + 1);
+    memset(buffer, 'x', BENCH_IO_CHUNK);
+    char param[64];
+    sprintf(param, "bytes=%d;chunk=%d", file_bytes, BENCH_IO_CHUNK);
+
+    double start = now_seconds();
+    int fd = f_open("seqfile", F_WRITE);
+    long long written = 0;
+    int n_writes = 0;
+    while (written < file_bytes) {
+        int n = (file_bytes - written < BENCH_IO_CHUNK) ? file_bytes - written : BENCH_IO_CHUNK;
+        int res = f_write(fd, buffer, n);
+        if (res < 0) break;
+        written += res;
+        n_writes++;
+    }
+    f_close(fd);
+    emit_rate("seq_write", param, n_writes, written, now_seconds() - start);
+
+    start = now_seconds();
+    fd = f_open("seqfile", F_READ);
+    long long read = 0;
+    int n_reads = 0;
+    int res;
+    while ((res = f_read(fd, BENCH_IO_CHUNK, buffer)) > 0) {
+        read += res;
+        n_reads++;
+    }
+    emit_rate("seq_read", param, n_reads, read, now_seconds() - start);
+
+    sprintf(param, "bytes=%lld;size=%d", read, BENCH_RANDOM_SIZE);
+    int max_offset = (read > BENCH_RANDOM_SIZE) ? read - BENCH_RANDOM_SIZE : 0;
+    char* small = safe_malloc(BENCH_RANDOM_SIZE + 1);
+    start = now_seconds();
+    long long random_bytes = 0;
+    for (int i = 0; i < BENCH_RANDOM_OPS; i++) {
+        f_lseek(fd, (max_offset > 0) ? rand() % max_offset : 0, F_SEEK_SET);
+        res = f_read(fd, BENCH_RANDOM_SIZE, small);
+        if (res > 0) random_bytes += res;
+    }
+    emit_rate("random_read", param, BENCH_RANDOM_OPS, random_bytes, now_seconds() - start);
+    f_close(fd);
+    free(small);
+
+    char* names[1] = { "seqfile" };
+    sprintf(param, "bytes=%lld", read);
+    start = now_seconds();
+    f_rm(names, 1);
+    emit_rate("rm_large", param, 1, 0, now_seconds() - start);
+    free(buffer);
+}
+
+/**
+ * create, append to & delete files of random sizes while 40% to 70% of the free blocks
+ * are in use, then measure fragmentation & how fast the aged files read back; appends are
+ * a few blocks at a time & interleaved across files, & each one extends the file's chain
+ * next to its last block (f_write's append path), so a file whose neighbor took those blocks
+ * gets another extent, the way real aging fragments a filesystem
+ * @return none
+*/
+static void bench_aging() {
+    int block_size = fs_block_size(fat);
+    int n_blocks = fs_free_blocks(fat); // blocks the workload can use
+    int max_files = n_blocks / 4;
+    if (max_files > BENCH_AGING_MAX_FILES) max_files = BENCH_AGING_MAX_FILES;
+    int n_ops = (n_blocks / 2 > BENCH_AGING_OPS) ? n_blocks / 2 : BENCH_AGING_OPS;
+    bool* exists = calloc(max_files, sizeof(bool));
+    char* buffer = safe_malloc(BENCH_AGING_MAX_BLOCKS * block_size + 1);
+    memset(buffer, 'a', BENCH_AGING_MAX_BLOCKS * block_size);
+    char name[32];
+    char* names[1] = { name };
+    char param[32];
+    sprintf(param, "ops=%d", n_ops);
+
+    double start = now_seconds();
+    for (int op = 0; op < n_ops; op++) {
+        int i = rand() % max_files;
+        bench_name(name, i);
+        int used = n_blocks - fs_free_blocks(fat);
+        int max_blocks = exists[i] ? BENCH_AGING_APPEND_BLOCKS : BENCH_AGING_MAX_BLOCKS;
+        int n = (1 + rand() % max_blocks) * block_size - rand() % block_size;
+        if (exists[i] && (used > n_blocks * 7 / 10 || rand() % 3 == 0)) { // delete
+            f_rm(names, 1);
+            exists[i] = false;
+        } else if (used + BENCH_AGING_MAX_BLOCKS * 2 < n_blocks * 7 / 10 || used < n_blocks * 4 / 10) { // create or append
+            int fd = f_open(name, exists[i] ? F_APPEND : F_WRITE);
+            if (fd < 0) continue;
+            f_write(fd, buffer, n);
+            f_close(fd);
+            exists[i] = true;
+        }
+    }
+    emit_rate("aging", param, n_ops, 0, now_seconds() - start);
+
+    frag_stats_t stats;
+    fs_frag_stats(fat, fs_fd, &stats);
+    emit("aging", param, "files", stats.n_files, "count");
+    emit("aging", param, "fragmented_files", stats.n_fragmented, "count");
+    emit("aging", param, "extents_per_file", (stats.n_files > 0) ? (double) stats.n_extents / stats.n_files : 0, "extents");
+    emit("aging", param, "avg_run", (stats.n_extents > 0) ? (double) stats.n_blocks / stats.n_extents : 0, "blocks");
+    emit("aging", param, "max_extents", stats.max_extents, "extents");
+    emit("aging", param, "used", 100.0 * (n_blocks - fs_free_blocks(fat)) / n_blocks, "%");
+
+    // read every aged file back
+    long long read = 0;
+    int n_reads = 0;
+    start = now_seconds();
+    for (int i = 0; i < max_files; i++) {
+        if (!exists[i]) continue;
+        bench_name(name, i);
+        int fd = f_open(name, F_READ);
+        int res;
+        while ((res = f_read(fd, BENCH_AGING_MAX_BLOCKS * block_size, buffer)) > 0) {
+            read += res;
+            n_reads++;
+        }
+        f_close(fd);
+    }
+    emit_rate("aged_read", param, n_reads, read, now_seconds() - start);
+
+    for (int i = 0; i < max_files; i++) {
+        if (!exists[i]) continue;
+        bench_name(name, i);
+        f_rm(names, 1);
+    }
+    free(buffer);
+    free(exists);
+}
+
+/**
+ * run every benchmark on a fresh image
+ * @param options what to run
+ * @param config block size config
+ * @param fat_blocks blocks in the FAT
+ * @return none
+*/
+static void bench_image(bench_options_t* options, int config, int fat_blocks) {
+    if (!fs_mkfs(options->image, fat_blocks, config, options->version, options->features)) return; // geometry too big
+    fs_fd = fs_mount(options->image, &fat);
+    bench_block_size = fs_block_size(fat);
+    bench_fat_blocks = fat_blocks;
+    int n_blocks = fs_n_blocks(fat) - 1; // data blocks
+    int dir_files = (n_blocks / 8) * (bench_block_size / DIR_ENTRY_SIZE); // the directory never shrinks, so it gets an eighth of the image
+    fprintf(stderr, "fsbench: %s, %d-byte blocks, %d FAT blocks (%d data blocks)\n", format_name, bench_block_size, fat_blocks, n_blocks);
+    srand(1); // the same workload for every run
+
+    int n_files = (dir_files < BENCH_MAX_SMALL_FILES) ? dir_files : BENCH_MAX_SMALL_FILES;
+    bench_small_files(n_files);
+    bench_lookup((dir_files < options->max_files) ? dir_files : options->max_files);
+
+    long long file_bytes = (long long) options->file_mb * 1024 * 1024;
+    long long quarter = (long long) n_blocks * bench_block_size / 4;
+    bench_sequential((file_bytes < quarter) ? file_bytes : quarter);
+    bench_aging();
+
+    fs_unmount(&fat, fs_fd);
+    fs_fd = -1;
+    unlink(options->image);
+}
+
+/**
+ * parse a list like `0-4` or `1,8,32`
+ * @param arg the list
+ * @param values set to its values
+ * @param max_values length of `values`
+ * @param min smallest valid value
+ * @param max largest valid value
+ * @return the number of values, or `-1` if the list is invalid
+*/
+static int parse_list(char* arg, int* values, int max_values, int min, int max) {
+    int n = 0;
+    char* end = arg;
+    while (*end != '\0') {
+        int first = (int) strtol(end, &end, 10);
+        int last = first;
+        if (*end == '-') last = (int) strtol(end + 1, &end, 10);
+        if (first < min || last > max || last < first) return -1;
+        for (int v = first; v <= last; v++) {
+            if (n == max_values) return -1;
+            values[n++] = v;
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+    }
+    return n;
+}
+
+int main(int argc, char* argv[]) {
+    bench_options_t options = {
+        .image = "/tmp/fsbench.img", .configs = { 0, 1, 2, 3, 4 }, .n_configs = 5,
+        .fat_sizes = { 1, 8, 32 }, .n_fat_sizes = 3, .file_mb = 4, .max_files = 4096,
+        .version = FS_VERSION_1, .features = 0
+    };
+    bool inline_files = true;
+    for (int i = 1; i < argc; i++) {
+        char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        bool ok = true;
+        if (strcmp(argv[i], "-b") == 0 && value != NULL) {
+            options.n_configs = parse_list(value, options.configs, 5, 0, 4);
+            ok = options.n_configs > 0;
+            i++;
+        } else if (strcmp(argv[i], "-f") == 0 && value != NULL) {
+            options.n_fat_sizes = parse_list(value, options.fat_sizes, 32, 1, 32);
+            ok = options.n_fat_sizes > 0;
+            i++;
+        } else if (strcmp(argv[i], "-s") == 0 && value != NULL) {
+            options.file_mb = atoi(value);
+            ok = options.file_mb > 0;
+            i++;
+        } else if (strcmp(argv[i], "-n") == 0 && value != NULL) {
+            options.max_files = atoi(value);
+            ok = options.max_files >= 16;
+            i++;
+        } else if (strcmp(argv[i], "-o") == 0 && value != NULL) {
+            snprintf(options.image, sizeof(options.image), "%s", value);
+            i++;
+        } else if (strcmp(argv[i], "-v2") == 0) {
+            options.version = FS_VERSION_2;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            options.features |= FEATURE_JOURNAL;
+        } else if (strcmp(argv[i], "-noinline") == 0) {
+            inline_files = false;
+        } else if (strcmp(argv[i], "-z") == 0) {
+            options.features |= FEATURE_COMPRESS;
+        } else if (strcmp(argv[i], "-crc") == 0) {
+            options.features |= FEATURE_CHECKSUM;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "usage: %s [ -b CONFIGS ] [ -f FAT_BLOCKS ] [ -s FILE_MB ] [ -n MAX_FILES ] [ -o IMAGE ] [ -v2 ] [ -j ] [ -noinline ] [ -z ] [ -crc ]\n"
+                            "       (CONFIGS & FAT_BLOCKS are lists like 0-4 or 1,8,32)\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (options.version == FS_VERSION_2 && inline_files) options.features |= FEATURE_INLINE;
+    if (options.version == FS_VERSION_1 && options.features != 0) {
+        fprintf(stderr, "failed: -j, -z and -crc require -v2\n");
+        exit(EXIT_FAILURE);
+    }
+    format_name = (options.version == FS_VERSION_2) ? "v2" : "v1";
+
+    logfile = fopen("/dev/null", "w");
+    current_pcb = createPCB(NULL); // the benchmark runs as one process with fresh file descriptors
+
+    printf("format,block_size,fat_blocks,benchmark,param,metric,value,unit\n");
+    for (int c = 0; c < options.n_configs; c++) {
+        for (int f = 0; f < options.n_fat_sizes; f++) {
+            bench_image(&options, options.configs[c], options.fat_sizes[f]);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,7 +1,11 @@
 #include "PCB.h"
 #include "scheduler.h"
+#include "wait-queue.h"
+#include "shm.h"
+#include "kernel-functions.h"
 #include <stdio.h>
 #include "../util/globals.h"
+#include "../filesystem/filesystem.h"
 #include <valgrind/valgrind.h>
 
 pid_t next_pid = 1;
@@ -31,6 +35,18 @@ void k_free(PCB *process)
 {
     if (process != NULL)
     {
+        if (process->sig_return != NULL)
+        { // freed while running signal handlers: its own context is the one they interrupted
+            process->context = process->sig_return;
+            process->sig_return = NULL;
+        }
+        free(process->sig_context);
+        if (process->sig_stack != NULL)
+        {
+            VALGRIND_STACK_DEREGISTER(process->sig_stack);
+            free(process->sig_stack);
+        }
+
         if (process->context != NULL)
         {
 
@@ -45,6 +61,14 @@ void k_free(PCB *process)
             process->context = NULL;
         }
 
+        k_wait_cancel(process);
+        k_timer_disarm(&process->alarm);
+        k_shm_detach_all(process);
+        if (process->fds != NULL)
+        { // close any files the process still has open
+            process_close_fds(process);
+        }
+
         free(process->name);
         free(process);
     }
@@ -67,6 +91,20 @@ PCB *createPCB(PCB *Parent)
         new_pcb->status = T_RUNNING;
         next_pid++;
         new_pcb->numChildren = 0;
+        new_pcb->fds = NULL;
+        new_pcb->waits = NULL;
+        k_timer_init(&new_pcb->wait_timer, new_pcb, k_wait_timeout);
+        k_timer_init(&new_pcb->alarm, new_pcb, k_alarm_expire);
+        new_pcb->alarms = 0;
+        new_pcb->sig_pending = 0;
+        new_pcb->sig_blocked = (Parent != NULL) ? Parent->sig_blocked : 0; // handlers are reset, the mask is kept
+        memset(new_pcb->sig_handlers, 0, sizeof(new_pcb->sig_handlers));
+        new_pcb->sig_context = NULL;
+        new_pcb->sig_stack = NULL;
+        new_pcb->sig_return = NULL;
+        new_pcb->shm = NULL;
+        new_pcb->lock_wait = NULL;
+        new_pcb->inherited = NULL;
 
         new_pcb->context = (ucontext_t *)malloc(sizeof(ucontext_t)); // Allocate on the heap
         if (new_pcb->context == NULL)
@@ -102,24 +140,17 @@ PCB *createPCB(PCB *Parent)
 
         // set fields in the new PCB
         new_pcb->priority = 0;
+        new_pcb->base_priority = 0;
         new_pcb->next = NULL;
 
         if (Parent)
-        { // if parent, copy the parent's file descriptors
-            for (int i = 0; i < MAX_FDS; i++)
-            {
-                new_pcb->fileDescriptors[i] = Parent->fileDescriptors[i];
-            }
+        { // if parent, share the parent's file descriptors until either changes them
+            new_pcb->fds = Parent->fds;
+            new_pcb->fds->refs++;
         }
         else
         { // if no parent, then file descriptors all start empty, except for 0, 1, 2 (in/out/err)
-            for (int i = 3; i < MAX_FDS; i++)
-            {
-                new_pcb->fileDescriptors[i] = NOFILE;
-            }
-            new_pcb->fileDescriptors[0] = STDIN_ID;
-            new_pcb->fileDescriptors[1] = STDOUT_ID;
-            new_pcb->fileDescriptors[2] = STDERR_ID;
+            new_pcb->fds = fd_table_create();
         }
 
         return new_pcb;
@@ -10,17 +10,16 @@
 #ifndef PCB_H
 #define PCB_H
 
-#define STACKSIZE 4096*256 // TODO: maybe we should increase this
-#define MAX_FDS 1024
+#include "fd-table.h"
+#include "timer.h"
+#include "../util/globals.h"
 
-// file ids
-#define NOFILE -1
-#define STDIN_ID -2
-#define STDOUT_ID -3
-#define STDERR_ID -4
+#define STACKSIZE 4096*256 // TODO: maybe we should increase this
 
 typedef struct PCB PCB;
 
+typedef void (*p_sighandler_t)(int sig); // signal handler registered with p_signal
+
 typedef struct PCB
 {
    char* name;                      // the name of the process (i.e., "cat")
@@ -29,9 +28,23 @@ typedef struct PCB
    pid_t pid;
    pid_t children[10000];
    int numChildren;
-   int fileDescriptors[MAX_FDS];
-   int priority;
+   fd_table_t* fds;                 // shared copy-on-write with the parent until either opens or closes a file
+   int priority;                    // effective priority, which the scheduler uses
+   int base_priority;               // priority set by p_nice; `priority` is raised above it while the process holds a mutex a higher priority process waits for
    int status; // see util/globals.h for statuses
+   struct wait_entry* waits;        // entries of the process in the queues it is blocked in (several if it polls), or NULL
+   ktimer_t wait_timer;             // armed while the process waits with a deadline
+   ktimer_t alarm;                  // armed by p_alarm / p_setitimer; sends S_SIGALRM when it expires
+   int alarms;                      // S_SIGALRM signals the process has received
+   int sig_pending;                 // signals (S_BIT) sent to the process & not handled yet; each is pending at most once
+   int sig_blocked;                 // signals (S_BIT) whose delivery the process defers (see p_sigprocmask)
+   p_sighandler_t sig_handlers[S_NSIG]; // handler of each signal, in S_BIT order, or P_SIG_DFL / P_SIG_IGN
+   ucontext_t* sig_context;         // context signal handlers run in, on `sig_stack`; allocated by the first p_signal
+   void* sig_stack;                 // stack signal handlers run on
+   ucontext_t* sig_return;          // the context the process was interrupted in while it runs handlers, or NULL
+   struct shm_attachment* shm;      // shared memory regions the process is attached to
+   struct mutex* lock_wait;         // mutex the process is blocked on, or NULL
+   struct mutex* inherited;         // mutexes the process holds that have waiters
    struct PCB* next;
 } PCB;
 
@@ -0,0 +1,129 @@
+#include "fd-table.h"
+#include <stdlib.h>
+
+/**
+ * creates an fd table with only F_STDIN, F_STDOUT & F_STDERR in use, to the terminal
+ * @return the table, with one reference
+ */
+fd_table_t *fd_table_create()
+{
+    fd_table_t *table = malloc(sizeof(fd_table_t));
+    table->refs = 1;
+    for (int i = 0; i < FD_WORDS; i++)
+    {
+        table->used[i] = 0;
+    }
+    fd_table_set(table, 0, STDIN_ID);
+    fd_table_set(table, 1, STDOUT_ID);
+    fd_table_set(table, 2, STDERR_ID);
+    return table;
+}
+
+/**
+ * copies the fds in use of \p table; `ids` of unused fds are left uninitialized
+ * @param table the table to copy
+ * @return the copy, with one reference
+ */
+fd_table_t *fd_table_copy(fd_table_t *table)
+{
+    fd_table_t *copy = malloc(sizeof(fd_table_t));
+    copy->refs = 1;
+    for (int i = 0; i < FD_WORDS; i++)
+    {
+        copy->used[i] = table->used[i];
+    }
+    for (int fd = fd_table_next_used(table, 0); fd != -1; fd = fd_table_next_used(table, fd + 1))
+    {
+        copy->ids[fd] = table->ids[fd];
+    }
+    return copy;
+}
+
+/**
+ * gets the file id of \p fd in \p table
+ * @param table the table
+ * @param fd the file descriptor
+ * @return the file id, or `NOFILE` if \p fd is out of range or not in use
+ */
+int fd_table_get(fd_table_t *table, int fd)
+{
+    if (fd < 0 || fd >= MAX_FDS || (table->used[fd / FD_WORD_BITS] & (1ULL << (fd % FD_WORD_BITS))) == 0)
+    {
+        return NOFILE;
+    }
+    return table->ids[fd];
+}
+
+/**
+ * sets the file id of \p fd in \p table, marking it in use
+ * @param table the table, not shared
+ * @param fd the file descriptor
+ * @param id the file id
+ * @return none
+ */
+void fd_table_set(fd_table_t *table, int fd, int id)
+{
+    table->used[fd / FD_WORD_BITS] |= 1ULL << (fd % FD_WORD_BITS);
+    table->ids[fd] = id;
+}
+
+/**
+ * marks \p fd unused in \p table
+ * @param table the table, not shared
+ * @param fd the file descriptor
+ * @return none
+ */
+void fd_table_clear(fd_table_t *table, int fd)
+{
+    table->used[fd / FD_WORD_BITS] &= ~(1ULL << (fd % FD_WORD_BITS));
+}
+
+/**
+ * finds the lowest unused fd from \p from on, skipping full words of the bitmap
+ * @param table the table
+ * @param from the lowest fd to consider
+ * @return the fd, or `-1` if all fds from \p from on are in use
+ */
+int fd_table_first_unused(fd_table_t *table, int from)
+{
+    if (from < 0 || from >= MAX_FDS)
+    {
+        return -1;
+    }
+    int word = from / FD_WORD_BITS;
+    uint64_t free_bits = ~table->used[word] & (~0ULL << (from % FD_WORD_BITS)); // ignore fds below from
+    while (free_bits == 0)
+    {
+        if (++word == FD_WORDS)
+        {
+            return -1;
+        }
+        free_bits = ~table->used[word];
+    }
+    return word * FD_WORD_BITS + __builtin_ctzll(free_bits);
+}
+
+/**
+ * finds the lowest fd in use from \p from on, skipping empty words of the bitmap
+ * @param table the table
+ * @param from the lowest fd to consider
+ * @return the fd, or `-1` if no fd from \p from on is in use
+ */
+int fd_table_next_used(fd_table_t *table, int from)
+{
+    if (from < 0 || from >= MAX_FDS)
+    {
+        return -1;
+    }
+    int word = from / FD_WORD_BITS;
+    uint64_t used_bits = table->used[word] & (~0ULL << (from % FD_WORD_BITS));
+    while (used_bits == 0)
+    {
+        if (++word == FD_WORDS)
+        {
+            return -1;
+        }
+        used_bits = table->used[word];
+    }
+    return word * FD_WORD_BITS + __builtin_ctzll(used_bits);
+}
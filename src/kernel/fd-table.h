@@ -0,0 +1,79 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_FDS 1024
+#define FD_WORD_BITS 64
+#define FD_WORDS (MAX_FDS / FD_WORD_BITS)
+
+// file ids
+#define NOFILE -1
+#define STDIN_ID -2
+#define STDOUT_ID -3
+#define STDERR_ID -4
+
+typedef struct fd_table
+{
+   int refs;                        // processes sharing the table; it is copied before one of them changes it
+   uint64_t used[FD_WORDS];         // bit `fd` is set if `fd` is in use
+   int ids[MAX_FDS];                // file id of each fd in use (open file description, or a terminal id)
+} fd_table_t;
+
+/**
+ * create an fd table with only F_STDIN, F_STDOUT & F_STDERR in use, to the terminal
+ * @return the table, with one reference
+ */
+fd_table_t *fd_table_create();
+
+/**
+ * copy the fds in use of a table, in time proportional to their number
+ * @param table the table to copy
+ * @return the copy, with one reference
+ */
+fd_table_t *fd_table_copy(fd_table_t *table);
+
+/**
+ * get the file id of a fd
+ * @param table the table
+ * @param fd the file descriptor
+ * @return the file id, or `NOFILE` if `fd` is out of range or not in use
+ */
+int fd_table_get(fd_table_t *table, int fd);
+
+/**
+ * set the file id of a fd, marking it in use
+ * @param table the table, not shared
+ * @param fd the file descriptor
+ * @param id the file id
+ * @return none
+ */
+void fd_table_set(fd_table_t *table, int fd, int id);
+
+/**
+ * mark a fd unused
+ * @param table the table, not shared
+ * @param fd the file descriptor
+ * @return none
+ */
+void fd_table_clear(fd_table_t *table, int fd);
+
+/**
+ * find the lowest unused fd from \p from on, a word of the bitmap at a time
+ * @param table the table
+ * @param from the lowest fd to consider
+ * @return the fd, or `-1` if all fds from \p from on are in use
+ */
+int fd_table_first_unused(fd_table_t *table, int from);
+
+/**
+ * find the lowest fd in use from \p from on, to iterate over the fds in use:
+ * `for (int fd = fd_table_next_used(t, 0); fd != -1; fd = fd_table_next_used(t, fd + 1))`
+ * @param table the table
+ * @param from the lowest fd to consider
+ * @return the fd, or `-1` if no fd from \p from on is in use
+ */
+int fd_table_next_used(fd_table_t *table, int from);
+
+#endif // FD_TABLE_H
@@ -1,8 +1,13 @@
 
 #include "PCB.h"
 #include "kernel-functions.h"
+#include "wait-queue.h"
+#include "shm.h"
+#include "sync.h"
+#include "scheduler.h"
 #include "../logger/logger.h"
 #include "../util/globals.h"
+#include "../filesystem/filesystem.h"
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
@@ -25,56 +30,304 @@ PCB *k_process_create(PCB *parent)
     return child;
 }
 
+wait_queue_t child_exits = WAIT_QUEUE_INITIALIZER;
+
+/**
+ * returns the index of \p signal in a PCB's `sig_handlers`
+ * @param signal a kernel signal
+ * @return the index, or -1 if \p signal isn't a kernel signal
+ */
+int k_signal_index(int signal)
+{
+    int bit = S_BIT(signal);
+    return (bit == 0) ? -1 : __builtin_ctz(bit);
+}
+
+/**
+ * returns the kernel signal whose index in a PCB's `sig_handlers` is \p index
+ * @param index the index
+ * @return the signal
+ */
+static int signal_at(int index)
+{
+    static const int signals[S_NSIG] = { S_SIGSTOP, S_SIGCONT, S_SIGTERM, S_SIGCHLD, S_SIGALRM };
+    return signals[index];
+}
+
+/**
+ * terminates PCB \p process (the default action of S_SIGTERM) & closes its files; if \p process
+ * is the current PCB, like p_exit it never runs again, so this doesn't return
+ * @param process pointer of PCB to terminate
+ * @return none
+ */
+static void terminate(PCB *process)
+{
+    k_mutex_wait_cancel(process); // no longer waiting for anything
+    k_mutex_release_all(process); // nor holding up anyone
+    k_wait_cancel(process);
+    k_timer_disarm(&process->alarm);
+    k_shm_detach_all(process);
+    process_close_fds(process); // readers of its pipes see EOF
+    process->status = T_ZOMBIED;
+    log_zombie_event(process->pid, process->priority, process->name);
+    k_wake_all(&child_exits);
+    k_notify_parent(process);
+
+    PCB *parent = findPCBByPID(process->parent_pid);
+    if (parent != NULL && parent->status == T_WAITED)
+    { // as in p_exit, a parent blocked in p_waitpid checks its children again
+        parent->status = T_RUNNING;
+        log_continued_event(parent->pid, parent->priority, parent->name);
+    }
+
+    for (int i = 0; i < process->numChildren; i++)
+    {
+        PCB *curr = findPCBByPID(process->children[i]);
+        log_orphan_event(curr->pid, curr->priority, curr->name);
+    }
+        // removePCBFromList(&pcb_list, process);
+
+    if (process == current_pcb)
+    { // terminated by a signal it unblocked, or stopped handling, itself
+        sigset_t prev_mask;
+        k_block_alarm(&prev_mask);
+        setcontext(&schedulerContext);
+    }
+}
+
+/**
+ * takes the default action of signal \p signal on PCB \p process
+ * @param process pointer of PCB the signal was sent to
+ * @param signal the signal
+ * @return none
+ */
+void k_signal_default(PCB *process, int signal)
+{
+    if (signal == S_SIGTERM)
+    {
+        terminate(process);
+    }
+    else if (signal == S_SIGALRM)
+    {
+        k_wait_interrupt(process); // a poll or sleep in progress returns to see it
+    }
+    // S_SIGSTOP & S_SIGCONT act when they are sent; S_SIGCHLD is ignored
+}
+
+/**
+ * makes signal \p signal pending for PCB \p process if it has a handler for it or blocks it, and
+ * takes its default action otherwise; a signal that is already pending is not queued again
+ * @param process pointer of PCB to send signal to
+ * @param signal the signal
+ * @return none
+ */
+static void post(PCB *process, int signal)
+{
+    int index = k_signal_index(signal);
+    if (index < 0)
+    { // not a kernel signal; senders check first
+        return;
+    }
+    p_sighandler_t handler = process->sig_handlers[index];
+    if (handler == P_SIG_IGN)
+    {
+        return;
+    }
+    if (handler == P_SIG_DFL && !(process->sig_blocked & S_BIT(signal)))
+    {
+        k_signal_default(process, signal);
+        return;
+    }
+    process->sig_pending |= S_BIT(signal);
+    if (!(process->sig_blocked & S_BIT(signal)))
+    { // delivered the next time the process is scheduled
+        k_wait_interrupt(process);
+    }
+}
+
 /**
- * sends signal \p signal to inputted PCB \p process
+ * sends signal \p signal to inputted PCB \p process; S_SIGSTOP & S_SIGCONT stop & continue it
+ * right away, while other signals are handled by the process on its next schedule if it
+ * registered a handler with p_signal, and take their default action (S_SIGTERM terminates it)
+ * otherwise
  * @param process pointer of PCB to send signal to
  * @param signal signal to send
- * @return 0 on success; 1 on failure
+ * @return 0 on success; -1 on failure
  */
 int k_process_kill(PCB *process, int signal)
 {
     
-    if (process == NULL)
+    if (process == NULL || S_BIT(signal) == 0)
     {
         return -1;
     }
     log_signaled_event(process->pid, process->priority, process->name);
-    if (signal == S_SIGTERM)
+    if (process->status == T_ZOMBIED)
     {
-        process->status = T_ZOMBIED;
-        log_zombie_event(process->pid, process->priority, process->name);
-
-        for (int i = 0; i < process->numChildren; i++)
-        {
-            PCB *curr = findPCBByPID(process->children[i]);
-            log_orphan_event(curr->pid, curr->priority, curr->name);
-        }
-            // removePCBFromList(&pcb_list, process);
         return 0;
     }
-    else if (signal == S_SIGSTOP)
-    {
+    if (signal == S_SIGSTOP)
+    { // can't be handled or blocked
         process->status = T_STOPPED;
         log_stopped_event(process->pid, process->priority, process->name);
+        k_notify_parent(process);
         return 0;
     }
-    else if (signal == S_SIGCONT)
-    {
+    if (signal == S_SIGCONT)
+    { // continues the process even if it handles or blocks the signal
         process->status = T_RUNNING;
         log_continued_event(process->pid, process->priority, process->name);
-        return 0;
+        k_notify_parent(process);
     }
-    else if (signal == S_SIGCHLD)
+    else if (signal == S_SIGALRM)
     {
-        k_process_kill(process, S_SIGCONT);
-        return 0;
+        process->alarms++;
     }
-    else
+    post(process, signal);
+    return 0;
+}
+
+/**
+ * sends S_SIGCHLD to the parent of PCB \p child, after \p child exited, stopped, or continued;
+ * not logged, & coalesced with an S_SIGCHLD the parent has pending, so a parent that handles it
+ * runs its handler once for any number of changes
+ * @param child pointer of the PCB that changed state
+ * @return none
+ */
+void k_notify_parent(PCB *child)
+{
+    PCB *parent = findPCBByPID(child->parent_pid);
+    if (parent != NULL && parent->status != T_ZOMBIED)
     {
-        return -1;
+        post(parent, S_SIGCHLD);
+    }
+}
+
+/**
+ * sets the handler of signal \p signal for PCB \p process; a pending signal that is now ignored
+ * is dropped, & one that now has its default action takes it unless it is blocked
+ * @param process pointer of the PCB
+ * @param signal the signal, which must not be S_SIGSTOP
+ * @param handler the handler, P_SIG_DFL, or P_SIG_IGN
+ * @return the previous handler, or P_SIG_ERR if \p signal can't be handled
+ */
+p_sighandler_t k_signal_set_handler(PCB *process, int signal, p_sighandler_t handler)
+{
+    int index = k_signal_index(signal);
+    if (index < 0 || signal == S_SIGSTOP)
+    {
+        return P_SIG_ERR;
+    }
+    p_sighandler_t prev = process->sig_handlers[index];
+    process->sig_handlers[index] = handler;
+    if ((handler == P_SIG_DFL || handler == P_SIG_IGN) && (process->sig_pending & S_BIT(signal)))
+    {
+        if (handler == P_SIG_IGN || !(process->sig_blocked & S_BIT(signal)))
+        {
+            process->sig_pending &= ~S_BIT(signal);
+        }
+        if (handler == P_SIG_DFL && !(process->sig_blocked & S_BIT(signal)))
+        {
+            k_signal_default(process, signal);
+        }
     }
+    return prev;
 }
 
+/**
+ * sets the blocked signals of PCB \p process to \p mask (S_SIGSTOP can't be blocked); pending
+ * signals that are unblocked take their default action now if they have no handler, & are
+ * handled on the process's next schedule otherwise
+ * @param process pointer of the PCB
+ * @param mask the signals to block, as S_BIT bits
+ * @return none
+ */
+void k_signal_set_blocked(PCB *process, int mask)
+{
+    int unblocked = process->sig_blocked & ~mask;
+    process->sig_blocked = mask & ~S_BIT(S_SIGSTOP);
+    for (int index = 0; index < S_NSIG; index++)
+    {
+        int bit = 1 << index;
+        if ((unblocked & process->sig_pending & bit) && process->sig_handlers[index] == P_SIG_DFL)
+        {
+            process->sig_pending &= ~bit;
+            k_signal_default(process, signal_at(index));
+        }
+    }
+    if (unblocked & process->sig_pending)
+    {
+        k_wait_interrupt(process);
+    }
+}
+
+/**
+ * runs the current PCB's handlers for its deliverable signals on its signal stack, with SIGALRM
+ * unblocked so that handlers can be preempted, then returns (through `uc_link`) to the context
+ * the PCB was interrupted in; each handler runs with its own signal blocked
+ * @return none
+ */
+static void run_handlers(void)
+{
+    PCB *pcb = current_pcb;
+    sigset_t alarm_mask;
+    sigemptyset(&alarm_mask);
+    sigaddset(&alarm_mask, SIGALRM);
+
+    int deliverable;
+    while ((deliverable = pcb->sig_pending & ~pcb->sig_blocked) != 0)
+    {
+        int index = __builtin_ctz(deliverable);
+        pcb->sig_pending &= ~(1 << index);
+        p_sighandler_t handler = pcb->sig_handlers[index];
+        if (handler == P_SIG_DFL || handler == P_SIG_IGN)
+        { // the handler was removed while the signal was pending
+            if (handler == P_SIG_DFL)
+            {
+                k_signal_default(pcb, signal_at(index));
+            }
+            continue;
+        }
+
+        int blocked = pcb->sig_blocked;
+        pcb->sig_blocked |= 1 << index;
+        sigprocmask(SIG_UNBLOCK, &alarm_mask, NULL);
+        handler(signal_at(index));
+        sigprocmask(SIG_BLOCK, &alarm_mask, NULL);
+        pcb->sig_blocked = blocked;
+    }
+
+    pcb->context = pcb->sig_return;
+    pcb->sig_return = NULL;
+}
+
+/**
+ * makes PCB \p process run its signal handlers before resuming, if it has a deliverable signal;
+ * called by the scheduler with SIGALRM blocked, right before switching to \p process
+ * @param process pointer of the PCB about to run
+ * @return none
+ */
+void k_signal_prepare(PCB *process)
+{
+    if (process->sig_return != NULL || process->sig_context == NULL || process->waits != NULL ||
+        (process->sig_pending & ~process->sig_blocked) == 0)
+    { // already running its handlers, continued in the middle of a wait, or nothing to deliver
+        return;
+    }
+
+    ucontext_t *handlers = process->sig_context;
+    getcontext(handlers);
+    handlers->uc_stack.ss_sp = process->sig_stack;
+    handlers->uc_stack.ss_size = STACKSIZE;
+    handlers->uc_stack.ss_flags = 0;
+    sigemptyset(&handlers->uc_sigmask);
+    sigaddset(&handlers->uc_sigmask, SIGALRM);
+    handlers->uc_link = process->context;
+    makecontext(handlers, run_handlers, 0);
+
+    process->sig_return = process->context;
+    process->context = handlers;
+}
 
 /**
  * frees PCB \p process and all of its descendants
@@ -97,7 +350,7 @@ void k_process_deep_cleanup(PCB *process)
 }
 
 /**
- * frees PCB \p process
+ * frees PCB \p process, detaching it from its shared memory regions
  * @param process pointer of PCB to be freed
  * @return none
  */
@@ -105,7 +358,36 @@ void k_process_cleanup(PCB *process)
 {
     if (process != NULL)
     {
+        k_shm_detach_all(process);
         process->status = T_ZOMBIED;
         removePCBFromList(&pcb_list, process);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * sends S_SIGALRM to PCB \p process when its alarm timer expires
+ * @param process pointer of the PCB whose alarm expired
+ * @return none
+ */
+void k_alarm_expire(PCB *process)
+{
+    k_process_kill(process, S_SIGALRM);
+}
+
+/**
+ * checks whether PCB \p process has a child that has exited & not been waited for
+ * @param process pointer of the parent PCB
+ * @return true if a child of \p process is a zombie
+ */
+bool k_has_exited_child(PCB *process)
+{
+    for (int i = 0; i < process->numChildren; i++)
+    {
+        PCB *child = findPCBByPID(process->children[i]);
+        if (child != NULL && child->status == T_ZOMBIED)
+        {
+            return true;
+        }
+    }
+    return false;
+}
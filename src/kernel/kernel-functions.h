@@ -2,11 +2,26 @@
 #define KERNEL_FUNCTIONS_H
 
 #include "PCB.h" // Include PCB.h for PCB structure and functions
+#include "wait-queue.h"
+
+extern wait_queue_t child_exits; // processes polling for a child's exit
+
+#define P_SIG_DFL ((p_sighandler_t) 0)  // p_signal handler: take the signal's default action
+#define P_SIG_IGN ((p_sighandler_t) 1)  // p_signal handler: ignore the signal
+#define P_SIG_ERR ((p_sighandler_t) -1) // returned by p_signal on failure
 
 // Function prototypes
 PCB *k_process_create(PCB *parent);
 int k_process_kill(PCB *process, int signal);
 void k_process_deep_cleanup(PCB *process);
 void k_process_cleanup(PCB *process);
+bool k_has_exited_child(PCB *process);
+void k_alarm_expire(PCB *process);
+int k_signal_index(int signal);
+void k_signal_default(PCB *process, int signal);
+void k_notify_parent(PCB *child);
+void k_signal_prepare(PCB *process);
+p_sighandler_t k_signal_set_handler(PCB *process, int signal, p_sighandler_t handler);
+void k_signal_set_blocked(PCB *process, int mask);
 
 #endif // KERNEL_FUNCTIONS_H
\ No newline at end of file
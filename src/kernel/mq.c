@@ -0,0 +1,201 @@
+#include "mq.h"
+#include <stdlib.h>
+#include <string.h>
+
+mq_t *mqs = NULL; // every queue with at least one reference
+
+/**
+ * finds the queue named \p name in `mqs`
+ * @param name the queue's name
+ * @return the queue, or `NULL` if there is none with that name
+ */
+mq_t *k_mq_find(const char *name)
+{
+    for (mq_t *curr = mqs; curr != NULL; curr = curr->next)
+    {
+        if (strcmp(curr->name, name) == 0)
+        {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * frees \p mq & its slots, without unlinking it from `mqs`
+ * @param mq the queue
+ * @return none
+ */
+static void mq_free(mq_t *mq)
+{
+    free(mq->slots);
+    free(mq->lens);
+    free(mq->links);
+    free(mq);
+}
+
+/**
+ * creates an empty queue named \p name, with every slot in the free list, & adds it to `mqs`
+ * @param name the queue's name
+ * @param capacity messages the queue holds
+ * @param msg_size longest message, in bytes
+ * @return the queue, or `NULL` if it could not be allocated
+ */
+mq_t *k_mq_create(const char *name, int capacity, int msg_size)
+{
+    mq_t *mq = calloc(1, sizeof(mq_t));
+    if (mq == NULL)
+    {
+        return NULL;
+    }
+    mq->slots = malloc((size_t) capacity * msg_size);
+    mq->lens = malloc(capacity * sizeof(int));
+    mq->links = malloc(capacity * sizeof(int));
+    if (mq->slots == NULL || mq->lens == NULL || mq->links == NULL)
+    {
+        mq_free(mq);
+        return NULL;
+    }
+    strncpy(mq->name, name, MQ_NAME_SIZE - 1);
+    mq->name[MQ_NAME_SIZE - 1] = '\0';
+    mq->capacity = capacity;
+    mq->msg_size = msg_size;
+    for (int slot = 0; slot < capacity; slot++)
+    {
+        mq->links[slot] = (slot + 1 < capacity) ? slot + 1 : -1;
+    }
+    mq->free = 0;
+    for (int priority = 0; priority < MQ_PRIORITIES; priority++)
+    {
+        mq->heads[priority] = mq->tails[priority] = -1;
+    }
+    mq->refs = 1;
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    mq->next = mqs;
+    mqs = mq;
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return mq;
+}
+
+/**
+ * wakes up to \p n processes in \p queue, one for each message sent or slot freed
+ * @return none
+ */
+static void wake(wait_queue_t *queue, int n)
+{
+    for (int i = 0; i < n && k_wake_one(queue) != NULL; i++)
+    {
+        // each woken process checks the queue again when it runs
+    }
+}
+
+/**
+ * copies each message into a free slot at the tail of its priority's list, blocking while there
+ * is no free slot; receivers are woken once for each run of messages that fit
+ * @param mq the queue
+ * @param msgs the messages
+ * @param n number of messages
+ * @return none
+ */
+void k_mq_send(mq_t *mq, const mq_msg_t msgs[], int n)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    int sent = 0;
+    while (sent < n)
+    {
+        if (mq->free == -1)
+        {
+            k_wait(&mq->senders);
+            continue;
+        }
+        int queued = 0;
+        for (; sent < n && mq->free != -1; sent++, queued++)
+        {
+            const mq_msg_t *msg = &msgs[sent];
+            int slot = mq->free;
+            mq->free = mq->links[slot];
+            memcpy(mq->slots + (size_t) slot * mq->msg_size, msg->data, msg->len);
+            mq->lens[slot] = msg->len;
+            mq->links[slot] = -1;
+            if (mq->tails[msg->priority] == -1)
+            {
+                mq->heads[msg->priority] = slot;
+            }
+            else
+            {
+                mq->links[mq->tails[msg->priority]] = slot;
+            }
+            mq->tails[msg->priority] = slot;
+            mq->count++;
+        }
+        wake(&mq->receivers, queued);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * takes up to \p n messages from the heads of the priority lists, highest priority first,
+ * blocking while the queue is empty; senders are woken once for the slots freed
+ * @param mq the queue
+ * @param msgs set to the messages
+ * @param n most messages to receive
+ * @return number of messages received
+ */
+int k_mq_recv(mq_t *mq, mq_msg_t msgs[], int n)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    while (mq->count == 0)
+    {
+        k_wait(&mq->receivers);
+    }
+
+    int received = 0;
+    for (int priority = MQ_PRIORITIES - 1; priority >= 0 && received < n; priority--)
+    {
+        while (mq->heads[priority] != -1 && received < n)
+        {
+            mq_msg_t *msg = &msgs[received++];
+            int slot = mq->heads[priority];
+            mq->heads[priority] = mq->links[slot];
+            if (mq->heads[priority] == -1)
+            {
+                mq->tails[priority] = -1;
+            }
+            memcpy(msg->data, mq->slots + (size_t) slot * mq->msg_size, mq->lens[slot]);
+            msg->len = mq->lens[slot];
+            msg->priority = priority;
+            mq->links[slot] = mq->free;
+            mq->free = slot;
+            mq->count--;
+        }
+    }
+    wake(&mq->senders, received);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return received;
+}
+
+/**
+ * drops a reference to \p mq; with the last one, unlinks it from `mqs` & frees it
+ * @param mq the queue
+ * @return none
+ */
+void k_mq_close(mq_t *mq)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    if (--mq->refs == 0)
+    {
+        mq_t **link = &mqs;
+        while (*link != mq)
+        {
+            link = &(*link)->next;
+        }
+        *link = mq->next;
+        mq_free(mq);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
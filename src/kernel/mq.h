@@ -0,0 +1,79 @@
+#ifndef MQ_H
+#define MQ_H
+
+#include <stdbool.h>
+#include "wait-queue.h"
+
+#define MQ_NAME_SIZE 32   // longest queue name, including the null terminator
+#define MQ_PRIORITIES 8   // message priorities are 0 (the default) to MQ_PRIORITIES - 1, highest received first
+
+typedef struct mq
+{
+   char name[MQ_NAME_SIZE];         // name that processes open the queue by
+   int capacity;                    // messages the queue holds before senders block
+   int msg_size;                    // longest message, in bytes
+   char *slots;                     // `capacity` slots of `msg_size` bytes
+   int *lens;                       // length of the message in each slot
+   int *links;                      // next slot in the same priority list, or in the free list; -1 at the end
+   int heads[MQ_PRIORITIES];        // oldest message of each priority, or -1
+   int tails[MQ_PRIORITIES];        // newest message of each priority, or -1
+   int free;                        // first free slot, or -1 if the queue is full
+   int count;                       // messages queued
+   int refs;                        // open file descriptions of the queue
+   wait_queue_t senders;            // processes blocked until there is room
+   wait_queue_t receivers;          // processes blocked until there is a message
+   struct mq *next;                 // next queue in `mqs`
+} mq_t;
+
+typedef struct mq_msg
+{
+   void *data;                      // the message, or the buffer to receive it into
+   int len;                         // bytes in the message
+   int priority;                    // 0 to MQ_PRIORITIES - 1
+} mq_msg_t;
+
+/**
+ * find a message queue by name
+ * @param name the queue's name
+ * @return the queue, or `NULL` if there is none with that name
+ */
+mq_t *k_mq_find(const char *name);
+
+/**
+ * create an empty message queue with one reference
+ * @param name the queue's name, which must not be taken
+ * @param capacity messages the queue holds before senders block
+ * @param msg_size longest message, in bytes
+ * @return the queue, or `NULL` if it could not be allocated
+ */
+mq_t *k_mq_create(const char *name, int capacity, int msg_size);
+
+/**
+ * send messages, each in one piece, blocking while the queue is full; as many messages as fit
+ * are queued before any receiver is woken
+ * @param mq the queue
+ * @param msgs the messages, no longer than the queue's message size
+ * @param n number of messages
+ * @return none
+ */
+void k_mq_send(mq_t *mq, const mq_msg_t msgs[], int n);
+
+/**
+ * receive up to \p n messages, highest priority first & in the order they were sent within a
+ * priority, blocking while the queue is empty
+ * @param mq the queue
+ * @param msgs set to the messages; each `data` is a buffer of at least the queue's message size
+ * @param n most messages to receive
+ * @return number of messages received, at least 1
+ */
+int k_mq_recv(mq_t *mq, mq_msg_t msgs[], int n);
+
+/**
+ * drop a reference to a message queue; the queue & the messages in it are freed, & its name
+ * can be reused, with its last reference
+ * @param mq the queue
+ * @return none
+ */
+void k_mq_close(mq_t *mq);
+
+#endif // MQ_H
@@ -0,0 +1,124 @@
+#include "pipe.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+/**
+ * creates a pipe with one read end & one write end open
+ * @return the pipe, or `NULL` if it could not be allocated
+ */
+pipe_t *k_pipe_create()
+{
+    pipe_t *pipe = malloc(sizeof(pipe_t));
+    if (pipe == NULL)
+    {
+        return NULL;
+    }
+    pipe->buffer = malloc(PIPE_SIZE);
+    if (pipe->buffer == NULL)
+    {
+        free(pipe);
+        return NULL;
+    }
+    pipe->head = 0;
+    pipe->count = 0;
+    pipe->n_readers = 1;
+    pipe->n_writers = 1;
+    pipe->readers = (wait_queue_t) WAIT_QUEUE_INITIALIZER;
+    pipe->writers = (wait_queue_t) WAIT_QUEUE_INITIALIZER;
+    return pipe;
+}
+
+/**
+ * reads from \p pipe, blocking while it is empty & a write end is still open;
+ * the bytes are copied out of the ring buffer in at most two pieces
+ * @param pipe the pipe
+ * @param buf buffer to read into
+ * @param n most bytes to read
+ * @return number of bytes read, or `0` at EOF
+ */
+int k_pipe_read(pipe_t *pipe, char *buf, int n)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    while (pipe->count == 0 && pipe->n_writers > 0)
+    {
+        k_wait(&pipe->readers);
+    }
+
+    int bytes = MIN(n, pipe->count);
+    int first = MIN(bytes, PIPE_SIZE - pipe->head); // up to the end of the buffer
+    memcpy(buf, pipe->buffer + pipe->head, first);
+    memcpy(buf + first, pipe->buffer, bytes - first);
+    pipe->head = (pipe->head + bytes) % PIPE_SIZE;
+    pipe->count -= bytes;
+    if (bytes > 0)
+    {
+        k_wake_all(&pipe->writers);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return bytes;
+}
+
+/**
+ * writes all of \p buf to \p pipe, filling the free space of the ring buffer & blocking while
+ * it is full, until everything is written or the last read end is closed
+ * @param pipe the pipe
+ * @param buf the data
+ * @param n number of bytes to write
+ * @return number of bytes written, or `-1` if no read end was open before anything was written
+ */
+int k_pipe_write(pipe_t *pipe, const char *buf, int n)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    int written = 0;
+    while (written < n && pipe->n_readers > 0)
+    {
+        if (pipe->count == PIPE_SIZE)
+        {
+            k_wait(&pipe->writers);
+            continue;
+        }
+        int tail = (pipe->head + pipe->count) % PIPE_SIZE;
+        int bytes = MIN(n - written, PIPE_SIZE - pipe->count);
+        int first = MIN(bytes, PIPE_SIZE - tail); // up to the end of the buffer
+        memcpy(pipe->buffer + tail, buf + written, first);
+        memcpy(pipe->buffer, buf + written + first, bytes - first);
+        pipe->count += bytes;
+        written += bytes;
+        k_wake_all(&pipe->readers);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return (written == 0 && n > 0) ? -1 : written;
+}
+
+/**
+ * closes one end of \p pipe & wakes the other end, which sees EOF or a closed pipe once the
+ * last end of this side is gone; frees the pipe once both sides are closed
+ * @param pipe the pipe
+ * @param write_end `true` to close a write end, `false` to close a read end
+ * @return none
+ */
+void k_pipe_close(pipe_t *pipe, bool write_end)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    if (write_end)
+    {
+        pipe->n_writers--;
+        k_wake_all(&pipe->readers);
+    }
+    else
+    {
+        pipe->n_readers--;
+        k_wake_all(&pipe->writers);
+    }
+    if (pipe->n_readers == 0 && pipe->n_writers == 0)
+    {
+        free(pipe->buffer);
+        free(pipe);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
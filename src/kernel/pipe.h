@@ -0,0 +1,54 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <stdbool.h>
+#include "wait-queue.h"
+
+#define PIPE_SIZE (64 * 1024) // bytes buffered in a pipe before writers block
+
+typedef struct pipe
+{
+   char *buffer;                    // ring buffer of PIPE_SIZE bytes
+   int head;                        // index of the first unread byte
+   int count;                       // bytes buffered
+   int n_readers;                   // open read ends
+   int n_writers;                   // open write ends
+   wait_queue_t readers;            // processes blocked until there is data or EOF
+   wait_queue_t writers;            // processes blocked until there is room
+} pipe_t;
+
+/**
+ * create a pipe with one read end & one write end open
+ * @return the pipe, or `NULL` if it could not be allocated
+ */
+pipe_t *k_pipe_create();
+
+/**
+ * read from a pipe, blocking while it is empty & a write end is still open
+ * @param pipe the pipe
+ * @param buf buffer to read into
+ * @param n most bytes to read
+ * @return number of bytes read, or `0` at EOF (empty & no write end open)
+ */
+int k_pipe_read(pipe_t *pipe, char *buf, int n);
+
+/**
+ * write all of \p buf to a pipe, blocking while it is full
+ * @param pipe the pipe
+ * @param buf the data
+ * @param n number of bytes to write
+ * @return number of bytes written, which is less than \p n only if the last read end was closed;
+ * `-1` if no read end was open before anything was written
+ */
+int k_pipe_write(pipe_t *pipe, const char *buf, int n);
+
+/**
+ * close one end of a pipe, waking the processes blocked on the other end; the pipe is freed
+ * once both of its ends are closed
+ * @param pipe the pipe
+ * @param write_end `true` to close a write end, `false` to close a read end
+ * @return none
+ */
+void k_pipe_close(pipe_t *pipe, bool write_end);
+
+#endif // PIPE_H
@@ -1,5 +1,9 @@
 #include "kernel-functions.h"
 #include "scheduler.h"
+#include "pipe.h"
+#include "shm.h"
+#include "sync.h"
+#include "mq.h"
 #include "../filesystem/filesystem.h"
 #include "../logger/logger.h"
 #include "../util/globals.h"
@@ -33,24 +37,9 @@ int p_spawn(void (*func)(), char *argv[], int fd0, int fd1)
         return -1;
     }
 
-    // TODO: does this work?
-    // I think this is all we need for I/O redirection, but this seems a little too simple
-    child->fileDescriptors[F_STDIN] = child->fileDescriptors[fd0];
-    child->fileDescriptors[F_STDOUT] = child->fileDescriptors[fd1];
-
-    // TODO: if possible, get around this hack;
-    // basically the child needs write perms but only one process can open a file
-    // in write mode currently; so we pass write perms from the parent to the child
-    // if there's IO redirection and the parent has write perms
-    int output_fid = child->fileDescriptors[F_STDOUT];
-    if (output_fid >= 0)
-    {
-        file_t *file_entry = find_file_entry_by_file_id(output_fid);
-        file_entry->wr_pid = child->pid;
-    }
-
-    // update open files list to include child's pid
-    process_create_fileptrs(child);
+    // the child shares the parent's fds until either opens or closes a file; if its output
+    // is redirected to a writable file, write access is passed from the parent to the child
+    process_copy_fds(child, fd0, fd1);
       
     int argc = 0;
     while (argv != NULL && argv[argc] != NULL)
@@ -90,6 +79,7 @@ int p_spawn(void (*func)(), char *argv[], int fd0, int fd1)
         child->name = NULL;
     }
     child->priority = 0;
+    child->base_priority = 0;
 
     log_create_event(child->pid, child->priority, child->name);
     return child->pid;
@@ -119,7 +109,7 @@ pid_t p_waitpid(pid_t pid, int *wstatus, bool nohang)
             log_blocked_event(current_pcb->pid, current_pcb->priority, current_pcb->name);
              
              if(current_pcb->numChildren==0){
-                
+                current_pcb->status = T_RUNNING;
                 return -1;
              }
 
@@ -132,6 +122,7 @@ pid_t p_waitpid(pid_t pid, int *wstatus, bool nohang)
                     if (curr!=NULL && curr->status == T_ZOMBIED)
                     {   
                      
+                        current_pcb->status = T_RUNNING; // already exited, so don't stay waiting
                         log_unblocked_event(current_pcb->pid, current_pcb->priority, current_pcb->name);
                         if(wstatus!=NULL){
                         *wstatus = curr->status;
@@ -252,6 +243,8 @@ pid_t p_waitpid(pid_t pid, int *wstatus, bool nohang)
             
             if (child->status == T_ZOMBIED)
             { 
+                current_pcb->status = T_RUNNING; // already exited, so don't stay waiting
+                log_unblocked_event(current_pcb->pid, current_pcb->priority, current_pcb->name);
                 if(wstatus!=NULL){
                   *wstatus = child->status;
                 }
@@ -283,7 +276,7 @@ pid_t p_waitpid(pid_t pid, int *wstatus, bool nohang)
 }
 
 /**
- * sends signal \p sig to PCB with pid \p pid
+ * sends signal \p sig to PCB with pid \p pid; see \ref p_signal for how signals are handled
  * @param pid pid of PCB to send signal to
  * @param sig signal to send
  * @return 0 on sucess; -1 on failure
@@ -297,13 +290,17 @@ int p_kill(pid_t pid, int sig)
         ERRNO = ERR_P_KILL_NULL_PROCESS;
         return -1;
     }
-    process_delete_fileptrs(process);
-    k_process_kill(process, sig);
+    if (k_process_kill(process, sig) == -1) // takes a terminated process off any wait queue first
+    {
+        ERRNO = ERR_P_KILL_INVALID_SIGNAL;
+        return -1;
+    }
     return 0;
 }
 
 /**
- * changes priority of PCB with pid \p pid to inputted priority \p priority
+ * changes priority of PCB with pid \p pid to inputted priority \p priority; while the PCB holds a
+ * mutex that a higher priority PCB waits for, it keeps running at the waiter's priority
  * @param pid pid of PCB to change priority of
  * @param priority priority to change to
  * @return 0 on sucess; -1 on failure
@@ -311,42 +308,651 @@ int p_kill(pid_t pid, int sig)
 int p_nice(pid_t pid, int priority)
 {
     PCB *process = findPCBByPID(pid);
-    int old = process->priority;
     if (process == NULL) {
         ERRNO = ERR_P_NICE_NULL_PROCESS;
         return -1;
     }
+    int old = process->priority;
 
     removePCBFromList(&pcb_list, process);
     addPCBToList(&pcb_list, process);
 
-    process->priority = priority;
-    log_nice_event(pid, old, process->priority, process->name);
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    process->base_priority = priority;
+    if (!k_inherit_priority(process))
+    { // logged by `k_inherit_priority` if the effective priority changed
+        log_nice_event(pid, old, process->priority, process->name);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
     return 0;
 }
 
 /**
- * blocks current PCB for \p time ticks
+ * blocks current PCB for \p time ticks; it is T_BLOCKED, with its wait timer armed, until then
  * @param time ticks to block for
  * @return none
  */
 void p_sleep(unsigned int time)
 {
-    // TODO: this implementation doesn't match the writeup;
-    // it needs to set the current_pcb status to T_BLOCKED,
-    // then set it to running after some time.
-    // time is in OS ticks
-    PCB *caller = current_pcb;
-    // caller->status = T_BLOCKED;
-    int startTime = ticks;
-    log_blocked_event(caller->pid, caller->priority, caller->name);
-    while (ticks - startTime < time)
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    int deadline = ticks + time;
+    while (ticks < deadline)
+    { // woken early by a signal, or continued after being stopped
+        k_wait_any(NULL, 0, deadline);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * arms the current PCB's timer to send it S_SIGALRM in \p delay ticks and then, if \p interval
+ * is positive, every \p interval ticks; a \p delay of 0 disarms it. S_SIGALRM makes a \ref p_poll
+ * or \ref p_sleep in progress return early; pending timers cost nothing until they expire
+ * @param delay ticks until the first S_SIGALRM, or 0
+ * @param interval ticks between later S_SIGALRM signals, or 0 for only one
+ * @return ticks that were left until the previous timer would have expired (0 if it was not armed) on success; -1 on failure
+ */
+int p_setitimer(int delay, int interval)
+{
+    if (delay < 0 || interval < 0)
+    {
+        ERRNO = ERR_P_SETITIMER_INVALID;
+        return -1;
+    }
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    ktimer_t *alarm = &current_pcb->alarm;
+    int left = k_timer_armed(alarm) ? alarm->expires - ticks : 0;
+    if (delay > 0)
+    {
+        k_timer_arm(alarm, ticks + delay, interval);
+    }
+    else
+    {
+        k_timer_disarm(alarm);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return (left > 0) ? left : 0;
+}
+
+/**
+ * sends the current PCB S_SIGALRM once, in \p delay ticks; replaces any timer set by
+ * \ref p_setitimer, & a \p delay of 0 cancels it
+ * @param delay ticks until S_SIGALRM, or 0
+ * @return ticks that were left on the previous timer (0 if it was not armed) on success; -1 on failure
+ */
+int p_alarm(int delay)
+{
+    return p_setitimer(delay, 0);
+}
+
+/**
+ * creates a pipe; reading \p fds [0] blocks until data is written to \p fds [1], and returns 0 once
+ * every fd for the write end is closed, in any process; spawned processes share the ends they are
+ * given as F_STDIN / F_STDOUT
+ * @param fds set to the fds of the read end and the write end
+ * @return 0 on success; -1 on failure
+ */
+int p_pipe(int fds[2])
+{
+    pipe_t *pipe = k_pipe_create();
+    if (pipe == NULL)
+    {
+        ERRNO = ERR_P_PIPE_NULL_PIPE;
+        return -1;
+    }
+
+    if (process_open_pipe(current_pcb, pipe, fds) == -1)
+    {
+        k_pipe_close(pipe, false);
+        k_pipe_close(pipe, true); // frees the pipe
+        ERRNO = ERR_P_PIPE_NO_FDS;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * creates a zero-filled shared memory region named \p name and attaches the current PCB to it;
+ * other PCBs attach to it by name and get the same address, so buffers are passed by reference
+ * @param name name of the region (at most SHM_NAME_SIZE - 1 characters, not already in use)
+ * @param size bytes in the region
+ * @return address of the region on success; NULL on failure
+ */
+void *p_shm_create(const char *name, size_t size)
+{
+    if (name == NULL || name[0] == '\0' || strlen(name) >= SHM_NAME_SIZE || size == 0)
+    {
+        ERRNO = ERR_P_SHM_CREATE_INVALID;
+        return NULL;
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask); // no other PCB can take the name in between
+    void *addr = NULL;
+    if (k_shm_find(name) != NULL)
+    {
+        ERRNO = ERR_P_SHM_CREATE_EXISTS;
+    }
+    else
+    {
+        addr = k_shm_create(current_pcb, name, size);
+        if (addr == NULL)
+        {
+            ERRNO = ERR_P_SHM_CREATE_NULL_REGION;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return addr;
+}
+
+/**
+ * attaches the current PCB to the shared memory region named \p name
+ * @param name name of the region
+ * @param size if not NULL, set to the size of the region
+ * @return address of the region on success; NULL on failure
+ */
+void *p_shm_attach(const char *name, size_t *size)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    shm_region_t *region = (name == NULL) ? NULL : k_shm_find(name);
+    void *addr = NULL;
+    if (region == NULL)
+    {
+        ERRNO = ERR_P_SHM_ATTACH_NOT_FOUND;
+    }
+    else
+    {
+        addr = k_shm_attach(current_pcb, region);
+        if (addr == NULL)
+        {
+            ERRNO = ERR_P_SHM_ATTACH_NULL_ATTACHMENT;
+        }
+        else if (size != NULL)
+        {
+            *size = region->size;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return addr;
+}
+
+/**
+ * detaches the current PCB from the shared memory region at \p addr; the region is freed (and its
+ * name can be reused) once no PCB is attached to it. PCBs are detached from all of their regions
+ * when they exit or are terminated
+ * @param addr address returned by \ref p_shm_create or \ref p_shm_attach
+ * @return 0 on success; -1 on failure
+ */
+int p_shm_detach(void *addr)
+{
+    if (!k_shm_detach(current_pcb, addr))
+    {
+        ERRNO = ERR_P_SHM_DETACH_NOT_ATTACHED;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * initializes an unlocked mutex; mutexes shared between PCBs go in a shared memory region
+ * @param mutex the mutex
+ * @return none
+ */
+void p_mutex_init(mutex_t *mutex)
+{
+    *mutex = (mutex_t) MUTEX_INITIALIZER;
+}
+
+/**
+ * locks \p mutex; if another PCB holds it, the current PCB is T_BLOCKED (off the run queues) until
+ * the mutex is handed to it, in the order PCBs started waiting. An uncontended lock never enters
+ * the scheduler. A holder that exits or is terminated without unlocking gives the mutex to its
+ * first waiter, or to the next PCB that locks it; the data it protects may then be inconsistent
+ * @param mutex the mutex
+ * @return 0 on success; -1 if the current PCB already holds it
+ */
+int p_mutex_lock(mutex_t *mutex)
+{
+    if (mutex->owner == current_pcb->pid)
+    {
+        ERRNO = ERR_P_MUTEX_LOCK_DEADLOCK;
+        return -1;
+    }
+    k_mutex_lock(mutex);
+    return 0;
+}
+
+/**
+ * locks \p mutex if no PCB holds it
+ * @param mutex the mutex
+ * @return 0 on success; -1 if it is held
+ */
+int p_mutex_trylock(mutex_t *mutex)
+{
+    if (!k_mutex_trylock(mutex))
+    {
+        ERRNO = ERR_P_MUTEX_TRYLOCK_BUSY;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * unlocks \p mutex, handing it to the PCB that has waited longest for it
+ * @param mutex the mutex
+ * @return 0 on success; -1 if the current PCB does not hold it
+ */
+int p_mutex_unlock(mutex_t *mutex)
+{
+    if (mutex->owner != current_pcb->pid)
+    {
+        ERRNO = ERR_P_MUTEX_UNLOCK_NOT_OWNER;
+        return -1;
+    }
+    k_mutex_unlock(mutex);
+    return 0;
+}
+
+/**
+ * initializes a counting semaphore
+ * @param sem the semaphore
+ * @param value initial number of units
+ * @return 0 on success; -1 if \p value is negative
+ */
+int p_sem_init(semaphore_t *sem, int value)
+{
+    if (value < 0)
+    {
+        ERRNO = ERR_P_SEM_INIT_INVALID;
+        return -1;
+    }
+    *sem = (semaphore_t) SEMAPHORE_INITIALIZER(value);
+    return 0;
+}
+
+/**
+ * takes a unit of \p sem; if it has none, the current PCB is T_BLOCKED until a post hands one to
+ * it, in the order PCBs started waiting
+ * @param sem the semaphore
+ * @return none
+ */
+void p_sem_wait(semaphore_t *sem)
+{
+    k_sem_wait(sem);
+}
+
+/**
+ * takes a unit of \p sem if it has one
+ * @param sem the semaphore
+ * @return 0 on success; -1 if it has none
+ */
+int p_sem_trywait(semaphore_t *sem)
+{
+    if (!k_sem_trywait(sem))
+    {
+        ERRNO = ERR_P_SEM_TRYWAIT_BUSY;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * gives a unit to \p sem, waking the PCB that has waited longest for one
+ * @param sem the semaphore
+ * @return none
+ */
+void p_sem_post(semaphore_t *sem)
+{
+    k_sem_post(sem);
+}
+
+/**
+ * initializes a condition variable
+ * @param cond the condition variable
+ * @return none
+ */
+void p_cond_init(cond_t *cond)
+{
+    *cond = (cond_t) COND_INITIALIZER;
+}
+
+/**
+ * unlocks \p mutex and blocks the current PCB on \p cond until it is signalled, then locks \p mutex
+ * again; wakeups may be spurious (e.g. after the PCB is stopped and continued), so callers wait in
+ * a loop that checks their condition
+ * @param cond the condition variable
+ * @param mutex the mutex protecting the condition
+ * @return 0 on success; -1 if the current PCB does not hold \p mutex
+ */
+int p_cond_wait(cond_t *cond, mutex_t *mutex)
+{
+    if (mutex->owner != current_pcb->pid)
+    {
+        ERRNO = ERR_P_COND_WAIT_NOT_OWNER;
+        return -1;
+    }
+    k_cond_wait(cond, mutex);
+    return 0;
+}
+
+/**
+ * wakes the PCB that has waited longest on \p cond, if any
+ * @param cond the condition variable
+ * @return none
+ */
+void p_cond_signal(cond_t *cond)
+{
+    k_cond_signal(cond);
+}
+
+/**
+ * wakes every PCB waiting on \p cond
+ * @param cond the condition variable
+ * @return none
+ */
+void p_cond_broadcast(cond_t *cond)
+{
+    k_cond_broadcast(cond);
+}
+
+/**
+ * opens the message queue named \p name, creating it if it doesn't exist; the queue is read and
+ * written through the returned fd, which is shared with spawned PCBs like any other fd, and is
+ * freed (and its name can be reused) once every fd for it is closed
+ * @param name name of the queue (at most MQ_NAME_SIZE - 1 characters)
+ * @param capacity messages the queue holds before senders block, or 0 to only open an existing queue
+ * @param msg_size longest message in bytes, or 0 to only open an existing queue
+ * @return fd of the queue on success; -1 on failure
+ */
+int p_mq_open(const char *name, int capacity, int msg_size)
+{
+    bool create = (capacity != 0 || msg_size != 0);
+    if (name == NULL || name[0] == '\0' || strlen(name) >= MQ_NAME_SIZE || (create && (capacity < 1 || msg_size < 1)))
+    {
+        ERRNO = ERR_P_MQ_OPEN_INVALID;
+        return -1;
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask); // no other PCB can take the name in between
+    int fd = -1;
+    mq_t *mq = k_mq_find(name);
+    if (mq == NULL && !create)
+    {
+        ERRNO = ERR_P_MQ_OPEN_NOT_FOUND;
+    }
+    else if (mq != NULL && create && (mq->capacity != capacity || mq->msg_size != msg_size))
     {
-        sleep(1);
-        // printf("%d %d\n", ticks, startTime);
+        ERRNO = ERR_P_MQ_OPEN_MISMATCH;
+    }
+    else
+    {
+        if (mq == NULL)
+        {
+            mq = k_mq_create(name, capacity, msg_size);
+        }
+        else
+        {
+            mq->refs++;
+        }
+
+        if (mq == NULL)
+        {
+            ERRNO = ERR_P_MQ_OPEN_NULL_QUEUE;
+        }
+        else if ((fd = process_open_mq(current_pcb, mq)) == -1)
+        {
+            k_mq_close(mq);
+            ERRNO = ERR_P_MQ_OPEN_NO_FDS;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return fd;
+}
+
+/**
+ * sends one message to the queue at \p fd, blocking while the queue is full
+ * @param fd fd of the queue
+ * @param msg the message
+ * @param len bytes in the message, at most the queue's message size
+ * @param priority 0 to MQ_PRIORITIES - 1; higher priority messages are received first
+ * @return 0 on success; -1 on failure
+ */
+int p_mq_send(int fd, const void *msg, int len, int priority)
+{
+    mq_msg_t message = { (void *) msg, len, priority };
+    return (p_mq_send_batch(fd, &message, 1) == -1) ? -1 : 0;
+}
+
+/**
+ * receives one message from the queue at \p fd, blocking while the queue is empty
+ * @param fd fd of the queue
+ * @param buf buffer to receive into
+ * @param size bytes in \p buf, at least the queue's message size
+ * @param priority if not NULL, set to the message's priority
+ * @return length of the message on success; -1 on failure
+ */
+int p_mq_recv(int fd, void *buf, int size, int *priority)
+{
+    mq_msg_t message = { buf, size, 0 };
+    if (p_mq_recv_batch(fd, &message, 1) == -1)
+    {
+        return -1;
+    }
+    if (priority != NULL)
+    {
+        *priority = message.priority;
+    }
+    return message.len;
+}
+
+/**
+ * sends \p n messages to the queue at \p fd in order, blocking while the queue is full; every
+ * message that fits is queued before receivers are woken, so a batch costs one wakeup per
+ * waiting receiver rather than one per message
+ * @param fd fd of the queue
+ * @param msgs the messages, each with its data, length, and priority
+ * @param n number of messages
+ * @return \p n on success; -1 on failure, before anything is sent
+ */
+int p_mq_send_batch(int fd, const mq_msg_t msgs[], int n)
+{
+    mq_t *mq = process_fd_mq(current_pcb, fd);
+    if (mq == NULL)
+    {
+        ERRNO = ERR_P_MQ_SEND_NOT_MQ;
+        return -1;
     }
-    log_unblocked_event(caller->pid, caller->priority, caller->name);
-    // caller->status = T_RUNNING;
+    for (int i = 0; i < n; i++)
+    {
+        if (msgs[i].len < 0 || msgs[i].len > mq->msg_size || msgs[i].priority < 0 || msgs[i].priority >= MQ_PRIORITIES)
+        {
+            ERRNO = ERR_P_MQ_SEND_INVALID;
+            return -1;
+        }
+    }
+    k_mq_send(mq, msgs, n);
+    return n;
+}
+
+/**
+ * receives up to \p n messages from the queue at \p fd, highest priority first, blocking only
+ * while the queue is empty
+ * @param fd fd of the queue
+ * @param msgs buffers to receive into; each `len` is the size of its `data` buffer (at least the
+ * queue's message size), and is set to the length of the message received into it, along with
+ * its `priority`
+ * @param n most messages to receive
+ * @return number of messages received (at least 1) on success; -1 on failure
+ */
+int p_mq_recv_batch(int fd, mq_msg_t msgs[], int n)
+{
+    mq_t *mq = process_fd_mq(current_pcb, fd);
+    if (mq == NULL)
+    {
+        ERRNO = ERR_P_MQ_RECV_NOT_MQ;
+        return -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (msgs[i].len < mq->msg_size)
+        {
+            ERRNO = ERR_P_MQ_RECV_TOO_SMALL;
+            return -1;
+        }
+    }
+    return (n <= 0) ? 0 : k_mq_recv(mq, msgs, n);
+}
+
+/**
+ * waits until at least one of \p fds is ready for one of its events, \p timeout_ticks ticks
+ * pass, or the current PCB is sent S_SIGALRM (see \ref p_setitimer); the current PCB is T_BLOCKED as a poller of each source's wait queue in the meantime, so
+ * an idle event loop uses no CPU. Pipes, message queues, the terminal, and child exit fds (see
+ * \ref p_child_fd) can block; files are always ready
+ * @param fds the fds & the events to wait for; each `revents` is set to the events its fd is ready for
+ * @param n number of fds
+ * @param timeout_ticks ticks to wait at most, 0 to only check the fds, or -1 to wait without a timeout
+ * @return number of ready fds (0 if the timeout passed or an alarm was received) on success; -1 on failure
+ */
+int p_poll(p_pollfd_t fds[], int n, int timeout_ticks)
+{
+    int deadline = (timeout_ticks < 0) ? -1 : ticks + timeout_ticks;
+    int alarms = current_pcb->alarms;
+    wait_queue_t *queues[2 * n + 1];
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask); // no event can be missed between checking & waiting
+    int ready;
+    while (true)
+    {
+        ready = 0;
+        int n_queues = 0;
+        for (int i = 0; i < n && ready != -1; i++)
+        {
+            int added;
+            fds[i].revents = process_poll_fd(current_pcb, fds[i].fd, fds[i].events, &queues[n_queues], &added);
+            if (fds[i].revents == -1)
+            {
+                ERRNO = ERR_P_POLL_BAD_FD;
+                ready = -1;
+            }
+            else if (fds[i].revents != 0)
+            {
+                ready++;
+            }
+            n_queues += added;
+        }
+        if (ready != 0 || timeout_ticks == 0 || (deadline >= 0 && ticks >= deadline) || current_pcb->alarms != alarms)
+        {
+            break;
+        }
+        k_wait_any(queues, n_queues, deadline);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return ready;
+}
+
+/**
+ * opens a child exit fd, which \ref p_poll reports readable (F_POLLIN) while the polling PCB has
+ * a child that has exited and not been waited for; reap it with \ref p_waitpid, then close the fd
+ * with f_close when it is no longer needed
+ * @return the fd on success; -1 on failure
+ */
+int p_child_fd(void)
+{
+    int fd = process_open_child_fd(current_pcb);
+    if (fd == -1)
+    {
+        ERRNO = ERR_P_CHILD_FD_NO_FDS;
+    }
+    return fd;
+}
+
+/**
+ * registers \p handler for signal \p sig in the current PCB. A handled signal is made pending
+ * when it is sent, & the handler runs on a separate stack the next time the PCB is scheduled
+ * (a p_poll or p_sleep in progress is woken for it), then the PCB resumes where it was; a signal
+ * sent again while pending is only handled once, so several S_SIGCHLD for child changes coalesce.
+ * Handling S_SIGTERM lets a PCB terminate gracefully (flush its buffers, then p_exit); S_SIGSTOP
+ * can't be handled. Handlers are reset to P_SIG_DFL in spawned children
+ * @param sig the signal
+ * @param handler function to call with the signal, P_SIG_DFL for its default action (S_SIGTERM
+ * terminates, S_SIGALRM only wakes a p_poll or p_sleep, the others are ignored), or P_SIG_IGN to ignore it
+ * @return the previous handler on success; P_SIG_ERR on failure
+ */
+p_sighandler_t p_signal(int sig, p_sighandler_t handler)
+{
+    if (S_BIT(sig) == 0 || sig == S_SIGSTOP)
+    {
+        ERRNO = ERR_P_SIGNAL_INVALID;
+        return P_SIG_ERR;
+    }
+    PCB *pcb = current_pcb;
+    if (handler != P_SIG_DFL && handler != P_SIG_IGN && pcb->sig_stack == NULL)
+    { // handlers run on their own stack, so the stack a PCB was interrupted on is left intact
+        pcb->sig_context = malloc(sizeof(ucontext_t));
+        pcb->sig_stack = malloc(STACKSIZE);
+        if (pcb->sig_context == NULL || pcb->sig_stack == NULL)
+        {
+            free(pcb->sig_context);
+            free(pcb->sig_stack);
+            pcb->sig_context = NULL;
+            pcb->sig_stack = NULL;
+            ERRNO = ERR_P_SIGNAL_NULL_STACK;
+            return P_SIG_ERR;
+        }
+        VALGRIND_STACK_REGISTER(pcb->sig_stack, pcb->sig_stack + STACKSIZE);
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    p_sighandler_t prev = k_signal_set_handler(pcb, sig, handler);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return prev;
+}
+
+/**
+ * changes the signals the current PCB blocks; a blocked signal stays pending until it is unblocked
+ * @param how P_SIG_BLOCK to block the signals in \p mask too, P_SIG_UNBLOCK to unblock them, or
+ * P_SIG_SETMASK to block exactly them
+ * @param mask signals, as a bitwise or of S_BIT(sig); S_SIGSTOP can't be blocked
+ * @param old_mask set to the previously blocked signals, unless NULL
+ * @return 0 on success; -1 on failure
+ */
+int p_sigprocmask(int how, int mask, int *old_mask)
+{
+    PCB *pcb = current_pcb;
+    int blocked;
+    if (how == P_SIG_BLOCK)
+    {
+        blocked = pcb->sig_blocked | mask;
+    }
+    else if (how == P_SIG_UNBLOCK)
+    {
+        blocked = pcb->sig_blocked & ~mask;
+    }
+    else if (how == P_SIG_SETMASK)
+    {
+        blocked = mask;
+    }
+    else
+    {
+        ERRNO = ERR_P_SIGPROCMASK_INVALID;
+        return -1;
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    if (old_mask != NULL)
+    {
+        *old_mask = pcb->sig_blocked;
+    }
+    k_signal_set_blocked(pcb, blocked);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return 0;
 }
 
 /**
@@ -366,9 +972,14 @@ void p_exit(void)
     // if the parent calls p_waitpid. Is there a better way to do this?
     
     log_exited_event(current_pcb->pid, current_pcb->priority, current_pcb->name);
-    process_delete_fileptrs(current_pcb);   // delete the current_pcb's file pointers
+    process_close_fds(current_pcb);        // close the current_pcb's file descriptors
+    k_mutex_release_all(current_pcb);      // the mutexes it holds go to their waiters
+    k_shm_detach_all(current_pcb);         // and drop its shared memory regions
+    k_timer_disarm(&current_pcb->alarm);
     current_pcb->status = T_ZOMBIED;       // set the status of the current_pcb to T_ZOMBIED
     log_zombie_event(current_pcb->pid, current_pcb->priority, current_pcb->name);
+    k_wake_all(&child_exits);              // wake parents polling a child exit fd
+    k_notify_parent(current_pcb);          // & send the parent S_SIGCHLD
 
      for(int i = 0; i<current_pcb->numChildren; i++){
         PCB* curr = findPCBByPID(current_pcb->children[i]);
@@ -1,6 +1,8 @@
 #ifndef PUSER_FUNCTIONS_H
 #define PUSER_FUNCTIONS_H
 #include "kernel-functions.h"
+#include "sync.h"
+#include "mq.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -11,11 +13,49 @@
 extern PCB *current_pcb;
 extern int ticks;
 
+#define P_SIG_BLOCK   0 // p_sigprocmask: block the signals in the mask too
+#define P_SIG_UNBLOCK 1 // p_sigprocmask: unblock the signals in the mask
+#define P_SIG_SETMASK 2 // p_sigprocmask: block exactly the signals in the mask
+
+typedef struct p_pollfd
+{
+   int fd;                          // the file descriptor to poll
+   int events;                      // F_POLLIN and/or F_POLLOUT
+   int revents;                     // set to the events the fd is ready for
+} p_pollfd_t;
+
 int p_spawn(void (*func)(), char *argv[], int fd0, int fd1);
 pid_t p_waitpid(pid_t pid, int *wstatus, bool nohang);
 int p_kill(pid_t pid, int sig);
+p_sighandler_t p_signal(int sig, p_sighandler_t handler);
+int p_sigprocmask(int how, int mask, int *old_mask);
 int p_nice(pid_t pid, int priority);
 void p_sleep(unsigned int time);
+int p_setitimer(int delay, int interval);
+int p_alarm(int delay);
+int p_pipe(int fds[2]);
+void *p_shm_create(const char *name, size_t size);
+void *p_shm_attach(const char *name, size_t *size);
+int p_shm_detach(void *addr);
+void p_mutex_init(mutex_t *mutex);
+int p_mutex_lock(mutex_t *mutex);
+int p_mutex_trylock(mutex_t *mutex);
+int p_mutex_unlock(mutex_t *mutex);
+int p_sem_init(semaphore_t *sem, int value);
+void p_sem_wait(semaphore_t *sem);
+int p_sem_trywait(semaphore_t *sem);
+void p_sem_post(semaphore_t *sem);
+void p_cond_init(cond_t *cond);
+int p_cond_wait(cond_t *cond, mutex_t *mutex);
+void p_cond_signal(cond_t *cond);
+void p_cond_broadcast(cond_t *cond);
+int p_mq_open(const char *name, int capacity, int msg_size);
+int p_mq_send(int fd, const void *msg, int len, int priority);
+int p_mq_recv(int fd, void *buf, int size, int *priority);
+int p_mq_send_batch(int fd, const mq_msg_t msgs[], int n);
+int p_mq_recv_batch(int fd, mq_msg_t msgs[], int n);
+int p_poll(p_pollfd_t fds[], int n, int timeout_ticks);
+int p_child_fd(void);
 void p_exit(void);
 bool W_WIFEXITED(int status);
 bool W_WIFSTOPPED(int status);
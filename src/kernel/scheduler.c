@@ -19,6 +19,21 @@ ucontext_t reaperContext;
 static ucontext_t *activeContext = NULL;
 static const int centisecond = 10000; // 10 milliseconds
 
+/**
+ * waits for the next alarm without running any process; the scheduler runs with SIGALRM blocked,
+ * so the alarm is taken here instead of by \ref alarmHandler
+ * @return none
+ */
+static void idle(void)
+{
+    sigset_t alarm_mask;
+    sigemptyset(&alarm_mask);
+    sigaddset(&alarm_mask, SIGALRM);
+    int sig;
+    sigwait(&alarm_mask, &sig);
+    ticks++;
+}
+
 /**
  * scheduler function - function to be run at every tick
  * decides which PCB to be run for the remainder of current tick
@@ -26,10 +41,22 @@ static const int centisecond = 10000; // 10 milliseconds
  */
 static void scheduler(void)
 {
-    if (count_running(pcb_list) == 0)
+    static int last_tick = -1;
+    if (ticks != last_tick)
+    { // first decision of this tick
+        last_tick = ticks;
+        k_tick();
+    }
+
+    while (count_running(pcb_list) == 0)
     {
-        // TODO: idle()
-        exit(12);
+        if (!k_tick_pending())
+        { // nothing can ever run again
+            exit(12);
+        }
+        idle();
+        last_tick = ticks;
+        k_tick();
     }
 
     int priority;
@@ -68,6 +95,7 @@ static void scheduler(void)
     }
 
     current_pcb = pcb_list;
+    k_signal_prepare(current_pcb); // handlers for its pending signals run first
 
     activeContext = current_pcb->context;
     activeContext->uc_link = &schedulerContext;
@@ -148,6 +176,7 @@ void start_scheduler()
     signal(SIGTSTP, SIG_IGN); // Ctrl-Z
 
     getcontext(&schedulerContext);
+    sigaddset(&schedulerContext.uc_sigmask, SIGALRM); // a tick mid-decision would save the scheduler as the last process
     char *stack = malloc(STACKSIZE);
     schedulerContext.uc_stack.ss_sp = stack;
     schedulerContext.uc_stack.ss_size = STACKSIZE;
@@ -157,6 +186,7 @@ void start_scheduler()
     VALGRIND_STACK_REGISTER(stack, stack + STACKSIZE);
 
     getcontext(&reaperContext);
+    sigaddset(&reaperContext.uc_sigmask, SIGALRM);
     stack = malloc(STACKSIZE);
     reaperContext.uc_stack.ss_sp = stack;
     reaperContext.uc_stack.ss_size = STACKSIZE;
@@ -0,0 +1,143 @@
+#include "shm.h"
+#include "wait-queue.h"
+#include <stdlib.h>
+#include <string.h>
+
+shm_region_t *shm_regions = NULL; // every region with at least one attachment
+
+/**
+ * finds the region named \p name in `shm_regions`
+ * @param name the region's name
+ * @return the region, or `NULL` if there is none with that name
+ */
+shm_region_t *k_shm_find(const char *name)
+{
+    for (shm_region_t *curr = shm_regions; curr != NULL; curr = curr->next)
+    {
+        if (strcmp(curr->name, name) == 0)
+        {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * unlinks \p region from `shm_regions` & frees it with its memory
+ * @param region the region, which has no attachments left
+ * @return none
+ */
+static void shm_destroy(shm_region_t *region)
+{
+    shm_region_t **link = &shm_regions;
+    while (*link != region)
+    {
+        link = &(*link)->next;
+    }
+    *link = region->next;
+    free(region->addr);
+    free(region);
+}
+
+/**
+ * creates a zero-filled region named \p name of \p size bytes & attaches \p pcb to it
+ * @param pcb the creating process
+ * @param name the region's name
+ * @param size bytes in the region
+ * @return the region's address, or `NULL` if it could not be allocated
+ */
+void *k_shm_create(PCB *pcb, const char *name, size_t size)
+{
+    shm_region_t *region = malloc(sizeof(shm_region_t));
+    if (region == NULL)
+    {
+        return NULL;
+    }
+    region->addr = calloc(1, size); // large regions are mapped lazily by the host allocator
+    if (region->addr == NULL)
+    {
+        free(region);
+        return NULL;
+    }
+    strncpy(region->name, name, SHM_NAME_SIZE - 1);
+    region->name[SHM_NAME_SIZE - 1] = '\0';
+    region->size = size;
+    region->refs = 0;
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    region->next = shm_regions;
+    shm_regions = region;
+    void *addr = k_shm_attach(pcb, region);
+    if (addr == NULL)
+    {
+        shm_destroy(region);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return addr;
+}
+
+/**
+ * attaches \p pcb to \p region, taking a reference to it
+ * @param pcb the process
+ * @param region the region
+ * @return the region's address, or `NULL` if the attachment could not be allocated
+ */
+void *k_shm_attach(PCB *pcb, shm_region_t *region)
+{
+    shm_attachment_t *attachment = malloc(sizeof(shm_attachment_t));
+    if (attachment == NULL)
+    {
+        return NULL;
+    }
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    attachment->region = region;
+    attachment->next = pcb->shm;
+    pcb->shm = attachment;
+    region->refs++;
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return region->addr;
+}
+
+/**
+ * detaches \p pcb from the region at \p addr once, freeing the region with its last reference
+ * @param pcb the process
+ * @param addr the region's address
+ * @return `true` on success, `false` if \p pcb isn't attached to a region at \p addr
+ */
+bool k_shm_detach(PCB *pcb, void *addr)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    shm_attachment_t **link = &pcb->shm;
+    while (*link != NULL && (*link)->region->addr != addr)
+    {
+        link = &(*link)->next;
+    }
+    shm_attachment_t *attachment = *link;
+    if (attachment != NULL)
+    {
+        *link = attachment->next;
+        if (--attachment->region->refs == 0)
+        {
+            shm_destroy(attachment->region);
+        }
+        free(attachment);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return attachment != NULL;
+}
+
+/**
+ * detaches \p pcb from all of its regions
+ * @param pcb the process
+ * @return none
+ */
+void k_shm_detach_all(PCB *pcb)
+{
+    while (pcb->shm != NULL)
+    {
+        k_shm_detach(pcb, pcb->shm->region->addr);
+    }
+}
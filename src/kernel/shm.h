@@ -0,0 +1,65 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "PCB.h"
+
+#define SHM_NAME_SIZE 32 // longest region name, including the null terminator
+
+typedef struct shm_region
+{
+   char name[SHM_NAME_SIZE];        // name that processes attach by
+   void *addr;                      // the memory, at the same address in every attached process
+   size_t size;                     // bytes in the region
+   int refs;                        // attachments, counted over all processes
+   struct shm_region *next;         // next region in `shm_regions`
+} shm_region_t;
+
+typedef struct shm_attachment
+{
+   shm_region_t *region;            // the attached region
+   struct shm_attachment *next;     // next attachment of the same process
+} shm_attachment_t;
+
+/**
+ * find a shared memory region by name
+ * @param name the region's name
+ * @return the region, or `NULL` if there is none with that name
+ */
+shm_region_t *k_shm_find(const char *name);
+
+/**
+ * create a zero-filled shared memory region & attach it to \p pcb
+ * @param pcb the creating process
+ * @param name the region's name, which must not be taken
+ * @param size bytes in the region
+ * @return the region's address, or `NULL` if it could not be allocated
+ */
+void *k_shm_create(PCB *pcb, const char *name, size_t size);
+
+/**
+ * attach a process to a shared memory region; a process may attach to a region more than once,
+ * & is detached from it once per attachment
+ * @param pcb the process
+ * @param region the region
+ * @return the region's address, or `NULL` if the attachment could not be allocated
+ */
+void *k_shm_attach(PCB *pcb, shm_region_t *region);
+
+/**
+ * detach a process from the region at \p addr; the region is freed with its last attachment
+ * @param pcb the process
+ * @param addr the region's address
+ * @return `true` on success, `false` if \p pcb isn't attached to a region at \p addr
+ */
+bool k_shm_detach(PCB *pcb, void *addr);
+
+/**
+ * detach a process from every region it is attached to (when it exits, is terminated, or is freed)
+ * @param pcb the process
+ * @return none
+ */
+void k_shm_detach_all(PCB *pcb);
+
+#endif // SHM_H
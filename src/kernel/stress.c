@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include "puser-functions.h"
+#include "../filesystem/filesystem.h"
 
 
 static void nap(void)
@@ -32,6 +33,7 @@ static void spawn(bool nohang)
   }
      
   // Wait on all children.
+  p_pollfd_t exits = { p_child_fd(), F_POLLIN, 0 };
   
   while (1) {
    
@@ -41,14 +43,15 @@ static void spawn(bool nohang)
       
       break;
     }
-    // polling if nonblocking wait and no waitable children yet
+    // polling if nonblocking wait and no waitable children yet: sleep until one exits
     if (nohang && cpid == 0) {
-      usleep(90000);  // 90 milliseconds
+      p_poll(&exits, 1, -1);
       continue;
     }
 
     dprintf(STDERR_FILENO, "child_%d was reaped\n", cpid - pid);
   }
+  f_close(exits.fd);
 
 }
 
@@ -0,0 +1,412 @@
+#include "sync.h"
+#include "scheduler.h"
+#include "../logger/logger.h"
+
+// the fast paths use compare-and-swap so that a SIGALRM between reading & updating a state
+// can't let two processes both succeed; the slow paths run with SIGALRM blocked, so nothing
+// else can run until they either finish or block
+
+/**
+ * atomically replaces *\p word with \p desired if it is \p expected
+ * @return `true` if it was replaced
+ */
+static bool cas(int *word, int expected, int desired)
+{
+    return __atomic_compare_exchange_n(word, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * returns the holder of \p mutex
+ * @return the holder, or `NULL` if it is between its compare-and-swap & setting `owner`
+ */
+static PCB *holder(mutex_t *mutex)
+{
+    return (mutex->owner == 0) ? NULL : findPCBByPID(mutex->owner);
+}
+
+/**
+ * raises the effective priority of \p pcb to \p priority, & of the holder of the mutex it waits
+ * for in turn, as far along the chain as it is an increase
+ * @param pcb the process
+ * @param priority the priority to raise it to
+ * @return none
+ */
+static void raise_priority(PCB *pcb, int priority)
+{
+    while (pcb != NULL && priority < pcb->priority)
+    {
+        log_nice_event(pcb->pid, pcb->priority, priority, pcb->name);
+        pcb->priority = priority;
+        pcb = (pcb->lock_wait == NULL) ? NULL : holder(pcb->lock_wait);
+    }
+}
+
+/**
+ * removes \p mutex from the list of mutexes with waiters of \p pcb, if it is in it
+ * @return none
+ */
+static void drop_inherited(PCB *pcb, mutex_t *mutex)
+{
+    for (mutex_t **link = &pcb->inherited; *link != NULL; link = &(*link)->next_inherited)
+    {
+        if (*link == mutex)
+        {
+            *link = mutex->next_inherited;
+            mutex->next_inherited = NULL;
+            return;
+        }
+    }
+}
+
+/**
+ * adds \p mutex to the list of mutexes with waiters of \p pcb, if it isn't in it already
+ * @return none
+ */
+static void add_inherited(PCB *pcb, mutex_t *mutex)
+{
+    for (mutex_t *held = pcb->inherited; held != NULL; held = held->next_inherited)
+    {
+        if (held == mutex)
+        {
+            return;
+        }
+    }
+    mutex->next_inherited = pcb->inherited;
+    pcb->inherited = mutex;
+}
+
+/**
+ * recomputes the effective priority of \p pcb: the highest of its base priority & the priorities
+ * of the waiters of the mutexes it holds; a change is passed on along the chain of holders
+ * @param pcb the process
+ * @return `true` if the effective priority of \p pcb changed
+ */
+bool k_inherit_priority(PCB *pcb)
+{
+    bool changed = false;
+    for (PCB *curr = pcb; curr != NULL; curr = (curr->lock_wait == NULL) ? NULL : holder(curr->lock_wait))
+    {
+        int priority = curr->base_priority;
+        for (mutex_t *held = curr->inherited; held != NULL; held = held->next_inherited)
+        {
+            for (wait_entry_t *waiter = held->waiters.head; waiter != NULL; waiter = waiter->next)
+            {
+                if (waiter->pcb->priority < priority)
+                {
+                    priority = waiter->pcb->priority;
+                }
+            }
+        }
+        if (priority == curr->priority)
+        {
+            break;
+        }
+        log_nice_event(curr->pid, curr->priority, priority, curr->name);
+        curr->priority = priority;
+        changed = true;
+    }
+    return changed;
+}
+
+/**
+ * takes \p mutex over if its holder exited or was terminated while holding it & nobody waits
+ * for it (a holder with waiters hands its mutexes on when it ends, see \ref k_mutex_release_all);
+ * called with SIGALRM blocked
+ * @param mutex the mutex
+ * @return `true` if the current process now holds it
+ */
+static bool take_abandoned(mutex_t *mutex)
+{
+    if (mutex->owner == 0 || mutex->waiters.head != NULL)
+    {
+        return false;
+    }
+    PCB *owner = holder(mutex);
+    if (owner != NULL && owner->status != T_ZOMBIED)
+    {
+        return false;
+    }
+    mutex->owner = current_pcb->pid;
+    mutex->state = MUTEX_LOCKED;
+    return true;
+}
+
+/**
+ * makes the first waiter of \p mutex its holder & wakes it, with the priorities of the rest
+ * passed on to it, or frees \p mutex if it has no waiters left; called with SIGALRM blocked
+ * @param mutex the mutex, whose holder is giving it up
+ * @return none
+ */
+static void hand_off(mutex_t *mutex)
+{
+    mutex->owner = 0;
+    PCB *next = k_wake_one(&mutex->waiters);
+    if (next == NULL)
+    { // the waiters were terminated
+        mutex->state = MUTEX_FREE;
+        return;
+    }
+    next->lock_wait = NULL;
+    mutex->owner = next->pid;
+    mutex->state = (mutex->waiters.head == NULL) ? MUTEX_LOCKED : MUTEX_CONTENDED;
+    if (mutex->state == MUTEX_CONTENDED)
+    {
+        add_inherited(next, mutex);
+        k_inherit_priority(next);
+    }
+}
+
+/**
+ * takes \p pcb out of the waiters of the mutex it is blocked on, & recomputes the priority of the
+ * mutex's holder without it
+ * @param pcb the process
+ * @return none
+ */
+void k_mutex_wait_cancel(PCB *pcb)
+{
+    mutex_t *mutex = pcb->lock_wait;
+    if (mutex == NULL)
+    {
+        return;
+    }
+    pcb->lock_wait = NULL;
+    k_wait_cancel(pcb);
+    PCB *owner = holder(mutex);
+    if (owner != NULL)
+    {
+        k_inherit_priority(owner);
+    }
+}
+
+/**
+ * locks \p mutex: a single compare-and-swap when it is free, otherwise the current process
+ * waits in FIFO order until an unlock hands the mutex to it, & the holder runs at the current
+ * process's priority if that is higher than its own in the meantime
+ * @param mutex the mutex
+ * @return none
+ */
+void k_mutex_lock(mutex_t *mutex)
+{
+    if (cas(&mutex->state, MUTEX_FREE, MUTEX_LOCKED))
+    {
+        mutex->owner = current_pcb->pid;
+        return;
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    current_pcb->lock_wait = mutex;
+    while (true)
+    {
+        if (mutex->state == MUTEX_FREE)
+        { // unlocked since the fast path
+            mutex->state = MUTEX_LOCKED;
+            mutex->owner = current_pcb->pid;
+            break;
+        }
+        if (take_abandoned(mutex))
+        {
+            break;
+        }
+        mutex->state = MUTEX_CONTENDED; // the holder's unlock has to take the slow path
+        PCB *owner = holder(mutex);
+        if (owner != NULL)
+        {
+            add_inherited(owner, mutex);
+            raise_priority(owner, current_pcb->priority);
+        }
+        if (k_wait(&mutex->waiters))
+        { // handed the mutex by `k_mutex_unlock`
+            break;
+        }
+    }
+    current_pcb->lock_wait = NULL;
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * locks \p mutex if it is free, with a single compare-and-swap, or if its holder ended without
+ * unlocking it
+ * @param mutex the mutex
+ * @return `true` if the current process now holds it
+ */
+bool k_mutex_trylock(mutex_t *mutex)
+{
+    if (cas(&mutex->state, MUTEX_FREE, MUTEX_LOCKED))
+    {
+        mutex->owner = current_pcb->pid;
+        return true;
+    }
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    bool taken = take_abandoned(mutex);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    return taken;
+}
+
+/**
+ * unlocks \p mutex: a single compare-and-swap when nobody waits for it, otherwise the first
+ * waiter becomes the holder & is woken, inheriting the priorities of the rest, & the current
+ * process gives back the priority it inherited through \p mutex
+ * @param mutex the mutex
+ * @return none
+ */
+void k_mutex_unlock(mutex_t *mutex)
+{
+    mutex->owner = 0;
+    if (cas(&mutex->state, MUTEX_LOCKED, MUTEX_FREE))
+    {
+        return;
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    drop_inherited(current_pcb, mutex);
+    hand_off(mutex);
+    k_inherit_priority(current_pcb);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * hands the mutexes with waiters that \p pcb holds to their first waiters, as if \p pcb unlocked
+ * them; mutexes without waiters are taken over by the next process that locks them
+ * @param pcb the process, which exited or was terminated
+ * @return none
+ */
+void k_mutex_release_all(PCB *pcb)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    while (pcb->inherited != NULL)
+    {
+        mutex_t *mutex = pcb->inherited;
+        pcb->inherited = mutex->next_inherited;
+        mutex->next_inherited = NULL;
+        hand_off(mutex);
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * takes a unit of \p sem: a single compare-and-swap when it has one, otherwise the current
+ * process waits in FIFO order until a post hands a unit to it
+ * @param sem the semaphore
+ * @return none
+ */
+void k_sem_wait(semaphore_t *sem)
+{
+    if (k_sem_trywait(sem))
+    {
+        return;
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    while (true)
+    {
+        if (sem->value > 0)
+        { // posted since the fast path
+            sem->value--;
+            break;
+        }
+        sem->value = -1; // posts have to take the slow path
+        if (k_wait(&sem->waiters))
+        { // handed a unit by `k_sem_post`
+            break;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * takes a unit of \p sem if it has one
+ * @param sem the semaphore
+ * @return `true` if a unit was taken
+ */
+bool k_sem_trywait(semaphore_t *sem)
+{
+    int value = __atomic_load_n(&sem->value, __ATOMIC_ACQUIRE);
+    while (value > 0)
+    {
+        if (cas(&sem->value, value, value - 1))
+        {
+            return true;
+        }
+        value = __atomic_load_n(&sem->value, __ATOMIC_ACQUIRE);
+    }
+    return false;
+}
+
+/**
+ * gives a unit to \p sem: a single compare-and-swap when nobody waits for one, otherwise the
+ * unit goes straight to the first waiter, which is woken
+ * @param sem the semaphore
+ * @return none
+ */
+void k_sem_post(semaphore_t *sem)
+{
+    int value = __atomic_load_n(&sem->value, __ATOMIC_ACQUIRE);
+    while (value >= 0)
+    {
+        if (cas(&sem->value, value, value + 1))
+        {
+            return;
+        }
+        value = __atomic_load_n(&sem->value, __ATOMIC_ACQUIRE);
+    }
+
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    if (k_wake_one(&sem->waiters) == NULL)
+    { // the waiters were terminated
+        sem->value = 1;
+    }
+    else if (sem->waiters.head == NULL)
+    {
+        sem->value = 0;
+    }
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * unlocks \p mutex & waits on \p cond with SIGALRM blocked in between, so a signal sent after
+ * the unlock can't be missed; locks \p mutex again before returning
+ * @param cond the condition variable
+ * @param mutex the mutex
+ * @return none
+ */
+void k_cond_wait(cond_t *cond, mutex_t *mutex)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    k_mutex_unlock(mutex);
+    k_wait(&cond->waiters);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+    k_mutex_lock(mutex);
+}
+
+/**
+ * wakes the first process waiting on \p cond
+ * @param cond the condition variable
+ * @return none
+ */
+void k_cond_signal(cond_t *cond)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    k_wake_one(&cond->waiters);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * wakes every process waiting on \p cond
+ * @param cond the condition variable
+ * @return none
+ */
+void k_cond_broadcast(cond_t *cond)
+{
+    sigset_t prev_mask;
+    k_block_alarm(&prev_mask);
+    k_wake_all(&cond->waiters);
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
@@ -0,0 +1,137 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdbool.h>
+#include "PCB.h"
+#include "wait-queue.h"
+
+// mutex, semaphore & condition variable objects live in the memory of the processes that use
+// them (e.g. a shared memory region); the uncontended paths are a single atomic instruction,
+// & only contended operations block SIGALRM & use the wait queue
+
+// a mutex holder runs at the highest priority of the processes waiting for it (priority
+// inheritance), so a low priority holder can't keep e.g. the shell waiting; the boost follows
+// chains of holders that are themselves waiting for mutexes, & is dropped at unlock
+
+// a holder that exits or is terminated gives its mutexes up as if it unlocked them, so waiters
+// don't hang on a dead pid; the data they protect may be left half updated
+
+#define MUTEX_FREE      0 // unlocked
+#define MUTEX_LOCKED    1 // locked, nobody waiting
+#define MUTEX_CONTENDED 2 // locked, & processes may be waiting
+
+typedef struct mutex
+{
+   int state;                       // MUTEX_FREE, MUTEX_LOCKED, or MUTEX_CONTENDED
+   pid_t owner;                     // pid of the holder, or 0
+   wait_queue_t waiters;            // processes blocked in `k_mutex_lock`, woken in FIFO order
+   struct mutex* next_inherited;    // next in the holder's list of mutexes with waiters
+} mutex_t;
+
+typedef struct semaphore
+{
+   int value;                       // available units, or -1 if there are none & processes may be waiting
+   wait_queue_t waiters;            // processes blocked in `k_sem_wait`, woken in FIFO order
+} semaphore_t;
+
+typedef struct cond
+{
+   wait_queue_t waiters;            // processes blocked in `k_cond_wait`, woken in FIFO order
+} cond_t;
+
+#define MUTEX_INITIALIZER { MUTEX_FREE, 0, WAIT_QUEUE_INITIALIZER, NULL }
+#define SEMAPHORE_INITIALIZER(value) { (value), WAIT_QUEUE_INITIALIZER }
+#define COND_INITIALIZER { WAIT_QUEUE_INITIALIZER }
+
+/**
+ * lock a mutex, blocking (`T_BLOCKED`) while another process holds it; the lock is handed to
+ * the waiters in the order they started waiting
+ * @param mutex the mutex, which the current process must not hold
+ * @return none
+ */
+void k_mutex_lock(mutex_t *mutex);
+
+/**
+ * lock a mutex only if it is free (or its holder ended without unlocking it)
+ * @param mutex the mutex
+ * @return `true` if the current process now holds it
+ */
+bool k_mutex_trylock(mutex_t *mutex);
+
+/**
+ * unlock a mutex, handing it to the first waiter if there is one
+ * @param mutex the mutex, which the current process must hold
+ * @return none
+ */
+void k_mutex_unlock(mutex_t *mutex);
+
+/**
+ * give up the mutexes of a process that exited or was terminated: each one with waiters goes to
+ * its first waiter, & one without waiters is taken over by the next process that locks it
+ * @param pcb the process
+ * @return none
+ */
+void k_mutex_release_all(PCB *pcb);
+
+/**
+ * recompute a process's effective priority from its base priority & the waiters of the mutexes
+ * it holds, logging a change with `log_nice_event`; a change is passed on to the holder of the
+ * mutex the process is waiting for, if any
+ * @param pcb the process
+ * @return `true` if its effective priority changed
+ */
+bool k_inherit_priority(PCB *pcb);
+
+/**
+ * stop a terminated process waiting for a mutex, giving back any priority its holder inherited
+ * from it
+ * @param pcb the process
+ * @return none
+ */
+void k_mutex_wait_cancel(PCB *pcb);
+
+/**
+ * take a unit of a semaphore, blocking (`T_BLOCKED`) while it has none
+ * @param sem the semaphore
+ * @return none
+ */
+void k_sem_wait(semaphore_t *sem);
+
+/**
+ * take a unit of a semaphore only if it has one
+ * @param sem the semaphore
+ * @return `true` if a unit was taken
+ */
+bool k_sem_trywait(semaphore_t *sem);
+
+/**
+ * give a unit to a semaphore, handing it to the first waiter if there is one
+ * @param sem the semaphore
+ * @return none
+ */
+void k_sem_post(semaphore_t *sem);
+
+/**
+ * unlock \p mutex & block on \p cond in one step, then lock \p mutex again once woken; the
+ * caller should check its condition again on return
+ * @param cond the condition variable
+ * @param mutex the mutex, which the current process must hold
+ * @return none
+ */
+void k_cond_wait(cond_t *cond, mutex_t *mutex);
+
+/**
+ * wake the first process waiting on a condition variable, if any
+ * @param cond the condition variable
+ * @return none
+ */
+void k_cond_signal(cond_t *cond);
+
+/**
+ * wake every process waiting on a condition variable
+ * @param cond the condition variable
+ * @return none
+ */
+void k_cond_broadcast(cond_t *cond);
+
+#endif // SYNC_H
@@ -0,0 +1,137 @@
+#include "timer.h"
+#include "PCB.h"
+#include <stddef.h>
+
+extern int ticks;
+
+static ktimer_t *wheel[TIMER_SLOTS]; // armed timers, hashed by the tick they expire at
+static int armed = 0;                // armed timers, over all slots
+static int wheel_tick = -1;          // last tick whose slot was expired
+
+/**
+ * sets up \p timer for \p pcb, not armed
+ * @return none
+ */
+void k_timer_init(ktimer_t *timer, PCB *pcb, void (*expire)(PCB *pcb))
+{
+    timer->pcb = pcb;
+    timer->expire = expire;
+    timer->expires = -1;
+    timer->interval = 0;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * links \p timer in at the front of the list \p head
+ * @return none
+ */
+static void link_timer(ktimer_t **head, ktimer_t *timer)
+{
+    timer->next = *head;
+    timer->pprev = head;
+    if (*head != NULL)
+    {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+}
+
+/**
+ * unlinks \p timer from the list it is in
+ * @return none
+ */
+static void unlink_timer(ktimer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * arms \p timer to expire at tick \p expires (at the earliest the next tick), then every
+ * \p interval ticks if \p interval is positive
+ * @return none
+ */
+void k_timer_arm(ktimer_t *timer, int expires, int interval)
+{
+    k_timer_disarm(timer);
+    int earliest = (wheel_tick < ticks) ? wheel_tick + 1 : ticks + 1; // a tick the wheel hasn't expired yet
+    timer->expires = (expires > earliest) ? expires : earliest;
+    timer->interval = (interval > 0) ? interval : 0;
+    link_timer(&wheel[timer->expires & (TIMER_SLOTS - 1)], timer);
+    armed++;
+}
+
+/**
+ * disarms \p timer
+ * @return none
+ */
+void k_timer_disarm(ktimer_t *timer)
+{
+    if (timer->expires >= 0)
+    {
+        unlink_timer(timer);
+        timer->expires = -1;
+        timer->interval = 0;
+        armed--;
+    }
+}
+
+/**
+ * checks whether \p timer is armed
+ * @return `true` if it is
+ */
+bool k_timer_armed(const ktimer_t *timer)
+{
+    return timer->expires >= 0;
+}
+
+/**
+ * expires the timers due at each tick since the last call: first moves them out of their slot,
+ * then calls each one's `expire`, which may arm or disarm any timer (including ones still due)
+ * @return none
+ */
+void k_timer_tick(void)
+{
+    while (wheel_tick < ticks)
+    {
+        wheel_tick++;
+        ktimer_t *due = NULL;
+        ktimer_t *next;
+        for (ktimer_t *timer = wheel[wheel_tick & (TIMER_SLOTS - 1)]; timer != NULL; timer = next)
+        {
+            next = timer->next;
+            if (timer->expires == wheel_tick)
+            { // others in the slot are due a later turn of the wheel
+                unlink_timer(timer);
+                link_timer(&due, timer);
+            }
+        }
+
+        while (due != NULL)
+        {
+            ktimer_t *timer = due;
+            int interval = timer->interval;
+            k_timer_disarm(timer);
+            if (interval > 0)
+            {
+                k_timer_arm(timer, wheel_tick + interval, interval);
+            }
+            timer->expire(timer->pcb);
+        }
+    }
+}
+
+/**
+ * checks whether any timer is armed
+ * @return `true` if one is
+ */
+bool k_timers_pending(void)
+{
+    return armed > 0;
+}
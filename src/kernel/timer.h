@@ -0,0 +1,66 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+
+#define TIMER_SLOTS 256 // slots in the timer wheel; a power of 2, so a tick's slot is `tick & (TIMER_SLOTS - 1)`
+
+struct PCB;
+
+typedef struct ktimer
+{
+   struct PCB *pcb;                 // process the timer belongs to
+   void (*expire)(struct PCB *pcb); // called with SIGALRM blocked when the timer expires
+   int expires;                     // tick the timer expires at, or -1 if it is not armed
+   int interval;                    // ticks between expiries of a repeating timer, or 0
+   struct ktimer *next;             // next timer in the same wheel slot
+   struct ktimer **pprev;           // link that points to the timer, so it can be unlinked from any list
+} ktimer_t;
+
+/**
+ * set up a timer that is not armed
+ * @param timer the timer
+ * @param pcb process the timer belongs to
+ * @param expire called with \p pcb when the timer expires
+ * @return none
+ */
+void k_timer_init(ktimer_t *timer, struct PCB *pcb, void (*expire)(struct PCB *pcb));
+
+/**
+ * arm a timer, replacing its previous expiry if it was armed; call with SIGALRM blocked
+ * @param timer the timer
+ * @param expires tick to expire at; a tick that has passed expires at the next one
+ * @param interval ticks between later expiries, or 0 for a timer that expires once
+ * @return none
+ */
+void k_timer_arm(ktimer_t *timer, int expires, int interval);
+
+/**
+ * disarm a timer, if it is armed; call with SIGALRM blocked
+ * @param timer the timer
+ * @return none
+ */
+void k_timer_disarm(ktimer_t *timer);
+
+/**
+ * check whether a timer is armed
+ * @param timer the timer
+ * @return `true` if the timer will expire
+ */
+bool k_timer_armed(const ktimer_t *timer);
+
+/**
+ * expire the timers due at each tick up to the current one; called by \ref k_tick, with SIGALRM
+ * blocked. Each tick only visits the timers hashed to its slot of the wheel, so pending timers
+ * cost nothing until (a multiple of TIMER_SLOTS ticks before) they are due
+ * @return none
+ */
+void k_timer_tick(void);
+
+/**
+ * check whether any timer is armed
+ * @return `true` if a timer will expire
+ */
+bool k_timers_pending(void);
+
+#endif // TIMER_H
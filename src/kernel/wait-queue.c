@@ -0,0 +1,243 @@
+#include "wait-queue.h"
+#include "scheduler.h"
+#include "../logger/logger.h"
+#include "../util/globals.h"
+#include "../pennfat/fat.h"
+#include <poll.h>
+#include <unistd.h>
+
+wait_queue_t terminal_input = WAIT_QUEUE_INITIALIZER;
+
+/**
+ * blocks SIGALRM, saving the previous mask in \p prev_mask
+ * @param prev_mask set to the previous signal mask
+ * @return none
+ */
+void k_block_alarm(sigset_t *prev_mask)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &mask, prev_mask);
+}
+
+/**
+ * appends \p entry of the current process to \p queue: at the tail of its FIFO, or to its
+ * pollers if \p poll
+ * @return none
+ */
+static void enqueue(wait_queue_t *queue, wait_entry_t *entry, bool poll)
+{
+    PCB *pcb = current_pcb;
+    entry->pcb = pcb;
+    entry->queue = queue;
+    entry->poll = poll;
+    entry->next = NULL;
+    if (poll)
+    {
+        entry->next = queue->pollers;
+        queue->pollers = entry;
+    }
+    else if (queue->tail == NULL)
+    {
+        queue->head = queue->tail = entry;
+    }
+    else
+    {
+        queue->tail->next = entry;
+        queue->tail = entry;
+    }
+    entry->next_of_pcb = pcb->waits;
+    pcb->waits = entry;
+}
+
+/**
+ * blocks the current process & switches to the scheduler until it is woken or continued
+ * @return `true` if a waker took the process off its queues, `false` otherwise
+ */
+static bool block(void)
+{
+    PCB *pcb = current_pcb;
+    pcb->status = T_BLOCKED;
+    log_blocked_event(pcb->pid, pcb->priority, pcb->name);
+    swapcontext(pcb->context, &schedulerContext);
+    bool woken = (pcb->waits == NULL);
+    k_wait_cancel(pcb); // still queued if continued by S_SIGCONT instead
+    return woken;
+}
+
+/**
+ * blocks the current process in \p queue and switches to the scheduler until it is woken;
+ * the queue entry lives on the process's stack while it waits
+ * @param queue the queue to wait in
+ * @return `true` if a waker took the process off \p queue, `false` otherwise
+ */
+bool k_wait(wait_queue_t *queue)
+{
+    wait_entry_t entry;
+    enqueue(queue, &entry, false);
+    return block();
+}
+
+/**
+ * blocks the current process as a poller of each of \p queues, with its wait timer armed if it
+ * has a deadline, until any of them wakes it
+ * @param queues the queues to poll
+ * @param n number of queues
+ * @param deadline value of `ticks` to wake the process at, or `-1`
+ * @return `true` if a waker took the process off its queues, `false` otherwise
+ */
+bool k_wait_any(wait_queue_t *queues[], int n, int deadline)
+{
+    wait_entry_t entries[(n > 0) ? n : 1];
+    for (int i = 0; i < n; i++)
+    {
+        enqueue(queues[i], &entries[i], true);
+    }
+    if (deadline >= 0)
+    {
+        k_timer_arm(&current_pcb->wait_timer, deadline, 0);
+    }
+    return block();
+}
+
+/**
+ * takes \p pcb off all of its queues & makes it runnable; a process stopped while waiting
+ * only leaves its queues
+ * @param pcb the process
+ * @return none
+ */
+static void wake(PCB *pcb)
+{
+    k_wait_cancel(pcb);
+    if (pcb->status == T_BLOCKED)
+    {
+        pcb->status = T_RUNNING;
+        log_unblocked_event(pcb->pid, pcb->priority, pcb->name);
+    }
+}
+
+/**
+ * wakes \p pcb at the expiry of its wait timer (its deadline)
+ * @param pcb the process
+ * @return none
+ */
+void k_wait_timeout(PCB *pcb)
+{
+    wake(pcb);
+}
+
+/**
+ * wakes \p pcb if it is blocked in \ref k_wait_any, so it can see a signal it was sent
+ * @param pcb the process
+ * @return none
+ */
+void k_wait_interrupt(PCB *pcb)
+{
+    bool polling = (pcb->waits != NULL && pcb->waits->poll) || k_timer_armed(&pcb->wait_timer);
+    if (pcb->status == T_BLOCKED && polling)
+    {
+        wake(pcb);
+    }
+}
+
+/**
+ * wakes every poller of \p queue, then the first process in it
+ * @param queue the queue
+ * @return the first process, or `NULL` if the queue's FIFO was empty
+ */
+PCB *k_wake_one(wait_queue_t *queue)
+{
+    while (queue->pollers != NULL)
+    {
+        wake(queue->pollers->pcb); // takes the poller off this queue, among others
+    }
+    if (queue->head == NULL)
+    {
+        return NULL;
+    }
+    PCB *pcb = queue->head->pcb;
+    wake(pcb);
+    return pcb;
+}
+
+/**
+ * wakes every process in \p queue
+ * @param queue the queue
+ * @return none
+ */
+void k_wake_all(wait_queue_t *queue)
+{
+    while (k_wake_one(queue) != NULL)
+    {
+        // woken in order, until the queue is empty
+    }
+}
+
+/**
+ * removes \p entry from its queue
+ * @return none
+ */
+static void unlink_entry(wait_entry_t *entry)
+{
+    wait_queue_t *queue = entry->queue;
+    wait_entry_t **link = entry->poll ? &queue->pollers : &queue->head;
+    wait_entry_t *prev = NULL;
+    while (*link != NULL && *link != entry)
+    {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    if (*link == NULL)
+    {
+        return;
+    }
+    *link = entry->next;
+    if (!entry->poll && queue->tail == entry)
+    {
+        queue->tail = prev;
+    }
+}
+
+/**
+ * removes \p pcb from every queue it is waiting in, if any
+ * @param pcb the process
+ * @return none
+ */
+void k_wait_cancel(PCB *pcb)
+{
+    for (wait_entry_t *entry = pcb->waits; entry != NULL; entry = entry->next_of_pcb)
+    {
+        unlink_entry(entry);
+    }
+    pcb->waits = NULL;
+    k_timer_disarm(&pcb->wait_timer);
+}
+
+/**
+ * expires the timers due by the current tick, wakes the terminal's pollers if the host
+ * terminal has input (or is at EOF), & commits the filesystem's journal group once it is due
+ * @return none
+ */
+void k_tick(void)
+{
+    k_timer_tick();
+    fs_tick(fat);
+
+    if (terminal_input.pollers != NULL)
+    {
+        struct pollfd host = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&host, 1, 0) > 0)
+        {
+            k_wake_all(&terminal_input);
+        }
+    }
+}
+
+/**
+ * @return `true` if a timer is armed or a process polls the terminal
+ */
+bool k_tick_pending(void)
+{
+    return k_timers_pending() || terminal_input.pollers != NULL;
+}
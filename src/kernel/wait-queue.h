@@ -0,0 +1,107 @@
+#ifndef WAIT_QUEUE_H
+#define WAIT_QUEUE_H
+
+#include "PCB.h"
+#include <signal.h>
+
+typedef struct wait_entry
+{
+   PCB *pcb;                        // the waiting process
+   struct wait_queue *queue;        // queue the entry is in
+   bool poll;                       // in the queue's `pollers` rather than its FIFO
+   struct wait_entry *next;         // next entry in the same list of `queue`
+   struct wait_entry *next_of_pcb;  // next entry of the same process (a poller waits in several queues)
+} wait_entry_t;
+
+typedef struct wait_queue
+{
+   wait_entry_t *head;              // first process to wake
+   wait_entry_t *tail;              // last process to wake
+   wait_entry_t *pollers;           // processes polling the queue, which every wakeup wakes
+} wait_queue_t;
+
+#define WAIT_QUEUE_INITIALIZER { NULL, NULL, NULL }
+
+extern wait_queue_t terminal_input; // processes polling the terminal, woken by \ref k_tick once it has input
+
+/**
+ * block SIGALRM, so that checking a kernel object & waiting on it can't be interleaved with
+ * another process; restore with `sigprocmask(SIG_SETMASK, prev_mask, NULL)`
+ * @param prev_mask set to the previous signal mask
+ * @return none
+ */
+void k_block_alarm(sigset_t *prev_mask);
+
+/**
+ * block the current process in \p queue until another process wakes it; call with SIGALRM
+ * blocked & check the condition waited for again on return, since a process can also be woken
+ * by S_SIGCONT
+ * @param queue the queue to wait in
+ * @return `true` if woken by \ref k_wake_one or \ref k_wake_all (so a waker can hand the
+ * process a resource), `false` if it was continued without being woken
+ */
+bool k_wait(wait_queue_t *queue);
+
+/**
+ * block the current process as a poller of several queues at once, until a wakeup of any of
+ * them or until tick \p deadline; call with SIGALRM blocked & check every source again on return
+ * @param queues the queues to poll
+ * @param n number of queues
+ * @param deadline value of `ticks` to wake the process at, or `-1` to wait without a deadline
+ * @return `true` if woken by a wakeup or the deadline, `false` if it was continued without being woken
+ */
+bool k_wait_any(wait_queue_t *queues[], int n, int deadline);
+
+/**
+ * wake a process whose wait deadline has passed; the expiry of each PCB's `wait_timer`
+ * @param pcb the process
+ * @return none
+ */
+void k_wait_timeout(PCB *pcb);
+
+/**
+ * wake a process if it is blocked in \ref k_wait_any (rather than in \ref k_wait, whose callers
+ * expect a wakeup to come with the resource they wait for), so it can react to a signal
+ * @param pcb the process
+ * @return none
+ */
+void k_wait_interrupt(PCB *pcb);
+
+/**
+ * wake the first process in \p queue, & every process polling it
+ * @param queue the queue
+ * @return the woken process (not counting pollers), or `NULL` if the queue was empty
+ */
+PCB *k_wake_one(wait_queue_t *queue);
+
+/**
+ * wake every process in \p queue, in the order they started waiting
+ * @param queue the queue
+ * @return none
+ */
+void k_wake_all(wait_queue_t *queue);
+
+/**
+ * remove a process from the queues it is waiting in, if any, without waking it
+ * (for processes that are terminated or freed while waiting)
+ * @param pcb the process
+ * @return none
+ */
+void k_wait_cancel(PCB *pcb);
+
+/**
+ * expire the timers that are due (see timer.h), wake the terminal's pollers if it has input, &
+ * commit the filesystem's journal group if it is due (see \ref fs_tick); called once per tick
+ * with SIGALRM blocked
+ * @return none
+ */
+void k_tick(void);
+
+/**
+ * check whether a process is waiting for something that \ref k_tick can wake it for, so that
+ * the scheduler should wait for the next tick rather than give up when nothing can run
+ * @return `true` if \ref k_tick may wake a process
+ */
+bool k_tick_pending(void);
+
+#endif // WAIT_QUEUE_H
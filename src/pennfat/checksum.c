@@ -0,0 +1,365 @@
+// per-block checksums & scrubbing
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_KERNEL 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_ARMV8_KERNEL 1
+#endif
+
+#include "checksum.h"
+#include "fat.h"
+#include "journal.h"
+#include "safe.h"
+#include "../util/util.h"
+
+#define CRC32C_POLY         0x82F63B78 // reflected Castagnoli polynomial
+#define SCRUB_MAX_THREADS   16
+#define SCRUB_BATCH_BYTES   (1 << 20) // read up to this much per pread while scrubbing
+
+static uint32_t slice_table[8][256]; // slicing-by-8 tables, built on first use
+static bool slice_ready = false;
+static uint32_t (*kernel)(uint32_t, const uint8_t*, size_t) = NULL; // chosen on first use
+
+static uint32_t* table = NULL; // checksum table of the mounted filesystem (in the FAT mapping), `NULL` if it has none
+static bool table_owned = false; // `table` is a private copy (see `checksum_detach`)
+
+/**
+ * build the slicing-by-8 tables
+ * @return none
+*/
+static void build_slice_table() {
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        slice_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            slice_table[t][i] = (slice_table[t - 1][i] >> 8) ^ slice_table[0][slice_table[t - 1][i] & 0xFF];
+        }
+    }
+    slice_ready = true;
+}
+
+/**
+ * CRC32C in software, 8 bytes per step
+ * @param crc running CRC (pre-inverted)
+ * @param p data
+ * @param n length of `p`
+ * @return running CRC
+*/
+static uint32_t crc32c_slice8(uint32_t crc, const uint8_t* p, size_t n) {
+    while (n >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = slice_table[7][lo & 0xFF] ^ slice_table[6][(lo >> 8) & 0xFF]
+            ^ slice_table[5][(lo >> 16) & 0xFF] ^ slice_table[4][lo >> 24]
+            ^ slice_table[3][hi & 0xFF] ^ slice_table[2][(hi >> 8) & 0xFF]
+            ^ slice_table[1][(hi >> 16) & 0xFF] ^ slice_table[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0) crc = (crc >> 8) ^ slice_table[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#ifdef HAVE_SSE42_KERNEL
+/**
+ * CRC32C with the SSE4.2 `crc32` instruction
+ * @param crc running CRC (pre-inverted)
+ * @param p data
+ * @param n length of `p`
+ * @return running CRC
+*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t n) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        n -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (n-- > 0) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+#ifdef HAVE_ARMV8_KERNEL
+/**
+ * CRC32C with the ARMv8 `crc32c` instructions
+ * @param crc running CRC (pre-inverted)
+ * @param p data
+ * @param n length of `p`
+ * @return running CRC
+*/
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t* p, size_t n) {
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+/**
+ * pick the CRC32C kernel for this CPU
+ * @return none
+*/
+static void choose_kernel() {
+    build_slice_table();
+    kernel = crc32c_slice8;
+#ifdef HAVE_SSE42_KERNEL
+    if (__builtin_cpu_supports("sse4.2")) kernel = crc32c_sse42;
+#endif
+#ifdef HAVE_ARMV8_KERNEL
+    kernel = crc32c_armv8; // compiled for a CPU with the CRC extension
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t n_bytes) {
+    if (kernel == NULL) choose_kernel();
+    return ~kernel(~crc, (const uint8_t*) data, n_bytes);
+}
+
+const char* crc32c_kernel() {
+    if (kernel == NULL) choose_kernel();
+#ifdef HAVE_SSE42_KERNEL
+    if (kernel == crc32c_sse42) return "sse4.2";
+#endif
+#ifdef HAVE_ARMV8_KERNEL
+    if (kernel == crc32c_armv8) return "armv8";
+#endif
+    return "slicing-by-8";
+}
+
+uint32_t checksum_block(const char* data, int block_size) {
+    uint32_t crc = crc32c(0, data, block_size);
+    return (crc == 0) ? 1 : crc;
+}
+
+/**
+ * set one entry of the checksum table, logging it with the FAT updates on journaled filesystems
+ * @param block block index
+ * @param value the entry, `0` for none
+ * @return none
+*/
+static void set_entry(int block, uint32_t value) {
+    table[block] = value;
+    if (journal_active()) journal_log_csum(block, value);
+}
+
+void checksum_mount(uint16_t* fat, int fs_fd) {
+    checksum_unmount();
+    superblock_t* sb = fs_superblock(fat);
+    if (sb == NULL || !(sb->features & FEATURE_CHECKSUM)) return;
+
+    // part of the metadata mapping: private (& journaled) along with the FAT on journaled filesystems,
+    // so replay never pairs the FAT of one group with the checksums of another
+    table = (uint32_t*) ((char*) fat + sb->csum_offset);
+}
+
+void checksum_detach(uint16_t* fat) {
+    if (table == NULL) return;
+    superblock_t* sb = fs_superblock(fat);
+    uint32_t* copy = malloc(sb->csum_size);
+    if (copy == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, table, sb->csum_size);
+    table = copy;
+    table_owned = true;
+}
+
+void checksum_unmount() {
+    if (table_owned) free(table);
+    table = NULL; // otherwise written back with the FAT
+    table_owned = false;
+}
+
+bool checksum_enabled() {
+    return table != NULL;
+}
+
+void checksum_update(int block, const char* data, int block_size) {
+    if (table == NULL) return;
+    set_entry(block, checksum_block(data, block_size));
+}
+
+void checksum_set(int block, uint32_t value) {
+    if (table != NULL) set_entry(block, value);
+}
+
+void checksum_refresh(uint16_t* fat, int fs_fd, int block) {
+    if (table == NULL) return;
+    int block_size = fs_block_size(fat);
+    char* data = safe_malloc(block_size);
+    safe_pread(fs_fd, data, block_size, mem_idx(fat, block));
+    checksum_update(block, data, block_size);
+    free(data);
+}
+
+void checksum_clear(int block) {
+    if (table != NULL && table[block] != 0) set_entry(block, 0);
+}
+
+void checksum_copy(int from, int to) {
+    if (table != NULL) set_entry(to, table[from]);
+}
+
+bool checksum_verify(int block, const char* data, int block_size) {
+    if (table == NULL || table[block] == 0) return true;
+    if (checksum_block(data, block_size) == table[block]) return true;
+    fprintf(stderr, "checksum mismatch in block %d\n", block);
+    return false;
+}
+
+typedef struct scrub_worker {
+    uint16_t* fat;
+    int fs_fd;
+    int first; // blocks [first, last) are this worker's
+    int last;
+    uint64_t* bad; // bitmap of blocks that failed; workers own whole words
+    int n_checked;
+    int n_bad;
+    long long bytes;
+} scrub_worker_t;
+
+/**
+ * check whether a block should be verified by `fs_scrub`
+ * @param fat filesystem
+ * @param block block index
+ * @return `true` if the block is allocated & has a checksum
+*/
+static bool scrub_wanted(uint16_t* fat, int block) {
+    return fat_get(fat, block) != 0 && table[block] != 0;
+}
+
+/**
+ * verify one range of blocks, reading runs of wanted blocks with one pread each
+ * @param arg the worker's `scrub_worker_t`
+ * @return `NULL`
+*/
+static void* scrub_range(void* arg) {
+    scrub_worker_t* w = (scrub_worker_t*) arg;
+    int block_size = fs_block_size(w->fat);
+    int batch_blocks = (SCRUB_BATCH_BYTES > block_size) ? SCRUB_BATCH_BYTES / block_size : 1;
+    char* buffer = safe_malloc((size_t) batch_blocks * block_size);
+
+    int b = w->first;
+    while (b < w->last) {
+        if (!scrub_wanted(w->fat, b)) {
+            b++;
+            continue;
+        }
+        int run = 1;
+        while (run < batch_blocks && b + run < w->last && scrub_wanted(w->fat, b + run)) run++;
+        safe_pread(w->fs_fd, buffer, (size_t) run * block_size, mem_idx(w->fat, b));
+        w->bytes += (long long) run * block_size;
+        for (int i = 0; i < run; i++) {
+            w->n_checked++;
+            if (checksum_block(&buffer[(size_t) i * block_size], block_size) != table[b + i]) {
+                w->n_bad++;
+                w->bad[(b + i) / 64] |= 1ULL << ((b + i) % 64);
+            }
+        }
+        b += run;
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * print the files that own failed blocks
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param bad bitmap of failed blocks
+ * @return none
+*/
+static void print_bad_files(uint16_t* fat, int fs_fd, uint64_t* bad) {
+    int block_size = fs_block_size(fat);
+    char* dir_block = safe_malloc(block_size);
+    for (int d = fs_root(fat); d != LASTBLOCK; d = fat_get(fat, d)) {
+        read_dir_block(fat, fs_fd, d, dir_block);
+        for (int i = 0; i < block_size / DIR_ENTRY_SIZE; i++) {
+            dir_entry_t entry;
+            memcpy(&entry, &dir_block[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
+            if (entry.name[0] <= FILENAME_DEL_INUSE || entry.name[0] == FILENAME_INLINE) continue;
+            int idx = 0;
+            for (int b = entry_first_block(fat, &entry); b != LASTBLOCK; b = fat_get(fat, b), idx++) {
+                if ((bad[b / 64] >> (b % 64)) & 1) {
+                    fprintf(stderr, "scrub: file:[%s] block %d (#%d in the file) fails its checksum\n", entry.name, b, idx);
+                }
+            }
+        }
+    }
+    free(dir_block);
+}
+
+bool fs_scrub(uint16_t* fat, int fs_fd, int n_threads, scrub_report_t* report) {
+    memset(report, 0, sizeof(scrub_report_t));
+    if (table == NULL) return true;
+    if (n_threads <= 0) n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads < 1) n_threads = 1;
+    if (n_threads > SCRUB_MAX_THREADS) n_threads = SCRUB_MAX_THREADS;
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int n_blocks = fs_n_blocks(fat);
+    uint64_t* bad = calloc(n_blocks / 64 + 1, sizeof(uint64_t));
+    scrub_worker_t workers[SCRUB_MAX_THREADS];
+    pthread_t threads[SCRUB_MAX_THREADS];
+    int per_worker = ((n_blocks / n_threads) / 64 + 1) * 64; // whole bitmap words per worker
+    for (int t = 0; t < n_threads; t++) {
+        scrub_worker_t* w = &workers[t];
+        memset(w, 0, sizeof(scrub_worker_t));
+        w->fat = fat;
+        w->fs_fd = fs_fd;
+        w->first = (t == 0) ? 1 : t * per_worker;
+        w->last = ((t + 1) * per_worker < n_blocks) ? (t + 1) * per_worker : n_blocks;
+        w->bad = bad;
+        if (w->first >= w->last) w->first = w->last; // nothing left for this worker
+        if (pthread_create(&threads[t], NULL, scrub_range, w) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < n_threads; t++) {
+        pthread_join(threads[t], NULL);
+        report->n_checked += workers[t].n_checked;
+        report->n_bad += workers[t].n_bad;
+        report->bytes += workers[t].bytes;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->n_threads = n_threads;
+    report->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (report->n_bad > 0) print_bad_files(fat, fs_fd, bad);
+    free(bad);
+    return report->n_bad == 0;
+}
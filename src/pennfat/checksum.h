@@ -0,0 +1,136 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fat.h"
+
+#pragma once
+
+// per-block checksum interface (v2 filesystems with FEATURE_CHECKSUM)
+//
+// The checksum table sits between the FAT (& journal) and the data region and holds
+// one CRC32C per block. File data blocks get their checksum when they are written and
+// are verified whenever they are read; `0` means "no checksum" (directory blocks,
+// free blocks), so a CRC that happens to be `0` is stored as `1`. On journaled filesystems the
+// table is mapped privately with the FAT and each update is logged in the same journal group as
+// the FAT updates around it, so a replayed image has the checksums of the files it replays.
+
+typedef struct scrub_report { // results of `fs_scrub`
+    int n_threads; // workers the image was split between
+    int n_checked; // blocks with a checksum that were verified
+    int n_bad; // blocks that failed their checksum
+    double seconds; // wall-clock time of the scan
+    long long bytes; // bytes read
+} scrub_report_t;
+
+/**
+ * compute a CRC32C (Castagnoli) with the fastest kernel the CPU supports:
+ * SSE4.2 or ARMv8 CRC instructions, otherwise slicing-by-8 tables
+ * @param crc `0` to start, or the result of the previous call to continue
+ * @param data bytes to add
+ * @param n_bytes length of `data`
+ * @return the CRC
+*/
+uint32_t crc32c(uint32_t crc, const void* data, size_t n_bytes);
+
+/**
+ * get the name of the CRC32C kernel in use
+ * @return `"sse4.2"`, `"armv8"`, or `"slicing-by-8"`
+*/
+const char* crc32c_kernel();
+
+/**
+ * compute the checksum table entry for a block's contents; unlike `checksum_update`, safe to
+ * call from any thread
+ * @param data the whole block
+ * @param block_size bytes per block
+ * @return the CRC, never `0` (which means "no checksum")
+*/
+uint32_t checksum_block(const char* data, int block_size);
+/**
+ * locate the checksum table of a mounted filesystem (called by `fs_mount`)
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @return none
+*/
+void checksum_mount(uint16_t* fat, int fs_fd);
+
+/**
+ * keep a private copy of the checksum table before the metadata mapping it lives in is
+ * unmapped (called by `snapshot_mount`: blocks a snapshot shares are never rewritten, so
+ * the live checksums still verify them)
+ * @param fat filesystem
+ * @return none
+*/
+void checksum_detach(uint16_t* fat);
+
+/**
+ * forget the checksum table (called by `fs_unmount`)
+ * @return none
+*/
+void checksum_unmount();
+
+/**
+ * check whether the mounted filesystem keeps checksums
+ * @return `true` if FEATURE_CHECKSUM is on
+*/
+bool checksum_enabled();
+
+/**
+ * record the checksum of a block that was just written (journaled with the running group)
+ * @param block block index
+ * @param data the whole block, `fs_block_size(fat)` bytes
+ * @param block_size bytes per block
+ * @return none
+*/
+void checksum_update(int block, const char* data, int block_size);
+/**
+ * record a checksum computed by `checksum_block` (journaled with the running group)
+ * @param block block index
+ * @param value the checksum
+ * @return none
+*/
+void checksum_set(int block, uint32_t value);
+
+/**
+ * record the checksum of a block that was partially rewritten, reading it back from disk
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param block block index
+ * @return none
+*/
+void checksum_refresh(uint16_t* fat, int fs_fd, int block);
+
+/**
+ * drop the checksum of a block (called by `fat_set` when the block is freed)
+ * @param block block index
+ * @return none
+*/
+void checksum_clear(int block);
+
+/**
+ * give a block the checksum of another (called when a block is copied inside the image)
+ * @param from block index of the original
+ * @param to block index of the copy
+ * @return none
+*/
+void checksum_copy(int from, int to);
+
+/**
+ * verify a block that was just read; prints a message on a mismatch
+ * @param block block index
+ * @param data the whole block
+ * @param block_size bytes per block
+ * @return `true` if the block has no checksum or matches it
+*/
+bool checksum_verify(int block, const char* data, int block_size);
+
+/**
+ * verify every allocated block that has a checksum, splitting the image between threads
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param n_threads number of worker threads, `0` for one per CPU
+ * @param report set to the results
+ * @return `true` if every checksum matched, `false` otherwise
+*/
+bool fs_scrub(uint16_t* fat, int fs_fd, int n_threads, scrub_report_t* report);
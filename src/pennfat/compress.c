@@ -0,0 +1,117 @@
+// compressed file data
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "fat.h"
+#include "lz.h"
+#include "safe.h"
+#include "../util/util.h"
+
+typedef struct extent_map { // start of a compressed file's chain, followed by `uint32_t ends[n_chunks]`
+    uint32_t n_bytes; // data bytes (the logical size of the encoding)
+    uint32_t n_chunks; // COMPRESS_CHUNK_SIZE-byte chunks; the last one may be shorter
+} extent_map_t;
+
+/**
+ * get the length of a chunk before compression
+ * @param map the extent map
+ * @param chunk chunk index
+ * @return bytes in the chunk
+*/
+static int chunk_bytes(extent_map_t* map, int chunk) {
+    int start = chunk * COMPRESS_CHUNK_SIZE;
+    int remaining = (int) map->n_bytes - start;
+    return (remaining < COMPRESS_CHUNK_SIZE) ? remaining : COMPRESS_CHUNK_SIZE;
+}
+
+int compress_encode(const char* data, int n_bytes, char** encoded) {
+    extent_map_t map = { (uint32_t) n_bytes, (uint32_t) ((n_bytes + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE) };
+    int map_bytes = sizeof(map) + map.n_chunks * sizeof(uint32_t);
+    char* out = safe_malloc(map_bytes + n_bytes); // worst case: every chunk is stored raw
+    memcpy(out, &map, sizeof(map));
+
+    int pos = map_bytes;
+    for (int c = 0; c < map.n_chunks; c++) {
+        const char* chunk = &data[c * COMPRESS_CHUNK_SIZE];
+        int len = chunk_bytes(&map, c);
+        int packed = lz_compress(chunk, len, &out[pos], len - 1); // must shrink, so raw chunks are recognizable
+        if (packed == 0) {
+            memcpy(&out[pos], chunk, len);
+            packed = len;
+        }
+        pos += packed;
+        uint32_t end = pos - map_bytes;
+        memcpy(&out[sizeof(map) + c * sizeof(uint32_t)], &end, sizeof(end));
+    }
+    *encoded = out;
+    return pos;
+}
+
+bool compress_read(uint16_t* fat, int fs_fd, int head, int offset, char* buffer, int n_bytes) {
+    if (n_bytes <= 0) return true;
+    extent_map_t map;
+    bool ok = read_chain_range(fat, fs_fd, head, 0, (char*) &map, sizeof(map));
+    int map_bytes = sizeof(map) + map.n_chunks * sizeof(uint32_t);
+    int first = offset / COMPRESS_CHUNK_SIZE;
+    int last = (offset + n_bytes - 1) / COMPRESS_CHUNK_SIZE;
+
+    // ends[0] is where chunk `first` starts, ends[i] is where chunk `first + i - 1` ends
+    int n_ends = last - first + 2;
+    uint32_t* ends = safe_malloc(n_ends * sizeof(uint32_t));
+    if (first == 0) {
+        ends[0] = 0;
+        ok &= read_chain_range(fat, fs_fd, head, sizeof(map), (char*) &ends[1], (n_ends - 1) * sizeof(uint32_t));
+    } else {
+        ok &= read_chain_range(fat, fs_fd, head, sizeof(map) + (first - 1) * sizeof(uint32_t), (char*) ends, n_ends * sizeof(uint32_t));
+    }
+
+    // the chunks are contiguous, so fetch them with one read
+    int span = ends[n_ends - 1] - ends[0];
+    char* packed = safe_malloc(span);
+    ok &= read_chain_range(fat, fs_fd, head, map_bytes + ends[0], packed, span);
+
+    char* chunk = safe_malloc(COMPRESS_CHUNK_SIZE);
+    for (int c = first; c <= last; c++) {
+        int len = chunk_bytes(&map, c);
+        if (len <= 0) break; // map is corrupt (`fsck` reports it)
+        int packed_len = ends[c - first + 1] - ends[c - first];
+        char* src = &packed[ends[c - first] - ends[0]];
+        char* plain = src; // raw chunk
+        if (packed_len != len) {
+            if (lz_decompress(src, packed_len, chunk, len) != len) {
+                fprintf(stderr, "compressed chunk %d is corrupt\n", c);
+                memset(chunk, 0, len);
+            }
+            plain = chunk;
+        }
+
+        // copy the overlap of the chunk & the requested range
+        int chunk_start = c * COMPRESS_CHUNK_SIZE;
+        int from = (offset > chunk_start) ? offset : chunk_start;
+        int to = (offset + n_bytes < chunk_start + len) ? offset + n_bytes : chunk_start + len;
+        memcpy(&buffer[from - offset], &plain[from - chunk_start], to - from);
+    }
+    free(chunk);
+    free(packed);
+    free(ends);
+    return ok;
+}
+
+int compress_stored_bytes(uint16_t* fat, int fs_fd, int head, int chain_bytes) {
+    extent_map_t map;
+    if (head == LASTBLOCK || chain_bytes < sizeof(map)) return -1;
+    read_chain_range(fat, fs_fd, head, 0, (char*) &map, sizeof(map));
+    long long map_bytes = sizeof(map) + (long long) map.n_chunks * sizeof(uint32_t);
+    if (map.n_chunks != (map.n_bytes + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE) return -1;
+    if (map_bytes > chain_bytes) return -1;
+    if (map.n_chunks == 0) return (int) map_bytes;
+
+    uint32_t end;
+    read_chain_range(fat, fs_fd, head, sizeof(map) + (map.n_chunks - 1) * sizeof(uint32_t), (char*) &end, sizeof(end));
+    return (int) (map_bytes + end);
+}
@@ -0,0 +1,46 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fat.h"
+
+#pragma once
+
+// compressed file data (files with the FILETYPE_COMPRESSED attribute)
+//
+// The chain of a compressed file holds an extent map followed by the data, split into
+// COMPRESS_CHUNK_SIZE-byte chunks that are each compressed with `lz_compress` (or stored
+// raw if they don't shrink). The map is the number of data bytes, the number of chunks,
+// and the end offset of every chunk, so a read decodes only the chunks it overlaps.
+
+#define COMPRESS_CHUNK_SIZE 4096
+
+/**
+ * encode file data as an extent map & compressed chunks
+ * @param data the file data
+ * @param n_bytes length of `data`
+ * @param encoded set to the encoding (malloc'd; the caller frees it)
+ * @return length of the encoding
+*/
+int compress_encode(const char* data, int n_bytes, char** encoded);
+
+/**
+ * read a range of a compressed file, decoding only the chunks it overlaps
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param head the first index of the file's chain
+ * @param offset first byte to read
+ * @param buffer what to read into; assume this has enough space
+ * @param n_bytes bytes to read; `offset + n_bytes` is at most the file size
+ * @return `false` if a block failed its checksum, `true` otherwise
+*/
+bool compress_read(uint16_t* fat, int fs_fd, int head, int offset, char* buffer, int n_bytes);
+
+/**
+ * get the length of a compressed file's encoding from its extent map (for `fs_fsck`)
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param head the first index of the file's chain
+ * @param chain_bytes bytes in the chain; the map must fit in them
+ * @return length of the encoding, or `-1` if the map is corrupt
+*/
+int compress_stored_bytes(uint16_t* fat, int fs_fd, int head, int chain_bytes);
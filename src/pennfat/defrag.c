@@ -0,0 +1,238 @@
+// defragmenter
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+#include "defrag.h"
+#include "fat.h"
+#include "journal.h"
+#include "safe.h"
+#include "../util/util.h"
+
+#define DEFRAG_CHUNK_BLOCKS 256 // blocks copied per write
+
+int chain_extents(uint16_t* fat, int head, int* n_blocks) {
+    int n = 0;
+    int n_extents = 0;
+    int prev = 0;
+    for (int curr = head; curr != LASTBLOCK; curr = fat_get(fat, curr)) {
+        if (n == 0 || curr != prev + 1) n_extents++;
+        prev = curr;
+        n++;
+    }
+    if (n_blocks != NULL) *n_blocks = n;
+    return n_extents;
+}
+
+/**
+ * check whether a directory slot is a file with a chain
+ * @param fat filesystem
+ * @param entry the slot
+ * @return `true` if it is a live, non-inline file with at least one block
+*/
+static bool has_chain(uint16_t* fat, dir_entry_t* entry) {
+    if (entry->name[0] <= FILENAME_INLINE) return false; // free, deleted or inline data
+    if (entry->type == FILETYPE_SNAPSHOT) return false; // the snapshot's own blocks stay put
+    return entry_first_block(fat, entry) != LASTBLOCK;
+}
+
+/**
+ * walk the root directory, calling `visit` on every file with a chain
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param visit called with each file & its extents and blocks
+ * @param arg passed to `visit`
+ * @return none
+*/
+static void for_each_chain(uint16_t* fat, int fs_fd, void (*visit)(dir_entry_t*, int, int, void*), void* arg) {
+    int block_size = fs_block_size(fat);
+    char* dir_block = safe_malloc(block_size);
+    for (int b = fs_root(fat); b != LASTBLOCK; b = fat_get(fat, b)) {
+        read_dir_block(fat, fs_fd, b, dir_block);
+        for (int i = 0; i < block_size / DIR_ENTRY_SIZE; i++) {
+            dir_entry_t entry;
+            memcpy(&entry, &dir_block[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
+            if (!has_chain(fat, &entry)) continue;
+            int n_blocks;
+            int n_extents = chain_extents(fat, entry_first_block(fat, &entry), &n_blocks);
+            visit(&entry, n_extents, n_blocks, arg);
+        }
+    }
+    free(dir_block);
+}
+
+static void add_stats(dir_entry_t* entry, int n_extents, int n_blocks, void* arg) {
+    frag_stats_t* stats = arg;
+    stats->n_files++;
+    if (n_extents > 1) stats->n_fragmented++;
+    stats->n_blocks += n_blocks;
+    stats->n_extents += n_extents;
+    if (n_extents > stats->max_extents) stats->max_extents = n_extents;
+}
+
+void fs_frag_stats(uint16_t* fat, int fs_fd, frag_stats_t* stats) {
+    memset(stats, 0, sizeof(frag_stats_t));
+    for_each_chain(fat, fs_fd, add_stats, stats);
+}
+
+void frag_format(char* buffer, int size, const char* label, frag_stats_t* stats) {
+    double per_file = (stats->n_files > 0) ? (double) stats->n_extents / stats->n_files : 0.0;
+    double avg_run = (stats->n_extents > 0) ? (double) stats->n_blocks / stats->n_extents : 0.0;
+    snprintf(buffer, size, "defrag: %s: %d files, %lld extents (%.2f per file, at most %d), average run %.1f blocks, %d fragmented\n",
+             label, stats->n_files, stats->n_extents, per_file, stats->max_extents, avg_run, stats->n_fragmented);
+}
+
+typedef struct plan_state { // `defrag_plan` in progress
+    defrag_candidate_t* files;
+    int n_files;
+    int capacity;
+} plan_state_t;
+
+static void add_candidate(dir_entry_t* entry, int n_extents, int n_blocks, void* arg) {
+    plan_state_t* plan = arg;
+    if (n_extents <= 1) return;
+    if (plan->n_files == plan->capacity) {
+        plan->capacity = (plan->capacity == 0) ? 16 : plan->capacity * 2;
+        plan->files = realloc(plan->files, plan->capacity * sizeof(defrag_candidate_t));
+    }
+    defrag_candidate_t* file = &plan->files[plan->n_files++];
+    memcpy(file->name, entry->name, sizeof(file->name));
+    file->n_extents = n_extents;
+    file->n_blocks = n_blocks;
+}
+
+static int most_fragmented_first(const void* a, const void* b) {
+    const defrag_candidate_t* x = a;
+    const defrag_candidate_t* y = b;
+    if (x->n_extents != y->n_extents) return y->n_extents - x->n_extents;
+    return y->n_blocks - x->n_blocks; // ties: the larger file has more to gain
+}
+
+int defrag_plan(uint16_t* fat, int fs_fd, defrag_candidate_t** plan) {
+    plan_state_t state = { NULL, 0, 0 };
+    for_each_chain(fat, fs_fd, add_candidate, &state);
+    if (state.n_files > 1) qsort(state.files, state.n_files, sizeof(defrag_candidate_t), most_fragmented_first);
+    *plan = state.files;
+    return state.n_files;
+}
+
+/**
+ * copy a chain, in order, into a run of blocks
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param blocks the chain's blocks, in order
+ * @param n_blocks length of `blocks`
+ * @param target first block of the run
+ * @return `false` if a block failed its checksum (nothing was allocated), `true` otherwise
+*/
+static bool copy_chain(uint16_t* fat, int fs_fd, int* blocks, int n_blocks, int target) {
+    int block_size = fs_block_size(fat);
+    int chunk_blocks = (n_blocks < DEFRAG_CHUNK_BLOCKS) ? n_blocks : DEFRAG_CHUNK_BLOCKS;
+    char* buffer = safe_malloc((size_t) chunk_blocks * block_size);
+    bool ok = true;
+    for (int first = 0; first < n_blocks && ok; first += chunk_blocks) {
+        int n = (n_blocks - first < chunk_blocks) ? n_blocks - first : chunk_blocks;
+        for (int i = 0; i < n; ) { // one read per run of consecutive source blocks
+            int run = 1;
+            while (i + run < n && blocks[first + i + run] == blocks[first + i] + run) run++;
+            safe_pread(fs_fd, &buffer[(size_t) i * block_size], (size_t) run * block_size, mem_idx(fat, blocks[first + i]));
+            i += run;
+        }
+        for (int i = 0; i < n; i++) {
+            ok &= checksum_verify(blocks[first + i], &buffer[(size_t) i * block_size], block_size);
+        }
+        if (!ok) { // forget the checksums of the partial copy; its blocks stay free
+            for (int i = 0; i < first; i++) checksum_clear(target + i);
+            break;
+        }
+        safe_pwrite(fs_fd, buffer, (size_t) n * block_size, mem_idx(fat, target + first));
+        for (int i = 0; i < n; i++) {
+            checksum_update(target + first + i, &buffer[(size_t) i * block_size], block_size);
+        }
+    }
+    free(buffer);
+    return ok;
+}
+
+defrag_result_t defrag_move(uint16_t* fat, int fs_fd, const char* filename, int* n_moved) {
+    if (n_moved != NULL) *n_moved = 0;
+    point_t location;
+    dir_entry_t entry;
+    if (!find_file(fat, fs_fd, fs_root(fat), filename, &location, &entry)) return DEFRAG_NOT_FOUND;
+    if (!has_chain(fat, &entry)) return DEFRAG_CONTIGUOUS;
+    int head = entry_first_block(fat, &entry);
+    int n_blocks;
+    if (chain_extents(fat, head, &n_blocks) <= 1) return DEFRAG_CONTIGUOUS;
+    if (chain_shared(fat, fs_fd, location, &entry)) return DEFRAG_SHARED; // moving it would strand the other file
+
+    int target = get_free_extent(fat, 0, n_blocks);
+    if ((target == 0 || fs_free_run(fat, target, n_blocks) < n_blocks) && fs_reclaim_freed(fat)) { // runs freed by earlier moves
+        target = get_free_extent(fat, 0, n_blocks);
+    }
+    if (target == 0 || fs_free_run(fat, target, n_blocks) < n_blocks) return DEFRAG_NO_SPACE;
+
+    int* blocks = safe_malloc(n_blocks * sizeof(int));
+    int i = 0;
+    for (int curr = head; curr != LASTBLOCK; curr = fat_get(fat, curr)) blocks[i++] = curr;
+
+    // the copy is written before anything points at it, so a crash leaves the old chain intact
+    if (!copy_chain(fat, fs_fd, blocks, n_blocks, target)) {
+        free(blocks);
+        return DEFRAG_BAD_BLOCK;
+    }
+
+    journal_begin();
+    for (i = 0; i < n_blocks; i++) {
+        fat_set(fat, target + i, (i == n_blocks - 1) ? LASTBLOCK : target + i + 1);
+    }
+    entry_set_first_block(fat, &entry, target);
+    write_file(fat, fs_fd, location, entry);
+    for (i = 0; i < n_blocks; i++) fat_set(fat, blocks[i], 0); // snapshots keep holding theirs
+    fat_sync(fat);
+    journal_end(fat);
+
+    free(blocks);
+    if (n_moved != NULL) *n_moved = n_blocks;
+    return DEFRAG_MOVED;
+}
+
+void defrag_count(defrag_report_t* report, defrag_result_t result, int n_blocks) {
+    switch (result) {
+        case DEFRAG_MOVED: report->n_moved++; report->n_blocks_moved += n_blocks; break;
+        case DEFRAG_NO_SPACE: report->n_no_space++; break;
+        case DEFRAG_BAD_BLOCK: report->n_bad++; break;
+        case DEFRAG_SHARED: report->n_shared++; break;
+        default: break;
+    }
+}
+
+void defrag_format(char* buffer, int size, defrag_report_t* report) {
+    snprintf(buffer, size, "defrag: moved %d files (%lld blocks) in %.3f s; left %d open, %d shared, %d without a long enough free run, %d with bad blocks\n",
+             report->n_moved, report->n_blocks_moved, report->seconds, report->n_busy, report->n_shared, report->n_no_space, report->n_bad);
+}
+
+void fs_defrag(uint16_t* fat, int fs_fd, defrag_report_t* report) {
+    memset(report, 0, sizeof(defrag_report_t));
+    fs_frag_stats(fat, fs_fd, &report->before);
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    defrag_candidate_t* plan;
+    int n_files = defrag_plan(fat, fs_fd, &plan);
+    for (int f = 0; f < n_files; f++) {
+        int n_blocks;
+        defrag_result_t result = defrag_move(fat, fs_fd, plan[f].name, &n_blocks);
+        defrag_count(report, result, n_blocks);
+    }
+    free(plan);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fs_frag_stats(fat, fs_fd, &report->after);
+}
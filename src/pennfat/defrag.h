@@ -0,0 +1,122 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fat.h"
+
+#pragma once
+
+// defragmenter interface
+//
+// A file's chain is moved by copying it, in order, into the first run of free blocks that
+// holds all of it, then pointing the directory entry at the copy and freeing the old chain
+// (the switch goes through the journal on journaled filesystems). Files are moved one at a
+// time, most fragmented first, so the caller can check each one against its open files.
+
+typedef struct frag_stats { // fragmentation of the files in the root directory
+    int n_files; // files with a chain
+    int n_fragmented; // files with more than one extent
+    long long n_blocks; // blocks in their chains
+    long long n_extents; // runs of consecutive blocks in their chains
+    int max_extents; // extents of the most fragmented file
+} frag_stats_t;
+
+typedef struct defrag_candidate { // a fragmented file, from `defrag_plan`
+    char name[32];
+    int n_extents;
+    int n_blocks;
+} defrag_candidate_t;
+
+typedef enum defrag_result { // outcome of `defrag_move`
+    DEFRAG_MOVED, // the chain is now one extent
+    DEFRAG_CONTIGUOUS, // nothing to do
+    DEFRAG_NO_SPACE, // no free run is long enough
+    DEFRAG_BAD_BLOCK, // a block failed its checksum, so the file was left where it is
+    DEFRAG_SHARED, // another file shares the chain (`cp -s`), so it was left where it is
+    DEFRAG_NOT_FOUND // the file no longer exists
+} defrag_result_t;
+
+typedef struct defrag_report { // results of `fs_defrag`
+    frag_stats_t before;
+    frag_stats_t after;
+    int n_moved; // files moved into one extent
+    long long n_blocks_moved;
+    int n_no_space; // files left alone because no free run was long enough
+    int n_bad; // files left alone because a block failed its checksum
+    int n_busy; // files left alone because they were open
+    int n_shared; // files left alone because they share their chain with another file
+    double seconds; // wall-clock time of the moves
+} defrag_report_t;
+
+/**
+ * count the extents (runs of consecutive blocks) of a chain
+ * @param fat filesystem
+ * @param head the first index of the chain
+ * @param n_blocks if not `NULL`, set to the number of blocks in the chain
+ * @return the number of extents, `0` for an empty chain
+*/
+int chain_extents(uint16_t* fat, int head, int* n_blocks);
+
+/**
+ * measure the fragmentation of the files in the root directory
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param stats set to the results
+ * @return none
+*/
+void fs_frag_stats(uint16_t* fat, int fs_fd, frag_stats_t* stats);
+
+/**
+ * format fragmentation metrics as one line
+ * @param buffer what to write into
+ * @param size length of `buffer`
+ * @param label what the metrics describe (`"before"`, `"after"`)
+ * @param stats the metrics
+ * @return none
+*/
+void frag_format(char* buffer, int size, const char* label, frag_stats_t* stats);
+
+/**
+ * list the fragmented files, most fragmented first
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param plan set to the files (malloc'd; the caller frees it)
+ * @return the number of files in `plan`
+*/
+int defrag_plan(uint16_t* fat, int fs_fd, defrag_candidate_t** plan);
+
+/**
+ * move a file's chain into one run of free blocks
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param filename the file
+ * @param n_moved if not `NULL`, set to the number of blocks moved
+ * @return what happened
+*/
+defrag_result_t defrag_move(uint16_t* fat, int fs_fd, const char* filename, int* n_moved);
+
+/**
+ * defragment every file in the root directory, most fragmented first
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param report set to the results, including fragmentation before & after
+ * @return none
+*/
+void fs_defrag(uint16_t* fat, int fs_fd, defrag_report_t* report);
+
+/**
+ * count the outcome of a `defrag_move` in a report
+ * @param report the report
+ * @param result what `defrag_move` returned
+ * @param n_blocks blocks it moved
+ * @return none
+*/
+void defrag_count(defrag_report_t* report, defrag_result_t result, int n_blocks);
+
+/**
+ * format the moves of a report as one line (use `frag_format` for the before & after metrics)
+ * @param buffer what to write into
+ * @param size length of `buffer`
+ * @param report the report
+ * @return none
+*/
+void defrag_format(char* buffer, int size, defrag_report_t* report);
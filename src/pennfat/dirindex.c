@@ -0,0 +1,122 @@
+// root directory name index
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirindex.h"
+#include "fat.h"
+#include "../util/util.h"
+
+#define INDEX_MIN_NAMES 64
+
+typedef struct name_slot { // open-addressed hash table slot
+    char name[32]; // empty if the slot is unused
+    point_t location; // directory slot the name was last written to
+} name_slot_t;
+
+static uint16_t* index_fat = NULL; // filesystem the index was built for, `NULL` if none
+static name_slot_t* table = NULL;
+static size_t table_cap = 0; // number of slots, a power of 2
+static size_t table_used = 0; // number of names
+static int free_block = 0; // first root directory block that may have a free slot
+
+static uint32_t name_hash(const char* name) { // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 32 && name[i] != '\0'; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static name_slot_t* table_slot(const char* name) {
+    size_t mask = table_cap - 1;
+    for (size_t i = name_hash(name) & mask; ; i = (i + 1) & mask) {
+        if (table[i].name[0] == '\0' || strncmp(table[i].name, name, 32) == 0) return &table[i];
+    }
+}
+
+static bool findable(dir_entry_t* entry) { // the entries `find_file` can return
+    if (entry->name[0] < FILENAME_DEL_INUSE || entry->name[0] == FILENAME_INLINE) return false;
+    return entry->type != FILETYPE_SNAPSHOT;
+}
+
+static void table_insert(const char* name, point_t location) {
+    name_slot_t* slot = table_slot(name);
+    if (slot->name[0] == '\0') {
+        snprintf(slot->name, sizeof(slot->name), "%.31s", name);
+        table_used++;
+    }
+    slot->location = location;
+}
+
+/**
+ * read the whole root directory into a new index
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @return none
+*/
+static void build(uint16_t* fat, int fs_fd) {
+    int block_size = fs_block_size(fat);
+    int n_entries = block_size / DIR_ENTRY_SIZE;
+    size_t n_slots = 0;
+    for (int b = fs_root(fat); b != LASTBLOCK; b = fat_get(fat, b)) n_slots += n_entries;
+
+    // room for the directory to double before the index is rebuilt
+    table_cap = 1;
+    while (table_cap < 4 * (n_slots + INDEX_MIN_NAMES)) table_cap *= 2;
+    free(table);
+    table = safe_malloc(table_cap * sizeof(name_slot_t));
+    memset(table, 0, table_cap * sizeof(name_slot_t));
+    table_used = 0;
+
+    char* dir_block = safe_malloc(block_size);
+    for (int b = fs_root(fat); b != LASTBLOCK; b = fat_get(fat, b)) {
+        read_dir_block(fat, fs_fd, b, dir_block);
+        for (int i = 0; i < n_entries; i++) {
+            dir_entry_t* entry = (dir_entry_t*) &dir_block[i * DIR_ENTRY_SIZE];
+            if (findable(entry)) table_insert(entry->name, (point_t) { b, i });
+        }
+    }
+    free(dir_block);
+    free_block = fs_root(fat);
+    index_fat = fat;
+}
+
+bool dirindex_find(uint16_t* fat, int fs_fd, const char* filename, point_t* loc) {
+    if (index_fat != fat) build(fat, fs_fd);
+    name_slot_t* slot = table_slot(filename);
+    if (slot->name[0] == '\0') return false;
+    *loc = slot->location;
+    return true;
+}
+
+void dirindex_note(uint16_t* fat, point_t location, dir_entry_t* entry) {
+    if (index_fat != fat) return;
+    if (entry->name[0] == FILENAME_ENDDIR || entry->name[0] == FILENAME_DEL_UNUSED) {
+        free_block = fs_root(fat); // may be anywhere in the chain
+    } else if (findable(entry)) {
+        table_insert(entry->name, location);
+        if (table_used * 2 > table_cap) dirindex_reset(); // rebuilt, without stale names, on the next lookup
+    }
+}
+
+int dirindex_free_block(uint16_t* fat) {
+    return (index_fat == fat) ? free_block : fs_root(fat);
+}
+
+void dirindex_set_free_block(uint16_t* fat, int block) {
+    if (index_fat == fat) free_block = block;
+}
+
+void dirindex_reset() {
+    free(table);
+    table = NULL;
+    table_cap = 0;
+    table_used = 0;
+    index_fat = NULL;
+    free_block = 0;
+}
@@ -0,0 +1,55 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fat.h"
+
+#pragma once
+
+// root directory name index interface
+//
+// Maps every file name in the root directory to the slot it was last written to, so
+// `find_file` reads one directory block instead of the whole directory, and remembers
+// the first directory block that may have a free slot for `add_file`. The index is built
+// from the directory on first use and kept up to date by `write_file`; a slot that was
+// rewritten since (renamed, deleted, moved by an inline store) is caught by checking the
+// entry itself, so names never need to be removed.
+
+/**
+ * look a name up, building the index if the mounted filesystem doesn't have one yet
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param filename the file to look up
+ * @param loc set to the slot the name was last written to
+ * @return `false` if the root directory has no file with that name
+*/
+bool dirindex_find(uint16_t* fat, int fs_fd, const char* filename, point_t* loc);
+
+/**
+ * record a directory entry written by `write_file` (no-op if there is no index)
+ * @param fat filesystem
+ * @param location the slot
+ * @param entry the new entry
+ * @return none
+*/
+void dirindex_note(uint16_t* fat, point_t location, dir_entry_t* entry);
+
+/**
+ * get where `add_file` should start looking for a free slot
+ * @param fat filesystem
+ * @return a root directory block; every slot in the blocks before it is in use
+*/
+int dirindex_free_block(uint16_t* fat);
+
+/**
+ * record where `add_file` found a free slot
+ * @param fat filesystem
+ * @param block the root directory block
+ * @return none
+*/
+void dirindex_set_free_block(uint16_t* fat, int block);
+
+/**
+ * forget the index (called by `fs_unmount`)
+ * @return none
+*/
+void dirindex_reset();
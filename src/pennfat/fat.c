@@ -1,43 +1,215 @@
 // FAT manipulation functions
 
+#define _GNU_SOURCE // SEEK_DATA, SEEK_HOLE
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "checksum.h"
+#include "compress.h"
+#include "dirindex.h"
 #include "fat.h"
+#include "fsck.h"
+#include "hostcp.h"
+#include "journal.h"
 #include "safe.h"
+#include "snapshot.h"
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int) // from <linux/fs.h>, which clashes with BLOCK_SIZE
+#endif
 
 const int DIR_ENTRY_SIZE = 64;
 
 const int ROOTDIR = 1;
 const int DEFAULT_PERMISSIONS = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; // octal 0644
 
-const int LASTBLOCK = 0xFFFF; // -1 16bit
+const int LASTBLOCK = -1; // end of chain; stored as 0xFFFF (v1) or 0xFFFFFFFF (v2)
 const int BITS_PER_BYTE = 8;
 const int BYTE_SIZE = 1 << BITS_PER_BYTE; // 256
 
+const int FS_VERSION_1 = 1;
+const int FS_VERSION_2 = 2;
+const uint32_t FS_MAGIC = 0x54414650; // "PFAT"; low 16 bits are never a valid v1 fat[0]
+const int FS_SUPERBLOCK_SIZE = 256;
+
+const int MAX_FAT_BLOCKS_V1 = 32;
+const int MAX_FAT_BLOCKS_V2 = 65535;
+const int MAX_BLOCK_SIZE_CONFIG_V1 = 4; // 4 KB
+const int MAX_BLOCK_SIZE_CONFIG_V2 = 8; // 64 KB
+
+const uint32_t FEATURE_JOURNAL = 0x1;
+const uint32_t FEATURE_INLINE = 0x2;
+const uint32_t FEATURE_COMPRESS = 0x4;
+const uint32_t FEATURE_CHECKSUM = 0x8;
+const uint32_t FS_FEATURES_SUPPORTED = 0xF; // FEATURE_JOURNAL | FEATURE_INLINE | FEATURE_COMPRESS | FEATURE_CHECKSUM
+
+#define LASTBLOCK_V1 0xFFFF // LASTBLOCK as stored in a 16-bit FAT entry
+#define INLINE_HEAD_OFFSET 48 // offsetof(dir_entry_t, firstBlockHi): inline data starts here
+#define ALLOC_NEAR_WINDOW 64 // blocks past the goal that `get_free_block_near` searches before giving up
+#define MAX_IMAGE_BYTES ((off_t) 1 << 40) // 1 TB; images are sparse, but host filesystems cap file sizes
+
 // uint8_t type
 const int FILETYPE_UNKNOWN =    0;
 const int FILETYPE_FILE =       1;
 const int FILETYPE_DIRECTORY =  2;
 const int FILETYPE_LINK =       4;
+const int FILETYPE_SNAPSHOT =   8; // v2 only, hidden from `ls` & `find_file`
+const int FILETYPE_INLINE =     16; // flag: data is stored in the directory slots, not a chain
+const int FILETYPE_COMPRESSED = 32; // flag: the chain holds compressed chunks (`compress.h`)
+const int FILETYPE_SHARED =     64; // flag: the chain was shared by `cp -s` & other files may still use it
 // char name[32]
 const int FILENAME_ENDDIR =     0;
 const int FILENAME_DEL_UNUSED = 1;
 const int FILENAME_DEL_INUSE =  2;
+const int FILENAME_INLINE =     3; // continuation slot of an inline file
 // uint8_t perm
 const int FILEPERM_NONE =       0;
 const int FILEPERM_RD =         0b100;
 const int FILEPERM_WR =         0b010;
 const int FILEPERM_EX =         0b001;
 
+static int free_hint = 1; // every block below this one is allocated
+static bool sync_deferred = false; // `fat_sync` is a no-op until `fs_defer_sync(fat, false)`
+
+// format accessors
+
+int fs_version(uint16_t* fat) {
+    superblock_t* sb = (superblock_t*) fat;
+    if (sb->magic == FS_MAGIC) return sb->version;
+    return FS_VERSION_1;
+}
+
+superblock_t* fs_superblock(uint16_t* fat) {
+    if (fs_version(fat) == FS_VERSION_1) return NULL;
+    return (superblock_t*) fat;
+}
+
+int fs_block_size(uint16_t* fat) {
+    superblock_t* sb = fs_superblock(fat);
+    if (sb == NULL) return BLOCK_SIZE(fat[0]);
+    return sb->block_size;
+}
+
+int fs_n_entries(uint16_t* fat) {
+    superblock_t* sb = fs_superblock(fat);
+    if (sb == NULL) return FAT_BLOCKS(fat[0]) * BLOCK_SIZE(fat[0]) / sizeof(uint16_t);
+    return sb->block_count;
+}
+
+int fs_n_blocks(uint16_t* fat) {
+    int n_entries = fs_n_entries(fat);
+    if (fs_version(fat) == FS_VERSION_1 && n_entries > LASTBLOCK_V1) {
+        n_entries = LASTBLOCK_V1; // block 0xFFFF is indistinguishable from LASTBLOCK
+    }
+    return n_entries;
+}
+
+void fs_seed_free(uint16_t* fat, int free_blocks, int first_free) {
+    free_hint = (first_free == 0) ? fs_n_blocks(fat) : first_free;
+    superblock_t* sb = fs_superblock(fat);
+    if (sb != NULL) sb->free_blocks = free_blocks;
+}
+
+size_t fs_meta_size(uint16_t* fat) {
+    superblock_t* sb = fs_superblock(fat);
+    if (sb == NULL) return (size_t) FAT_BLOCKS(fat[0]) * BLOCK_SIZE(fat[0]);
+    return (size_t) sb->meta_blocks * sb->block_size;
+}
+
+int fs_root(uint16_t* fat) {
+    superblock_t* sb = fs_superblock(fat);
+    if (sb == NULL) return ROOTDIR;
+    return sb->root_dir;
+}
+
+/**
+ * get the 32-bit FAT of a v2 filesystem
+ * @param fat filesystem
+ * @return the first FAT entry (entry 0)
+*/
+static uint32_t* fat32(uint16_t* fat) {
+    return (uint32_t*) ((char*) fat + fs_superblock(fat)->fat_offset);
+}
+
+int fat_get(uint16_t* fat, int idx) {
+    if (fs_version(fat) == FS_VERSION_1) {
+        uint16_t value = fat[idx];
+        return (value == LASTBLOCK_V1) ? LASTBLOCK : value;
+    }
+    return (int) fat32(fat)[idx];
+}
+
+void fat_set(uint16_t* fat, int idx, int value) {
+    bool held = (value == 0) && snapshot_frozen(idx); // still allocated by a snapshot, so not free
+    if (value == 0 && idx < free_hint && !journal_active() && !held) free_hint = idx; // else once the journal commits the free
+    superblock_t* sb = fs_superblock(fat);
+    if (sb == NULL) {
+        fat[idx] = (value == LASTBLOCK) ? LASTBLOCK_V1 : value;
+        return;
+    }
+    uint32_t* table = fat32(fat);
+    if (table[idx] == 0 && value != 0) sb->free_blocks--;
+    else if (table[idx] != 0 && value == 0 && !held) sb->free_blocks++;
+    if (journal_active()) journal_log_fat(idx, (int) table[idx], value);
+    table[idx] = (uint32_t) value;
+    if (value == 0) checksum_clear(idx);
+}
+
+void fs_release_block(int idx) {
+    if (idx < free_hint) free_hint = idx;
+}
+
+bool fs_reclaim_freed(uint16_t* fat) {
+    if (!journal_active() || journal_n_freed() == 0) return false;
+    journal_commit(fat);
+    return journal_n_freed() == 0; // not if an operation is half done
+}
+
+void fat_sync(uint16_t* fat) {
+    if (journal_active()) return; // the FAT is mapped privately & reaches disk through the journal
+    if (sync_deferred) return; // flushed once by `fs_defer_sync(fat, false)` or `fs_unmount`
+    safe_msync(fat, fs_meta_size(fat), MS_SYNC);
+}
+
+void fs_sync(uint16_t* fat) {
+    if (journal_active()) journal_commit(fat);
+    else safe_msync(fat, fs_meta_size(fat), MS_SYNC);
+}
+
+void fs_defer_sync(uint16_t* fat, bool defer) {
+    sync_deferred = defer;
+    if (!defer && fat != NULL) fs_sync(fat);
+}
+
+void fs_tick(uint16_t* fat) {
+    if (fat != NULL && journal_active()) journal_tick(fat);
+}
+
+int entry_first_block(uint16_t* fat, dir_entry_t* entry) {
+    if (entry->type & FILETYPE_INLINE) return LASTBLOCK; // no chain
+    if (fs_version(fat) == FS_VERSION_1) {
+        return (entry->firstBlock == LASTBLOCK_V1) ? LASTBLOCK : entry->firstBlock;
+    }
+    return (int) (((uint32_t) entry->firstBlockHi << 16) | entry->firstBlock);
+}
+
+void entry_set_first_block(uint16_t* fat, dir_entry_t* entry, int block) {
+    entry->firstBlock = (uint16_t) block; // LASTBLOCK truncates to 0xFFFF
+    entry->firstBlockHi = (fs_version(fat) == FS_VERSION_1) ? 0 : (uint16_t) ((uint32_t) block >> 16);
+}
+
 // helper functions
 
 /**
@@ -46,30 +218,164 @@ const int FILEPERM_EX =         0b001;
  * @param block_idx block index
  * @return the address/index in memory of `block_idx`
 */
-int mem_idx(uint16_t* fat, int block_idx) {
-    uint16_t metadata = fat[0];
-    int fat_blocks = FAT_BLOCKS(metadata);
-    int block_size = BLOCK_SIZE(metadata);
-    return (block_size*fat_blocks + block_size*(block_idx-1));
+off_t mem_idx(uint16_t* fat, int block_idx) {
+    return (off_t) fs_meta_size(fat) + (off_t) fs_block_size(fat) * (block_idx - 1);
+}
+
+/**
+ * read a whole directory block, including journaled entries that aren't checkpointed yet
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param block_idx block index of the directory block
+ * @param buffer where to read the block into, `fs_block_size(fat)` bytes
+ * @return none
+*/
+void read_dir_block(uint16_t* fat, int fs_fd, int block_idx, char* buffer) {
+    int block_size = fs_block_size(fat);
+    safe_lseek(fs_fd, mem_idx(fat, block_idx), SEEK_SET);
+    safe_read(fs_fd, buffer, block_size);
+    if (journal_active()) journal_overlay(mem_idx(fat, block_idx), buffer, block_size);
+}
+
+/**
+ * read one directory entry, including a journaled update that isn't checkpointed yet
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location block & entry number of the entry
+ * @param ret set to the entry
+ * @return none
+*/
+void read_entry(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* ret) {
+    off_t offset = mem_idx(fat, location.first) + (off_t) location.second * DIR_ENTRY_SIZE;
+    safe_lseek(fs_fd, offset, SEEK_SET);
+    safe_read(fs_fd, ret, DIR_ENTRY_SIZE);
+    if (journal_active()) journal_overlay(offset, (char*) ret, DIR_ENTRY_SIZE);
 }
 
 /**
- * search for an open block (where value is `0`)
+ * check whether a block can be allocated
+ * @param fat filesystem
+ * @param idx block index
+ * @return `true` if the block is free, no snapshot holds it & the journal committed its free
+*/
+static bool block_free(uint16_t* fat, int idx) {
+    if (fat_get(fat, idx) != 0 || snapshot_frozen(idx)) return false; // blocks held by snapshots are never reused
+    return !journal_freed(idx);
+}
+
+/**
+ * search for an open block (where value is `0`), starting from the lowest block that may be free
  * @param fat filesystem
  * @return the block index on success, `0` on failure
 */
 int get_free_block(uint16_t* fat) {
-    uint16_t metadata = fat[0];
-    int n_blocks = FAT_BLOCKS(metadata);
-    int block_size = BLOCK_SIZE(metadata);
-
-    int size = n_blocks * block_size;
-    for (int i = 1; i < size; i++) {
-        if (fat[i] == 0) return i;
+    int n_blocks = fs_n_blocks(fat);
+    for (int i = free_hint; i < n_blocks; i++) {
+        if (block_free(fat, i)) {
+            free_hint = i;
+            return i;
+        }
     }
+    free_hint = n_blocks;
     return 0;
 }
 
+int get_free_block_near(uint16_t* fat, int goal) {
+    int n_blocks = fs_n_blocks(fat);
+    int end = (goal + ALLOC_NEAR_WINDOW < n_blocks) ? goal + ALLOC_NEAR_WINDOW : n_blocks;
+    for (int i = (goal > free_hint) ? goal : free_hint; i < end; i++) {
+        if (block_free(fat, i)) return i;
+    }
+    return get_free_block(fat);
+}
+
+int get_free_extent(uint16_t* fat, int goal, int n_blocks) {
+    int n_total = fs_n_blocks(fat);
+    if (goal < free_hint || goal >= n_total) goal = free_hint;
+    int best = 0;
+    int best_len = 0;
+
+    // first fit from `goal` to the end, then from the start up to `goal`
+    for (int pass = 0; pass < 2; pass++) {
+        int from = (pass == 0) ? goal : free_hint;
+        int to = (pass == 0) ? n_total : goal;
+        int run = 0;
+        for (int i = from; i < to; i++) {
+            if (!block_free(fat, i)) {
+                run = 0;
+                continue;
+            }
+            run++;
+            if (run > best_len) {
+                best = i - run + 1;
+                best_len = run;
+                if (best_len >= n_blocks) return best;
+            }
+        }
+    }
+    return best;
+}
+
+int fs_free_run(uint16_t* fat, int start, int max_blocks) {
+    int n_blocks = fs_n_blocks(fat);
+    int n = 0;
+    while (n < max_blocks && start + n < n_blocks && block_free(fat, start + n)) n++;
+    return n;
+}
+
+int fs_free_blocks(uint16_t* fat) {
+    int n_blocks = fs_n_blocks(fat);
+    int n_free = 0;
+    for (int i = free_hint; i < n_blocks; i++) {
+        if (block_free(fat, i)) n_free++;
+    }
+    return n_free;
+}
+
+void fs_recount_free(uint16_t* fat) {
+    int n_blocks = fs_n_blocks(fat);
+    int n_free = 0;
+    int first_free = 0;
+    for (int i = 1; i < n_blocks; i++) {
+        if (fat_get(fat, i) != 0 || snapshot_frozen(i)) continue;
+        if (first_free == 0) first_free = i;
+        n_free++;
+    }
+    fs_seed_free(fat, n_free, first_free);
+}
+
+/**
+ * check whether an operation can allocate some number of blocks,
+ * counting free blocks only until there are enough
+ * @param fat filesystem
+ * @param n_blocks blocks the operation needs
+ * @return `true` if at least `n_blocks` blocks can be allocated
+*/
+static bool have_free_blocks(uint16_t* fat, int n_blocks) {
+    int n_total = fs_n_blocks(fat);
+    for (int i = free_hint; i < n_total && n_blocks > 0; i++) {
+        if (block_free(fat, i)) n_blocks--;
+    }
+    return n_blocks <= 0;
+}
+
+int* alloc_chain(uint16_t* fat, int goal, int n_blocks) {
+    int* blocks = malloc(n_blocks * sizeof(int));
+    for (int i = 0; i < n_blocks; i++) {
+        int block = (i == 0) ? get_free_extent(fat, goal, n_blocks) : get_free_block_near(fat, blocks[i - 1] + 1);
+        if (block == 0) { // full
+            if (i > 0) delete_chain(fat, blocks[0]);
+            free(blocks);
+            return NULL;
+        }
+        fat_set(fat, block, LASTBLOCK);
+        if (i > 0) fat_set(fat, blocks[i - 1], block);
+        blocks[i] = block;
+    }
+    fat_sync(fat);
+    return blocks;
+}
+
 /**
  * traverse down the fat chain, marking them all as deleted
  * @param fat filesystem
@@ -77,17 +383,13 @@ int get_free_block(uint16_t* fat) {
  * @return none
 */
 void delete_chain(uint16_t* fat, int head) {
-    uint16_t metadata = fat[0];
-    int n_blocks = FAT_BLOCKS(metadata);
-    int block_size = BLOCK_SIZE(metadata);
-
     int curr = head;
     while (curr != LASTBLOCK) {
         // fprintf(stderr, "marking as free: %d\n", curr); // DEBUG: show cleared block
-        int next = fat[curr];
-        fat[curr] = 0;
+        int next = fat_get(fat, curr);
+        fat_set(fat, curr, 0);
         curr = next;
-        safe_msync(fat, n_blocks * block_size, MS_SYNC);
+        fat_sync(fat);
     }
 }
 
@@ -103,26 +405,33 @@ void delete_chain(uint16_t* fat, int head) {
 void build_chain(uint16_t* fat, int fs_fd, int curr_block, char* data, int n_bytes) {
     if (n_bytes == 0) return;
     
-    uint16_t metadata = fat[0];
-    int n_blocks = FAT_BLOCKS(metadata);
-    int block_size = BLOCK_SIZE(metadata);
+    int block_size = fs_block_size(fat);
 
-    fat[curr_block] = LASTBLOCK;
-    safe_msync(fat, n_blocks * block_size, MS_SYNC);
+    fat_set(fat, curr_block, LASTBLOCK);
+    fat_sync(fat);
     if (n_bytes <= block_size) { // data fits in a single block
         // fprintf(stderr, "final block: %d %d\n", curr, mem_idx(fat, curr)); // DEBUG: show current block in data region & overall mem idx
+        if (checksum_enabled()) { // write the whole block, so its checksum doesn't depend on stale bytes
+            char* block = calloc(1, block_size);
+            memcpy(block, data, n_bytes);
+            safe_pwrite(fs_fd, block, block_size, mem_idx(fat, curr_block));
+            checksum_update(curr_block, block, block_size);
+            free(block);
+            return;
+        }
         safe_lseek(fs_fd, mem_idx(fat, curr_block), SEEK_SET);
         safe_write(fs_fd, data, n_bytes);
     } else { // need multiple blocks
-        int next = get_free_block(fat);
+        int next = get_free_block_near(fat, curr_block + 1);
         build_chain(fat, fs_fd, next, &data[block_size], n_bytes - block_size);
 
-        fat[curr_block] = next;
-        safe_msync(fat, n_blocks * block_size, MS_SYNC);
+        fat_set(fat, curr_block, next);
+        fat_sync(fat);
 
         // fprintf(stderr, "block: %d\n", curr_block); // debug: show first chain block
         safe_lseek(fs_fd, mem_idx(fat, curr_block), SEEK_SET);
         safe_write(fs_fd, data, block_size);
+        checksum_update(curr_block, data, block_size);
     }
 }
 
@@ -142,8 +451,7 @@ int fill_chain(uint16_t* fat, int fs_fd, int head, int chain_size, char* buffer,
     }
     if (buffer_size == 0) return 0;
     
-    uint16_t metadata = fat[0];
-    int block_size = BLOCK_SIZE(metadata);
+    int block_size = fs_block_size(fat);
 
     if (chain_size <= block_size) { // data fits in a single block
         if (chain_size == block_size) {
@@ -152,62 +460,97 @@ int fill_chain(uint16_t* fat, int fs_fd, int head, int chain_size, char* buffer,
             int bytes_written = block_size - chain_size;
             safe_lseek(fs_fd, mem_idx(fat, head) + chain_size, SEEK_SET);
             safe_write(fs_fd, buffer, bytes_written);
+            checksum_refresh(fat, fs_fd, head);
             return bytes_written;
         } else { // buffer has less bytes so write them all
             safe_lseek(fs_fd, mem_idx(fat, head) + chain_size, SEEK_SET);
             safe_write(fs_fd, buffer, buffer_size);
+            checksum_refresh(fat, fs_fd, head);
             return buffer_size;
         }
     } else { // need multiple blocks
-        return fill_chain(fat, fs_fd, fat[head], chain_size - block_size, buffer, buffer_size);
+        return fill_chain(fat, fs_fd, fat_get(fat, head), chain_size - block_size, buffer, buffer_size);
+    }
+}
+
+/**
+ * seek and write a file block to memory
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location point in memory
+ * @param entry the file block
+ * @return none
+*/
+void write_file(uint16_t* fat, int fs_fd, point_t location, dir_entry_t entry) {
+    int block = location.first;
+    int index = location.second;
+    if (journal_active()) { // written in place at the next checkpoint
+        journal_log_dir(mem_idx(fat, block) + index * DIR_ENTRY_SIZE, &entry);
+    } else {
+        safe_lseek(fs_fd, mem_idx(fat, block) + index * DIR_ENTRY_SIZE, SEEK_SET);
+        safe_write(fs_fd, &entry, DIR_ENTRY_SIZE);
     }
+    dirindex_note(fat, location, &entry);
+}
+
+/**
+ * get the type of a new file: compressed on filesystems made with `mkfs ... -z`
+ * @param fat filesystem
+ * @return the type
+*/
+static uint8_t new_file_type(uint16_t* fat) {
+    superblock_t* sb = fs_superblock(fat);
+    if (sb != NULL && (sb->features & FEATURE_COMPRESS)) return FILETYPE_FILE | FILETYPE_COMPRESSED;
+    return FILETYPE_FILE;
 }
 
 /**
  * add a new empty file to the directory, allocating new blocks as necessary
  * @param fat filesystem
  * @param fs_fd filesystem file descriptor
- * @param dirhead the first index of the directory chain (`ROOTDIR` or `1` for the root dir)
+ * @param dirhead the first index of the directory chain (`fs_root(fat)` for the root dir)
  * @param filename the file to add
  * @return none
 */
 void add_file(uint16_t* fat, int fs_fd, int dir_head, const char* filename) {
-    uint16_t metadata = fat[0];
-    int n_blocks = FAT_BLOCKS(metadata);
-    int block_size = BLOCK_SIZE(metadata);
+    int block_size = fs_block_size(fat);
 
-    int curr_block = dir_head;
+    char* dir_block = malloc(block_size);
+    int curr_block = (dir_head == fs_root(fat)) ? dirindex_free_block(fat) : dir_head; // skip full blocks
     while (true) {
-        safe_lseek(fs_fd, mem_idx(fat, curr_block), SEEK_SET);
+        read_dir_block(fat, fs_fd, curr_block, dir_block);
         dir_entry_t entry;
         for (int i = 0; i < block_size / DIR_ENTRY_SIZE; i++) { // i = entry idx
-            safe_read(fs_fd, &entry, DIR_ENTRY_SIZE);
+            memcpy(&entry, &dir_block[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
             if (entry.name[0] == FILENAME_ENDDIR || entry.name[0] == FILENAME_DEL_UNUSED) { 
+                memset(&entry, 0, DIR_ENTRY_SIZE);
                 strcpy(entry.name, filename);
                 entry.mtime = time(0);
                 entry.size = 0;
-                entry.type = FILETYPE_FILE;
+                entry.type = new_file_type(fat);
                 entry.perm = (FILEPERM_RD | FILEPERM_WR);
-                entry.firstBlock = -1;
-                safe_lseek(fs_fd, mem_idx(fat, curr_block) + i * DIR_ENTRY_SIZE, SEEK_SET);
-                safe_write(fs_fd, &entry, DIR_ENTRY_SIZE);
+                entry_set_first_block(fat, &entry, LASTBLOCK);
+                write_file(fat, fs_fd, (point_t) { curr_block, i }, entry);
+                if (dir_head == fs_root(fat)) dirindex_set_free_block(fat, curr_block);
+                free(dir_block);
                 return;
             }
         } 
-        if (fat[curr_block] == LASTBLOCK) break;
-        else curr_block = fat[curr_block];
+        if (fat_get(fat, curr_block) == LASTBLOCK) break;
+        else curr_block = fat_get(fat, curr_block);
     }
+    free(dir_block);
 
     // not enough space in the current chain so allocate a new link
     // fprintf(stderr, "out of space!\nlast: %d\n", curr_block); // DEBUG: show previous last dir block
-    int new_block = get_free_block(fat);
+    int new_block = get_free_block_near(fat, curr_block + 1);
     // fprintf(stderr, "new: %d\n", new_block); // DEBUG: show newly allocated dir block
 
-    fat[curr_block] = new_block;
-    safe_msync(fat, n_blocks * block_size, MS_SYNC);
+    fat_set(fat, curr_block, new_block);
+    fat_sync(fat);
 
-    fat[new_block] = LASTBLOCK;
-    safe_msync(fat, n_blocks * block_size, MS_SYNC);
+    fat_set(fat, new_block, LASTBLOCK);
+    fat_sync(fat);
     
     // zero out the new block
     char* zeros = malloc(block_size);
@@ -219,31 +562,17 @@ void add_file(uint16_t* fat, int fs_fd, int dir_head, const char* filename) {
     free(zeros);
 
     dir_entry_t entry;
+    memset(&entry, 0, DIR_ENTRY_SIZE);
     strcpy(entry.name, filename);
     entry.mtime = time(0);
     entry.size = 0;
-    entry.type = FILETYPE_FILE;
+    entry.type = new_file_type(fat);
     entry.perm = (FILEPERM_RD | FILEPERM_WR);
-    entry.firstBlock = -1;
+    entry_set_first_block(fat, &entry, LASTBLOCK);
 
     // write the new directory entry
-    safe_lseek(fs_fd, mem_idx(fat, new_block), SEEK_SET);
-    safe_write(fs_fd, &entry, DIR_ENTRY_SIZE);
-}
-
-/**
- * seek and write a file block to memory
- * @param fat filesystem
- * @param fs_fd filesystem file descriptor
- * @param location point in memory
- * @param entry the file block
- * @return none
-*/
-void write_file(uint16_t* fat, int fs_fd, point_t location, dir_entry_t entry) {
-    int block = location.first;
-    int index = location.second;
-    safe_lseek(fs_fd, mem_idx(fat, block) + index * DIR_ENTRY_SIZE, SEEK_SET);
-    safe_write(fs_fd, &entry, DIR_ENTRY_SIZE);
+    write_file(fat, fs_fd, (point_t) { new_block, 0 }, entry);
+    if (dir_head == fs_root(fat)) dirindex_set_free_block(fat, new_block);
 }
 
 /**
@@ -258,18 +587,515 @@ void write_file(uint16_t* fat, int fs_fd, point_t location, dir_entry_t entry) {
 void read_chain(uint16_t* fat, int fs_fd, int head, char* buffer, int chain_bytes) {
     if (head == LASTBLOCK) return;
     if (chain_bytes == 0) return;
-    
-    uint16_t metadata = fat[0];
-    int block_size = BLOCK_SIZE(metadata);
+    read_chain_range(fat, fs_fd, head, 0, buffer, chain_bytes);
+}
+
+/**
+ * read whole blocks & verify their checksums, then copy out the requested part
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param first first block of a run of physically consecutive blocks
+ * @param n_blocks blocks in the run
+ * @param in_block offset of the requested part in the first block
+ * @param buffer where the requested part goes
+ * @param n_bytes length of the requested part
+ * @return `true` if every block matched its checksum
+*/
+static bool read_run_checked(uint16_t* fat, int fs_fd, int first, int n_blocks, int in_block, char* buffer, int n_bytes) {
+    int block_size = fs_block_size(fat);
+    size_t run_size = (size_t) n_blocks * block_size;
+    bool whole = (in_block == 0 && n_bytes == run_size);
+    char* blocks = whole ? buffer : malloc(run_size); // partial runs are staged
+    safe_pread(fs_fd, blocks, run_size, mem_idx(fat, first));
+    bool ok = true;
+    for (int i = 0; i < n_blocks; i++) {
+        ok &= checksum_verify(first + i, &blocks[(size_t) i * block_size], block_size);
+    }
+    if (!whole) {
+        memcpy(buffer, &blocks[in_block], n_bytes);
+        free(blocks);
+    }
+    return ok;
+}
+
+bool read_chain_range(uint16_t* fat, int fs_fd, int head, int offset, char* buffer, int n_bytes) {
+    int block_size = fs_block_size(fat);
+    int curr = head;
+    for (int i = 0; i < offset / block_size && curr != LASTBLOCK; i++) curr = fat_get(fat, curr);
+
+    bool ok = true;
+    int in_block = offset % block_size;
+    int done = 0;
+    while (done < n_bytes && curr != LASTBLOCK) {
+        // extend the read over physically consecutive blocks
+        int run_start = curr;
+        int run_blocks = 1;
+        int run_bytes = block_size - in_block;
+        while (done + run_bytes < n_bytes && fat_get(fat, curr) == curr + 1) {
+            curr++;
+            run_blocks++;
+            run_bytes += block_size;
+        }
+        if (run_bytes > n_bytes - done) run_bytes = n_bytes - done;
+        if (checksum_enabled()) {
+            ok &= read_run_checked(fat, fs_fd, run_start, run_blocks, in_block, &buffer[done], run_bytes);
+        } else {
+            safe_pread(fs_fd, &buffer[done], run_bytes, mem_idx(fat, run_start) + in_block);
+        }
+        done += run_bytes;
+        in_block = 0;
+        curr = fat_get(fat, curr);
+    }
+    return ok;
+}
+
+int inline_slots(int n_bytes) {
+    if (n_bytes <= INLINE_HEAD_BYTES) return 0;
+    return (n_bytes - INLINE_HEAD_BYTES + INLINE_SLOT_BYTES - 1) / INLINE_SLOT_BYTES;
+}
+
+/**
+ * count the continuation slots following an entry in a directory block
+ * @param dir_block contents of the directory block
+ * @param entry_idx entry number of the inline file
+ * @param n_entries entries per directory block
+ * @return number of consecutive `FILENAME_INLINE` slots after `entry_idx` (at most INLINE_MAX_SLOTS)
+*/
+int inline_run(char* dir_block, int entry_idx, int n_entries) {
+    int n = 0;
+    while (n < INLINE_MAX_SLOTS && entry_idx + n + 1 < n_entries
+           && dir_block[(entry_idx + n + 1) * DIR_ENTRY_SIZE] == FILENAME_INLINE) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * check whether a directory slot can take a new entry
+ * @param slot the directory slot
+ * @return `true` if the slot is unused
+*/
+static bool slot_free(char* slot) {
+    return slot[0] == FILENAME_ENDDIR || slot[0] == FILENAME_DEL_UNUSED;
+}
+
+bool chain_shared(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry) {
+    if (!(entry->type & FILETYPE_SHARED)) return false; // only `cp -s` shares chains, so there is nothing to look for
+    int head = entry_first_block(fat, entry);
+    if (head == LASTBLOCK) return false;
+    int block_size = fs_block_size(fat);
+    char* dir_block = malloc(block_size);
+    bool shared = false;
+    for (int b = fs_root(fat); b != LASTBLOCK && !shared; b = fat_get(fat, b)) {
+        read_dir_block(fat, fs_fd, b, dir_block);
+        for (int i = 0; i < block_size / DIR_ENTRY_SIZE && !shared; i++) {
+            dir_entry_t other;
+            memcpy(&other, &dir_block[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
+            if (other.name[0] < FILENAME_DEL_INUSE || other.name[0] == FILENAME_INLINE) continue; // no chain
+            if (!(other.type & FILETYPE_SHARED) || (other.type & (FILETYPE_INLINE | FILETYPE_SNAPSHOT))) continue;
+            if (b == location.first && i == location.second) continue;
+            shared = (entry_first_block(fat, &other) == head);
+        }
+    }
+    free(dir_block);
+    if (!shared) entry->type &= ~FILETYPE_SHARED; // the other files let go of the chain
+    return shared;
+}
+
+/**
+ * copy the blocks of a chain into another chain of the same length, inside the image
+ * (copy_file_range, so the data doesn't pass through memory); checksums are copied along
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param head the first block of the chain to copy
+ * @param to the blocks to copy into, in order
+ * @param n_blocks length of both chains
+ * @return none
+*/
+static void copy_blocks(uint16_t* fat, int fs_fd, int head, int* to, int n_blocks) {
+    int block_size = fs_block_size(fat);
+    int curr = head;
+    for (int i = 0; i < n_blocks && curr != LASTBLOCK; ) {
+        // extend the copy while both chains are physically consecutive
+        int first = curr;
+        int run = 1;
+        while (i + run < n_blocks && fat_get(fat, curr) == curr + 1 && to[i + run] == to[i] + run) {
+            curr++;
+            run++;
+        }
+        safe_copy_file_range(fs_fd, mem_idx(fat, first), fs_fd, mem_idx(fat, to[i]), (size_t) run * block_size);
+        for (int j = 0; j < run; j++) checksum_copy(first + j, to[i + j]);
+        i += run;
+        curr = fat_get(fat, curr);
+    }
+}
+
+/**
+ * give a file a private copy of a chain it shares with another file
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param entry the file; its first block is updated, and the caller writes it back
+ * @return `true` on success, `false` if the filesystem is too full
+*/
+static bool unshare_chain(uint16_t* fat, int fs_fd, dir_entry_t* entry) {
+    int head = entry_first_block(fat, entry);
+    int n_blocks = 0;
+    for (int b = head; b != LASTBLOCK; b = fat_get(fat, b)) n_blocks++;
+    int* blocks = alloc_chain(fat, head, n_blocks);
+    if (blocks == NULL) return false;
+    copy_blocks(fat, fs_fd, head, blocks, n_blocks);
+    entry_set_first_block(fat, entry, blocks[0]);
+    entry->type &= ~FILETYPE_SHARED;
+    free(blocks);
+    return true;
+}
+
+void free_data(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry) {
+    if (entry->type & FILETYPE_INLINE) {
+        int block_size = fs_block_size(fat);
+        char* dir_block = malloc(block_size);
+        read_dir_block(fat, fs_fd, location.first, dir_block);
+        int n_slots = inline_run(dir_block, location.second, block_size / DIR_ENTRY_SIZE);
+        free(dir_block);
+
+        dir_entry_t unused;
+        memset(&unused, 0, DIR_ENTRY_SIZE);
+        unused.name[0] = FILENAME_DEL_UNUSED;
+        for (int i = 1; i <= n_slots; i++) {
+            write_file(fat, fs_fd, (point_t) { location.first, location.second + i }, unused);
+        }
+        entry->type &= ~FILETYPE_INLINE;
+        memset((char*) entry + INLINE_HEAD_OFFSET, 0, INLINE_HEAD_BYTES);
+    } else if (!chain_shared(fat, fs_fd, location, entry)) { // the last file using the chain
+        delete_chain(fat, entry_first_block(fat, entry));
+    }
+    entry->type &= ~FILETYPE_SHARED;
+    entry_set_first_block(fat, entry, LASTBLOCK);
+}
+
+/**
+ * store data inline, moving the entry to a run of free slots if the slots after it are taken
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location location of the (empty) file; updated if the entry moves
+ * @param entry the file's directory entry; the caller writes it to `location`
+ * @param data what to store
+ * @param n_bytes length of `data`, at most INLINE_MAX_BYTES
+ * @return `true` on success, `false` if no run of free slots is long enough
+*/
+static bool store_inline(uint16_t* fat, int fs_fd, point_t* location, dir_entry_t* entry, const char* data, int n_bytes) {
+    int block_size = fs_block_size(fat);
+    int n_entries = block_size / DIR_ENTRY_SIZE;
+    int n_slots = inline_slots(n_bytes);
+    char* dir_block = malloc(block_size);
+
+    point_t target = *location;
+    bool found = (n_slots == 0);
+    if (!found && location->second + n_slots < n_entries) { // right after the entry
+        read_dir_block(fat, fs_fd, location->first, dir_block);
+        found = true;
+        for (int i = 1; i <= n_slots; i++) {
+            if (!slot_free(&dir_block[(location->second + i) * DIR_ENTRY_SIZE])) found = false;
+        }
+    }
+    for (int b = fs_root(fat); !found && b != LASTBLOCK; b = fat_get(fat, b)) { // anywhere in the directory
+        read_dir_block(fat, fs_fd, b, dir_block);
+        int run = 0;
+        for (int i = 0; i < n_entries && !found; i++) {
+            run = slot_free(&dir_block[i * DIR_ENTRY_SIZE]) ? run + 1 : 0;
+            if (run == n_slots + 1) {
+                target = (point_t) { b, i - n_slots };
+                found = true;
+            }
+        }
+    }
+    free(dir_block);
+    if (!found) return false;
+
+    if (target.first != location->first || target.second != location->second) { // move the entry
+        dir_entry_t unused;
+        memset(&unused, 0, DIR_ENTRY_SIZE);
+        unused.name[0] = FILENAME_DEL_UNUSED;
+        write_file(fat, fs_fd, *location, unused);
+        *location = target;
+    }
 
-    if (chain_bytes <= block_size) {
-        safe_lseek(fs_fd, mem_idx(fat, head), SEEK_SET);
-        safe_read(fs_fd, buffer, chain_bytes);
+    int head_bytes = (n_bytes < INLINE_HEAD_BYTES) ? n_bytes : INLINE_HEAD_BYTES;
+    memset((char*) entry + INLINE_HEAD_OFFSET, 0, INLINE_HEAD_BYTES);
+    memcpy((char*) entry + INLINE_HEAD_OFFSET, data, head_bytes);
+    entry->firstBlock = LASTBLOCK_V1;
+    entry->type |= FILETYPE_INLINE;
+    for (int i = 1; i <= n_slots; i++) {
+        char slot[DIR_ENTRY_SIZE];
+        memset(slot, 0, DIR_ENTRY_SIZE);
+        slot[0] = FILENAME_INLINE;
+        int offset = INLINE_HEAD_BYTES + (i - 1) * INLINE_SLOT_BYTES;
+        int slot_bytes = (n_bytes - offset < INLINE_SLOT_BYTES) ? n_bytes - offset : INLINE_SLOT_BYTES;
+        memcpy(&slot[1], &data[offset], slot_bytes);
+        dir_entry_t slot_entry;
+        memcpy(&slot_entry, slot, DIR_ENTRY_SIZE);
+        write_file(fat, fs_fd, (point_t) { target.first, target.second + i }, slot_entry);
+    }
+    return true;
+}
+
+bool write_data(uint16_t* fat, int fs_fd, point_t* location, dir_entry_t* entry, const char* data, int n_bytes) {
+    int old_head = entry_first_block(fat, entry); // rewrites go back where the file was, if they fit
+    free_data(fat, fs_fd, *location, entry);
+    if (n_bytes == 0) return true;
+
+    superblock_t* sb = fs_superblock(fat);
+    bool inline_ok = (sb != NULL) && (sb->features & FEATURE_INLINE) && n_bytes <= INLINE_MAX_BYTES;
+    if (inline_ok && store_inline(fat, fs_fd, location, entry, data, n_bytes)) return true;
+
+    char* encoded = NULL;
+    if (entry->type & FILETYPE_COMPRESSED) {
+        n_bytes = compress_encode(data, n_bytes, &encoded);
+        data = encoded;
+    }
+    int block_size = fs_block_size(fat);
+    int n_blocks = (n_bytes + block_size - 1) / block_size;
+    if (!have_free_blocks(fat, n_blocks)) {
+        fprintf(stderr, "write_data: filesystem is full\n");
+        free(encoded);
+        return false;
+    }
+    int head = get_free_extent(fat, (old_head == LASTBLOCK) ? 0 : old_head, n_blocks);
+    build_chain(fat, fs_fd, head, (char*) data, n_bytes);
+    entry_set_first_block(fat, entry, head);
+    free(encoded);
+    return true;
+}
+
+/**
+ * append data to a file, growing its chain next to its last block
+ * (empty, inline & compressed files are rewritten instead)
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location where the entry is
+ * @param entry the file; its size & time are updated and it is written back
+ * @param data what to append
+ * @param n_bytes length of `data`
+ * @return `true` on success, `false` if the filesystem is full (a rewritten file is left empty)
+*/
+static bool append_data(uint16_t* fat, int fs_fd, point_t* location, dir_entry_t* entry, const char* data, int n_bytes) {
+    if (entry_first_block(fat, entry) == LASTBLOCK || (entry->type & FILETYPE_COMPRESSED)) { // empty, inline or compressed: rewrite the whole file
+        char* combined = malloc(entry->size + n_bytes);
+        read_file(fat, fs_fd, *location, entry, combined, entry->size);
+        memcpy(&combined[entry->size], data, n_bytes);
+        bool ok = write_data(fat, fs_fd, location, entry, combined, entry->size + n_bytes);
+        free(combined);
+        if (!ok) {
+            entry->size = 0;
+            write_file(fat, fs_fd, *location, *entry);
+            return false;
+        }
     } else {
-        safe_lseek(fs_fd, mem_idx(fat, head), SEEK_SET);
-        safe_read(fs_fd, buffer, block_size);
-        read_chain(fat, fs_fd, fat[head], &buffer[block_size], chain_bytes - block_size);
+        if (chain_shared(fat, fs_fd, *location, entry) && !unshare_chain(fat, fs_fd, entry)) {
+            fprintf(stderr, "append_data: filesystem is full\n");
+            return false;
+        }
+        int block_size = fs_block_size(fat);
+        int n_kept = (entry->size + block_size - 1) / block_size;
+        if (n_kept == 0) n_kept = 1;
+
+        // find the block holding the last byte, dropping a block that only holds a null terminator
+        int last = entry_first_block(fat, entry);
+        for (int i = 1; i < n_kept; i++) last = fat_get(fat, last);
+        if (fat_get(fat, last) != LASTBLOCK) {
+            delete_chain(fat, fat_get(fat, last));
+            fat_set(fat, last, LASTBLOCK);
+            fat_sync(fat);
+        }
+
+        // everything the append allocates is checked up front, so it is never left half done
+        bool in_place = (entry->size % block_size != 0 || entry->size == 0); // the last block is written in place
+        long long n_total = ((long long) entry->size + n_bytes + block_size - 1) / block_size;
+        int n_needed = (int) ((n_total > n_kept) ? n_total - n_kept : 0) + ((in_place && snapshot_frozen(last)) ? 1 : 0);
+        if (!have_free_blocks(fat, n_needed)) {
+            fprintf(stderr, "append_data: filesystem is full\n");
+            return false;
+        }
+        if (in_place) {
+            if (!snapshot_cow(fat, fs_fd, entry, n_kept - 1)) {
+                fprintf(stderr, "append_data: filesystem is full\n");
+                return false;
+            }
+            last = entry_first_block(fat, entry);
+            for (int i = 1; i < n_kept; i++) last = fat_get(fat, last);
+        }
+        int buffer_offset = fill_chain(fat, fs_fd, entry_first_block(fat, entry), entry->size, (char*) data, n_bytes);
+        if (buffer_offset < n_bytes) { // continue in the blocks right after the last one, if they are free
+            int remaining = n_bytes - buffer_offset;
+            int n_blocks = (remaining + block_size - 1) / block_size;
+            int new_head = last + 1;
+            if (new_head >= fs_n_blocks(fat) || !block_free(fat, new_head)) {
+                // another file took the blocks after this one (interleaved writers), so move to the
+                // middle of the largest free run: both that file & this one can keep growing in place
+                int run = get_free_extent(fat, 0, INT_MAX);
+                int run_len = (run == 0) ? 0 : fs_free_run(fat, run, INT_MAX);
+                if (run_len >= 4 * n_blocks) new_head = run + run_len / 2;
+                else new_head = get_free_extent(fat, last + 1, n_blocks);
+            }
+            build_chain(fat, fs_fd, new_head, (char*) &data[buffer_offset], remaining);
+            fat_set(fat, last, new_head);
+            fat_sync(fat);
+        }
     }
+    entry->mtime = time(0);
+    entry->size = entry->size + n_bytes;
+    write_file(fat, fs_fd, *location, *entry);
+    return true;
+}
+
+bool fs_fallocate(uint16_t* fat, int fs_fd, const char* target, int offset, int len) {
+    point_t location;
+    dir_entry_t entry;
+    if (!find_file(fat, fs_fd, fs_root(fat), target, &location, &entry)) return false;
+    long long end = (long long) offset + len;
+    if (end <= entry.size) return true; // FAT files have no holes, so the range is already allocated
+
+    int grow = (int) (end - entry.size);
+    int block_size = fs_block_size(fat);
+    long long n_needed = (end + block_size - 1) / block_size - ((long long) entry.size + block_size - 1) / block_size;
+    if (entry.type & (FILETYPE_INLINE | FILETYPE_COMPRESSED)) n_needed = (end + block_size - 1) / block_size;
+    if (n_needed > fs_free_blocks(fat)) fs_reclaim_freed(fat);
+    if (n_needed > fs_free_blocks(fat)) return false;
+
+    journal_begin();
+    char* zeros = calloc(grow, 1);
+    bool ok = append_data(fat, fs_fd, &location, &entry, zeros, grow);
+    free(zeros);
+    journal_end(fat);
+    return ok;
+}
+
+/**
+ * find the block at a position in a chain
+ * @param fat filesystem
+ * @param head the first block of the chain
+ * @param idx position of the block (`0` for the first block)
+ * @return the block, or LASTBLOCK if the chain is shorter
+*/
+static int chain_block_at(uint16_t* fat, int head, int idx) {
+    int block = head;
+    for (int i = 0; i < idx && block != LASTBLOCK; i++) block = fat_get(fat, block);
+    return block;
+}
+
+/**
+ * write data at an offset of a file: the blocks the chain already has (including blocks
+ * reserved by `fs_fallocate`) are overwritten in place, & the rest is appended
+ * (empty, inline & compressed files are rewritten instead)
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location where the entry is; updated if the entry moves
+ * @param entry the file; its size & time are updated and it is written back
+ * @param offset where to write, at most the file's size
+ * @param data what to write
+ * @param n_bytes length of `data`
+ * @return `true` on success, `false` if the filesystem is full
+*/
+static bool write_range(uint16_t* fat, int fs_fd, point_t* location, dir_entry_t* entry, int offset, const char* data, int n_bytes) {
+    int end = offset + n_bytes;
+    if (entry_first_block(fat, entry) == LASTBLOCK || (entry->type & FILETYPE_COMPRESSED)) { // empty, inline or compressed: rewrite the whole file
+        int size = (end > (int) entry->size) ? end : (int) entry->size;
+        char* combined = malloc(size);
+        read_file(fat, fs_fd, *location, entry, combined, entry->size);
+        memcpy(&combined[offset], data, n_bytes);
+        bool ok = write_data(fat, fs_fd, location, entry, combined, size);
+        free(combined);
+        entry->mtime = time(0);
+        entry->size = ok ? size : 0;
+        write_file(fat, fs_fd, *location, *entry);
+        return ok;
+    }
+    if (chain_shared(fat, fs_fd, *location, entry) && !unshare_chain(fat, fs_fd, entry)) {
+        fprintf(stderr, "write_range: filesystem is full\n");
+        return false;
+    }
+
+    int block_size = fs_block_size(fat);
+    int idx = offset / block_size;
+    int block = chain_block_at(fat, entry_first_block(fat, entry), idx);
+    int pos = offset;
+    while (pos < end && block != LASTBLOCK) {
+        if (snapshot_frozen(block)) { // shared with a snapshot: write a private copy
+            if (!snapshot_cow(fat, fs_fd, entry, idx)) {
+                fprintf(stderr, "write_range: filesystem is full\n");
+                return false;
+            }
+            block = chain_block_at(fat, entry_first_block(fat, entry), idx);
+        }
+        int block_offset = pos % block_size;
+        int n = (end - pos < block_size - block_offset) ? end - pos : block_size - block_offset;
+        safe_pwrite(fs_fd, &data[pos - offset], n, mem_idx(fat, block) + block_offset);
+        if (n == block_size) checksum_update(block, &data[pos - offset], block_size);
+        else checksum_refresh(fat, fs_fd, block);
+        pos += n;
+        idx++;
+        block = fat_get(fat, block);
+    }
+    if (pos < end) { // past the end of the chain, which is now filled up to `pos`
+        if (pos > (int) entry->size) entry->size = pos;
+        return append_data(fat, fs_fd, location, entry, &data[pos - offset], end - pos);
+    }
+    entry->mtime = time(0);
+    if (end > (int) entry->size) entry->size = end;
+    write_file(fat, fs_fd, *location, *entry);
+    return true;
+}
+
+bool fs_pwrite(uint16_t* fat, int fs_fd, const char* target, int offset, const char* data, int n_bytes) {
+    point_t location;
+    dir_entry_t entry;
+    if (!find_file(fat, fs_fd, fs_root(fat), target, &location, &entry) || offset > (int) entry.size) return false;
+    if (n_bytes == 0) return true;
+    journal_begin();
+    bool ok = write_range(fat, fs_fd, &location, &entry, offset, data, n_bytes);
+    journal_end(fat);
+    return ok;
+}
+
+void read_file(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, char* buffer, int n_bytes) {
+    if (!(entry->type & FILETYPE_INLINE)) {
+        if (entry->type & FILETYPE_COMPRESSED) compress_read(fat, fs_fd, entry_first_block(fat, entry), 0, buffer, n_bytes);
+        else read_chain(fat, fs_fd, entry_first_block(fat, entry), buffer, n_bytes);
+        return;
+    }
+    int head_bytes = (n_bytes < INLINE_HEAD_BYTES) ? n_bytes : INLINE_HEAD_BYTES;
+    memcpy(buffer, (char*) entry + INLINE_HEAD_OFFSET, head_bytes);
+    if (n_bytes <= INLINE_HEAD_BYTES) return; // no directory access at all
+
+    int block_size = fs_block_size(fat);
+    char* dir_block = malloc(block_size);
+    read_dir_block(fat, fs_fd, location.first, dir_block);
+    for (int i = 1; i <= inline_slots(n_bytes); i++) {
+        int offset = INLINE_HEAD_BYTES + (i - 1) * INLINE_SLOT_BYTES;
+        int slot_bytes = (n_bytes - offset < INLINE_SLOT_BYTES) ? n_bytes - offset : INLINE_SLOT_BYTES;
+        memcpy(&buffer[offset], &dir_block[(location.second + i) * DIR_ENTRY_SIZE + 1], slot_bytes);
+    }
+    free(dir_block);
+}
+
+bool read_file_range(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, int offset, char* buffer, int n_bytes) {
+    if (n_bytes <= 0) return true;
+    if (entry->type & FILETYPE_INLINE) { // at most INLINE_MAX_BYTES
+        char data[INLINE_MAX_BYTES];
+        read_file(fat, fs_fd, location, entry, data, offset + n_bytes);
+        memcpy(buffer, &data[offset], n_bytes);
+        return true;
+    } else if (entry->type & FILETYPE_COMPRESSED) {
+        return compress_read(fat, fs_fd, entry_first_block(fat, entry), offset, buffer, n_bytes);
+    } else {
+        return read_chain_range(fat, fs_fd, entry_first_block(fat, entry), offset, buffer, n_bytes);
+    }
+}
+
+long long fs_physical_bytes(uint16_t* fat, dir_entry_t* entry) {
+    long long n_blocks = 0;
+    for (int b = entry_first_block(fat, entry); b != LASTBLOCK; b = fat_get(fat, b)) n_blocks++;
+    return n_blocks * fs_block_size(fat);
 }
 
 /**
@@ -283,17 +1109,34 @@ void read_chain(uint16_t* fat, int fs_fd, int head, char* buffer, int chain_byte
  * @return Returns true if the file or directory is found; otherwise, false.
  */
 bool find_file(uint16_t* fat, int fs_fd, int dir_head, const char* filename, point_t* loc, dir_entry_t* ret) {
-    uint16_t metadata = fat[0];
-    int block_size = BLOCK_SIZE(metadata);
+    int block_size = fs_block_size(fat);
+    if (dir_head == fs_root(fat)) { // one block, from the name index
+        point_t found;
+        if (!dirindex_find(fat, fs_fd, filename, &found)) return false;
+        char* dir_block = malloc(block_size);
+        read_dir_block(fat, fs_fd, found.first, dir_block);
+        dir_entry_t entry;
+        memcpy(&entry, &dir_block[found.second * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
+        free(dir_block);
+        bool live = entry.name[0] >= FILENAME_DEL_INUSE && entry.name[0] != FILENAME_INLINE && entry.type != FILETYPE_SNAPSHOT;
+        if (!live || strcmp(filename, entry.name) != 0) return false; // the slot was rewritten since
+        if (loc == NULL || ret == NULL) return true;
+        *loc = found;
+        *ret = entry;
+        return true;
+    }
 
+    char* dir_block = malloc(block_size);
     int curr_block = dir_head;
     while (curr_block != LASTBLOCK) {
-        safe_lseek(fs_fd, mem_idx(fat, curr_block), SEEK_SET);
+        read_dir_block(fat, fs_fd, curr_block, dir_block);
         dir_entry_t entry;
         for (int i = 0; i < block_size / DIR_ENTRY_SIZE; i++) {
-            safe_read(fs_fd, &entry, DIR_ENTRY_SIZE);
+            memcpy(&entry, &dir_block[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
             if (entry.name[0] < FILENAME_DEL_INUSE) continue; // end of dir, or deleted entry & file
+            if (entry.name[0] == FILENAME_INLINE || entry.type == FILETYPE_SNAPSHOT) continue;
             if (strcmp(filename, entry.name) == 0) {
+                free(dir_block);
                 if (loc == NULL || ret == NULL) return true;
                 loc->first = curr_block;
                 loc->second = i;
@@ -301,8 +1144,9 @@ bool find_file(uint16_t* fat, int fs_fd, int dir_head, const char* filename, poi
                 return true;
             }
         } 
-        curr_block = fat[curr_block];
+        curr_block = fat_get(fat, curr_block);
     }
+    free(dir_block);
     return false;
 }
 
@@ -335,11 +1179,146 @@ bool valid_filename(char* str) {
  * @return None.
  */
 void fs_getmeta(uint16_t* fat, int fs_fd, int* n_blocks, int* block_size) {
-    uint16_t metadata;
+    superblock_t header;
     safe_lseek(fs_fd, 0, SEEK_SET);
-    safe_read(fs_fd, &metadata, 2);
-    *n_blocks = FAT_BLOCKS(metadata);
-    *block_size = BLOCK_SIZE(metadata);
+    safe_read(fs_fd, &header, FS_SUPERBLOCK_SIZE);
+    if (header.magic == FS_MAGIC) { // v2
+        *n_blocks = header.meta_blocks;
+        *block_size = header.block_size;
+    } else { // v1, metadata packed into the first FAT entry
+        uint16_t metadata;
+        memcpy(&metadata, &header, sizeof(metadata));
+        *n_blocks = FAT_BLOCKS(metadata);
+        *block_size = BLOCK_SIZE(metadata);
+    }
+}
+
+/**
+ * Creates a file system image.
+ * @param fs_name The name of the file system to create.
+ * @param fat_blocks Number of blocks in the FAT region (including the superblock for v2).
+ * @param block_size_config Block size configuration; blocks are BYTE_SIZE << block_size_config bytes.
+ * @param version On-disk format version (FS_VERSION_1 or FS_VERSION_2).
+ * @param features v2 only: bitwise OR of FEATURE_* flags.
+ * @return true on success; false, with a message and without touching fs_name, if the metadata
+ * offsets don't fit the 32-bit superblock fields or the image would be bigger than MAX_IMAGE_BYTES.
+ */
+bool fs_mkfs(const char* fs_name, int fat_blocks, int block_size_config, int version, uint32_t features) {
+    int block_size_bytes = BYTE_SIZE << block_size_config;
+    size_t fat_size = (size_t) fat_blocks * block_size_bytes;
+
+    // lay out the metadata first, so that a geometry that doesn't fit leaves no image behind
+    int n_fat_entries;
+    int meta_blocks = fat_blocks;
+    superblock_t sb;
+    memset(&sb, 0, sizeof(sb));
+    if (version == FS_VERSION_1) {
+        n_fat_entries = fat_size / sizeof(uint16_t);
+    } else {
+        uint64_t max_entries = (fat_size - FS_SUPERBLOCK_SIZE) / sizeof(uint32_t);
+        n_fat_entries = (max_entries > INT32_MAX) ? INT32_MAX : (int) max_entries; // block indices are ints
+        sb.magic = FS_MAGIC;
+        sb.version = FS_VERSION_2;
+        sb.block_size = block_size_bytes;
+        sb.block_count = n_fat_entries;
+        sb.free_blocks = n_fat_entries - 2; // entry 0 is reserved, ROOTDIR is taken
+        sb.features = features;
+        sb.root_dir = ROOTDIR;
+        sb.fat_offset = FS_SUPERBLOCK_SIZE;
+        // journal region, then checksum table (all zeros: no checksums yet), between the FAT & the data region
+        uint64_t journal_bytes = 0;
+        uint64_t csum_bytes = 0;
+        if (features & FEATURE_JOURNAL) {
+            journal_bytes = (JOURNAL_DEFAULT_SIZE + block_size_bytes - 1) / block_size_bytes * (uint64_t) block_size_bytes;
+        }
+        if (features & FEATURE_CHECKSUM) {
+            csum_bytes = ((uint64_t) n_fat_entries * sizeof(uint32_t) + block_size_bytes - 1) / block_size_bytes * block_size_bytes;
+        }
+        uint64_t meta_bytes = fat_size + journal_bytes + csum_bytes;
+        if (meta_bytes > UINT32_MAX) { // the superblock's offsets are 32-bit
+            fprintf(stderr, "failed: %d FAT blocks of %d bytes need %llu bytes of metadata (at most %u)\n",
+                    fat_blocks, block_size_bytes, (unsigned long long) meta_bytes, UINT32_MAX);
+            return false;
+        }
+        if (features & FEATURE_JOURNAL) {
+            sb.journal_offset = fat_size;
+            sb.journal_size = journal_bytes;
+        }
+        if (features & FEATURE_CHECKSUM) {
+            sb.csum_offset = fat_size + journal_bytes;
+            sb.csum_size = csum_bytes;
+        }
+        sb.meta_blocks = meta_bytes / block_size_bytes;
+        meta_blocks = sb.meta_blocks;
+    }
+    off_t data_offset = (off_t) meta_blocks * block_size_bytes;
+    off_t n_data_blocks = n_fat_entries - 1;
+    off_t image_size = data_offset + n_data_blocks * block_size_bytes;
+    if (image_size > MAX_IMAGE_BYTES) {
+        fprintf(stderr, "failed: %d FAT blocks of %d bytes make a %lld-byte image (at most %lld)\n",
+                fat_blocks, block_size_bytes, (long long) image_size, (long long) MAX_IMAGE_BYTES);
+        return false;
+    }
+
+    int fd = safe_open(fs_name, O_CREAT|O_TRUNC|O_RDWR, DEFAULT_PERMISSIONS);
+
+    // the image is sparse: only the nonzero FAT entries, the journal header & the root directory
+    // block are written; everything else is a hole that reads back as zeros (free blocks)
+    if (version == FS_VERSION_1) {
+        uint16_t head[2];
+        head[0] = (fat_blocks << BITS_PER_BYTE) | block_size_config; // metadata
+        head[ROOTDIR] = LASTBLOCK_V1;
+        safe_pwrite(fd, head, sizeof(head), 0);
+    } else {
+        if (features & FEATURE_JOURNAL) journal_format(fd, sb.journal_offset);
+        safe_pwrite(fd, &sb, FS_SUPERBLOCK_SIZE, 0);
+        uint32_t root_entry = (uint32_t) LASTBLOCK;
+        safe_pwrite(fd, &root_entry, sizeof(root_entry), sb.fat_offset + ROOTDIR * sizeof(uint32_t));
+    }
+
+    // the (empty) root directory block
+    char* block = calloc(1, block_size_bytes);
+    if (block == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    safe_pwrite(fd, block, block_size_bytes, data_offset + (off_t) block_size_bytes * (ROOTDIR - 1));
+    free(block);
+
+    safe_ftruncate(fd, image_size);
+    safe_close(fd);
+    return true;
+}
+
+/**
+ * Copies a file system image, sharing its blocks with the copy if the host filesystem
+ * supports reflinks; otherwise copies only the allocated ranges, so holes stay holes.
+ * @param source The image to copy.
+ * @param dest The copy; created, or truncated if it exists.
+ * @return None.
+ */
+void fs_clone(const char* source, const char* dest) {
+    int source_fd = safe_open(source, O_RDONLY, DEFAULT_PERMISSIONS); // permissions ignored because no O_CREAT
+    int dest_fd = safe_open(dest, O_CREAT|O_TRUNC|O_WRONLY, DEFAULT_PERMISSIONS);
+    off_t size = safe_lseek(source_fd, 0, SEEK_END);
+
+    if (ioctl(dest_fd, FICLONE, source_fd) == 0) { // reflink: no data is copied at all
+        safe_close(dest_fd);
+        safe_close(source_fd);
+        return;
+    }
+
+    off_t data = 0;
+    while (data < size) {
+        data = lseek(source_fd, data, SEEK_DATA);
+        if (data == -1) break; // only a hole is left
+        off_t hole = safe_lseek(source_fd, data, SEEK_HOLE);
+        safe_copy_range(source_fd, dest_fd, data, hole - data);
+        data = hole;
+    }
+    safe_ftruncate(dest_fd, size); // trailing hole
+    safe_close(dest_fd);
+    safe_close(source_fd);
 }
 
 /**
@@ -349,12 +1328,55 @@ void fs_getmeta(uint16_t* fat, int fs_fd, int* n_blocks, int* block_size) {
  * @return Returns the file descriptor of the mounted file system on success. On failure, returns -1.
  */
 int fs_mount(char* fs_name, uint16_t** fat) {
+    return fs_mount_mode(fs_name, fat, false);
+}
+
+/**
+ * Mounts a file system, optionally checking it first.
+ * @param fs_name The name of the file system to mount.
+ * @param fat Pointer to FAT.
+ * @param check If true, run fs_fsck (without repairing) and seed the free-space state from it.
+ * @return Returns the file descriptor of the mounted file system on success. On failure, returns -1.
+ */
+int fs_mount_mode(char* fs_name, uint16_t** fat, bool check) {
     int fs_fd = safe_open(fs_name, O_RDWR, DEFAULT_PERMISSIONS); // permissions ignored because no O_CREAT
+    superblock_t header;
+    safe_read(fs_fd, &header, FS_SUPERBLOCK_SIZE);
+    if (header.magic == FS_MAGIC) { // refuse formats this build can't safely write to
+        if (header.version != FS_VERSION_2) {
+            fprintf(stderr, "filename:[%s] unsupported filesystem version:[%u]\n", fs_name, header.version);
+            exit(EXIT_FAILURE);
+        }
+        if ((header.features & ~FS_FEATURES_SUPPORTED) != 0) {
+            fprintf(stderr, "filename:[%s] unsupported filesystem features:[%#x]\n", fs_name, header.features);
+            exit(EXIT_FAILURE);
+        }
+    }
     int n_blocks;
     int block_size;
     fs_getmeta(*fat, fs_fd, &n_blocks, &block_size);
 
-    *fat = safe_mmap(NULL, n_blocks * block_size, PROT_READ | PROT_WRITE, MAP_SHARED, fs_fd, 0);
+    free_hint = 1;
+    bool journaled = (header.magic == FS_MAGIC) && (header.features & FEATURE_JOURNAL);
+    if (!journaled) {
+        *fat = safe_mmap(NULL, (size_t) n_blocks * block_size, PROT_READ | PROT_WRITE, MAP_SHARED, fs_fd, 0);
+    } else {
+        // finish operations committed before a crash, then map privately so that
+        // uncommitted FAT updates never reach the disk
+        journal_replay(fs_fd, &header);
+        *fat = safe_mmap(NULL, (size_t) n_blocks * block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fs_fd, 0);
+        journal_mount(*fat, fs_fd);
+    }
+    checksum_mount(*fat, fs_fd);
+    snapshot_load(*fat, fs_fd);
+
+    if (check) { // the scan also seeds the free-space state
+        fsck_report_t report;
+        fs_fsck(*fat, fs_fd, false, &report);
+        fsck_print_report(&report, false);
+    } else if (journaled) { // the free-block count isn't journaled, so it is stale after a crash
+        fs_recount_free(*fat);
+    }
     return fs_fd;
 }
 
@@ -365,11 +1387,17 @@ int fs_mount(char* fs_name, uint16_t** fat) {
  * @return None.
  */
 void fs_unmount(uint16_t** fat, int fs_fd) {
-    int n_blocks;
-    int block_size;
-    fs_getmeta(*fat, fs_fd, &n_blocks, &block_size);
-
-    safe_munmap(*fat, n_blocks * block_size);
+    dirindex_reset();
+    if (snapshot_mounted(*fat)) { // the image itself was released by `snapshot_mount`
+        snapshot_unmount();
+        safe_close(fs_fd);
+        return;
+    }
+    if (sync_deferred) fs_sync(*fat);
+    if (journal_active()) journal_unmount(*fat);
+    checksum_unmount();
+    snapshot_unload();
+    safe_munmap(*fat, fs_meta_size(*fat));
     safe_close(fs_fd);
 }
 
@@ -381,17 +1409,18 @@ void fs_unmount(uint16_t** fat, int fs_fd) {
  * @return Returns true if a new file is created; otherwise, false if an existing file is updated.
  */
 bool fs_touch(uint16_t* fat, int fs_fd, const char* target) {
+    journal_begin();
     point_t location;
     dir_entry_t entry;
-    bool found = find_file(fat, fs_fd, ROOTDIR, target, &location, &entry);
+    bool found = find_file(fat, fs_fd, fs_root(fat), target, &location, &entry);
     if (found) { // update timestamp
         entry.mtime = time(0);
         write_file(fat, fs_fd, location, entry);
-        return false;
     } else { // create file
-        add_file(fat, fs_fd, ROOTDIR, target);
-        return true;
+        add_file(fat, fs_fd, fs_root(fat), target);
     }
+    journal_end(fat);
+    return !found;
 }
 
 /**
@@ -405,14 +1434,16 @@ bool fs_touch(uint16_t* fat, int fs_fd, const char* target) {
 bool fs_mv(uint16_t* fat, int fs_fd, const char* old_name, const char* new_name) {
     point_t location;
     dir_entry_t entry;
-    bool found = find_file(fat, fs_fd, ROOTDIR, old_name, &location, &entry);
+    bool found = find_file(fat, fs_fd, fs_root(fat), old_name, &location, &entry);
     if (!found) return false;
-    if (find_file(fat, fs_fd, ROOTDIR, new_name, NULL, NULL)) return false; // new_name already exists
+    if (find_file(fat, fs_fd, fs_root(fat), new_name, NULL, NULL)) return false; // new_name already exists
 
+    journal_begin();
     strcpy(entry.name, new_name);
     entry.mtime = time(0);
 
     write_file(fat, fs_fd, location, entry);
+    journal_end(fat);
     return true;
 }
 
@@ -426,13 +1457,36 @@ bool fs_mv(uint16_t* fat, int fs_fd, const char* old_name, const char* new_name)
 bool fs_mark_deleted(uint16_t* fat, int fs_fd, const char* target) {
     point_t location;
     dir_entry_t entry;
-    bool found = find_file(fat, fs_fd, ROOTDIR, target, &location, &entry);
+    bool found = find_file(fat, fs_fd, fs_root(fat), target, &location, &entry);
     if (!found) return false;
 
+    journal_begin();
     entry.name[0] = FILENAME_DEL_INUSE;
     entry.mtime = time(0);
 
     write_file(fat, fs_fd, location, entry);
+    journal_end(fat);
+    return true;
+}
+
+/**
+ * Frees a file marked with `FILENAME_DEL_INUSE` once its last user is gone.
+ * @param fat Pointer to FAT.
+ * @param fs_fd File descriptor of the filesystem.
+ * @param location Block & entry number of the marked entry.
+ * @return Returns true if the entry was marked & is now free; otherwise, false.
+ */
+bool fs_reclaim(uint16_t* fat, int fs_fd, point_t location) {
+    dir_entry_t entry;
+    read_entry(fat, fs_fd, location, &entry);
+    if (entry.name[0] != FILENAME_DEL_INUSE) return false;
+
+    journal_begin();
+    entry.name[0] = FILENAME_DEL_UNUSED;
+    free_data(fat, fs_fd, location, &entry);
+
+    write_file(fat, fs_fd, location, entry);
+    journal_end(fat);
     return true;
 }
 
@@ -446,13 +1500,15 @@ bool fs_mark_deleted(uint16_t* fat, int fs_fd, const char* target) {
 bool fs_rm(uint16_t* fat, int fs_fd, const char* target) {
     point_t location;
     dir_entry_t entry;
-    bool found = find_file(fat, fs_fd, ROOTDIR, target, &location, &entry);
+    bool found = find_file(fat, fs_fd, fs_root(fat), target, &location, &entry);
     if (!found) return false;
 
+    journal_begin();
     entry.name[0] = FILENAME_DEL_UNUSED;
-    delete_chain(fat, entry.firstBlock);
+    free_data(fat, fs_fd, location, &entry);
 
     write_file(fat, fs_fd, location, entry);
+    journal_end(fat);
     return true;
 }
 
@@ -481,7 +1537,7 @@ char* fs_cat(uint16_t* fat, int fs_fd, int input_mode, int output_mode,
             char* target = input_files[f];
             point_t location;
             dir_entry_t entry;
-            find_file(fat, fs_fd, ROOTDIR, target, &location, &entry);
+            find_file(fat, fs_fd, fs_root(fat), target, &location, &entry);
             output_size += entry.size;
         }
 
@@ -492,9 +1548,9 @@ char* fs_cat(uint16_t* fat, int fs_fd, int input_mode, int output_mode,
             char* target = input_files[f];
             point_t location;
             dir_entry_t entry;
-            find_file(fat, fs_fd, ROOTDIR, target, &location, &entry);
+            find_file(fat, fs_fd, fs_root(fat), target, &location, &entry);
 
-            read_chain(fat, fs_fd, entry.firstBlock, &output[position], entry.size);
+            read_file(fat, fs_fd, location, &entry, &output[position], entry.size);
             position += entry.size;
         }
     }
@@ -503,70 +1559,34 @@ char* fs_cat(uint16_t* fat, int fs_fd, int input_mode, int output_mode,
     if (output_mode == 0) { // output to stdout
         return output;
         // fprintf(stderr, "%s\n", output);
-    } else if (output_mode == 1) { // output to file, overwrite
+    }
+    journal_begin();
+    if (output_mode == 1) { // output to file, overwrite
         point_t location;
         dir_entry_t entry;
-        bool found = find_file(fat, fs_fd, ROOTDIR, output_file, &location, &entry);
+        bool found = find_file(fat, fs_fd, fs_root(fat), output_file, &location, &entry);
 
         if (!found) { // create file
-            add_file(fat, fs_fd, ROOTDIR, output_file);
-            find_file(fat, fs_fd, ROOTDIR, output_file, &location, &entry);
+            add_file(fat, fs_fd, fs_root(fat), output_file);
+            find_file(fat, fs_fd, fs_root(fat), output_file, &location, &entry);
         }
-        delete_chain(fat, entry.firstBlock); // overwrite contents
-        int new_head = get_free_block(fat);
-        build_chain(fat, fs_fd, new_head, output, output_size+1); // +1 to include null terminator
-        entry.firstBlock = new_head;
+        bool ok = write_data(fat, fs_fd, &location, &entry, output, output_size+1); // overwrite contents; +1 to include null terminator
         entry.mtime = time(0);
-        entry.size = output_size;
+        entry.size = ok ? output_size : 0;
 
         write_file(fat, fs_fd, location, entry);
     } else { // output to file, append mode
         point_t location;
         dir_entry_t entry;
-        bool found = find_file(fat, fs_fd, ROOTDIR, output_file, &location, &entry);
+        bool found = find_file(fat, fs_fd, fs_root(fat), output_file, &location, &entry);
         
         if (!found) { // create file
-            add_file(fat, fs_fd, ROOTDIR, output_file);
-            find_file(fat, fs_fd, ROOTDIR, output_file, &location, &entry);
-        }
-        if (entry.firstBlock == LASTBLOCK) {
-            int new_head = get_free_block(fat);
-            build_chain(fat, fs_fd, new_head, output, output_size);
-            entry.firstBlock = new_head;
-            entry.mtime = time(0);
-            entry.size = output_size;
-
-            write_file(fat, fs_fd, location, entry);
-        } else { // build new chains
-            int buffer_offset = fill_chain(fat, fs_fd, entry.firstBlock, entry.size, output, output_size);
-            if (buffer_offset == output_size) {
-                entry.mtime = time(0);
-                entry.size = entry.size + output_size;
-
-                write_file(fat, fs_fd, location, entry);
-            } else {
-                char* shifted = &output[buffer_offset];
-                int new_head = get_free_block(fat);
-                build_chain(fat, fs_fd, new_head, shifted, output_size - buffer_offset);
-                
-                // link the chains
-                int last = entry.firstBlock;
-                while (fat[last] != LASTBLOCK) {
-                    last = fat[last];
-                }
-                fat[last] = new_head;
-                int n_blocks;
-                int block_size;
-                fs_getmeta(fat, fs_fd, &n_blocks, &block_size);
-                safe_msync(fat, n_blocks * block_size, MS_SYNC);
-
-                entry.mtime = time(0);
-                entry.size = entry.size + output_size;
-
-                write_file(fat, fs_fd, location, entry);
-            }
+            add_file(fat, fs_fd, fs_root(fat), output_file);
+            find_file(fat, fs_fd, fs_root(fat), output_file, &location, &entry);
         }
+        append_data(fat, fs_fd, &location, &entry, output, output_size);
     }
+    journal_end(fat);
     free(output);
     return NULL;
 }
@@ -594,65 +1614,81 @@ bool fs_cp(uint16_t* fat, int fs_fd, const char* source, const char* dest) {
  * @return Returns true if the copy is successful; otherwise, false.
  */
 bool fs_cp_mode(uint16_t* fat, int fs_fd, const char* source, const char* dest, bool host_in, bool host_out) {
-    int source_size; // size of source file
-    char* buffer; // contents to copy
-    int bytes_read; // size of buffer
-    if (host_in) { // hostOS ->
-        // open input file
-        int source_fd = safe_open(source, O_RDONLY, DEFAULT_PERMISSIONS); // permissions ignored because no O_CREAT
-        // read input file
-        source_size = (int) safe_lseek(source_fd, 0, SEEK_END);
-        buffer = malloc(source_size);
-        safe_lseek(source_fd, 0, SEEK_SET); // read from start
-        bytes_read = (int) safe_read(source_fd, buffer, source_size);
-    } else { // PennFAT ->
-        // open input file
-        point_t source_loc;
-        dir_entry_t source_ent;
-        if (!find_file(fat, fs_fd, ROOTDIR, source, &source_loc, &source_ent)) return false;
-        // read input file
-        source_size = source_ent.size;
-        buffer = malloc(source_size);
-        read_chain(fat, fs_fd, source_ent.firstBlock, buffer, source_ent.size);
-        bytes_read = source_ent.size;
-    }
-
-    if (host_out) { // -> hostOS
-        // open output file
-        int dest_fd = safe_open(dest, O_WRONLY|O_TRUNC|O_CREAT, DEFAULT_PERMISSIONS);
-        // write to output file
-        safe_write(dest_fd, buffer, bytes_read);
-        safe_close(dest_fd);
-    } else { // -> PennFat
-        // open output file
-        point_t dest_loc;
-        dir_entry_t dest_ent;
-        bool dest_found = find_file(fat, fs_fd, ROOTDIR, dest, &dest_loc, &dest_ent);
-        if (!dest_found) { // create file
-            add_file(fat, fs_fd, ROOTDIR, dest);
-            find_file(fat, fs_fd, ROOTDIR, dest, &dest_loc, &dest_ent);
-        }
-        // delete old contents of dest and build new chain using buffer
-        delete_chain(fat, dest_ent.firstBlock);
-        int new_head = get_free_block(fat);
-        build_chain(fat, fs_fd, new_head, buffer, bytes_read);
-        dest_ent.firstBlock = new_head;
-        dest_ent.mtime = time(0);
-        dest_ent.size = bytes_read;
-        // write to output file
-        write_file(fat, fs_fd, dest_loc, dest_ent);
-    }
-    free(buffer);
-    return true;
+    if (host_in) return fs_import(fat, fs_fd, source, dest); // hostOS -> PennFAT, streamed
+    if (host_out) return fs_export(fat, fs_fd, source, dest); // PennFAT -> hostOS, streamed
+    return fs_copy(fat, fs_fd, source, dest, false); // PennFAT -> PennFAT, inside the image
+}
+
+bool fs_copy(uint16_t* fat, int fs_fd, const char* source, const char* dest, bool share) {
+    point_t source_loc;
+    dir_entry_t source_ent;
+    if (!find_file(fat, fs_fd, fs_root(fat), source, &source_loc, &source_ent)) return false;
+    if (strcmp(source, dest) == 0) return true;
+    int head = entry_first_block(fat, &source_ent);
+    char* buffer = NULL; // contents of a file without a chain (empty or inline)
+    if (head == LASTBLOCK) {
+        buffer = malloc(source_ent.size + 1);
+        read_file(fat, fs_fd, source_loc, &source_ent, buffer, source_ent.size);
+    }
+
+    journal_begin();
+    // open output file
+    point_t dest_loc;
+    dir_entry_t dest_ent;
+    bool dest_found = find_file(fat, fs_fd, fs_root(fat), dest, &dest_loc, &dest_ent);
+    if (!dest_found) { // create file
+        add_file(fat, fs_fd, fs_root(fat), dest);
+        find_file(fat, fs_fd, fs_root(fat), dest, &dest_loc, &dest_ent);
+    }
+    bool ok = true;
+    if (buffer != NULL) { // small enough to rewrite
+        dest_ent.type = (dest_ent.type & ~FILETYPE_COMPRESSED) | (source_ent.type & FILETYPE_COMPRESSED);
+        ok = write_data(fat, fs_fd, &dest_loc, &dest_ent, buffer, source_ent.size);
+        free(buffer);
+    } else {
+        // the chain is copied (or shared) as stored, so a compressed file stays compressed
+        int old_head = entry_first_block(fat, &dest_ent);
+        free_data(fat, fs_fd, dest_loc, &dest_ent);
+        if (share) {
+            entry_set_first_block(fat, &dest_ent, head);
+        } else {
+            int n_blocks = 0;
+            for (int b = head; b != LASTBLOCK; b = fat_get(fat, b)) n_blocks++;
+            int* blocks = alloc_chain(fat, (old_head == LASTBLOCK) ? head : old_head, n_blocks);
+            if (blocks != NULL) {
+                copy_blocks(fat, fs_fd, head, blocks, n_blocks);
+                entry_set_first_block(fat, &dest_ent, blocks[0]);
+                free(blocks);
+            } else {
+                fprintf(stderr, "cp: filesystem is full\n");
+                ok = false;
+            }
+        }
+        dest_ent.type = (dest_ent.type & ~(FILETYPE_INLINE | FILETYPE_COMPRESSED)) | (source_ent.type & FILETYPE_COMPRESSED);
+        if (share) { // both files are marked, so only their frees & appends look for each other
+            dest_ent.type |= FILETYPE_SHARED;
+            source_ent.type |= FILETYPE_SHARED;
+            write_file(fat, fs_fd, source_loc, source_ent);
+        }
+    }
+    dest_ent.mtime = time(0);
+    dest_ent.size = ok ? source_ent.size : 0;
+    // write to output file
+    write_file(fat, fs_fd, dest_loc, dest_ent);
+    journal_end(fat);
+    return ok;
 }
 
 /**
  * Displays information about a single directory entry.
+ * @param fat Pointer to FAT.
  * @param entry Pointer to the directory entry.
  * @return None.
  */
-void fs_ls_single(dir_entry_t* entry) {
+void fs_ls_single(uint16_t* fat, dir_entry_t* entry) {
     if (entry->name[0] <= FILENAME_DEL_INUSE) return; // not a valid file
+    if (entry->name[0] == FILENAME_INLINE) return; // data of the previous file
+    if (entry->type == FILETYPE_SNAPSHOT) return; // listed by `snapshot -l`
 
     char* time_str = ctime(&entry->mtime);
     time_str[strlen(time_str)-1] = '\0'; // delete '\n'
@@ -669,10 +1705,19 @@ void fs_ls_single(dir_entry_t* entry) {
             exit(EXIT_FAILURE);
     }
 
-    fprintf(stderr, "%5d %s %d %s %s\n", 
-            entry->firstBlock,
+    char first_block[16] = "-"; // inline files have no first block
+    if (!(entry->type & FILETYPE_INLINE)) {
+        int head = (fs_version(fat) == FS_VERSION_1) ? entry->firstBlock : entry_first_block(fat, entry);
+        if (head == LASTBLOCK) head = 0; // empty chain; v1 stores 0 for it too
+        snprintf(first_block, sizeof(first_block), "%d", head);
+    }
+    char attr = (entry->type & FILETYPE_COMPRESSED) ? 'c' : '-';
+    fprintf(stderr, "%5s %s%c %u %lld %s %s\n", // size is logical, then physical (allocated bytes)
+            first_block,
             rwx_perm,
+            attr,
             entry->size,
+            fs_physical_bytes(fat, entry),
             time_str,
             entry->name);
 }
@@ -684,19 +1729,19 @@ void fs_ls_single(dir_entry_t* entry) {
  * @return None.
  */
 void fs_ls(uint16_t* fat, int fs_fd) {
-    int curr_block = ROOTDIR;
-    int n_blocks;
-    int block_size;
-    fs_getmeta(fat, fs_fd, &n_blocks, &block_size);
+    int curr_block = fs_root(fat);
+    int block_size = fs_block_size(fat);
+    char* dir_block = malloc(block_size);
     while (curr_block != LASTBLOCK) {
-        safe_lseek(fs_fd, mem_idx(fat, curr_block), SEEK_SET);
+        read_dir_block(fat, fs_fd, curr_block, dir_block);
         dir_entry_t entry;
         for (int i = 0; i < block_size / DIR_ENTRY_SIZE; i++) {
-            safe_read(fs_fd, &entry, DIR_ENTRY_SIZE);
-            fs_ls_single(&entry);
+            memcpy(&entry, &dir_block[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
+            fs_ls_single(fat, &entry);
         } 
-        curr_block = fat[curr_block];
+        curr_block = fat_get(fat, curr_block);
     }
+    free(dir_block);
 }
 
 /**
@@ -710,11 +1755,40 @@ void fs_ls(uint16_t* fat, int fs_fd) {
 uint8_t fs_chmod(uint16_t* fat, int fs_fd, const char* target, uint8_t permissions) {
     point_t location;
     dir_entry_t entry;
-    find_file(fat, fs_fd, ROOTDIR, target, &location, &entry);
+    find_file(fat, fs_fd, fs_root(fat), target, &location, &entry);
+    journal_begin();
     uint8_t old_perm = entry.perm;
     entry.perm = permissions; // update permissions
     entry.mtime = time(0); // update timestamp
 
     write_file(fat, fs_fd, location, entry);
+    journal_end(fat);
     return old_perm;
+}
+
+/**
+ * Sets or clears the compression attribute of a file, re-encoding its contents.
+ * @param fat Pointer to FAT.
+ * @param fs_fd File descriptor of the filesystem.
+ * @param target Name of the file.
+ * @param compressed Whether the file should be stored compressed.
+ * @return Returns true if the file exists; otherwise, false.
+ */
+bool fs_chattr(uint16_t* fat, int fs_fd, const char* target, bool compressed) {
+    point_t location;
+    dir_entry_t entry;
+    if (!find_file(fat, fs_fd, fs_root(fat), target, &location, &entry)) return false;
+    if (((entry.type & FILETYPE_COMPRESSED) != 0) == compressed) return true; // nothing to do
+
+    journal_begin();
+    char* data = malloc(entry.size);
+    read_file(fat, fs_fd, location, &entry, data, entry.size);
+    if (compressed) entry.type |= FILETYPE_COMPRESSED;
+    else entry.type &= ~FILETYPE_COMPRESSED;
+    if (!write_data(fat, fs_fd, &location, &entry, data, entry.size)) entry.size = 0;
+    free(data);
+
+    write_file(fat, fs_fd, location, entry);
+    journal_end(fat);
+    return true;
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #pragma once
 
@@ -15,14 +17,60 @@ extern const int BYTE_SIZE;
 #define FAT_BLOCKS(x) ((x) >> BITS_PER_BYTE) // get number of blocks in fat, MSB of uint16_t
 #define BLOCK_SIZE(x) (BYTE_SIZE << ((x) & 0xFF)) // get block size from metadata, LSB of uint16_t
 
+// on-disk format versions
+extern const int FS_VERSION_1; // metadata packed into fat[0], 16-bit FAT entries
+extern const int FS_VERSION_2; // superblock, 32-bit FAT entries
+extern const uint32_t FS_MAGIC;
+extern const int FS_SUPERBLOCK_SIZE;
+
+extern const int MAX_FAT_BLOCKS_V1;
+extern const int MAX_FAT_BLOCKS_V2;
+extern const int MAX_BLOCK_SIZE_CONFIG_V1; // 4 KB blocks
+extern const int MAX_BLOCK_SIZE_CONFIG_V2; // 64 KB blocks
+
+extern const uint32_t FEATURE_JOURNAL; // write-ahead metadata journal after the FAT
+extern const uint32_t FEATURE_INLINE; // files of up to INLINE_MAX_BYTES are stored in their directory slots
+extern const uint32_t FEATURE_COMPRESS; // new files get FILETYPE_COMPRESSED
+extern const uint32_t FEATURE_CHECKSUM; // CRC32C of every data block in a table before the data region
+extern const uint32_t FS_FEATURES_SUPPORTED; // mount refuses images with other feature bits set
+
+typedef struct superblock { // v2 superblock, first FS_SUPERBLOCK_SIZE bytes of the image
+    uint32_t magic; // FS_MAGIC; can never be a valid v1 fat[0]
+    uint32_t version; // FS_VERSION_2
+    uint32_t block_size; // bytes per block
+    uint32_t block_count; // number of FAT entries, including the reserved entry 0
+    uint32_t free_blocks; // number of unallocated data blocks
+    uint32_t features; // bitwise OR of FEATURE_* flags
+    uint32_t root_dir; // first block of the root directory
+    uint32_t meta_blocks; // blocks before the data region (superblock & FAT)
+    uint32_t fat_offset; // byte offset of the FAT from the start of the image
+    uint32_t journal_offset; // FEATURE_JOURNAL: byte offset of the journal region
+    uint32_t journal_size; // FEATURE_JOURNAL: bytes in the journal region
+    uint32_t csum_offset; // FEATURE_CHECKSUM: byte offset of the checksum table
+    uint32_t csum_size; // FEATURE_CHECKSUM: bytes in the checksum table region
+    char _BUFFER_[204]; // included so that size of superblock is FS_SUPERBLOCK_SIZE bytes
+} superblock_t;
+
 extern const int FILETYPE_UNKNOWN;
 extern const int FILETYPE_FILE;
 extern const int FILETYPE_DIRECTORY;
 extern const int FILETYPE_LINK;
+extern const int FILETYPE_SNAPSHOT;
+extern const int FILETYPE_INLINE;
+extern const int FILETYPE_COMPRESSED;
+extern const int FILETYPE_SHARED;
 
 extern const int FILENAME_ENDDIR;
 extern const int FILENAME_DEL_UNUSED;
 extern const int FILENAME_DEL_INUSE;
+extern const int FILENAME_INLINE;
+
+// inline files (FEATURE_INLINE) keep their first bytes in the entry's `firstBlockHi` & `_BUFFER_`,
+// and the rest in up to INLINE_MAX_SLOTS continuation slots right after the entry
+#define INLINE_HEAD_BYTES 16
+#define INLINE_SLOT_BYTES 63 // a continuation slot is FILENAME_INLINE & 63 bytes of data
+#define INLINE_MAX_SLOTS 3
+#define INLINE_MAX_BYTES (INLINE_HEAD_BYTES + INLINE_MAX_SLOTS * INLINE_SLOT_BYTES) // 205
 
 extern const int FILEPERM_NONE;
 extern const int FILEPERM_RD;
@@ -36,7 +84,8 @@ typedef struct directory_entry { // 64-byte directory entry
     uint8_t type;
     uint8_t perm;
     time_t mtime;
-    char _BUFFER_[16]; // included so that size of directory_entry is 64 bytes
+    uint16_t firstBlockHi; // v2 only: high 16 bits of the first block
+    char _BUFFER_[14]; // included so that size of directory_entry is 64 bytes
 } dir_entry_t;
 
 typedef struct point { // file location (directory block & entry)
@@ -44,6 +93,264 @@ typedef struct point { // file location (directory block & entry)
     int second; // entry index
 } point_t;
 
+/**
+ * get the on-disk format version of a mounted filesystem
+ * @param fat filesystem
+ * @return `FS_VERSION_1` or `FS_VERSION_2`
+*/
+int fs_version(uint16_t* fat);
+
+/**
+ * get the superblock of a mounted filesystem
+ * @param fat filesystem
+ * @return the superblock, or `NULL` for a v1 filesystem
+*/
+superblock_t* fs_superblock(uint16_t* fat);
+
+/**
+ * get the block size of a mounted filesystem
+ * @param fat filesystem
+ * @return bytes per block
+*/
+int fs_block_size(uint16_t* fat);
+
+/**
+ * get the number of FAT entries of a mounted filesystem
+ * @param fat filesystem
+ * @return number of entries, including the reserved entry 0
+*/
+int fs_n_entries(uint16_t* fat);
+
+/**
+ * get the number of FAT entries that can name a block
+ * (v1 entry 0xFFFF is indistinguishable from `LASTBLOCK`)
+ * @param fat filesystem
+ * @return valid block indices are `1` to `fs_n_blocks(fat) - 1`
+*/
+int fs_n_blocks(uint16_t* fat);
+
+/**
+ * seed the free-space state from a full scan (`fs_fsck`) instead of rescanning
+ * @param fat filesystem
+ * @param free_blocks number of free blocks (stored in the v2 superblock)
+ * @param first_free lowest free block index, or `0` if the filesystem is full
+ * @return none
+*/
+void fs_seed_free(uint16_t* fat, int free_blocks, int first_free);
+
+/**
+ * count the free blocks again (blocks snapshots hold aren't free), e.g. after a crash
+ * or once a snapshot is deleted; updates the superblock count & the free-space state
+ * @param fat filesystem
+ * @return none
+*/
+void fs_recount_free(uint16_t* fat);
+
+/**
+ * get the size of the region before the data region (mapped by `fs_mount`)
+ * @param fat filesystem
+ * @return size in bytes
+*/
+size_t fs_meta_size(uint16_t* fat);
+
+/**
+ * get the first block of the root directory
+ * @param fat filesystem
+ * @return the root directory block
+*/
+int fs_root(uint16_t* fat);
+
+/**
+ * read a FAT entry
+ * @param fat filesystem
+ * @param idx block index
+ * @return the next block in the chain, `0` if free, or `LASTBLOCK`
+*/
+int fat_get(uint16_t* fat, int idx);
+
+/**
+ * write a FAT entry; keeps the superblock free-block count up to date (a block freed while
+ * a snapshot still holds it isn't counted until `fs_recount_free` after the snapshot is deleted)
+ * @param fat filesystem
+ * @param idx block index
+ * @param value the next block in the chain, `0` to free, or `LASTBLOCK`
+ * @return none
+*/
+void fat_set(uint16_t* fat, int idx, int value);
+
+/**
+ * make a freed block available to the allocator again; called by the journal once the
+ * group that freed the block has committed (unjournaled frees are available at once)
+ * @param idx block index
+ * @return none
+*/
+void fs_release_block(int idx);
+
+/**
+ * commit the running journal group early if it freed blocks, so an operation about to start
+ * can allocate them; call between operations when there isn't enough free space
+ * @param fat filesystem
+ * @return `true` if freed blocks were handed back to the allocator
+*/
+bool fs_reclaim_freed(uint16_t* fat);
+
+/**
+ * flush the FAT (and superblock) to disk;
+ * no-op on journaled filesystems, where `journal_end` decides when to commit
+ * @param fat filesystem
+ * @return none
+*/
+void fat_sync(uint16_t* fat);
+
+/**
+ * make all completed metadata updates durable
+ * (commit the running journal group, or flush the FAT)
+ * @param fat filesystem
+ * @return none
+*/
+void fs_sync(uint16_t* fat);
+
+/**
+ * defer FAT flushes until further notice, e.g. for a batch of commands; turning deferral off,
+ * or unmounting, makes everything durable at once (journal groups still commit on their deadline)
+ * @param fat filesystem, or `NULL` if none is mounted
+ * @param defer `true` to defer, `false` to flush & stop deferring
+ * @return none
+*/
+void fs_defer_sync(uint16_t* fat, bool defer);
+
+/**
+ * commit the running journal group once its deadline has passed, even if no operation
+ * ends after it; call periodically (PennOS calls it every tick)
+ * @param fat filesystem, or `NULL` if none is mounted
+ * @return none
+*/
+void fs_tick(uint16_t* fat);
+
+/**
+ * get the first block of a file from its directory entry
+ * @param fat filesystem
+ * @param entry the directory entry
+ * @return the first block, or `LASTBLOCK` if the file is empty
+*/
+int entry_first_block(uint16_t* fat, dir_entry_t* entry);
+
+/**
+ * set the first block of a file in its directory entry
+ * @param fat filesystem
+ * @param entry the directory entry
+ * @param block the first block, or `LASTBLOCK` if the file is empty
+ * @return none
+*/
+void entry_set_first_block(uint16_t* fat, dir_entry_t* entry, int block);
+
+/**
+ * get the byte offset of a block in the image
+ * @param fat filesystem
+ * @param block_idx block index
+ * @return the byte offset of `block_idx`
+*/
+off_t mem_idx(uint16_t* fat, int block_idx);
+
+/**
+ * search for a free block that no snapshot holds
+ * @param fat filesystem
+ * @return the block index on success, `0` if the filesystem is full
+*/
+int get_free_block(uint16_t* fat);
+
+/**
+ * search for a free block at or just after `goal` (so a chain grows in order),
+ * falling back to `get_free_block`
+ * @param fat filesystem
+ * @param goal the block to try first, usually the one after the chain's last block
+ * @return the block index on success, `0` if the filesystem is full
+*/
+int get_free_block_near(uint16_t* fat, int goal);
+
+/**
+ * search for a run of free blocks: the first run of `n_blocks` at or after `goal`, then
+ * the first one before it, otherwise the longest run there is
+ * @param fat filesystem
+ * @param goal where to start searching (`0` for the lowest free block)
+ * @param n_blocks blocks wanted
+ * @return the first block of the run, or `0` if the filesystem is full
+*/
+int get_free_extent(uint16_t* fat, int goal, int n_blocks);
+
+/**
+ * measure a run of free blocks
+ * @param fat filesystem
+ * @param start first block of the run
+ * @param max_blocks stop counting here
+ * @return the number of free blocks no snapshot holds from `start` on, at most `max_blocks`
+*/
+int fs_free_run(uint16_t* fat, int start, int max_blocks);
+
+/**
+ * count the blocks that can still be allocated
+ * @param fat filesystem
+ * @return the number of free blocks no snapshot holds, not counting ones whose free isn't committed yet
+*/
+int fs_free_blocks(uint16_t* fat);
+
+/**
+ * allocate a chain, as one run of blocks if possible
+ * @param fat filesystem
+ * @param goal where to look first
+ * @param n_blocks length of the chain
+ * @return the chain's blocks, in order (malloc'd), or `NULL` (nothing allocated) if there isn't enough space
+*/
+int* alloc_chain(uint16_t* fat, int goal, int n_blocks);
+
+/**
+ * add a new empty file to a directory
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param dir_head the first index of the directory chain (`fs_root(fat)` for the root dir)
+ * @param filename the file to add
+ * @return none
+*/
+void add_file(uint16_t* fat, int fs_fd, int dir_head, const char* filename);
+
+/**
+ * free every block of a FAT chain
+ * @param fat filesystem
+ * @param head the first index of the chain
+ * @return none
+*/
+void delete_chain(uint16_t* fat, int head);
+
+/**
+ * write a directory entry (through the journal on journaled filesystems)
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location directory block & entry number
+ * @param entry the directory entry
+ * @return none
+*/
+void write_file(uint16_t* fat, int fs_fd, point_t location, dir_entry_t entry);
+
+/**
+ * read a whole directory block, including journaled entries that aren't checkpointed yet
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param block_idx block index of the directory block
+ * @param buffer where to read the block into, `fs_block_size(fat)` bytes
+ * @return none
+*/
+void read_dir_block(uint16_t* fat, int fs_fd, int block_idx, char* buffer);
+
+/**
+ * read one directory entry, including a journaled update that isn't checkpointed yet
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location block & entry number of the entry
+ * @param ret set to the entry
+ * @return none
+*/
+void read_entry(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* ret);
+
 /**
  * read a FAT chain
  * @param fat filesystem
@@ -55,12 +362,112 @@ typedef struct point { // file location (directory block & entry)
 */
 void read_chain(uint16_t* fat, int fs_fd, int head, char* buffer, int chain_bytes);
 
+/**
+ * read part of a FAT chain, one read per run of consecutive blocks;
+ * with FEATURE_CHECKSUM, every block read is verified
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param head the first index of the chain
+ * @param offset byte offset into the chain to start at
+ * @param buffer what to read into; assume this has enough space
+ * @param n_bytes bytes to read
+ * @return `false` if a block failed its checksum, `true` otherwise
+*/
+bool read_chain_range(uint16_t* fat, int fs_fd, int head, int offset, char* buffer, int n_bytes);
+
+/**
+ * get the number of continuation slots an inline file needs
+ * @param n_bytes file size
+ * @return number of `FILENAME_INLINE` slots after the entry
+*/
+int inline_slots(int n_bytes);
+
+/**
+ * count the continuation slots of an inline file
+ * @param dir_block contents of the directory block holding the file
+ * @param entry_idx entry number of the file
+ * @param n_entries entries per directory block
+ * @return number of `FILENAME_INLINE` slots right after the entry
+*/
+int inline_run(char* dir_block, int entry_idx, int n_entries);
+
+/**
+ * release a file's data: its chain (unless another file shares it), or its continuation slots if it is inline
+ * the caller writes `entry` back
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location location of the file's directory entry
+ * @param entry the file's directory entry; left with no data
+ * @return none
+*/
+void free_data(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry);
+
+/**
+ * check whether another file uses the same chain (after `fs_copy` shared it); a shared chain is
+ * freed by the last file that lets go of it, and a file's chain is copied before it is changed in place.
+ * The directory is only searched for files marked FILETYPE_SHARED, and only if `entry` is marked
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location location of the file's directory entry, which doesn't count
+ * @param entry the file's directory entry; its FILETYPE_SHARED flag is cleared if no other file
+ * uses the chain any more, and the caller writes it back
+ * @return `true` if some other directory entry (including a deleted file that is still open) starts at the file's first block
+*/
+bool chain_shared(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry);
+
+/**
+ * replace a file's data; with FEATURE_INLINE, data of up to INLINE_MAX_BYTES is stored in
+ * the directory slots (moving the entry if the slots after it are taken), otherwise in a new chain
+ * the caller writes `entry` back to `location`
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location location of the file's directory entry; updated if the entry moves
+ * @param entry the file's directory entry
+ * @param data the new contents
+ * @param n_bytes length of `data`
+ * @return `true` on success, `false` if the filesystem is full (the file is left empty)
+*/
+bool write_data(uint16_t* fat, int fs_fd, point_t* location, dir_entry_t* entry, const char* data, int n_bytes);
+
+/**
+ * read a file's data, from its chain or its directory slots
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location location of the file's directory entry
+ * @param entry the file's directory entry
+ * @param buffer what to read into; assume this has enough space
+ * @param n_bytes bytes to read, at most the file size
+ * @return none
+*/
+void read_file(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, char* buffer, int n_bytes);
+
+/**
+ * read part of a file's data; for compressed files, only the chunks overlapping the range are decoded
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location location of the file's directory entry
+ * @param entry the file's directory entry
+ * @param offset first byte to read
+ * @param buffer what to read into; assume this has enough space
+ * @param n_bytes bytes to read; `offset + n_bytes` is at most the file size
+ * @return `false` if a block failed its checksum, `true` otherwise
+*/
+bool read_file_range(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, int offset, char* buffer, int n_bytes);
+
+/**
+ * get the space a file takes up in the data region
+ * @param fat filesystem
+ * @param entry the file's directory entry
+ * @return bytes in the file's chain (`0` for empty & inline files)
+*/
+long long fs_physical_bytes(uint16_t* fat, dir_entry_t* entry);
+
 /**
  * search for a filename in the directory
  * use `NULL` for `loc` and `ret` to simply check if the file exists
  * @param fat filesystem
  * @param fs_fd filesystem file descriptor
- * @param dir_head the first index of the directory chain (`ROOTDIR` or `1` for the root dir)
+ * @param dir_head the first index of the directory chain (`fs_root(fat)` for the root dir)
  * @param filename the file to search for
  * @param loc will be set to the block (`loc.first`) & entry number (`loc.second`) of the file,
  * if the file is found
@@ -81,12 +488,32 @@ bool valid_filename(char* str);
  * get the metadata of a filesystem
  * @param fat filesystem
  * @param fs_fd filesystem file descriptor
- * @param n_blocks set to the number of blocks in FAT
+ * @param n_blocks set to the number of blocks in FAT (superblock & FAT for v2)
  * @param block_size set to the size of a block
  * @return none
 */
 void fs_getmeta(uint16_t* fat, int fs_fd, int* n_blocks, int* block_size);
 
+/**
+ * create a filesystem image
+ * @param fs_name filesystem filename; created, or truncated if it exists
+ * @param fat_blocks number of blocks in the FAT region (superblock & FAT for v2)
+ * @param block_size_config block size is `BYTE_SIZE << block_size_config`
+ * @param version `FS_VERSION_1` or `FS_VERSION_2`
+ * @param features v2 only: bitwise OR of `FEATURE_*` flags
+ * @return `true`, or `false` (with a message, & `fs_name` untouched) if the metadata doesn't fit
+ * the superblock's 32-bit offsets or the image would be bigger than 1 TB
+*/
+bool fs_mkfs(const char* fs_name, int fat_blocks, int block_size_config, int version, uint32_t features);
+
+/**
+ * copy a filesystem image; reflinked if the host filesystem supports it, sparse otherwise
+ * @param source image to copy
+ * @param dest the copy; created, or truncated if it exists
+ * @return none
+*/
+void fs_clone(const char* source, const char* dest);
+
 /**
  * mount a filesystem & map fat to memory
  * @param fs_name filesystem filename
@@ -95,6 +522,15 @@ void fs_getmeta(uint16_t* fat, int fs_fd, int* n_blocks, int* block_size);
 */
 int fs_mount(char* fs_name, uint16_t** fat);
 
+/**
+ * mount a filesystem, optionally checking it first
+ * @param fs_name filesystem filename
+ * @param fat set to the filesytem
+ * @param check if `true`, run `fs_fsck` (without repairing) & seed the free-space state from it
+ * @return the filesystem file descriptor (`fs_fd`)
+*/
+int fs_mount_mode(char* fs_name, uint16_t** fat, bool check);
+
 /**
  * unmount a filesystem
  * @param fat pointer to the filesystem; will be unmapped from memory
@@ -141,6 +577,15 @@ bool fs_rm(uint16_t* fat, int fs_fd, const char* target);
 */
 bool fs_mark_deleted(uint16_t* fat, int fs_fd, const char* target);
 
+/**
+ * free a file marked with `FILENAME_DEL_INUSE` once its last user is gone
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param location block & entry number of the marked entry
+ * @return `true` if the entry was marked & is now free, `false` otherwise
+*/
+bool fs_reclaim(uint16_t* fat, int fs_fd, point_t location);
+
 /**
  * cat a number of files or the `input_str`, output to buffer or another file
  * @param fat filesystem
@@ -155,6 +600,32 @@ bool fs_mark_deleted(uint16_t* fat, int fs_fd, const char* target);
 char* fs_cat(uint16_t* fat, int fs_fd, int input_mode, int output_mode,
             char* input_str, char* input_files[], char* output_file);
 
+/**
+ * make sure the bytes `[offset, offset + len)` of a file are allocated, growing it with zeros
+ * if it is shorter; new blocks are taken as one run next to the file's last block if possible
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param target the file
+ * @param offset start of the range
+ * @param len length of the range
+ * @return `true` on success, `false` if `target` was not found or there isn't enough free space
+*/
+bool fs_fallocate(uint16_t* fat, int fs_fd, const char* target, int offset, int len);
+
+/**
+ * write data at an offset of a file, overwriting the blocks its chain already has in place
+ * (so blocks reserved by `fs_fallocate` are used, not replaced) & appending the rest
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param target the file
+ * @param offset where to write, at most the file's size
+ * @param data what to write
+ * @param n_bytes length of `data`
+ * @return `true` on success, `false` if `target` was not found, `offset` is past its end, or
+ * the filesystem is full
+*/
+bool fs_pwrite(uint16_t* fat, int fs_fd, const char* target, int offset, const char* data, int n_bytes);
+
 /**
  * copy a file
  * @param fat filesystem
@@ -177,12 +648,24 @@ bool fs_cp(uint16_t* fat, int fs_fd, const char* source, const char* dest);
 */
 bool fs_cp_mode(uint16_t* fat, int fs_fd, const char* source, const char* dest, bool host_in, bool host_out);
 
+/**
+ * copy a file's chain inside the image, without passing its data through memory
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param source the file to copy from
+ * @param dest the file to copy to; created if necessary, or overwritten if not
+ * @param share if `true`, `dest` shares `source`'s chain (copy-on-write) instead of getting a copy
+ * @return `true` on success, `false` if `source` was not found or the filesystem is full
+*/
+bool fs_copy(uint16_t* fat, int fs_fd, const char* source, const char* dest, bool share);
+
 /**
  * list information for a single file
+ * @param fat filesystem
  * @param entry the directory entry for the file
  * @return none
 */
-void fs_ls_single(dir_entry_t* entry);
+void fs_ls_single(uint16_t* fat, dir_entry_t* entry);
 
 /**
  * list directory
@@ -200,4 +683,14 @@ void fs_ls(uint16_t* fat, int fs_fd);
  * @param permissions the new permissions
  * @return the old permissions
 */
-uint8_t fs_chmod(uint16_t* fat, int fs_fd, const char* target, uint8_t permissions);
\ No newline at end of file
+uint8_t fs_chmod(uint16_t* fat, int fs_fd, const char* target, uint8_t permissions);
+
+/**
+ * set or clear the compression attribute of a file, re-encoding its contents
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param target name of the file
+ * @param compressed whether the file should be stored compressed
+ * @return `true` if the file exists, `false` otherwise
+*/
+bool fs_chattr(uint16_t* fat, int fs_fd, const char* target, bool compressed);
\ No newline at end of file
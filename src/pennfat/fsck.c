@@ -0,0 +1,328 @@
+// filesystem consistency check
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "compress.h"
+#include "fat.h"
+#include "fsck.h"
+#include "journal.h"
+#include "snapshot.h"
+
+typedef struct fsck_state {
+    uint16_t* fat; // filesystem
+    int fs_fd; // filesystem file descriptor
+    bool repair; // fix problems as they are found
+    int n_blocks; // valid block indices are below this
+    int block_size;
+    uint64_t* reachable; // bitmap of blocks reached from the root directory
+    uint64_t* heads; // bitmap of blocks that start a chain reached from the root directory
+    fsck_report_t* report;
+} fsck_state_t;
+
+/**
+ * check whether a block was already reached from the root directory
+ * @param state the check
+ * @param block block index
+ * @return `true` if the block is reachable
+*/
+static bool is_reachable(fsck_state_t* state, int block) {
+    return (state->reachable[block / 64] >> (block % 64)) & 1;
+}
+
+/**
+ * walk a chain, marking its blocks reachable, and truncate it before the first bad block (if repairing)
+ * @param state the check
+ * @param name name of the file (for messages)
+ * @param entry directory entry holding the head of the chain; its first block is updated by repairs
+ * @param head the first index of the chain
+ * @return the number of blocks kept in the chain
+*/
+static int walk_chain(fsck_state_t* state, const char* name, dir_entry_t* entry, int head) {
+    uint16_t* fat = state->fat;
+    int n = 0;
+    if (head >= 1 && head < state->n_blocks && ((state->heads[head / 64] >> (head % 64)) & 1)) { // shared by `cp -s`
+        for (int curr = head; curr != LASTBLOCK; curr = fat_get(fat, curr)) n++;
+        return n;
+    }
+    if (head >= 1 && head < state->n_blocks) state->heads[head / 64] |= 1ULL << (head % 64);
+    int prev = 0; // `0` while `curr` is the head
+    int curr = head;
+    while (curr != LASTBLOCK) {
+        const char* problem = NULL;
+        if (curr < 1 || curr >= state->n_blocks) {
+            problem = "points outside the filesystem";
+            state->report->n_bad_chains++;
+        } else if (fat_get(fat, curr) == 0) {
+            problem = "points to a free block";
+            state->report->n_bad_chains++;
+        } else if (is_reachable(state, curr)) {
+            problem = "is cross-linked";
+            state->report->n_cross_links++;
+        }
+        if (problem != NULL) {
+            fprintf(stderr, "fsck: file:[%s] chain %s at block %d\n", name, problem, curr);
+            state->report->n_problems++;
+            if (state->repair) {
+                if (prev == 0) entry_set_first_block(fat, entry, LASTBLOCK);
+                else fat_set(fat, prev, LASTBLOCK);
+                state->report->n_repaired++;
+            }
+            break;
+        }
+        state->reachable[curr / 64] |= 1ULL << (curr % 64);
+        n++;
+        prev = curr;
+        curr = fat_get(fat, curr);
+    }
+    return n;
+}
+
+/**
+ * check a file's chain against its size
+ * the chain may hold one byte more than the size (the null terminator `fs_cat` writes)
+ * @param state the check
+ * @param entry the directory entry; updated by repairs
+ * @param n number of blocks in the chain
+ * @return `true` if the entry was changed
+*/
+static bool check_size(fsck_state_t* state, dir_entry_t* entry, int n) {
+    uint16_t* fat = state->fat;
+    int block_size = state->block_size;
+    long long min_blocks = ((long long) entry->size + block_size - 1) / block_size;
+    long long max_blocks = ((long long) entry->size + block_size) / block_size;
+    if (n >= min_blocks && n <= max_blocks) return false;
+
+    fprintf(stderr, "fsck: file:[%s] size %u doesn't match its %d-block chain\n", entry->name, entry->size, n);
+    state->report->n_bad_sizes++;
+    state->report->n_problems++;
+    if (!state->repair) return false;
+
+    if (n < min_blocks) { // data is missing; keep what is there
+        entry->size = (uint32_t) n * block_size;
+    } else if (max_blocks == 0) { // chain of an empty file
+        delete_chain(fat, entry_first_block(fat, entry));
+        entry_set_first_block(fat, entry, LASTBLOCK);
+    } else { // trim the tail of the chain
+        int last = entry_first_block(fat, entry);
+        for (int i = 1; i < max_blocks; i++) last = fat_get(fat, last);
+        int tail = fat_get(fat, last);
+        fat_set(fat, last, LASTBLOCK);
+        delete_chain(fat, tail);
+    }
+    state->report->n_repaired++;
+    return true;
+}
+
+/**
+ * check a compressed file's chain against the length of its encoding (from its extent map)
+ * @param state the check
+ * @param entry the directory entry; updated by repairs
+ * @param n number of blocks in the chain
+ * @return `true` if the entry was changed
+*/
+static bool check_compressed(fsck_state_t* state, dir_entry_t* entry, int n) {
+    uint16_t* fat = state->fat;
+    int block_size = state->block_size;
+    if (n == 0 && entry->size == 0) return false;
+    int stored = compress_stored_bytes(fat, state->fs_fd, entry_first_block(fat, entry), n * block_size);
+    int needed = (stored < 0) ? -1 : (stored + block_size - 1) / block_size;
+    if (needed == n) return false;
+
+    if (stored < 0) fprintf(stderr, "fsck: file:[%s] has a corrupt extent map\n", entry->name);
+    else fprintf(stderr, "fsck: file:[%s] compressed size %d doesn't match its %d-block chain\n", entry->name, stored, n);
+    state->report->n_bad_sizes++;
+    state->report->n_problems++;
+    if (!state->repair) return false;
+
+    if (stored < 0 || needed > n) { // chunks are missing; the extent map can't be trusted
+        delete_chain(fat, entry_first_block(fat, entry));
+        entry_set_first_block(fat, entry, LASTBLOCK);
+        entry->size = 0;
+    } else { // trim the tail of the chain
+        int last = entry_first_block(fat, entry);
+        for (int i = 1; i < needed; i++) last = fat_get(fat, last);
+        int tail = fat_get(fat, last);
+        fat_set(fat, last, LASTBLOCK);
+        delete_chain(fat, tail);
+    }
+    state->report->n_repaired++;
+    return true;
+}
+
+/**
+ * check the entries of one directory block
+ * @param state the check
+ * @param dir_block block index of the directory block
+ * @param buffer contents of the directory block
+ * @return none
+*/
+static void check_dir_block(fsck_state_t* state, int dir_block, char* buffer) {
+    uint16_t* fat = state->fat;
+    int n_entries = state->block_size / DIR_ENTRY_SIZE;
+    for (int i = 0; i < n_entries; i++) {
+        dir_entry_t entry;
+        memcpy(&entry, &buffer[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
+        if (entry.name[0] < FILENAME_DEL_INUSE) continue; // end of dir, or deleted entry & file
+
+        bool changed = false;
+        int n_skip = 0;
+        int head = entry_first_block(fat, &entry);
+        if (entry.name[0] == FILENAME_INLINE) { // not preceded by an inline file (those skip their slots)
+            fprintf(stderr, "fsck: stray inline data slot at block %d, entry %d\n", dir_block, i);
+            state->report->n_bad_inline++;
+            state->report->n_problems++;
+            if (state->repair) {
+                entry.name[0] = FILENAME_DEL_UNUSED;
+                changed = true;
+                state->report->n_repaired++;
+            }
+        } else if (entry.type & FILETYPE_INLINE) { // data lives in the slots after the entry
+            int n_slots = inline_run(buffer, i, n_entries);
+            int n_needed = inline_slots(entry.size);
+            n_skip = n_slots;
+            for (int s = n_needed + 1; s <= n_slots && entry.name[0] != FILENAME_DEL_INUSE; s++) { // past the end of the data
+                fprintf(stderr, "fsck: stray inline data slot at block %d, entry %d\n", dir_block, i + s);
+                state->report->n_bad_inline++;
+                state->report->n_problems++;
+                if (state->repair) {
+                    dir_entry_t unused;
+                    memset(&unused, 0, DIR_ENTRY_SIZE);
+                    unused.name[0] = FILENAME_DEL_UNUSED;
+                    write_file(fat, state->fs_fd, (point_t) { dir_block, i + s }, unused);
+                    state->report->n_repaired++;
+                }
+            }
+            if (entry.name[0] == FILENAME_DEL_INUSE) {
+                if (state->repair) {
+                    free_data(fat, state->fs_fd, (point_t) { dir_block, i }, &entry);
+                    entry.name[0] = FILENAME_DEL_UNUSED;
+                    changed = true;
+                }
+            } else {
+                state->report->n_files++;
+                uint32_t max_size = INLINE_HEAD_BYTES + n_slots * INLINE_SLOT_BYTES;
+                if (entry.size > max_size) {
+                    fprintf(stderr, "fsck: file:[%s] size %u doesn't fit its %d inline slots\n", entry.name, entry.size, n_slots);
+                    state->report->n_bad_sizes++;
+                    state->report->n_problems++;
+                    if (state->repair) {
+                        entry.size = max_size;
+                        changed = true;
+                        state->report->n_repaired++;
+                    }
+                }
+            }
+        } else if (entry.name[0] == FILENAME_DEL_INUSE) { // deleted, but the blocks were never freed
+            int n = walk_chain(state, "(deleted)", &entry, head);
+            if (n > 0) {
+                fprintf(stderr, "fsck: deleted file at block %d still holds %d blocks\n", dir_block, n);
+                state->report->n_unreclaimed++;
+                state->report->n_problems++;
+            }
+            if (state->repair) {
+                free_data(fat, state->fs_fd, (point_t) { dir_block, i }, &entry);
+                entry.name[0] = FILENAME_DEL_UNUSED;
+                changed = true;
+                if (n > 0) state->report->n_repaired++;
+            }
+        } else if (entry.type == FILETYPE_SNAPSHOT) { // frozen FAT & directory copies
+            walk_chain(state, entry.name, &entry, head);
+            changed = (entry_first_block(fat, &entry) != head);
+        } else {
+            state->report->n_files++;
+            int n = walk_chain(state, entry.name, &entry, head);
+            changed = (entry_first_block(fat, &entry) != head);
+            if (entry.type & FILETYPE_COMPRESSED) changed |= check_compressed(state, &entry, n);
+            else changed |= check_size(state, &entry, n);
+        }
+        if (changed) write_file(fat, state->fs_fd, (point_t) { dir_block, i }, entry);
+        i += n_skip; // continuation slots aren't entries
+    }
+}
+
+bool fs_fsck(uint16_t* fat, int fs_fd, bool repair, fsck_report_t* report) {
+    memset(report, 0, sizeof(fsck_report_t));
+    fsck_state_t state;
+    state.fat = fat;
+    state.fs_fd = fs_fd;
+    state.repair = repair;
+    state.n_blocks = fs_n_blocks(fat);
+    state.block_size = fs_block_size(fat);
+    state.reachable = calloc(state.n_blocks / 64 + 1, sizeof(uint64_t));
+    state.heads = calloc(state.n_blocks / 64 + 1, sizeof(uint64_t));
+    state.report = report;
+    if (state.reachable == NULL || state.heads == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    journal_begin();
+
+    // the root directory: walk its chain, then read each directory block once
+    dir_entry_t root; // stand-in entry; the root's first block lives in the superblock
+    memset(&root, 0, sizeof(root));
+    int root_head = fs_root(fat);
+    int n_dir_blocks = walk_chain(&state, "/", &root, root_head);
+    if (n_dir_blocks == 0 && repair && root_head >= 1 && root_head < state.n_blocks) { // can't move the root; keep its first block
+        fat_set(fat, root_head, LASTBLOCK);
+        state.reachable[root_head / 64] |= 1ULL << (root_head % 64);
+        n_dir_blocks = 1;
+    }
+    report->n_dir_blocks = n_dir_blocks;
+    char* buffer = malloc(state.block_size);
+    int curr = root_head;
+    for (int b = 0; b < n_dir_blocks; b++) {
+        read_dir_block(fat, fs_fd, curr, buffer);
+        check_dir_block(&state, curr, buffer);
+        curr = fat_get(fat, curr);
+    }
+    free(buffer);
+
+    // one sequential pass over the FAT: orphans & free space
+    int n_orphans = 0;
+    for (int i = 1; i < state.n_blocks; i++) {
+        if (fat_get(fat, i) == 0) {
+            if (snapshot_frozen(i)) continue; // held by a snapshot, so not free
+            if (report->first_free == 0) report->first_free = i;
+            report->n_free++;
+        } else if (is_reachable(&state, i)) {
+            report->n_used++;
+        } else {
+            n_orphans++;
+            if (repair) {
+                fat_set(fat, i, 0);
+                if (snapshot_frozen(i)) continue;
+                if (report->first_free == 0) report->first_free = i;
+                report->n_free++;
+            }
+        }
+    }
+    if (n_orphans > 0) {
+        fprintf(stderr, "fsck: %d allocated blocks aren't reachable from any file\n", n_orphans);
+        report->n_orphans = n_orphans;
+        report->n_problems += n_orphans;
+        if (repair) report->n_repaired += n_orphans;
+    }
+
+    free(state.reachable);
+    free(state.heads);
+    journal_end(fat);
+    if (repair && report->n_repaired > 0) fs_sync(fat);
+    fs_seed_free(fat, report->n_free, report->first_free);
+    return report->n_problems == 0;
+}
+
+void fsck_print_report(fsck_report_t* report, bool repair) {
+    fprintf(stderr, "fsck: %d files, %d directory blocks, %d blocks used, %d free\n",
+            report->n_files, report->n_dir_blocks, report->n_used, report->n_free);
+    if (report->n_problems == 0) {
+        fprintf(stderr, "fsck: clean\n");
+    } else if (repair) {
+        fprintf(stderr, "fsck: %d problems, %d repaired\n", report->n_problems, report->n_repaired);
+    } else {
+        fprintf(stderr, "fsck: %d problems (run `fsck -r` to repair)\n", report->n_problems);
+    }
+}
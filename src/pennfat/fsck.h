@@ -0,0 +1,47 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fat.h"
+
+#pragma once
+
+// filesystem consistency check interface
+
+typedef struct fsck_report { // results of `fs_fsck`
+    int n_files; // live files in the root directory
+    int n_dir_blocks; // blocks in the root directory chain
+    int n_used; // blocks reachable from the root directory
+    int n_free; // free blocks (after repairs)
+    int first_free; // lowest free block index, `0` if the filesystem is full
+    int n_orphans; // allocated blocks that no file reaches
+    int n_cross_links; // chains that run into a block already owned by another chain (or loop)
+    int n_bad_chains; // chains that point outside the filesystem or to a free block
+    int n_bad_sizes; // file sizes that don't match their chain lengths
+    int n_unreclaimed; // deleted files whose blocks were never freed (`FILENAME_DEL_INUSE`)
+    int n_bad_inline; // inline data slots that don't follow an inline file
+    int n_problems; // sum of the above
+    int n_repaired; // problems fixed (only in repair mode)
+} fsck_report_t;
+
+/**
+ * check a mounted filesystem in one sequential pass over the FAT & the directory blocks,
+ * print every problem, and seed the free-space state from the results
+ * repairs (with `repair`):
+ * cross-linked or broken chains are truncated before the bad block,
+ * sizes are clamped to the chain & chains are trimmed to the size,
+ * unreclaimed deleted files, stray inline data slots & orphaned blocks are freed
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param repair if `true`, fix the problems found
+ * @param report set to the results
+ * @return `true` if no problems were found, `false` otherwise
+*/
+bool fs_fsck(uint16_t* fat, int fs_fd, bool repair, fsck_report_t* report);
+
+/**
+ * print the summary of a check
+ * @param report results of `fs_fsck`
+ * @param repair whether `fs_fsck` ran in repair mode
+ * @return none
+*/
+void fsck_print_report(fsck_report_t* report, bool repair);
@@ -0,0 +1,390 @@
+// host import & export
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "fat.h"
+#include "hostcp.h"
+#include "journal.h"
+#include "safe.h"
+#include "../util/util.h"
+
+typedef struct import_file { // a host file being imported
+    const char* source; // host path
+    const char* dest; // filename
+    int src_fd;
+    off_t size;
+    bool planned; // the destination is ready; `false` if the file was skipped
+    bool streamed; // copied chunk by chunk into `blocks` (small & compressed files are written whole)
+    bool failed; // a chunk couldn't be read
+    int* blocks; // the new chain, in order
+    uint32_t* csums; // checksums of `blocks`, computed by the workers & recorded by `commit_import`; `NULL` without checksums
+    int n_blocks;
+    int n_chunks;
+    point_t location;
+    dir_entry_t entry;
+} import_file_t;
+
+typedef struct import_state { // chunk copies shared by the workers
+    uint16_t* fat;
+    int fs_fd;
+    import_file_t* files;
+    int n_files;
+    int next_file; // the next chunk to copy
+    int next_chunk;
+    pthread_mutex_t lock;
+} import_state_t;
+
+/**
+ * read part of a host file
+ * @param file the file
+ * @param buffer where to read it into
+ * @param offset where to start
+ * @param n_bytes length of the part
+ * @return `true` on success, `false` if the file ended early or couldn't be read
+*/
+static bool read_host(import_file_t* file, char* buffer, off_t offset, size_t n_bytes) {
+    size_t done = 0;
+    while (done < n_bytes) {
+        ssize_t got = pread(file->src_fd, &buffer[done], n_bytes - done, offset + done);
+        if (got == -1 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        done += got;
+    }
+    return true;
+}
+
+/**
+ * get a file ready to import: open the host file, find or create the destination, and
+ * either write it whole (small & compressed files) or allocate its new chain
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param file the file; `source` & `dest` are set
+ * @return `true` if the file is ready, `false` (with a message) if it is skipped
+*/
+static bool plan_import(uint16_t* fat, int fs_fd, import_file_t* file) {
+    file->src_fd = open(file->source, O_RDONLY);
+    if (file->src_fd == -1) {
+        fprintf(stderr, "failed: host file:[%s]: %s\n", file->source, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(file->src_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "failed: host file:[%s] is not a regular file\n", file->source);
+        return false;
+    }
+    file->size = st.st_size;
+    if (file->size > UINT32_MAX) {
+        fprintf(stderr, "failed: host file:[%s] is %lld bytes, files hold at most %u\n", file->source, (long long) file->size, UINT32_MAX);
+        return false;
+    }
+
+    int block_size = fs_block_size(fat);
+    long long n_blocks = (file->size + block_size - 1) / block_size;
+    bool found = find_file(fat, fs_fd, fs_root(fat), file->dest, &file->location, &file->entry);
+    long long n_available = fs_free_blocks(fat);
+    if (found && !journal_active()) n_available += fs_physical_bytes(fat, &file->entry) / block_size; // journaled frees wait for the commit
+    if (n_blocks > n_available) {
+        fprintf(stderr, "failed: host file:[%s] needs %lld blocks, %lld free\n", file->source, n_blocks, n_available);
+        return false;
+    }
+    if (!found) {
+        add_file(fat, fs_fd, fs_root(fat), file->dest);
+        find_file(fat, fs_fd, fs_root(fat), file->dest, &file->location, &file->entry);
+    }
+
+    if (file->size <= INLINE_MAX_BYTES || (file->entry.type & FILETYPE_COMPRESSED)) { // encoded as a whole by `write_data`
+        char* data = safe_malloc(file->size + 1);
+        if (!read_host(file, data, 0, file->size)) {
+            fprintf(stderr, "failed: host file:[%s] changed while it was copied\n", file->source);
+            free(data);
+            return false;
+        }
+        bool ok = write_data(fat, fs_fd, &file->location, &file->entry, data, (int) file->size);
+        file->entry.mtime = time(0);
+        file->entry.size = ok ? (uint32_t) file->size : 0;
+        write_file(fat, fs_fd, file->location, file->entry);
+        free(data);
+        return ok;
+    }
+
+    int old_head = entry_first_block(fat, &file->entry); // rewrites go back where the file was, if they fit
+    free_data(fat, fs_fd, file->location, &file->entry);
+    file->blocks = alloc_chain(fat, (old_head == LASTBLOCK) ? 0 : old_head, (int) n_blocks);
+    if (file->blocks == NULL) { // blocks still held by snapshots
+        fprintf(stderr, "failed: host file:[%s] needs %lld blocks, %d free\n", file->source, n_blocks, fs_free_blocks(fat));
+        file->entry.size = 0;
+        write_file(fat, fs_fd, file->location, file->entry);
+        return false;
+    }
+    file->n_blocks = (int) n_blocks;
+    if (checksum_enabled()) file->csums = safe_malloc(n_blocks * sizeof(uint32_t));
+    file->n_chunks = (int) ((file->size + HOSTCP_CHUNK_BYTES - 1) / HOSTCP_CHUNK_BYTES);
+    file->streamed = true;
+    entry_set_first_block(fat, &file->entry, file->blocks[0]);
+    return true;
+}
+
+/**
+ * copy one chunk of a host file into its new chain
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param file the file
+ * @param chunk which chunk
+ * @param buffer HOSTCP_CHUNK_BYTES bytes to stage it in
+ * @return `true` on success, `false` if the host file ended early or couldn't be read
+*/
+static bool copy_chunk(uint16_t* fat, int fs_fd, import_file_t* file, int chunk, char* buffer) {
+    int block_size = fs_block_size(fat);
+    int per_chunk = HOSTCP_CHUNK_BYTES / block_size;
+    int first = chunk * per_chunk;
+    int n = (file->n_blocks - first < per_chunk) ? file->n_blocks - first : per_chunk;
+    off_t offset = (off_t) chunk * HOSTCP_CHUNK_BYTES;
+    size_t n_bytes = (file->size - offset < HOSTCP_CHUNK_BYTES) ? (size_t) (file->size - offset) : HOSTCP_CHUNK_BYTES;
+    if (!read_host(file, buffer, offset, n_bytes)) return false;
+
+    // whole blocks are written, so checksums don't depend on stale bytes
+    memset(&buffer[n_bytes], 0, (size_t) n * block_size - n_bytes);
+    for (int i = 0; i < n; ) { // one write per run of consecutive blocks
+        int run = 1;
+        while (i + run < n && file->blocks[first + i + run] == file->blocks[first + i] + run) run++;
+        safe_pwrite(fs_fd, &buffer[(size_t) i * block_size], (size_t) run * block_size, mem_idx(fat, file->blocks[first + i]));
+        i += run;
+    }
+    for (int i = 0; file->csums != NULL && i < n; i++) { // recorded by `commit_import`, as the journal is single threaded
+        file->csums[first + i] = checksum_block(&buffer[(size_t) i * block_size], block_size);
+    }
+    return true;
+}
+
+static void* import_worker(void* arg) {
+    import_state_t* state = arg;
+    char* buffer = safe_malloc(HOSTCP_CHUNK_BYTES);
+    while (true) {
+        pthread_mutex_lock(&state->lock);
+        while (state->next_file < state->n_files && state->next_chunk >= state->files[state->next_file].n_chunks) {
+            state->next_file++;
+            state->next_chunk = 0;
+        }
+        if (state->next_file == state->n_files) {
+            pthread_mutex_unlock(&state->lock);
+            break;
+        }
+        import_file_t* file = &state->files[state->next_file];
+        int chunk = state->next_chunk++;
+        pthread_mutex_unlock(&state->lock);
+
+        if (!copy_chunk(state->fat, state->fs_fd, file, chunk, buffer)) {
+            pthread_mutex_lock(&state->lock);
+            file->failed = true;
+            pthread_mutex_unlock(&state->lock);
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * write the directory entry of an imported file (or drop its chain if a chunk failed)
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param file the file
+ * @return `true` if the file was imported
+*/
+static bool commit_import(uint16_t* fat, int fs_fd, import_file_t* file) {
+    if (file->failed) {
+        fprintf(stderr, "failed: host file:[%s] changed while it was copied\n", file->source);
+        delete_chain(fat, file->blocks[0]);
+        entry_set_first_block(fat, &file->entry, LASTBLOCK);
+        file->entry.size = 0;
+    } else {
+        file->entry.size = (uint32_t) file->size;
+        for (int i = 0; file->csums != NULL && i < file->n_blocks; i++) checksum_set(file->blocks[i], file->csums[i]);
+    }
+    file->entry.mtime = time(0);
+    write_file(fat, fs_fd, file->location, file->entry);
+    return !file->failed;
+}
+
+/**
+ * import files: get every destination ready, copy the chunks (shared between threads), then
+ * write the directory entries, all in one journal operation
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param files the files; `source` & `dest` are set, the rest zeroed
+ * @param n_files length of `files`
+ * @param n_threads workers, `0` for one per CPU
+ * @param report set to the results
+ * @return `true` if every file was imported
+*/
+static bool import_files(uint16_t* fat, int fs_fd, import_file_t* files, int n_files, int n_threads, import_report_t* report) {
+    memset(report, 0, sizeof(import_report_t));
+    if (n_threads <= 0) n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads < 1) n_threads = 1;
+    if (n_threads > HOSTCP_MAX_THREADS) n_threads = HOSTCP_MAX_THREADS;
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long long n_wanted = 0; // blocks the files need, so blocks freed by the running group can be reclaimed first
+    int block_size = fs_block_size(fat);
+    for (int f = 0; f < n_files; f++) {
+        struct stat st;
+        if (stat(files[f].source, &st) == 0) n_wanted += (st.st_size + block_size - 1) / block_size;
+    }
+    if (n_wanted > fs_free_blocks(fat)) fs_reclaim_freed(fat);
+
+    journal_begin();
+    int n_chunks = 0;
+    for (int f = 0; f < n_files; f++) {
+        files[f].src_fd = -1;
+        files[f].planned = plan_import(fat, fs_fd, &files[f]);
+        n_chunks += files[f].n_chunks;
+    }
+    if (n_threads > n_chunks) n_threads = (n_chunks > 0) ? n_chunks : 1;
+
+    import_state_t state = { fat, fs_fd, files, n_files, 0, 0 };
+    pthread_mutex_init(&state.lock, NULL);
+    if (n_threads == 1) {
+        import_worker(&state);
+    } else {
+        pthread_t threads[HOSTCP_MAX_THREADS];
+        for (int t = 0; t < n_threads; t++) {
+            if (pthread_create(&threads[t], NULL, import_worker, &state) != 0) {
+                perror("pthread_create");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int t = 0; t < n_threads; t++) pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&state.lock);
+
+    for (int f = 0; f < n_files; f++) {
+        import_file_t* file = &files[f];
+        bool ok = file->planned && (!file->streamed || commit_import(fat, fs_fd, file));
+        if (ok) {
+            report->n_files++;
+            report->bytes += file->size;
+        } else {
+            report->n_failed++;
+        }
+        if (file->src_fd != -1) close(file->src_fd);
+        free(file->blocks);
+        free(file->csums);
+    }
+    fat_sync(fat);
+    journal_end(fat);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->n_threads = n_threads;
+    report->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return report->n_failed == 0;
+}
+
+bool fs_import(uint16_t* fat, int fs_fd, const char* source, const char* dest) {
+    import_file_t file;
+    memset(&file, 0, sizeof(import_file_t));
+    file.source = source;
+    file.dest = dest;
+    import_report_t report;
+    return import_files(fat, fs_fd, &file, 1, 1, &report);
+}
+
+bool fs_import_many(uint16_t* fat, int fs_fd, char** sources, int n_sources, int n_threads, import_report_t* report) {
+    import_file_t* files = calloc(n_sources, sizeof(import_file_t));
+    int n_files = 0;
+    int n_skipped = 0;
+    for (int i = 0; i < n_sources; i++) {
+        char* base = strrchr(sources[i], '/');
+        base = (base == NULL) ? sources[i] : base + 1;
+        bool duplicate = false;
+        for (int f = 0; f < n_files && !duplicate; f++) {
+            if (strcmp(files[f].dest, base) == 0) {
+                fprintf(stderr, "failed: host files:[%s] and [%s] have the same name\n", files[f].source, sources[i]);
+                duplicate = true;
+            }
+        }
+        if (duplicate || !valid_filename(base)) {
+            n_skipped++;
+            continue;
+        }
+        files[n_files].source = sources[i];
+        files[n_files].dest = base;
+        n_files++;
+    }
+    bool ok = import_files(fat, fs_fd, files, n_files, n_threads, report);
+    report->n_failed += n_skipped;
+    free(files);
+    return ok && n_skipped == 0;
+}
+
+/**
+ * stream a chain to a host file, one run of consecutive blocks at a time
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param head the first block of the chain
+ * @param size bytes to copy
+ * @param dest_fd host file descriptor
+ * @return `true` if every block matched its checksum
+*/
+static bool export_chain(uint16_t* fat, int fs_fd, int head, off_t size, int dest_fd) {
+    int block_size = fs_block_size(fat);
+    bool verify = checksum_enabled(); // blocks pass through memory to be checked
+    char* buffer = verify ? safe_malloc(HOSTCP_CHUNK_BYTES) : NULL;
+    bool ok = true;
+    off_t done = 0;
+    int curr = head;
+    while (done < size && curr != LASTBLOCK) {
+        int first = curr;
+        int n = 1;
+        while ((off_t) n * block_size < size - done && (n + 1) * block_size <= HOSTCP_CHUNK_BYTES && fat_get(fat, curr) == curr + 1) {
+            curr++;
+            n++;
+        }
+        size_t n_bytes = ((off_t) n * block_size < size - done) ? (size_t) n * block_size : (size_t) (size - done);
+        if (verify) {
+            safe_pread(fs_fd, buffer, (size_t) n * block_size, mem_idx(fat, first));
+            for (int i = 0; i < n; i++) ok &= checksum_verify(first + i, &buffer[(size_t) i * block_size], block_size);
+            safe_pwrite(dest_fd, buffer, n_bytes, done);
+        } else {
+            safe_copy_file_range(fs_fd, mem_idx(fat, first), dest_fd, done, n_bytes);
+        }
+        done += n_bytes;
+        curr = fat_get(fat, curr);
+    }
+    free(buffer);
+    return ok;
+}
+
+bool fs_export(uint16_t* fat, int fs_fd, const char* source, const char* dest) {
+    point_t location;
+    dir_entry_t entry;
+    if (!find_file(fat, fs_fd, fs_root(fat), source, &location, &entry)) return false;
+
+    int dest_fd = safe_open(dest, O_WRONLY|O_TRUNC|O_CREAT, DEFAULT_PERMISSIONS);
+    bool ok = true;
+    if (entry.type & (FILETYPE_INLINE | FILETYPE_COMPRESSED)) { // decoded a chunk at a time
+        char* buffer = safe_malloc(HOSTCP_CHUNK_BYTES);
+        for (off_t offset = 0; offset < entry.size; offset += HOSTCP_CHUNK_BYTES) {
+            int n_bytes = (entry.size - offset < HOSTCP_CHUNK_BYTES) ? (int) (entry.size - offset) : HOSTCP_CHUNK_BYTES;
+            ok &= read_file_range(fat, fs_fd, location, &entry, (int) offset, buffer, n_bytes);
+            safe_write(dest_fd, buffer, n_bytes);
+        }
+        free(buffer);
+    } else {
+        ok = export_chain(fat, fs_fd, entry_first_block(fat, &entry), entry.size, dest_fd);
+    }
+    safe_close(dest_fd);
+    return ok;
+}
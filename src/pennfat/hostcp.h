@@ -0,0 +1,58 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fat.h"
+
+#pragma once
+
+// host import & export interface (`cp -h`)
+//
+// Imports are streamed: every destination chain is allocated up front (one metadata
+// pass), then host data is copied into it HOSTCP_CHUNK_BYTES at a time, so memory use
+// doesn't depend on file size, and the directory entries are written last, in the same
+// journal operation. The chunk copies of a multi-file import are shared between worker
+// threads. Exports stream the source chain's runs of consecutive blocks straight to
+// the host file (copy_file_range when the filesystem has no checksums to verify).
+
+#define HOSTCP_CHUNK_BYTES (1024 * 1024) // bytes copied per read & write; a multiple of every block size
+#define HOSTCP_MAX_THREADS 16
+
+typedef struct import_report { // results of `fs_import_many`
+    int n_files; // files imported
+    int n_failed; // files that couldn't be imported
+    long long bytes; // bytes imported
+    int n_threads; // workers the chunk copies were shared between
+    double seconds; // wall-clock time of the import
+} import_report_t;
+
+/**
+ * copy a host file into the filesystem, replacing `dest` if it exists
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param source host path
+ * @param dest filename
+ * @return `true` on success; `false` (with a message) if `source` can't be read or doesn't fit
+*/
+bool fs_import(uint16_t* fat, int fs_fd, const char* source, const char* dest);
+
+/**
+ * copy host files into the filesystem, each under its base name, sharing the copying between threads
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param sources host paths
+ * @param n_sources length of `sources`
+ * @param n_threads workers, `0` for one per CPU (at most HOSTCP_MAX_THREADS)
+ * @param report set to the results
+ * @return `true` if every file was imported
+*/
+bool fs_import_many(uint16_t* fat, int fs_fd, char** sources, int n_sources, int n_threads, import_report_t* report);
+
+/**
+ * copy a file to the host, replacing `dest` if it exists
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param source filename
+ * @param dest host path
+ * @return `true` on success, `false` if `source` doesn't exist or a block failed its checksum
+*/
+bool fs_export(uint16_t* fat, int fs_fd, const char* source, const char* dest);
@@ -0,0 +1,522 @@
+// write-ahead metadata journal
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "fat.h"
+#include "journal.h"
+#include "safe.h"
+#include "../util/util.h"
+
+const int JOURNAL_DEFAULT_SIZE = 256 * 1024;
+
+#define JOURNAL_MAGIC       0x4C4E524A // "JRNL"
+#define GROUP_MAGIC         0x50555247 // "GRUP"
+#define RECORD_FAT          1
+#define RECORD_DIR          2
+#define RECORD_CSUM         3
+#define PAGE_BYTES          4096 // granularity of FAT writes during replay
+#define BLOCK_FRESH         1 // allocated by the running group: nothing committed refers to it
+#define BLOCK_FREED         2 // freed by the running group: the committed state still uses it
+#define BLOCK_LISTED        4 // in `touched`
+
+typedef struct journal_header { // first bytes of the journal region
+    uint32_t magic; // JOURNAL_MAGIC
+    uint32_t generation; // bumped by every checkpoint; groups of older generations are stale
+    uint32_t _BUFFER_[2];
+} journal_header_t;
+
+typedef struct group_header { // precedes the records of each committed group
+    uint32_t magic; // GROUP_MAGIC
+    uint32_t generation;
+    uint32_t n_bytes; // bytes of records following the header
+    uint32_t checksum; // of the records; a torn group fails this & ends replay
+} group_header_t;
+
+typedef struct fat_record {
+    uint32_t type; // RECORD_FAT, or RECORD_CSUM for an entry of the checksum table
+    uint32_t idx;
+    uint32_t value;
+} fat_record_t;
+
+typedef struct dir_record {
+    uint32_t type; // RECORD_DIR
+    uint32_t _BUFFER_;
+    uint64_t offset; // byte offset of the entry in the image
+    dir_entry_t entry;
+} dir_record_t;
+
+typedef struct overlay_slot { // directory entry that isn't checkpointed yet
+    off_t offset; // `0` if the slot is empty (offset 0 is always the superblock)
+    uint64_t seq; // group that last wrote the entry
+    dir_entry_t entry;
+} overlay_slot_t;
+
+typedef struct fat_page { // page of the FAT (or checksum table) being patched during replay
+    off_t offset; // `-1` if no page is loaded
+    off_t limit; // end of the table; pages are clipped to it
+    char data[PAGE_BYTES];
+} fat_page_t;
+
+static bool active = false; // a journaled filesystem is mounted
+static int journal_fd = -1; // filesystem file descriptor
+static off_t region_offset; // byte offset of the journal region
+static size_t capacity; // bytes for groups after the journal header
+static uint32_t generation; // current generation (from the journal header)
+static size_t tail; // bytes of committed groups in the current generation
+
+static char* group = NULL; // running group: a group_header_t followed by records
+static size_t group_bytes = 0; // bytes of records in the running group
+static bool group_overflow = false; // running group no longer fits in the journal
+static struct timespec group_start; // when the first operation of the running group began
+static int depth = 0; // metadata operations in progress
+static bool committing = false; // a commit is being written (and may have been interrupted by `journal_tick`)
+static uint64_t seq = 1; // sequence number of the running group
+static uint64_t committed_seq = 0; // last group that was committed
+
+static uint8_t* block_state = NULL; // BLOCK_* flags of every block
+static int* touched = NULL; // blocks the running group allocated or freed (BLOCK_LISTED)
+static int n_touched = 0;
+static int touched_cap = 0;
+static int n_freed = 0; // blocks that are BLOCK_FREED
+
+static char* replay_records = NULL; // checkpoint buffers, allocated at mount, so no checkpoint allocates
+static fat_page_t* replay_pages = NULL; // FAT & checksum table page caches
+
+static overlay_slot_t* overlay = NULL; // open-addressed hash table of pending directory entries
+static size_t overlay_cap = 0; // number of slots, a power of 2
+static size_t overlay_used = 0; // number of occupied slots
+
+/**
+ * find the overlay slot for a directory entry
+ * @param offset byte offset of the entry in the image
+ * @return the slot holding `offset`, or the empty slot where it belongs
+*/
+static overlay_slot_t* overlay_slot(off_t offset) {
+    size_t mask = overlay_cap - 1;
+    size_t i = ((uint64_t) offset / DIR_ENTRY_SIZE * 0x9E3779B97F4A7C15ULL) & mask;
+    while (overlay[i].offset != 0 && overlay[i].offset != offset) i = (i + 1) & mask;
+    return &overlay[i];
+}
+
+/**
+ * rebuild the overlay, keeping only entries newer than `min_seq`
+ * @param new_cap number of slots in the rebuilt table
+ * @param min_seq entries written by groups up to & including this one are dropped
+ * @return none
+*/
+static void overlay_rebuild(size_t new_cap, uint64_t min_seq) {
+    overlay_slot_t* old = overlay;
+    size_t old_cap = overlay_cap;
+    overlay = calloc(new_cap, sizeof(overlay_slot_t));
+    if (overlay == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    overlay_cap = new_cap;
+    overlay_used = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].offset == 0 || old[i].seq <= min_seq) continue;
+        *overlay_slot(old[i].offset) = old[i];
+        overlay_used++;
+    }
+    free(old);
+}
+
+/**
+ * get the length of a page, clipped to the end of its table
+ * @param page the page cache
+ * @param page_offset byte offset of the page in the image
+ * @return bytes in the page
+*/
+static size_t page_length(fat_page_t* page, off_t page_offset) {
+    off_t remaining = page->limit - page_offset;
+    return (remaining < PAGE_BYTES) ? remaining : PAGE_BYTES;
+}
+
+/**
+ * patch one FAT (or checksum table) entry on disk, loading & writing back whole pages
+ * @param fs_fd filesystem file descriptor
+ * @param page the page cache
+ * @param offset byte offset of the entry in the image
+ * @param value the new entry
+ * @return none
+*/
+static void fat_page_write(int fs_fd, fat_page_t* page, off_t offset, uint32_t value) {
+    off_t page_offset = offset - offset % PAGE_BYTES;
+    if (page->offset != page_offset) {
+        if (page->offset != -1) {
+            safe_pwrite(fs_fd, page->data, page_length(page, page->offset), page->offset);
+        }
+        page->offset = page_offset;
+        safe_pread(fs_fd, page->data, page_length(page, page_offset), page_offset);
+    }
+    memcpy(&page->data[offset - page_offset], &value, sizeof(value));
+}
+
+/**
+ * apply committed groups to the image, then start a new (empty) generation
+ * @param fs_fd filesystem file descriptor
+ * @param sb the superblock
+ * @param new_generation set to the generation now in the journal header
+ * @param records buffer for the records of a group, as big as the journal region
+ * @param pages the FAT & checksum table page caches
+ * @return the number of groups applied
+*/
+static int apply_groups(int fs_fd, superblock_t* sb, uint32_t* new_generation, char* records, fat_page_t pages[2]) {
+    journal_header_t header;
+    safe_pread(fs_fd, &header, sizeof(header), sb->journal_offset);
+    if (header.magic != JOURNAL_MAGIC) { // never formatted or clobbered; nothing can be trusted
+        journal_format(fs_fd, sb->journal_offset);
+        *new_generation = 0;
+        return 0;
+    }
+
+    size_t region_capacity = sb->journal_size - sizeof(journal_header_t);
+    off_t first_group = sb->journal_offset + sizeof(journal_header_t);
+    fat_page_t* page = &pages[0];
+    page->offset = -1;
+    page->limit = sb->journal_offset; // the FAT ends where the journal starts
+    fat_page_t* csum_page = &pages[1];
+    csum_page->offset = -1;
+    csum_page->limit = (off_t) sb->csum_offset + sb->csum_size;
+
+    int n_groups = 0;
+    size_t pos = 0;
+    while (pos + sizeof(group_header_t) <= region_capacity) {
+        group_header_t group_header;
+        safe_pread(fs_fd, &group_header, sizeof(group_header), first_group + pos);
+        if (group_header.magic != GROUP_MAGIC || group_header.generation != header.generation) break;
+        if (group_header.n_bytes > region_capacity - pos - sizeof(group_header)) break;
+        safe_pread(fs_fd, records, group_header.n_bytes, first_group + pos + sizeof(group_header));
+        if (crc32c(0, records, group_header.n_bytes) != group_header.checksum) break; // torn commit
+
+        size_t rec = 0;
+        while (rec < group_header.n_bytes) {
+            uint32_t type;
+            memcpy(&type, &records[rec], sizeof(type));
+            if (type == RECORD_FAT) {
+                fat_record_t record;
+                memcpy(&record, &records[rec], sizeof(record));
+                fat_page_write(fs_fd, page, sb->fat_offset + (off_t) record.idx * sizeof(uint32_t), record.value);
+                rec += sizeof(record);
+            } else if (type == RECORD_CSUM) {
+                fat_record_t record;
+                memcpy(&record, &records[rec], sizeof(record));
+                fat_page_write(fs_fd, csum_page, sb->csum_offset + (off_t) record.idx * sizeof(uint32_t), record.value);
+                rec += sizeof(record);
+            } else {
+                dir_record_t record;
+                memcpy(&record, &records[rec], sizeof(record));
+                safe_pwrite(fs_fd, &record.entry, DIR_ENTRY_SIZE, record.offset);
+                rec += sizeof(record);
+            }
+        }
+        pos += sizeof(group_header) + group_header.n_bytes;
+        n_groups++;
+    }
+    if (page->offset != -1) {
+        safe_pwrite(fs_fd, page->data, page_length(page, page->offset), page->offset);
+    }
+    if (csum_page->offset != -1) {
+        safe_pwrite(fs_fd, csum_page->data, page_length(csum_page, csum_page->offset), csum_page->offset);
+    }
+
+    if (n_groups > 0) { // make the applied groups durable, then retire them
+        safe_fdatasync(fs_fd);
+        header.generation++;
+        safe_pwrite(fs_fd, &header, sizeof(header), sb->journal_offset);
+        safe_fdatasync(fs_fd);
+    }
+    *new_generation = header.generation;
+    return n_groups;
+}
+
+/**
+ * write all committed groups in place & empty the journal; never from a timer, since it
+ * rebuilds the overlay & its I/O is unbounded
+ * @param fat filesystem
+ * @return none
+*/
+static void checkpoint(uint16_t* fat) {
+    apply_groups(journal_fd, fs_superblock(fat), &generation, replay_records, replay_pages);
+    tail = 0;
+    overlay_rebuild(overlay_cap, committed_seq); // checkpointed entries are on disk now
+}
+
+/**
+ * write the running group in place when it is too big to be journaled;
+ * this is only as crash safe as an unjournaled filesystem
+ * @param fat filesystem
+ * @return none
+*/
+static void checkpoint_direct(uint16_t* fat) {
+    checkpoint(fat); // committed groups first, so the image is consistent up to this group
+    safe_pwrite(journal_fd, fat, region_offset, 0); // superblock & FAT
+    superblock_t* sb = fs_superblock(fat);
+    if (sb->features & FEATURE_CHECKSUM) {
+        safe_pwrite(journal_fd, (char*) fat + sb->csum_offset, sb->csum_size, sb->csum_offset);
+    }
+    for (size_t i = 0; i < overlay_cap; i++) {
+        if (overlay[i].offset == 0) continue;
+        safe_pwrite(journal_fd, &overlay[i].entry, DIR_ENTRY_SIZE, overlay[i].offset);
+    }
+    safe_fdatasync(journal_fd);
+    committed_seq = seq++;
+    overlay_rebuild(overlay_cap, committed_seq);
+    group_bytes = 0;
+    group_overflow = false;
+}
+
+/**
+ * append a record to the running group
+ * @param record the record
+ * @param n_bytes length of `record`
+ * @return none
+*/
+static void group_append(const void* record, size_t n_bytes) {
+    if (group_overflow) return;
+    if (sizeof(group_header_t) + group_bytes + n_bytes > capacity) {
+        group_overflow = true;
+        return;
+    }
+    memcpy(&group[sizeof(group_header_t) + group_bytes], record, n_bytes);
+    group_bytes += n_bytes;
+}
+
+/**
+ * hand the blocks freed by the group that just committed back to the allocator; until then
+ * a crash replays the committed state, where they still belong to the files they were freed from
+ * @return none
+*/
+static void release_freed() {
+    for (int i = 0; i < n_touched; i++) {
+        if (block_state[touched[i]] & BLOCK_FREED) fs_release_block(touched[i]);
+        block_state[touched[i]] = 0;
+    }
+    n_touched = 0;
+    n_freed = 0;
+}
+
+/**
+ * set the state of a block the running group allocates or frees
+ * @param idx block index
+ * @param state BLOCK_FRESH, BLOCK_FREED, or `0`
+ * @return none
+*/
+static void set_block_state(int idx, uint8_t state) {
+    if (!(block_state[idx] & BLOCK_LISTED)) {
+        if (n_touched == touched_cap) {
+            touched_cap = (touched_cap == 0) ? 256 : touched_cap * 2;
+            touched = realloc(touched, touched_cap * sizeof(int));
+            if (touched == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        touched[n_touched++] = idx;
+    }
+    block_state[idx] = state | BLOCK_LISTED;
+}
+
+/**
+ * commit the running group with a single fdatasync, unless an operation is half done
+ * @param fat filesystem
+ * @return none
+*/
+static void commit(uint16_t* fat) {
+    if (!active || depth > 0 || committing) return;
+    committing = true;
+    if (group_overflow) {
+        checkpoint_direct(fat);
+    } else if (group_bytes > 0) {
+        size_t group_size = sizeof(group_header_t) + group_bytes;
+        if (tail + group_size > capacity) checkpoint(fat); // make room
+
+        group_header_t* header = (group_header_t*) group;
+        header->magic = GROUP_MAGIC;
+        header->generation = generation;
+        header->n_bytes = group_bytes;
+        header->checksum = crc32c(0, &group[sizeof(group_header_t)], group_bytes);
+        safe_pwrite(journal_fd, group, group_size, region_offset + sizeof(journal_header_t) + tail);
+        safe_fdatasync(journal_fd); // the one sync for every operation in the group
+
+        tail += group_size;
+        committed_seq = seq++;
+        group_bytes = 0;
+    }
+    release_freed();
+    committing = false;
+}
+
+/**
+ * get the time since an operation began
+ * @param start when it began
+ * @return elapsed milliseconds
+*/
+static long elapsed_ms(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void journal_format(int fs_fd, off_t journal_offset) {
+    journal_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    safe_pwrite(fs_fd, &header, sizeof(header), journal_offset);
+}
+
+int journal_replay(int fs_fd, superblock_t* sb) {
+    uint32_t new_generation;
+    char* records = safe_malloc(sb->journal_size - sizeof(journal_header_t));
+    fat_page_t* pages = safe_malloc(2 * sizeof(fat_page_t));
+    int n_groups = apply_groups(fs_fd, sb, &new_generation, records, pages);
+    free(pages);
+    free(records);
+    return n_groups;
+}
+
+void journal_mount(uint16_t* fat, int fs_fd) {
+    superblock_t* sb = fs_superblock(fat);
+    journal_header_t header;
+    safe_pread(fs_fd, &header, sizeof(header), sb->journal_offset);
+
+    journal_fd = fs_fd;
+    region_offset = sb->journal_offset;
+    capacity = sb->journal_size - sizeof(journal_header_t);
+    generation = header.generation;
+    tail = 0;
+    group = safe_malloc(capacity);
+    replay_records = safe_malloc(capacity);
+    replay_pages = safe_malloc(2 * sizeof(fat_page_t));
+    group_bytes = 0;
+    group_overflow = false;
+    depth = 0;
+    committing = false;
+    block_state = calloc(fs_n_blocks(fat), 1);
+    if (block_state == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    n_touched = 0;
+    n_freed = 0;
+    overlay = NULL;
+    overlay_cap = 0;
+    overlay_rebuild(256, 0);
+    active = true;
+}
+
+void journal_unmount(uint16_t* fat) {
+    depth = 0; // nothing else can run an operation past this point
+    journal_commit(fat);
+    checkpoint(fat);
+    safe_pwrite(journal_fd, fat, FS_SUPERBLOCK_SIZE, 0); // free-block count
+    safe_fdatasync(journal_fd);
+
+    free(group);
+    group = NULL;
+    free(replay_records);
+    replay_records = NULL;
+    free(replay_pages);
+    replay_pages = NULL;
+    free(block_state);
+    block_state = NULL;
+    free(touched);
+    touched = NULL;
+    touched_cap = 0;
+    free(overlay);
+    overlay = NULL;
+    overlay_cap = 0;
+    active = false;
+}
+
+bool journal_active() {
+    return active;
+}
+
+void journal_begin() {
+    if (!active) return;
+    if (depth == 0 && group_bytes == 0) clock_gettime(CLOCK_MONOTONIC, &group_start);
+    depth++;
+}
+
+void journal_end(uint16_t* fat) {
+    if (!active) return;
+    if (depth > 0) depth--;
+    if (depth > 0) return; // another operation is half done
+
+    if (group_overflow || group_bytes >= capacity / 4 || elapsed_ms(&group_start) >= COMMIT_INTERVAL_MS) {
+        journal_commit(fat);
+    }
+}
+
+void journal_log_fat(int idx, int old_value, int value) {
+    fat_record_t record = { RECORD_FAT, (uint32_t) idx, (uint32_t) value };
+    group_append(&record, sizeof(record));
+    if (old_value == 0 && value != 0) {
+        set_block_state(idx, BLOCK_FRESH);
+    } else if (old_value != 0 && value == 0) {
+        if (block_state[idx] & BLOCK_FRESH) { // never committed as in use, so it can be reused at once
+            set_block_state(idx, 0);
+            fs_release_block(idx);
+        } else {
+            set_block_state(idx, BLOCK_FREED);
+            n_freed++;
+        }
+    }
+}
+
+void journal_log_csum(int idx, uint32_t value) {
+    fat_record_t record = { RECORD_CSUM, (uint32_t) idx, value };
+    group_append(&record, sizeof(record));
+}
+
+bool journal_freed(int idx) {
+    return active && (block_state[idx] & BLOCK_FREED);
+}
+
+int journal_n_freed() {
+    return n_freed;
+}
+
+void journal_log_dir(off_t offset, dir_entry_t* entry) {
+    dir_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.type = RECORD_DIR;
+    record.offset = offset;
+    record.entry = *entry;
+    group_append(&record, sizeof(record));
+
+    if ((overlay_used + 1) * 2 > overlay_cap) overlay_rebuild(overlay_cap * 2, 0);
+    overlay_slot_t* slot = overlay_slot(offset);
+    if (slot->offset == 0) overlay_used++;
+    slot->offset = offset;
+    slot->seq = seq;
+    slot->entry = *entry;
+}
+
+void journal_overlay(off_t offset, char* buffer, size_t n_bytes) {
+    if (overlay_used == 0) return;
+    for (size_t i = 0; i < n_bytes; i += DIR_ENTRY_SIZE) {
+        overlay_slot_t* slot = overlay_slot(offset + i);
+        if (slot->offset != 0) memcpy(&buffer[i], &slot->entry, DIR_ENTRY_SIZE);
+    }
+}
+
+void journal_commit(uint16_t* fat) {
+    commit(fat);
+}
+
+void journal_tick(uint16_t* fat) {
+    if (!active || group_bytes == 0 || group_overflow) return;
+    // a group that needs a checkpoint first waits for the next `journal_end`
+    if (tail + sizeof(group_header_t) + group_bytes > capacity) return;
+    if (elapsed_ms(&group_start) >= COMMIT_INTERVAL_MS) commit(fat);
+}
@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "fat.h"
+
+#pragma once
+
+// write-ahead metadata journal interface (v2 filesystems with FEATURE_JOURNAL)
+//
+// FAT, checksum table and directory-entry updates are logged into an in-memory group instead of
+// being written in place. Completed operations are committed as one group with a
+// single fdatasync, at the latest COMMIT_INTERVAL_MS after the group's first operation
+// began (see `journal_tick`), and committed groups are checkpointed (written in place)
+// lazily, when the journal region fills up or the filesystem is unmounted.
+
+#define COMMIT_INTERVAL_MS 500 // longest a group stays uncommitted once its first operation began
+
+extern const int JOURNAL_DEFAULT_SIZE; // bytes reserved by `mkfs -j`
+
+/**
+ * initialize an empty journal region (called by `fs_mkfs`)
+ * @param fs_fd filesystem file descriptor
+ * @param journal_offset byte offset of the journal region
+ * @return none
+*/
+void journal_format(int fs_fd, off_t journal_offset);
+
+/**
+ * apply every committed group in the journal to the image & empty the journal;
+ * called by `fs_mount` before the FAT is mapped
+ * @param fs_fd filesystem file descriptor
+ * @param sb the superblock, as read from disk
+ * @return the number of groups replayed
+*/
+int journal_replay(int fs_fd, superblock_t* sb);
+
+/**
+ * start journaling a mounted filesystem
+ * @param fat filesystem, mapped with `MAP_PRIVATE`
+ * @param fs_fd filesystem file descriptor
+ * @return none
+*/
+void journal_mount(uint16_t* fat, int fs_fd);
+
+/**
+ * commit & checkpoint everything, write the superblock, and stop journaling
+ * @param fat filesystem
+ * @return none
+*/
+void journal_unmount(uint16_t* fat);
+
+/**
+ * check whether updates are currently being journaled
+ * @return `true` if a journaled filesystem is mounted
+*/
+bool journal_active();
+
+/**
+ * mark the start of a metadata operation; groups are only committed between operations
+ * @return none
+*/
+void journal_begin();
+
+/**
+ * mark the end of a metadata operation & commit the running group if it is due
+ * (a quarter of the journal full, or its deadline passed)
+ * @param fat filesystem
+ * @return none
+*/
+void journal_end(uint16_t* fat);
+
+
+/**
+ * log a FAT entry update (the caller updates the mapped FAT itself); a block that is freed
+ * isn't handed back to the allocator (`fs_release_block`) until the group commits, unless
+ * the running group allocated it in the first place
+ * @param idx block index
+ * @param old_value the entry before the update
+ * @param value the new entry
+ * @return none
+*/
+void journal_log_fat(int idx, int old_value, int value);
+
+/**
+ * log a checksum table update (the caller updates the mapped table itself)
+ * @param idx block index
+ * @param value the new entry
+ * @return none
+*/
+void journal_log_csum(int idx, uint32_t value);
+/**
+ * check whether a block was freed by the running group, which still has to commit
+ * before the block can be allocated again
+ * @param idx block index
+ * @return `true` if the block must not be allocated yet
+*/
+bool journal_freed(int idx);
+
+/**
+ * count the blocks freed by the running group
+ * @return the number of blocks `journal_commit` would hand back to the allocator
+*/
+int journal_n_freed();
+
+/**
+ * log a directory entry update; it is visible through `journal_overlay` until checkpointed
+ * @param offset byte offset of the entry in the image
+ * @param entry the new directory entry
+ * @return none
+*/
+void journal_log_dir(off_t offset, dir_entry_t* entry);
+
+/**
+ * copy logged directory entries that aren't checkpointed yet over a buffer read from disk
+ * @param offset byte offset of `buffer` in the image
+ * @param buffer directory entries read from disk
+ * @param n_bytes length of `buffer`
+ * @return none
+*/
+void journal_overlay(off_t offset, char* buffer, size_t n_bytes);
+
+/**
+ * commit the running group with a single fdatasync
+ * @param fat filesystem
+ * @return none
+*/
+void journal_commit(uint16_t* fat);
+
+/**
+ * commit the running group if its deadline has passed & no operation is half done;
+ * called from a timer, so that a group is committed even if no operation ends after it.
+ * It only writes a group that fits in the journal as is: one that needs a checkpoint (or is
+ * too big to be journaled) is left for the next `journal_end` or `journal_commit`, since a
+ * timer may interrupt a process in the middle of malloc or of the overlay
+ * @param fat filesystem
+ * @return none
+*/
+void journal_tick(uint16_t* fat);
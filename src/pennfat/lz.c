@@ -0,0 +1,161 @@
+// LZ77 byte codec
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define HASH_BITS   12 // entries in the match-finder table
+#define MAX_OFFSET  65535
+#define RUN_MASK    15 // nibble value meaning "more length bytes follow"
+
+/**
+ * load 4 bytes for hashing & match checks
+ * @param p where to load from
+ * @return the bytes as an integer
+*/
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * hash 4 bytes into the match-finder table
+ * @param v 4 bytes from `read32`
+ * @return table index
+*/
+static int hash(uint32_t v) {
+    return (int) ((v * 2654435761u) >> (32 - HASH_BITS));
+}
+
+/**
+ * write the extension bytes of a length that didn't fit in its nibble
+ * @param op where to write
+ * @param len the remaining length (after subtracting RUN_MASK)
+ * @return past the last byte written
+*/
+static uint8_t* put_length(uint8_t* op, int len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+/**
+ * write one sequence (literals, then optionally a match)
+ * @param op where to write; updated past the sequence
+ * @param oend end of the output buffer
+ * @param literals the literal bytes
+ * @param n_literals number of literal bytes
+ * @param offset match distance, ignored if `match_len` is `0`
+ * @param match_len match length, or `0` for the final literals-only sequence
+ * @return `false` if the sequence doesn't fit
+*/
+static bool put_sequence(uint8_t** op, uint8_t* oend, const uint8_t* literals, int n_literals, int offset, int match_len) {
+    int extra = (match_len == 0) ? 0 : match_len - LZ_MIN_MATCH;
+    long worst = 1 + n_literals / 255 + 1 + n_literals + 2 + extra / 255 + 1;
+    if (worst > oend - *op) return false;
+
+    uint8_t* p = *op;
+    uint8_t* token = p++;
+    *token = (uint8_t) (((n_literals < RUN_MASK) ? n_literals : RUN_MASK) << 4);
+    if (n_literals >= RUN_MASK) p = put_length(p, n_literals - RUN_MASK);
+    memcpy(p, literals, n_literals);
+    p += n_literals;
+    if (match_len != 0) {
+        *p++ = (uint8_t) (offset & 0xFF);
+        *p++ = (uint8_t) (offset >> 8);
+        *token |= (uint8_t) ((extra < RUN_MASK) ? extra : RUN_MASK);
+        if (extra >= RUN_MASK) p = put_length(p, extra - RUN_MASK);
+    }
+    *op = p;
+    return true;
+}
+
+int lz_compress(const char* src, int n_bytes, char* dst, int capacity) {
+    const uint8_t* base = (const uint8_t*) src;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base; // first byte not yet written
+    const uint8_t* end = base + n_bytes;
+    uint8_t* op = (uint8_t*) dst;
+    uint8_t* oend = op + capacity;
+    int table[1 << HASH_BITS]; // last position (+1) with each hash, `0` if none
+    memset(table, 0, sizeof(table));
+
+    while (end - ip >= LZ_MIN_MATCH) {
+        uint32_t seq = read32(ip);
+        int h = hash(seq);
+        int candidate = table[h] - 1;
+        table[h] = (int) (ip - base) + 1;
+        if (candidate < 0 || (ip - base) - candidate > MAX_OFFSET || read32(base + candidate) != seq) {
+            ip += 1 + ((ip - anchor) >> 6); // skip faster through incompressible runs
+            continue;
+        }
+
+        const uint8_t* match = base + candidate;
+        int len = LZ_MIN_MATCH;
+        while (ip + len < end && ip[len] == match[len]) len++;
+        if (!put_sequence(&op, oend, anchor, (int) (ip - anchor), (int) (ip - match), len)) return 0;
+        ip += len;
+        anchor = ip;
+    }
+    if (!put_sequence(&op, oend, anchor, (int) (end - anchor), 0, 0)) return 0;
+    return (int) (op - (uint8_t*) dst);
+}
+
+/**
+ * read the extension bytes of a length
+ * @param ip where to read; updated past the bytes
+ * @param iend end of the input
+ * @param len the nibble value; updated with the extension
+ * @return `false` if the input ends first
+*/
+static bool get_length(const uint8_t** ip, const uint8_t* iend, int* len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+int lz_decompress(const char* src, int n_bytes, char* dst, int capacity) {
+    const uint8_t* ip = (const uint8_t*) src;
+    const uint8_t* iend = ip + n_bytes;
+    uint8_t* base = (uint8_t*) dst;
+    uint8_t* op = base;
+    uint8_t* oend = base + capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        int n_literals = token >> 4;
+        if (n_literals == RUN_MASK && !get_length(&ip, iend, &n_literals)) return -1;
+        if (n_literals > iend - ip || n_literals > oend - op) return -1;
+        memcpy(op, ip, n_literals);
+        ip += n_literals;
+        op += n_literals;
+        if (ip == iend) break; // the final sequence has no match
+
+        if (iend - ip < 2) return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int len = token & RUN_MASK;
+        if (len == RUN_MASK && !get_length(&ip, iend, &len)) return -1;
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - base || len > oend - op) return -1;
+
+        const uint8_t* match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        } else { // overlapping copy repeats the last `offset` bytes
+            for (int i = 0; i < len; i++) *op++ = match[i];
+        }
+    }
+    return (int) (op - base);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// LZ77 byte codec (LZ4-style sequences) used by compressed files
+//
+// A compressed stream is a list of sequences: a token byte (literal count in the
+// high nibble, match length - LZ_MIN_MATCH in the low nibble, 15 meaning "more
+// length bytes follow"), the literals, then a 2-byte little-endian match offset.
+// The last sequence has literals only.
+
+#define LZ_MIN_MATCH 4
+
+/**
+ * compress a buffer
+ * @param src what to compress
+ * @param n_bytes length of `src`
+ * @param dst where to write the compressed stream
+ * @param capacity bytes available in `dst`
+ * @return length of the compressed stream, or `0` if it doesn't fit in `capacity`
+*/
+int lz_compress(const char* src, int n_bytes, char* dst, int capacity);
+
+/**
+ * decompress a buffer written by `lz_compress`
+ * @param src the compressed stream
+ * @param n_bytes length of `src`
+ * @param dst where to write the decompressed bytes
+ * @param capacity bytes available in `dst`
+ * @return number of decompressed bytes, or `-1` if the stream is corrupt or doesn't fit in `capacity`
+*/
+int lz_decompress(const char* src, int n_bytes, char* dst, int capacity);
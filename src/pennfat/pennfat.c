@@ -12,8 +12,13 @@
 #include <limits.h>
 #include <errno.h>
 
+#include "checksum.h"
+#include "defrag.h"
 #include "fat.h"
+#include "fsck.h"
+#include "hostcp.h"
 #include "safe.h"
+#include "snapshot.h"
 #include "../util/parser.h"
 #include "../util/util.h"
 
@@ -37,6 +42,16 @@ bool valid_fs_mounted(int fs_fd) {
     return true;
 }
 
+// return true if the mounted file system can be written, print & return false otherwise
+// must call valid_fs_mounted() before this
+bool valid_fs_writable(uint16_t* fat) {
+    if (snapshot_mounted(fat)) {
+        fprintf(stderr, "file system is a read-only snapshot\n");
+        return false;
+    }
+    return true;
+}
+
 // return true if all file arguments exist (between first_file_arg, last_file_arg)
 // print & return false otherwise
 // must call valid_fs_mounted() before this
@@ -45,7 +60,7 @@ bool all_files_exist(uint16_t* fat, int fs_fd, char* argv[], int first_file_arg,
         char* target = argv[f];
         point_t location;
         dir_entry_t entry;
-        bool found = find_file(fat, fs_fd, ROOTDIR, target, &location, &entry);
+        bool found = find_file(fat, fs_fd, fs_root(fat), target, &location, &entry);
         if (!found) {
             fprintf(stderr, "failed, file does not exist: %s\n", argv[f]);
             return false;
@@ -55,26 +70,240 @@ bool all_files_exist(uint16_t* fat, int fs_fd, char* argv[], int first_file_arg,
 }
 
 
+// hex dump (`hd`)
+
+#define HD_CHUNK_SIZE (64 * 1024) // bytes read & formatted per write; a multiple of 16
+#define HD_LINE_MAX 128 // longest line `hd_format_line` writes
+
+static char hd_hex[256][2]; // "00" through "ff", filled on first use
+
+// append the hex digits of `value` to `out`, padded with zeros to at least `width` digits
+// return the number of characters written
+static int hd_format_hex(char* out, unsigned long long value, int width) {
+    int n_digits = 1;
+    for (unsigned long long v = value >> 4; v != 0; v >>= 4) n_digits++;
+    if (n_digits < width) n_digits = width;
+    for (int i = n_digits - 1; i >= 0; i--) {
+        out[i] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    }
+    return n_digits;
+}
+
+// format one line of up to 16 bytes at `address` into `out`; a short line is the last one
+// return the number of characters written (at most HD_LINE_MAX)
+static int hd_format_line(char* out, off_t address, const unsigned char* bytes, int n, bool chars, bool blocks, int block_size) {
+    int len = hd_format_hex(out, (unsigned long long) address, 8);
+    if (blocks) {
+        memcpy(&out[len], " blk", 4);
+        len += 4;
+        len += hd_format_hex(&out[len], (unsigned int) (address / block_size), 4);
+    }
+    memcpy(&out[len], ":  ", 3);
+    len += 3;
+    for (int i = 0; i < n; i++) {
+        out[len++] = hd_hex[bytes[i]][0];
+        out[len++] = hd_hex[bytes[i]][1];
+        out[len++] = ' ';
+        if (i % 8 == 7) out[len++] = ' ';
+    }
+    int spaces = (n < 16) ? 3 * (16 - n) + 1 : 0; // pads a short last line
+    if (chars) {
+        memset(&out[len], ' ', spaces);
+        len += spaces;
+        out[len++] = '|';
+        for (int i = 0; i < n; i++) out[len++] = (bytes[i] >= 32 && bytes[i] <= 126) ? bytes[i] : '.';
+        out[len++] = '|';
+    }
+    if (n < 16) {
+        memset(&out[len], ' ', spaces);
+        len += spaces;
+    } else {
+        out[len++] = '\n';
+    }
+    return len;
+}
+
+// dump `n_bytes` of the image from `start`, reading & writing HD_CHUNK_SIZE bytes at a time
+static void hd_dump(int fs_fd, off_t start, off_t n_bytes, bool chars, bool blocks, int block_size) {
+    if (hd_hex[0][0] == 0) {
+        for (int b = 0; b < 256; b++) {
+            hd_hex[b][0] = "0123456789abcdef"[b >> 4];
+            hd_hex[b][1] = "0123456789abcdef"[b & 0xf];
+        }
+    }
+    unsigned char* in = safe_malloc(HD_CHUNK_SIZE);
+    char* out = safe_malloc((HD_CHUNK_SIZE / 16) * HD_LINE_MAX + 1);
+    off_t done = 0;
+    bool last = false;
+    while (!last) {
+        size_t wanted = (n_bytes - done < HD_CHUNK_SIZE) ? (size_t) (n_bytes - done) : HD_CHUNK_SIZE;
+        ssize_t got = (wanted == 0) ? 0 : safe_pread(fs_fd, in, wanted, start + done);
+        if (got < 0) got = 0;
+        last = (got < wanted) || (done + got == n_bytes); // end of the range or of the image
+
+        size_t len = 0;
+        for (ssize_t i = 0; i < got; i += 16) {
+            int n = (got - i < 16) ? (int) (got - i) : 16;
+            len += hd_format_line(&out[len], start + done + i, &in[i], n, chars, blocks, block_size);
+        }
+        if (last) out[len++] = '\n';
+        safe_write(STDERR_FILENO, out, len);
+        done += got;
+    }
+    free(out);
+    free(in);
+}
+
+// batch mode: `pennfat -f SCRIPT` or `pennfat IMAGE -c "CMD; CMD ..."` runs commands
+// without prompting, with FAT flushes deferred to one commit at the end
+#define BATCH_MAX_NAMES 32 // distinct command names in the timing summary
+
+typedef struct batch_timing {
+    char name[16]; // command name
+    int count; // times it ran
+    double seconds; // total wall-clock time
+    double max; // slowest run
+} batch_timing_t;
+
+static char* batch_text = NULL; // remaining commands; `NULL` in interactive mode
+static batch_timing_t batch_timings[BATCH_MAX_NAMES];
+static int batch_n_timings = 0;
+
+/**
+ * read a whole host script into memory
+ * @param path host path
+ * @return the script, null-terminated
+*/
+static char* batch_load(const char* path) {
+    int fd = safe_open(path, O_RDONLY, 0);
+    off_t size = safe_lseek(fd, 0, SEEK_END);
+    safe_lseek(fd, 0, SEEK_SET);
+    char* text = safe_malloc(size + 1);
+    off_t n_read = 0;
+    while (n_read < size) {
+        int n = safe_read(fd, &text[n_read], size - n_read);
+        if (n == 0) break;
+        n_read += n;
+    }
+    text[n_read] = '\0';
+    safe_close(fd);
+    return text;
+}
+
+/**
+ * take the next command off the batch; commands end at `;` or a newline, and lines starting with `#` are skipped
+ * @param line set to the command
+ * @param max_bytes size of `line`
+ * @return `false` once the batch is done
+*/
+static bool batch_next(char* line, int max_bytes) {
+    while (true) {
+        while (*batch_text == ';' || isspace((unsigned char) *batch_text)) batch_text++;
+        if (*batch_text != '#') break;
+        while (*batch_text != '\0' && *batch_text != '\n') batch_text++; // comment
+    }
+    if (*batch_text == '\0') return false;
+
+    int n = 0;
+    while (*batch_text != '\0' && *batch_text != ';' && *batch_text != '\n') {
+        if (n < max_bytes - 2) line[n++] = *batch_text;
+        batch_text++;
+    }
+    line[n++] = '\n';
+    line[n] = '\0';
+    return true;
+}
+
+/**
+ * add a command's run time to the summary
+ * @param name command name
+ * @param seconds time it took
+ * @return none
+*/
+static void batch_record(const char* name, double seconds) {
+    int i = 0;
+    while (i < batch_n_timings && strcmp(batch_timings[i].name, name) != 0) i++;
+    if (i == batch_n_timings) {
+        if (batch_n_timings == BATCH_MAX_NAMES) i--; // lumped into the last row
+        else snprintf(batch_timings[batch_n_timings++].name, sizeof(batch_timings[i].name), "%s", name);
+    }
+    batch_timings[i].count++;
+    batch_timings[i].seconds += seconds;
+    if (seconds > batch_timings[i].max) batch_timings[i].max = seconds;
+}
+
+/**
+ * print the per-command timing summary
+ * @param total_seconds wall-clock time of the whole batch
+ * @return none
+*/
+static void batch_summary(double total_seconds) {
+    int n_commands = 0;
+    for (int i = 0; i < batch_n_timings; i++) {
+        if (batch_timings[i].name[0] != '(') n_commands += batch_timings[i].count; // not the final commit
+    }
+    fprintf(stderr, "batch: %d commands in %.3f s\n", n_commands, total_seconds);
+    fprintf(stderr, "%-16s %8s %10s %10s %10s\n", "command", "count", "total s", "avg ms", "max ms");
+    for (int i = 0; i < batch_n_timings; i++) {
+        batch_timing_t* t = &batch_timings[i];
+        fprintf(stderr, "%-16s %8d %10.3f %10.3f %10.3f\n", t->name, t->count, t->seconds, t->seconds * 1000 / t->count, t->max * 1000);
+    }
+}
+
+/**
+ * @param since start time, from CLOCK_MONOTONIC
+ * @return seconds elapsed since then
+*/
+static double elapsed_seconds(struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
 
 int main(int argc, char* argv[]) {
     int fs_fd = -1; // filesystem file descriptor
     uint16_t* fat = NULL; // FAT
-    uint16_t metadata = -1; // these values are only valid if fs_fd != -1
-    int n_blocks = -1; // = FAT_BLOCKS(metadata);
-    int block_size = -1; // = BLOCK_SIZE(metadata);
+    int n_blocks = -1; // these values are only valid if fs_fd != -1
+    int block_size = -1; // = fs_block_size(fat);
 
     // buffer for read
     char line[10001];
     int n_bytes = 0;
     struct parsed_command* command = NULL;
 
+    // pennfat [ -f SCRIPT | IMAGE -c COMMANDS ]
+    if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        batch_text = batch_load(argv[2]);
+    } else if (argc == 4 && strcmp(argv[2], "-c") == 0) {
+        batch_text = safe_malloc(strlen(argv[1]) + strlen(argv[3]) + 16);
+        sprintf(batch_text, "mount %s\n%s", argv[1], argv[3]); // mounted once for every command
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [ -f SCRIPT | IMAGE -c COMMANDS ]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    struct timespec batch_start, command_start;
+    char command_name[16] = ""; // command being timed
+    if (batch_text != NULL) {
+        fs_defer_sync(NULL, true);
+        clock_gettime(CLOCK_MONOTONIC, &batch_start);
+    }
+
     // main loop
     while (1) {
-        fprintf(stderr, "$ "); // prompt
+        if (batch_text != NULL) {
+            if (command_name[0] != '\0') batch_record(command_name, elapsed_seconds(&command_start));
+            command_name[0] = '\0';
+            if (!batch_next(line, sizeof(line))) break;
+            clock_gettime(CLOCK_MONOTONIC, &command_start);
+        } else {
+            if (fs_fd != -1) fs_sync(fat); // commit what the last command changed before going idle
+            fprintf(stderr, "$ "); // prompt
 
-        n_bytes = safe_read(STDIN_FILENO, line, 10000);
-        line[n_bytes] = '\0';
-        if (line[n_bytes -  1] != '\n') fprintf(stderr, "\n"); // newline upon ctrl-D
+            n_bytes = safe_read(STDIN_FILENO, line, 10000);
+            line[n_bytes] = '\0';
+            if (line[n_bytes -  1] != '\n') fprintf(stderr, "\n"); // newline upon ctrl-D
+        }
 
         int parse_command_res = parse_command(line, &command);
         if (parse_command_res < 0) {
@@ -91,62 +320,98 @@ int main(int argc, char* argv[]) {
         if (command->num_commands == 0) {
             CONTINUE
         }
+        if (batch_text != NULL) snprintf(command_name, sizeof(command_name), "%s", command->commands[0][0]);
         // print_parsed_command(command); // DEBUG: show command
 
-        if (strcmp(command->commands[0][0], "mkfs") == 0) { // mkfs FS_NAME BLOCKS_IN_FAT BLOCK_SIZE_CONFIG
+        if (strcmp(command->commands[0][0], "mkfs") == 0) { // mkfs FS_NAME BLOCKS_IN_FAT BLOCK_SIZE_CONFIG [ -v2 ] [ -j ] [ -noinline ] [ -z ] [ -crc ]
             int argc = get_argc(command->commands[0]);
-            if (!correct_argc(4, argc)) CONTINUE
+            if (argc < 4 || argc > 9) {
+                fprintf(stderr, "expected 4-9 args, got %d instead\n", argc);
+                CONTINUE
+            }
+            int version = FS_VERSION_1;
+            uint32_t features = 0;
+            bool inline_files = true; // v2 stores tiny files in their directory slots unless told otherwise
+            bool bad_option = false;
+            for (int i = 4; i < argc; i++) {
+                char* option = command->commands[0][i];
+                if (strcmp(option, "-v2") == 0) {
+                    version = FS_VERSION_2;
+                } else if (strcmp(option, "-j") == 0) {
+                    features |= FEATURE_JOURNAL;
+                } else if (strcmp(option, "-noinline") == 0) {
+                    inline_files = false;
+                } else if (strcmp(option, "-z") == 0) {
+                    features |= FEATURE_COMPRESS;
+                } else if (strcmp(option, "-crc") == 0) {
+                    features |= FEATURE_CHECKSUM;
+                } else {
+                    fprintf(stderr, "failed: unknown option:[%s]\n", option);
+                    bad_option = true;
+                    break;
+                }
+            }
+            if (bad_option) CONTINUE
+            if (features != 0 && version == FS_VERSION_1) {
+                fprintf(stderr, "failed: -j, -z and -crc require -v2\n");
+                CONTINUE
+            }
+            if (version == FS_VERSION_2 && inline_files) features |= FEATURE_INLINE;
+            int max_fat_blocks = (version == FS_VERSION_1) ? MAX_FAT_BLOCKS_V1 : MAX_FAT_BLOCKS_V2;
+            int max_block_size_config = (version == FS_VERSION_1) ? MAX_BLOCK_SIZE_CONFIG_V1 : MAX_BLOCK_SIZE_CONFIG_V2;
+
             char* dir = command->commands[0][1]; // FS_NAME
             int blocks_in_fat = atoi(command->commands[0][2]); // BLOCKS_IN_FAT
-            if (blocks_in_fat < 1 || blocks_in_fat > 32) {
-                fprintf(stderr, "invalid BLOCKS_IN_FAT:[%d] (must be within 1-32)\n", blocks_in_fat);
+            if (blocks_in_fat < 1 || blocks_in_fat > max_fat_blocks) {
+                fprintf(stderr, "invalid BLOCKS_IN_FAT:[%d] (must be within 1-%d)\n", blocks_in_fat, max_fat_blocks);
                 CONTINUE
             }
             int block_size_config = atoi(command->commands[0][3]); // BLOCK_SIZE_CONFIG
-            if (block_size_config < 0 || block_size_config > 4) {
-                fprintf(stderr, "invalid BLOCK_SIZE_CONFIG:[%d] (must be within 0-4)\n", block_size_config);
+            if (block_size_config < 0 || block_size_config > max_block_size_config) {
+                fprintf(stderr, "invalid BLOCK_SIZE_CONFIG:[%d] (must be within 0-%d)\n", block_size_config, max_block_size_config);
+                CONTINUE
+            }
+            if (version == FS_VERSION_2 && (long long) (BYTE_SIZE << block_size_config) * blocks_in_fat <= FS_SUPERBLOCK_SIZE) {
+                fprintf(stderr, "invalid BLOCKS_IN_FAT:[%d] (no room for the FAT after the superblock)\n", blocks_in_fat);
                 CONTINUE
             }
-            int block_size_bytes = BYTE_SIZE << block_size_config;
-
-            int fat_size = blocks_in_fat * block_size_bytes;
-            int n_fat_entries = fat_size / 2;
-            int data_region_size = block_size_bytes * (n_fat_entries - 1);
             
-            // fprintf(stderr, "mkfs %s %d %d\n", dir, blocks_in_fat, block_size_bytes); // DEBUG: show parsed mkfs
+            // fprintf(stderr, "mkfs %s %d %d\n", dir, blocks_in_fat, block_size_config); // DEBUG: show parsed mkfs
 
-            int fd = safe_open(dir, O_CREAT|O_TRUNC|O_RDWR, DEFAULT_PERMISSIONS);
-
-            // write the FAT region
-            uint16_t* fat_region = safe_malloc(fat_size);
-            for (int j = 0; j < n_fat_entries; j++) {
-                fat_region[j] = 0;
-            }
-            fat_region[0] = (blocks_in_fat << BITS_PER_BYTE) | block_size_config; // metadata
-            fat_region[1] = LASTBLOCK;
-            safe_write(fd, fat_region, fat_size);
-            free(fat_region);
+            if (!fs_mkfs(dir, blocks_in_fat, block_size_config, version, features)) CONTINUE
+        } else if (strcmp(command->commands[0][0], "clone") == 0) { // clone FS_NAME NEW_FS_NAME
+            int argc = get_argc(command->commands[0]);
+            if (!correct_argc(3, argc)) CONTINUE
 
-            // write the data region
-            char* block = safe_malloc(block_size_bytes);
-            for (int j = 0; j < block_size_bytes; j++) {
-                block[j] = '\0';
+            if (fs_fd != -1) fs_sync(fat); // the mounted image may be the source
+            fs_clone(command->commands[0][1], command->commands[0][2]);
+        } else if (strcmp(command->commands[0][0], "mount") == 0) { // mount FS_NAME [ --check | --snapshot NAME ]
+            int argc = get_argc(command->commands[0]);
+            if (argc < 2 || argc > 4) {
+                fprintf(stderr, "expected 2-4 args, got %d instead\n", argc);
+                CONTINUE
             }
-            for (int i = 0; i < data_region_size / block_size_bytes; i++) {
-                safe_write(fd, block, block_size_bytes);
+            bool check = false;
+            char* snapshot = NULL;
+            if (argc == 3 && strcmp(command->commands[0][2], "--check") == 0) {
+                check = true;
+            } else if (argc == 4 && strcmp(command->commands[0][2], "--snapshot") == 0) {
+                snapshot = command->commands[0][3];
+            } else if (argc != 2) {
+                fprintf(stderr, "failed: unknown option:[%s]\n", command->commands[0][2]);
+                CONTINUE
             }
 
-            free(block);
-
-            safe_close(fd);
-        } else if (strcmp(command->commands[0][0], "mount") == 0) { // mount FS_NAME
-            int argc = get_argc(command->commands[0]);
-            if (!correct_argc(2, argc)) CONTINUE
-
             char* dir = command->commands[0][1]; // FS_NAME
-            fs_fd = fs_mount(dir, &fat);
-            safe_lseek(fs_fd, 0, SEEK_SET);
-            safe_read(fs_fd, &metadata, 2);
+            if (snapshot != NULL) { // read-only
+                fs_fd = snapshot_mount(dir, &fat, snapshot);
+                if (fs_fd == -1) {
+                    fprintf(stderr, "failed, snapshot does not exist: %s\n", snapshot);
+                    CONTINUE
+                }
+            } else {
+                fs_fd = fs_mount_mode(dir, &fat, check);
+            }
             fs_getmeta(fat, fs_fd, &n_blocks, &block_size);
         } else if (strcmp(command->commands[0][0], "unmount") == 0) { // umount
             int argc = get_argc(command->commands[0]);
@@ -155,9 +420,106 @@ int main(int argc, char* argv[]) {
 
             fs_unmount(&fat, fs_fd);
             fs_fd = -1;
+        } else if (strcmp(command->commands[0][0], "fsck") == 0) { // fsck [ -r ]
+            int argc = get_argc(command->commands[0]);
+            if (argc != 1 && argc != 2) {
+                fprintf(stderr, "expected 1-2 args, got %d instead\n", argc);
+                CONTINUE
+            }
+            if (!valid_fs_mounted(fs_fd)) CONTINUE
+            bool repair = false;
+            if (argc == 2) {
+                if (strcmp(command->commands[0][1], "-r") != 0) {
+                    fprintf(stderr, "failed: unknown option:[%s]\n", command->commands[0][1]);
+                    CONTINUE
+                }
+                repair = true;
+                if (!valid_fs_writable(fat)) CONTINUE
+            }
+
+            fsck_report_t report;
+            fs_fsck(fat, fs_fd, repair, &report);
+            fsck_print_report(&report, repair);
+        } else if (strcmp(command->commands[0][0], "scrub") == 0) { // scrub [ -t THREADS ]
+            int argc = get_argc(command->commands[0]);
+            if (argc != 1 && argc != 3) {
+                fprintf(stderr, "expected 1 or 3 args, got %d instead\n", argc);
+                CONTINUE
+            }
+            if (!valid_fs_mounted(fs_fd)) CONTINUE
+            int n_threads = 0; // one per CPU
+            if (argc == 3) {
+                n_threads = atoi(command->commands[0][2]);
+                if (strcmp(command->commands[0][1], "-t") != 0 || n_threads < 1) {
+                    fprintf(stderr, "failed: usage: scrub [ -t THREADS ]\n");
+                    CONTINUE
+                }
+            }
+            if (!checksum_enabled()) {
+                fprintf(stderr, "failed: file system has no checksums (mkfs ... -v2 -crc)\n");
+                CONTINUE
+            }
+
+            scrub_report_t report;
+            fs_scrub(fat, fs_fd, n_threads, &report);
+            double mb = report.bytes / (1024.0 * 1024.0);
+            fprintf(stderr, "scrub: %d blocks verified (%.1f MB in %.3f s, %.0f MB/s, %d threads, %s), %d bad\n",
+                    report.n_checked, mb, report.seconds, (report.seconds > 0) ? mb / report.seconds : 0.0,
+                    report.n_threads, crc32c_kernel(), report.n_bad);
+        } else if (strcmp(command->commands[0][0], "defrag") == 0) { // defrag
+            int argc = get_argc(command->commands[0]);
+            if (argc != 1) {
+                fprintf(stderr, "expected 1 arg, got %d instead\n", argc);
+                CONTINUE
+            }
+            if (!valid_fs_mounted(fs_fd)) CONTINUE
+            if (!valid_fs_writable(fat)) CONTINUE
+
+            defrag_report_t report;
+            fs_defrag(fat, fs_fd, &report);
+            char line[256];
+            frag_format(line, sizeof(line), "before", &report.before);
+            fprintf(stderr, "%s", line);
+            defrag_format(line, sizeof(line), &report);
+            fprintf(stderr, "%s", line);
+            frag_format(line, sizeof(line), "after", &report.after);
+            fprintf(stderr, "%s", line);
+        } else if (strcmp(command->commands[0][0], "snapshot") == 0) { // snapshot { NAME | -l | -d NAME }
+            int argc = get_argc(command->commands[0]);
+            if (argc != 2 && argc != 3) {
+                fprintf(stderr, "expected 2-3 args, got %d instead\n", argc);
+                CONTINUE
+            }
+            if (!valid_fs_mounted(fs_fd)) CONTINUE
+            if (fs_version(fat) == FS_VERSION_1) {
+                fprintf(stderr, "failed: snapshots require a v2 file system\n");
+                CONTINUE
+            }
+
+            if (argc == 2 && strcmp(command->commands[0][1], "-l") == 0) { // list
+                snapshot_list(fat, fs_fd);
+                CONTINUE
+            }
+            if (!valid_fs_writable(fat)) CONTINUE
+            if (argc == 3 && strcmp(command->commands[0][1], "-d") == 0) { // delete
+                if (!snapshot_delete(fat, fs_fd, command->commands[0][2])) {
+                    fprintf(stderr, "failed, snapshot does not exist: %s\n", command->commands[0][2]);
+                }
+                CONTINUE
+            }
+            if (argc != 2) {
+                fprintf(stderr, "failed: unknown option:[%s]\n", command->commands[0][1]);
+                CONTINUE
+            }
+            char* name = command->commands[0][1]; // NAME
+            if (!valid_filename(name)) CONTINUE
+            if (!snapshot_create(fat, fs_fd, name)) {
+                fprintf(stderr, "failed: snapshot already exists or file system is full: %s\n", name);
+            }
         } else if (strcmp(command->commands[0][0], "touch") == 0) { // touch FILE ...
             int argc = get_argc(command->commands[0]);
             if (!valid_fs_mounted(fs_fd)) CONTINUE
+            if (!valid_fs_writable(fat)) CONTINUE
 
             for (int f = 1; f < argc; f++) {
                 char* target = command->commands[0][f];
@@ -169,11 +531,12 @@ int main(int argc, char* argv[]) {
             int argc = get_argc(command->commands[0]);
             if (!correct_argc(3, argc)) CONTINUE
             if (!valid_fs_mounted(fs_fd)) CONTINUE
+            if (!valid_fs_writable(fat)) CONTINUE
 
             char* old_name = command->commands[0][1]; // SOURCE
             char* new_name = command->commands[0][2]; // DEST
             if (!all_files_exist(fat, fs_fd, command->commands[0], 1, 2)) CONTINUE // check SOURCE
-            if (find_file(fat, fs_fd, ROOTDIR, new_name, NULL, NULL)) { // new_name already exists
+            if (find_file(fat, fs_fd, fs_root(fat), new_name, NULL, NULL)) { // new_name already exists
                 fprintf(stderr, "DEST name already exists\n");
                 CONTINUE
             }
@@ -183,6 +546,7 @@ int main(int argc, char* argv[]) {
         } else if (strcmp(command->commands[0][0], "rm") == 0) { // rm FILE ...
             int argc = get_argc(command->commands[0]);
             if (!valid_fs_mounted(fs_fd)) CONTINUE
+            if (!valid_fs_writable(fat)) CONTINUE
             if (!all_files_exist(fat, fs_fd, command->commands[0], 1, argc)) CONTINUE
 
             for (int f = 1; f < argc; f++) {
@@ -215,6 +579,7 @@ int main(int argc, char* argv[]) {
                     output_mode = 0;
                 }
             }
+            if (output_mode != 0 && !valid_fs_writable(fat)) CONTINUE
             // check if files to be concatenated exist
             if (output_mode == 0) { // no -w/-a arg, check all files
                 if (!all_files_exist(fat, fs_fd, command->commands[0], 1, argc)) CONTINUE
@@ -254,8 +619,30 @@ int main(int argc, char* argv[]) {
                 }
                 free(input_files);
             }
-        } else if (strcmp(command->commands[0][0], "cp") == 0) { // cp [ -h ] SOURCE DEST
+        } else if (strcmp(command->commands[0][0], "cp") == 0) { // cp [ -h | -s ] SOURCE DEST, or cp -h -m [ -t THREADS ] SOURCE ...
             int argc = get_argc(command->commands[0]);
+            if (argc >= 3 && strcmp(command->commands[0][1], "-h") == 0 && strcmp(command->commands[0][2], "-m") == 0) { // host OS -> PennFAT, many files
+                if (!valid_fs_mounted(fs_fd)) CONTINUE
+                if (!valid_fs_writable(fat)) CONTINUE
+                int first_source = 3;
+                int n_threads = 0; // one per CPU
+                if (argc >= 5 && strcmp(command->commands[0][3], "-t") == 0) {
+                    n_threads = atoi(command->commands[0][4]);
+                    first_source = 5;
+                }
+                if (n_threads < 0 || (first_source == 5 && n_threads == 0) || first_source >= argc) {
+                    fprintf(stderr, "failed: usage: cp -h -m [ -t THREADS ] SOURCE ...\n");
+                    CONTINUE
+                }
+
+                import_report_t report;
+                fs_import_many(fat, fs_fd, &command->commands[0][first_source], argc - first_source, n_threads, &report);
+                double mb = report.bytes / (1024.0 * 1024.0);
+                fprintf(stderr, "cp: imported %d files (%.1f MB in %.3f s, %.0f MB/s, %d threads), %d failed\n",
+                        report.n_files, mb, report.seconds, (report.seconds > 0) ? mb / report.seconds : 0.0,
+                        report.n_threads, report.n_failed);
+                CONTINUE
+            }
             if (argc < 3 || argc > 4) {
                 fprintf(stderr, "expected 3-4 args, got %d instead\n", argc);
                 CONTINUE
@@ -266,6 +653,7 @@ int main(int argc, char* argv[]) {
                 char* source = command->commands[0][2];
                 char* dest = command->commands[0][3];
                 if (!valid_filename(dest)) CONTINUE // check DEST
+                if (!valid_fs_writable(fat)) CONTINUE
                 
                 fs_cp_mode(fat, fs_fd, source, dest, true, false);
             } else if (strcmp(command->commands[0][2], "-h") == 0) { // PennFAT -> host OS
@@ -274,13 +662,19 @@ int main(int argc, char* argv[]) {
                 if (!all_files_exist(fat, fs_fd, command->commands[0], 1, 2)) CONTINUE // check SOURCE
 
                 fs_cp_mode(fat, fs_fd, source, dest, false, true);
-            } else { // PennFAT -> PennFat
-                char* source = command->commands[0][1];
-                char* dest = command->commands[0][2];
-                if (!all_files_exist(fat, fs_fd, command->commands[0], 1, 2)) CONTINUE // check SOURCE
+            } else { // PennFAT -> PennFat; -s shares the blocks copy-on-write
+                bool share = (strcmp(command->commands[0][1], "-s") == 0);
+                if (argc != (share ? 4 : 3)) {
+                    fprintf(stderr, "failed: usage: cp [ -s ] SOURCE DEST\n");
+                    CONTINUE
+                }
+                char* source = command->commands[0][share ? 2 : 1];
+                char* dest = command->commands[0][share ? 3 : 2];
+                if (!all_files_exist(fat, fs_fd, command->commands[0], share ? 2 : 1, share ? 3 : 2)) CONTINUE // check SOURCE
                 if (!valid_filename(dest)) CONTINUE // check DEST
+                if (!valid_fs_writable(fat)) CONTINUE
 
-                fs_cp(fat, fs_fd, source, dest);
+                fs_copy(fat, fs_fd, source, dest, share);
             }
         } else if (strcmp(command->commands[0][0], "ls") == 0) { // ls
             int argc = get_argc(command->commands[0]);
@@ -291,6 +685,7 @@ int main(int argc, char* argv[]) {
         } else if (strcmp(command->commands[0][0], "chmod") == 0) { // chmod PERMISSIONS FILE ...
             int argc = get_argc(command->commands[0]);
             if (!valid_fs_mounted(fs_fd)) CONTINUE
+            if (!valid_fs_writable(fat)) CONTINUE
             if (!all_files_exist(fat, fs_fd, command->commands[0], 2, argc)) CONTINUE
 
             char* perm_arg = command->commands[0][1];
@@ -317,92 +712,110 @@ int main(int argc, char* argv[]) {
                 char* target = command->commands[0][f];
                 fs_chmod(fat, fs_fd, target, permissions);
             }
-        } else if (strcmp(command->commands[0][0], "hd") == 0) { // hd [ -c ] [ -n BYTES ] [-b]
+        } else if (strcmp(command->commands[0][0], "chattr") == 0) { // chattr { +c | -c } FILE ...
             int argc = get_argc(command->commands[0]);
-            if (argc > 5) {
-                fprintf(stderr, "expected 1-5 args, got %d instead\n", argc);
+            if (argc < 3) {
+                fprintf(stderr, "expected at least 3 args, got %d instead\n", argc);
+                CONTINUE
+            }
+            if (!valid_fs_mounted(fs_fd)) CONTINUE
+            if (!valid_fs_writable(fat)) CONTINUE
+            if (!all_files_exist(fat, fs_fd, command->commands[0], 2, argc)) CONTINUE
+
+            char* attr_arg = command->commands[0][1];
+            bool compressed;
+            if (strcmp(attr_arg, "+c") == 0) compressed = true;
+            else if (strcmp(attr_arg, "-c") == 0) compressed = false;
+            else {
+                fprintf(stderr, "invalid ATTRIBUTE:[%s] (must be +c or -c)\n", attr_arg);
+                CONTINUE
+            }
+
+            for (int f = 2; f < argc; f++) {
+                fs_chattr(fat, fs_fd, command->commands[0][f], compressed);
+            }
+        } else if (strcmp(command->commands[0][0], "hd") == 0) { // hd [ -c ] [ -b ] [ -n BYTES ] [ -s OFFSET | -B BLOCK[-LAST] ]
+            int argc = get_argc(command->commands[0]);
+            if (argc > 9) {
+                fprintf(stderr, "expected 1-9 args, got %d instead\n", argc);
                 CONTINUE
             }
             if (!valid_fs_mounted(fs_fd)) CONTINUE
 
             bool display_chars = false; // display ascii if true, otherwise just hex
-            int display_bytes = -1; // -1 to display all, otherwise display first n bytes
+            long long display_bytes = -1; // -1 to display to the end of the range, otherwise display first n bytes
+            long long display_offset = 0; // where to start
             bool display_blocks = false; // display blocks next to address if true
+            int first_block = 0; // if not 0, display data blocks first_block through last_block
+            int last_block = 0;
             bool invalid_args = false;
             // parse arguments
-            for (int i = 1; i < argc; i++) {
-                if (strcmp(command->commands[0][i], "-c") == 0) {
+            for (int i = 1; i < argc && !invalid_args; i++) {
+                char* option = command->commands[0][i];
+                char* value = (i + 1 < argc) ? command->commands[0][i + 1] : NULL;
+                char* end = NULL;
+                if (strcmp(option, "-c") == 0) {
                     display_chars = true;
-                } else if (strcmp(command->commands[0][i], "-n") == 0) {
-                    if (i+1 < argc) {
-                        display_bytes = atoi(command->commands[0][i+1]);
-                        i++;
-                    } 
-                    if (display_bytes <= 0) {
+                } else if (strcmp(option, "-n") == 0) {
+                    if (value != NULL) display_bytes = strtoll(value, &end, 0);
+                    if (value == NULL || *end != '\0' || display_bytes <= 0) {
                         fprintf(stderr, "failed: -n requires a number of bytes\n");
                         invalid_args = true;
                     }
-                } else if (strcmp(command->commands[0][i], "-b") == 0) {
+                    i++;
+                } else if (strcmp(option, "-s") == 0) {
+                    if (value != NULL) display_offset = strtoll(value, &end, 0);
+                    if (value == NULL || *end != '\0' || display_offset < 0) {
+                        fprintf(stderr, "failed: -s requires an offset\n");
+                        invalid_args = true;
+                    }
+                    i++;
+                } else if (strcmp(option, "-B") == 0) {
+                    if (value != NULL) {
+                        first_block = (int) strtol(value, &end, 0);
+                        last_block = first_block;
+                        if (*end == '-') last_block = (int) strtol(end + 1, &end, 0);
+                    }
+                    if (value == NULL || *end != '\0' || first_block < 1 || last_block < first_block || last_block >= fs_n_blocks(fat)) {
+                        fprintf(stderr, "failed: -B requires a data block (or FIRST-LAST) within 1-%d\n", fs_n_blocks(fat) - 1);
+                        invalid_args = true;
+                    }
+                    i++;
+                } else if (strcmp(option, "-b") == 0) {
                     display_blocks = true;
                 } else {
-                    fprintf(stderr, "failed: unknown option:[%s]\n", argv[i]);
+                    fprintf(stderr, "failed: unknown option:[%s]\n", option);
                     invalid_args = true;
                 }
             }
             if (invalid_args) CONTINUE
-            // fprintf(stderr, "char:[%d] bytes:[%d]\n", display_chars, display_bytes); // DEBUG: show parsed args
-            
-            if (display_bytes == -1) display_bytes = safe_lseek(fs_fd, 0, SEEK_END); // read entire FS
-            char* buffer = safe_malloc(display_bytes);
-            safe_lseek(fs_fd, 0, SEEK_SET); // read from start
-            ssize_t bytes_read = safe_read(fs_fd, buffer, display_bytes);
-
-            for (size_t i = 0; i < bytes_read; i++) {
-                if (i % 16 == 0) {
-                    if (display_blocks) fprintf(stderr, "%08zx blk%04x:  ", i, (int) i/block_size);
-                    else fprintf(stderr, "%08zx:  ", i);
-                }
-                fprintf(stderr, "%02x ", (unsigned char) buffer[i]);
-                if (i % 8 == 7) fprintf(stderr, " ");
-                if (i % 16 == 15) {
-                    if (display_chars) {
-                        fprintf(stderr, "|");
-                        for (int j = i - 15; j <= i; j++) {
-                            if (buffer[j] >= 32 && buffer[j] <= 126) {
-                                fprintf(stderr, "%c", buffer[j]);
-                            } else {
-                                fprintf(stderr, ".");
-                            }
-                        }
-                        fprintf(stderr, "|");
-                    }
-                    fprintf(stderr, "\n");
-                }
-            }
-            int bytes_remaining = bytes_read % 16;
-            if (bytes_remaining != 0) { // last line
-                int spaces = 3 * (16 - bytes_remaining) + 1;
-                if (display_chars) {
-                    fprintf(stderr, "%*s|", spaces, "");
-                    for (size_t i = bytes_read - bytes_remaining; i < bytes_read; i++) {
-                        if (buffer[i] >= 32 && buffer[i] <= 126) {
-                            fprintf(stderr, "%c", buffer[i]);
-                        } else {
-                            fprintf(stderr, ".");
-                        }
-                    }
-                    fprintf(stderr, "|");
-                }
-                fprintf(stderr, "%*s", spaces, "");
+            if (first_block != 0 && display_offset != 0) {
+                fprintf(stderr, "failed: -s and -B can't be combined\n");
+                CONTINUE
             }
-            fprintf(stderr, "\n");
+            // fprintf(stderr, "char:[%d] bytes:[%lld]\n", display_chars, display_bytes); // DEBUG: show parsed args
 
-            free(buffer);
+            off_t image_size = safe_lseek(fs_fd, 0, SEEK_END);
+            off_t range_end = image_size;
+            if (first_block != 0) {
+                display_offset = mem_idx(fat, first_block);
+                range_end = mem_idx(fat, last_block) + fs_block_size(fat);
+            }
+            if (display_offset > range_end) display_offset = range_end;
+            off_t range_bytes = range_end - display_offset;
+            if (display_bytes == -1 || display_bytes > range_bytes) display_bytes = range_bytes;
+            hd_dump(fs_fd, display_offset, display_bytes, display_chars, display_blocks, fs_block_size(fat));
         } else {
 
         }
         free(command);
     }
 
-    fprintf(stderr, "%ld\n", (long)fat);
+    // end of the batch: one commit for everything it changed
+    clock_gettime(CLOCK_MONOTONIC, &command_start);
+    if (fs_fd != -1) fs_unmount(&fat, fs_fd);
+    fs_defer_sync(NULL, false);
+    batch_record("(commit)", elapsed_seconds(&command_start));
+    batch_summary(elapsed_seconds(&batch_start));
+    return EXIT_SUCCESS;
 }
\ No newline at end of file
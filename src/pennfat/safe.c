@@ -1,5 +1,8 @@
 // system call error handling
 
+#define _GNU_SOURCE // copy_file_range
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -102,6 +105,141 @@ off_t safe_lseek(int fd, off_t offset, int whence)
     return offset_loc;
 }
 
+/**
+ * Reads data at an offset from a file descriptor with error handling.
+ * @param fd The file descriptor to read from.
+ * @param buf The buffer to store the read data.
+ * @param count The number of bytes to read.
+ * @param offset The file offset to read from; the file pointer is not moved.
+ * @return Returns the number of bytes read if successful; otherwise, exits with an error message.
+ */
+ssize_t safe_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    ssize_t n_bytes = pread(fd, buf, count, offset);
+    if (n_bytes == -1)
+    {
+        perror("pread");
+        exit(EXIT_FAILURE);
+    }
+    return n_bytes;
+}
+
+/**
+ * Writes data at an offset to a file descriptor with error handling.
+ * @param fd The file descriptor to write to.
+ * @param buf The buffer containing the data to write.
+ * @param count The number of bytes to write; short writes are retried.
+ * @param offset The file offset to write to; the file pointer is not moved.
+ * @return None.
+ */
+void safe_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    const char *pos = buf;
+    while (count > 0)
+    {
+        ssize_t n_bytes = pwrite(fd, pos, count, offset);
+        if (n_bytes == -1)
+        {
+            perror("pwrite");
+            exit(EXIT_FAILURE);
+        }
+        pos += n_bytes;
+        offset += n_bytes;
+        count -= n_bytes;
+    }
+}
+
+/**
+ * Flushes the data of a file to disk with error handling.
+ * @param fd The file descriptor to flush.
+ * @return None.
+ */
+void safe_fdatasync(int fd)
+{
+    if (fdatasync(fd) == -1)
+    {
+        perror("fdatasync");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Sets the size of a file with error handling; growing a file leaves a hole.
+ * @param fd The file descriptor of the file.
+ * @param length The new size in bytes.
+ * @return None.
+ */
+void safe_ftruncate(int fd, off_t length)
+{
+    if (ftruncate(fd, length) == -1)
+    {
+        perror("ftruncate");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Copies a range between two files with error handling, inside the kernel when possible
+ * (copy_file_range); falls back to pread/pwrite if the files can't use it.
+ * @param in_fd The file descriptor to copy from.
+ * @param in_offset The offset of the range in the source.
+ * @param out_fd The file descriptor to copy to.
+ * @param out_offset The offset of the range in the destination.
+ * @param count The number of bytes to copy.
+ * @return The number of bytes copied; less than count only if the source ended early.
+ */
+size_t safe_copy_file_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t count)
+{
+    size_t copied = 0;
+    while (copied < count)
+    {
+        ssize_t n_bytes = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, count - copied, 0);
+        if (n_bytes == -1 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL))
+        {
+            break; // not supported between these files
+        }
+        if (n_bytes == -1)
+        {
+            perror("copy_file_range");
+            exit(EXIT_FAILURE);
+        }
+        if (n_bytes == 0)
+        {
+            return copied; // source ended early
+        }
+        copied += n_bytes;
+    }
+
+    char buffer[65536];
+    while (copied < count)
+    {
+        size_t chunk = (count - copied < sizeof(buffer)) ? count - copied : sizeof(buffer);
+        ssize_t n_bytes = safe_pread(in_fd, buffer, chunk, in_offset);
+        if (n_bytes == 0)
+        {
+            break;
+        }
+        safe_pwrite(out_fd, buffer, n_bytes, out_offset);
+        in_offset += n_bytes;
+        out_offset += n_bytes;
+        copied += n_bytes;
+    }
+    return copied;
+}
+
+/**
+ * Copies a range between two files with error handling, at the same offset in both.
+ * @param in_fd The file descriptor to copy from.
+ * @param out_fd The file descriptor to copy to.
+ * @param offset The offset of the range, in both files; file pointers are not moved.
+ * @param count The number of bytes to copy.
+ * @return None.
+ */
+void safe_copy_range(int in_fd, int out_fd, off_t offset, size_t count)
+{
+    safe_copy_file_range(in_fd, offset, out_fd, offset, count);
+}
+
 /**
  * Synchronizes changes to a file mapping with error handling.
  * @param addr The starting address of the file mapping.
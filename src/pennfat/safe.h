@@ -18,6 +18,24 @@ void safe_write(int, const void*, size_t);
 // error handling for lseek
 off_t safe_lseek(int fd, off_t offset, int whence);
 
+// error handling for pread
+ssize_t safe_pread(int fd, void *buf, size_t count, off_t offset);
+
+// error handling for pwrite; retries short writes
+void safe_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+// error handling for fdatasync
+void safe_fdatasync(int fd);
+
+// error handling for ftruncate
+void safe_ftruncate(int fd, off_t length);
+
+// error handling for copy_file_range; falls back to pread/pwrite; returns bytes copied
+size_t safe_copy_file_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t count);
+
+// safe_copy_file_range at the same offset in both files
+void safe_copy_range(int in_fd, int out_fd, off_t offset, size_t count);
+
 // error handling for msync
 void safe_msync(void *addr, size_t length, int flags);
 
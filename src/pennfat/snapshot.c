@@ -0,0 +1,328 @@
+// copy-on-write snapshots
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "checksum.h"
+#include "fat.h"
+#include "journal.h"
+#include "safe.h"
+#include "snapshot.h"
+#include "../util/util.h"
+
+typedef void (*snapshot_fn)(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, void* arg);
+
+static uint64_t* frozen = NULL; // shared-block bitmap: blocks allocated by some snapshot's frozen FAT
+static int n_frozen_bits = 0; // bits in `frozen`
+static char* image = NULL; // frozen superblock & FAT of the snapshot mounted read-only
+
+/**
+ * get the size of the frozen copy of the superblock & FAT
+ * @param fat filesystem (v2)
+ * @return size in bytes
+*/
+static size_t frozen_size(uint16_t* fat) {
+    superblock_t* sb = fs_superblock(fat);
+    return sb->fat_offset + (size_t) sb->block_count * sizeof(uint32_t);
+}
+
+/**
+ * get the 32-bit FAT of a frozen copy
+ * @param copy frozen superblock & FAT
+ * @return the first FAT entry (entry 0)
+*/
+static uint32_t* frozen_fat(char* copy) {
+    return (uint32_t*) (copy + ((superblock_t*) copy)->fat_offset);
+}
+
+/**
+ * call `fn` for every snapshot entry in the root directory
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param fn called with the location & entry of each snapshot
+ * @param arg passed to `fn`
+ * @return none
+*/
+static void for_each_snapshot(uint16_t* fat, int fs_fd, snapshot_fn fn, void* arg) {
+    int block_size = fs_block_size(fat);
+    char* dir_block = safe_malloc(block_size);
+    int curr_block = fs_root(fat);
+    while (curr_block != LASTBLOCK) {
+        read_dir_block(fat, fs_fd, curr_block, dir_block);
+        for (int i = 0; i < block_size / DIR_ENTRY_SIZE; i++) {
+            dir_entry_t entry;
+            memcpy(&entry, &dir_block[i * DIR_ENTRY_SIZE], DIR_ENTRY_SIZE);
+            if (entry.name[0] <= FILENAME_DEL_INUSE || entry.name[0] == FILENAME_INLINE) continue;
+            if (entry.type != FILETYPE_SNAPSHOT) continue;
+            fn(fat, fs_fd, (point_t) { curr_block, i }, &entry, arg);
+        }
+        curr_block = fat_get(fat, curr_block);
+    }
+    free(dir_block);
+}
+
+typedef struct snapshot_search { // argument of `match_snapshot`
+    const char* name;
+    bool found;
+    point_t location;
+    dir_entry_t entry;
+} snapshot_search_t;
+
+static void match_snapshot(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, void* arg) {
+    snapshot_search_t* search = arg;
+    if (search->found || strcmp(search->name, entry->name) != 0) return;
+    search->found = true;
+    search->location = location;
+    search->entry = *entry;
+}
+
+/**
+ * find a snapshot by name
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param name snapshot name
+ * @param search set to the location & entry of the snapshot, if found
+ * @return `true` if the snapshot exists
+*/
+static bool find_snapshot(uint16_t* fat, int fs_fd, const char* name, snapshot_search_t* search) {
+    memset(search, 0, sizeof(snapshot_search_t));
+    search->name = name;
+    for_each_snapshot(fat, fs_fd, match_snapshot, search);
+    return search->found;
+}
+
+/**
+ * read the frozen superblock & FAT of a snapshot
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param entry the snapshot's entry
+ * @return the frozen copy (`entry->size` bytes); the caller frees it
+*/
+static char* read_frozen(uint16_t* fat, int fs_fd, dir_entry_t* entry) {
+    char* copy = safe_malloc(entry->size);
+    read_chain(fat, fs_fd, entry_first_block(fat, entry), copy, entry->size);
+    return copy;
+}
+
+static void freeze_snapshot(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, void* arg) {
+    char* copy = read_frozen(fat, fs_fd, entry);
+    uint32_t* table = frozen_fat(copy);
+    int n_entries = ((superblock_t*) copy)->block_count;
+    for (int i = 1; i < n_entries && i < n_frozen_bits; i++) {
+        if (table[i] != 0) frozen[i / 64] |= 1ULL << (i % 64);
+    }
+    free(copy);
+}
+
+void snapshot_load(uint16_t* fat, int fs_fd) {
+    snapshot_unload();
+    if (fs_version(fat) == FS_VERSION_1) return;
+    n_frozen_bits = fs_n_blocks(fat);
+    frozen = calloc(n_frozen_bits / 64 + 1, sizeof(uint64_t));
+    if (frozen == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for_each_snapshot(fat, fs_fd, freeze_snapshot, NULL);
+}
+
+void snapshot_unload() {
+    free(frozen);
+    frozen = NULL;
+    n_frozen_bits = 0;
+}
+
+bool snapshot_frozen(int block) {
+    if (frozen == NULL || block < 0 || block >= n_frozen_bits) return false;
+    return (frozen[block / 64] >> (block % 64)) & 1;
+}
+
+bool snapshot_cow(uint16_t* fat, int fs_fd, dir_entry_t* entry, int idx) {
+    int prev = 0; // `0` while `curr` is the first block
+    int curr = entry_first_block(fat, entry);
+    for (int i = 0; i < idx && curr != LASTBLOCK; i++) {
+        prev = curr;
+        curr = fat_get(fat, curr);
+    }
+    if (curr == LASTBLOCK || !snapshot_frozen(curr)) return true;
+
+    int copy = get_free_block_near(fat, (prev == 0) ? curr : prev + 1); // keep the chain in order where possible
+    if (copy == 0) return false; // full
+    int block_size = fs_block_size(fat);
+    char* buffer = safe_malloc(block_size);
+    safe_pread(fs_fd, buffer, block_size, mem_idx(fat, curr));
+    safe_pwrite(fs_fd, buffer, block_size, mem_idx(fat, copy));
+    checksum_update(copy, buffer, block_size);
+    free(buffer);
+
+    fat_set(fat, copy, fat_get(fat, curr));
+    if (prev == 0) entry_set_first_block(fat, entry, copy);
+    else fat_set(fat, prev, copy);
+    fat_set(fat, curr, 0); // the snapshot still holds it, so it isn't reused or counted as free
+    fat_sync(fat);
+    return true;
+}
+
+bool snapshot_create(uint16_t* fat, int fs_fd, const char* name) {
+    snapshot_search_t search;
+    if (find_snapshot(fat, fs_fd, name, &search)) return false;
+
+    journal_begin();
+    int block_size = fs_block_size(fat);
+    size_t copy_size = frozen_size(fat);
+    int n_fat_blocks = (copy_size + block_size - 1) / block_size;
+    int n_dir_blocks = 0;
+    for (int b = fs_root(fat); b != LASTBLOCK; b = fat_get(fat, b)) n_dir_blocks++;
+
+    // allocate the snapshot's chain: frozen FAT blocks, then root directory copies
+    int n_blocks = n_fat_blocks + n_dir_blocks;
+    int* blocks = safe_malloc(n_blocks * sizeof(int));
+    for (int i = 0; i < n_blocks; i++) {
+        blocks[i] = get_free_block(fat);
+        if (blocks[i] == 0) { // full; give back what was allocated
+            if (i > 0) delete_chain(fat, blocks[0]);
+            free(blocks);
+            journal_end(fat);
+            return false;
+        }
+        fat_set(fat, blocks[i], LASTBLOCK);
+        if (i > 0) fat_set(fat, blocks[i - 1], blocks[i]);
+    }
+
+    // copy the root directory, leaving out snapshots & deleted files
+    char* dir_block = safe_malloc(block_size);
+    int curr_block = fs_root(fat);
+    for (int i = 0; i < n_dir_blocks; i++) {
+        read_dir_block(fat, fs_fd, curr_block, dir_block);
+        bool dropped = false; // continuation slots of a dropped inline file go with it
+        for (int e = 0; e < block_size / DIR_ENTRY_SIZE; e++) {
+            dir_entry_t* entry = (dir_entry_t*) &dir_block[e * DIR_ENTRY_SIZE];
+            if (entry->name[0] == FILENAME_INLINE) {
+                if (dropped) entry->name[0] = FILENAME_DEL_UNUSED;
+                continue;
+            }
+            dropped = (entry->name[0] == FILENAME_DEL_INUSE || (entry->name[0] > FILENAME_DEL_INUSE && entry->type == FILETYPE_SNAPSHOT));
+            if (dropped) entry->name[0] = FILENAME_DEL_UNUSED;
+        }
+        safe_pwrite(fs_fd, dir_block, block_size, mem_idx(fat, blocks[n_fat_blocks + i]));
+        curr_block = fat_get(fat, curr_block);
+    }
+    free(dir_block);
+
+    // freeze the FAT: the copied directory replaces the root, and the live root
+    // & the snapshot's own FAT blocks belong to the live filesystem only
+    char* copy = calloc(n_fat_blocks, block_size);
+    if (copy == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, fat, copy_size);
+    superblock_t* copy_sb = (superblock_t*) copy;
+    uint32_t* table = frozen_fat(copy);
+    for (int b = fs_root(fat); b != LASTBLOCK; b = fat_get(fat, b)) table[b] = 0;
+    for (int i = 0; i < n_fat_blocks; i++) table[blocks[i]] = 0;
+    for (int i = n_fat_blocks; i < n_blocks; i++) {
+        table[blocks[i]] = (i + 1 < n_blocks) ? blocks[i + 1] : (uint32_t) LASTBLOCK;
+    }
+    copy_sb->root_dir = blocks[n_fat_blocks];
+    copy_sb->features &= ~FEATURE_JOURNAL; // mounted read-only, never journaled
+    copy_sb->features &= ~FEATURE_CHECKSUM; // the table isn't frozen; reads of a snapshot aren't verified
+    for (int i = 0; i < n_fat_blocks; i++) {
+        safe_pwrite(fs_fd, &copy[i * block_size], block_size, mem_idx(fat, blocks[i]));
+    }
+    safe_fdatasync(fs_fd); // the snapshot's blocks are on disk before its entry is committed
+
+    for (int i = 1; i < copy_sb->block_count && i < n_frozen_bits; i++) {
+        if (table[i] != 0) frozen[i / 64] |= 1ULL << (i % 64);
+    }
+    free(copy);
+
+    // add the (hidden) snapshot entry
+    point_t location;
+    dir_entry_t entry;
+    add_file(fat, fs_fd, fs_root(fat), name);
+    find_file(fat, fs_fd, fs_root(fat), name, &location, &entry);
+    entry.type = FILETYPE_SNAPSHOT;
+    entry.perm = FILEPERM_RD;
+    entry.size = copy_size;
+    entry_set_first_block(fat, &entry, blocks[0]);
+    write_file(fat, fs_fd, location, entry);
+    free(blocks);
+
+    journal_end(fat);
+    fs_sync(fat);
+    return true;
+}
+
+bool snapshot_delete(uint16_t* fat, int fs_fd, const char* name) {
+    snapshot_search_t search;
+    if (!find_snapshot(fat, fs_fd, name, &search)) return false;
+
+    journal_begin();
+    delete_chain(fat, entry_first_block(fat, &search.entry));
+    search.entry.name[0] = FILENAME_DEL_UNUSED;
+    write_file(fat, fs_fd, search.location, search.entry);
+    journal_end(fat);
+    fs_sync(fat);
+
+    snapshot_load(fat, fs_fd); // blocks only this snapshot held are free again
+    fs_recount_free(fat);
+    return true;
+}
+
+static void print_snapshot(uint16_t* fat, int fs_fd, point_t location, dir_entry_t* entry, void* arg) {
+    char* copy = read_frozen(fat, fs_fd, entry);
+    uint32_t* table = frozen_fat(copy);
+    int n_entries = ((superblock_t*) copy)->block_count;
+    int n_held = 0; // blocks the snapshot still references
+    int n_private = 0; // of those, blocks the live filesystem no longer uses
+    for (int i = 1; i < n_entries; i++) {
+        if (table[i] == 0) continue;
+        n_held++;
+        if (fat_get(fat, i) == 0) n_private++;
+    }
+    free(copy);
+
+    char* time_str = ctime(&entry->mtime);
+    time_str[strlen(time_str)-1] = '\0'; // delete '\n'
+    fprintf(stderr, "%s %d blocks (%d not shared with the live filesystem) %s\n",
+            time_str, n_held, n_private, entry->name);
+}
+
+void snapshot_list(uint16_t* fat, int fs_fd) {
+    for_each_snapshot(fat, fs_fd, print_snapshot, NULL);
+}
+
+int snapshot_mount(char* fs_name, uint16_t** fat, const char* name) {
+    int fs_fd = fs_mount(fs_name, fat);
+    snapshot_search_t search;
+    if (fs_version(*fat) == FS_VERSION_1 || !find_snapshot(*fat, fs_fd, name, &search)) {
+        fs_unmount(fat, fs_fd);
+        return -1;
+    }
+    char* copy = read_frozen(*fat, fs_fd, &search.entry);
+
+    // release the live filesystem but keep the image open
+    if (journal_active()) journal_unmount(*fat);
+    snapshot_unload();
+    checksum_detach(*fat);
+    safe_munmap(*fat, fs_meta_size(*fat));
+
+    image = copy;
+    *fat = (uint16_t*) image;
+    return fs_fd;
+}
+
+bool snapshot_mounted(uint16_t* fat) {
+    return image != NULL && fat == (uint16_t*) image;
+}
+
+void snapshot_unmount() {
+    free(image);
+    image = NULL;
+}
@@ -0,0 +1,95 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fat.h"
+
+#pragma once
+
+// copy-on-write snapshot interface (v2 filesystems)
+//
+// A snapshot is a root directory entry of type `FILETYPE_SNAPSHOT` (hidden from `ls`
+// & `find_file`) whose chain holds a frozen copy of the superblock & FAT, followed by
+// a copy of the root directory blocks. File data isn't copied: every block the frozen
+// FAT allocates is shared, and the allocator never hands out a shared block, so later
+// writes go to new blocks. In-place data writes (appending into a partially filled
+// block, & `fs_pwrite` inside a chain) copy the block first (`snapshot_cow`).
+
+/**
+ * build the shared-block bitmap from every snapshot of a mounted filesystem (called by `fs_mount`)
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @return none
+*/
+void snapshot_load(uint16_t* fat, int fs_fd);
+
+/**
+ * drop the shared-block bitmap (called by `fs_unmount`)
+ * @return none
+*/
+void snapshot_unload();
+
+/**
+ * check whether a block is held by a snapshot
+ * @param block block index
+ * @return `true` if some snapshot's frozen FAT allocates `block`
+*/
+bool snapshot_frozen(int block);
+
+/**
+ * make sure a block of a file can be written in place: if it is shared with a snapshot,
+ * replace it in the chain with a private copy
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param entry the file's directory entry; its first block is updated if block 0 is copied
+ * @param idx position of the block in the chain (`0` for the first block)
+ * @return `true` if the block can be written in place, `false` if it is shared & the filesystem is full
+*/
+bool snapshot_cow(uint16_t* fat, int fs_fd, dir_entry_t* entry, int idx);
+
+/**
+ * snapshot the FAT & root directory; O(FAT size), no file data is copied
+ * @param fat filesystem (v2)
+ * @param fs_fd filesystem file descriptor
+ * @param name snapshot name
+ * @return `true` on success, `false` if the name is taken or the filesystem is full
+*/
+bool snapshot_create(uint16_t* fat, int fs_fd, const char* name);
+
+/**
+ * delete a snapshot & release the blocks only it was holding
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @param name snapshot name
+ * @return `true` on success, `false` if there is no such snapshot
+*/
+bool snapshot_delete(uint16_t* fat, int fs_fd, const char* name);
+
+/**
+ * list the snapshots of a mounted filesystem
+ * @param fat filesystem
+ * @param fs_fd filesystem file descriptor
+ * @return none
+*/
+void snapshot_list(uint16_t* fat, int fs_fd);
+
+/**
+ * mount a snapshot read-only; its frozen FAT replaces the filesystem's
+ * @param fs_name filesystem filename
+ * @param fat set to the snapshot's filesystem
+ * @param name snapshot name
+ * @return the filesystem file descriptor (`fs_fd`), or `-1` if there is no such snapshot
+*/
+int snapshot_mount(char* fs_name, uint16_t** fat, const char* name);
+
+/**
+ * check whether a mounted filesystem is a (read-only) snapshot
+ * @param fat filesystem
+ * @return `true` if `fat` was mounted by `snapshot_mount`
+*/
+bool snapshot_mounted(uint16_t* fat);
+
+/**
+ * release a snapshot mounted by `snapshot_mount` (called by `fs_unmount`)
+ * @return none
+*/
+void snapshot_unmount();
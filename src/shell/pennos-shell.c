@@ -9,6 +9,8 @@
 #include "../filesystem/filesystem.h"
 #include "../kernel/puser-functions.h"
 #include "../kernel/stress.h"
+#include "../kernel/shm.h"
+#include "../kernel/mq.h"
 #include "../logger/logger.h"
 #include "job-list.h"
 
@@ -28,10 +30,16 @@ mv SRC DEST\n\
 cp SRC DEST\n\
 rm FILE ...\n\
 chmod FILE PERM\n\
+defrag\n\
 ps\n\
 kill [ -SIGNAL_NAME ] PID ...\n\
 zombify\n\
 orphanify\n\
+shmpass [ KILOBYTES ]\n\
+lockcount [ PROCESSES ]\n\
+mqpass [ MESSAGES ]\n\
+\n\
+COMMAND | COMMAND ...    (stages run at once, connected by pipes)\n\
 \n\
 --- Shell subroutines ---\n\
 nice PRIORITY COMMAND [ ARG ]\n\
@@ -62,6 +70,11 @@ void stop_handler(int signal) {
     safe_p_kill(foreground_job->pid, S_SIGSTOP);
 }
 
+bool jobs_changed = true; // whether a child exited, stopped, or continued since bg jobs were last culled
+void child_handler(int signal) { // S_SIGCHLD, coalesced by the kernel over any number of changes
+    jobs_changed = true;
+}
+
 void term_handler(int signal) {
     if (foreground_job == NULL) return;
     safe_f_print("terminated ");
@@ -71,16 +84,28 @@ void term_handler(int signal) {
 }
 
 
+// copy `fd` to F_STDOUT a buffer at a time until EOF, so that pipes & files of any size stream through
+void cat_fd(int fd) {
+    char buffer[IOBUFFER_SIZE+1];
+    int bytes_read;
+    while ((bytes_read = safe_f_read(fd, IOBUFFER_SIZE, buffer)) > 0) {
+        if (safe_f_write(F_STDOUT, buffer, bytes_read) == -1) return;
+    }
+}
+
 void shell_cat(int argc, char* argv[]) {
-    char buffer[IOBUFFER_SIZE+1]; // for simplicity, we assume no file has more than 10001 bytes
     if (argc == 1) { // read from stdin
-        int bytes_read = safe_f_read(F_STDIN, IOBUFFER_SIZE, buffer);
-        safe_f_write(F_STDOUT, buffer, bytes_read);
+        if (f_isatty(F_STDIN)) { // the terminal has no EOF, so copy one line
+            char buffer[IOBUFFER_SIZE+1];
+            int bytes_read = safe_f_read(F_STDIN, IOBUFFER_SIZE, buffer);
+            safe_f_write(F_STDOUT, buffer, bytes_read);
+        } else { // a file or a pipe
+            cat_fd(F_STDIN);
+        }
     } else { // read from filenames in argv
         for (int i = 1; i < argc; i++) {
             int fd = safe_f_open(argv[i], F_READ);
-            int bytes_read = safe_f_read(fd, IOBUFFER_SIZE, buffer); // for simplicity, we assume no file has more than 10001 bytes
-            safe_f_write(F_STDOUT, buffer, bytes_read);
+            cat_fd(fd);
             safe_f_close(fd);
         }
     }
@@ -155,7 +180,9 @@ void shell_mv(int argc, char* argv[]) {
 
 void shell_cp(int argc, char* argv[]) {
     if (argc == 3) {
-        f_cp(argv[1], argv[2]);
+        f_cp(argv[1], argv[2], false);
+    } else if (argc == 4 && strcmp(argv[1], "-s") == 0) { // share blocks copy-on-write
+        f_cp(argv[2], argv[3], true);
     } else {
         char buffer[ERRBUFFER_SIZE];
         snprintf(buffer, ERRBUFFER_SIZE, "cp expected 2 args but got:[%d]\n", argc - 1);
@@ -191,6 +218,17 @@ void shell_chmod(int argc, char* argv[]) {
     p_exit();
 }
 
+void shell_defrag(int argc, char* argv[]) {
+    if (argc == 1) {
+        f_defrag();
+    } else {
+        char buffer[ERRBUFFER_SIZE];
+        snprintf(buffer, ERRBUFFER_SIZE, "defrag expected no args but got:[%d]\n", argc - 1);
+        safe_f_print(buffer);
+    }
+    p_exit();
+}
+
 void shell_ps(int argc, char* argv[]) {
     char buffer[ERRBUFFER_SIZE];
     PCB* curr = pcb_list; // TODO: make p_ps for abstraction
@@ -226,6 +264,156 @@ void shell_kill(int argc, char* argv[]) {
     p_exit();
 }
 
+// consumer of shmpass: attaches to the producer's region by name, reads it in place, & leaves
+// its result in the last word of the region
+void shmpass_reader(int argc, char* argv[]) {
+    size_t size;
+    unsigned char* data = safe_p_shm_attach(argv[1], &size);
+    if (data == NULL) return;
+    size_t n_bytes = size - sizeof(unsigned long);
+    unsigned long sum = 0;
+    for (size_t i = 0; i < n_bytes; i++) sum += data[i];
+    memcpy(&data[n_bytes], &sum, sizeof(sum));
+    safe_p_shm_detach(data);
+    p_exit();
+}
+
+// producer/consumer demo: fill a shared region & hand it to a child by name, without a copy
+void shell_shmpass(int argc, char* argv[]) {
+    int kilobytes = (argc >= 2) ? atoi(argv[1]) : 1024;
+    size_t n_bytes = (size_t) kilobytes * 1024;
+    char name[SHM_NAME_SIZE];
+    snprintf(name, SHM_NAME_SIZE, "shmpass_%d", current_pcb->pid);
+    unsigned char* data = safe_p_shm_create(name, n_bytes + sizeof(unsigned long));
+    if (data == NULL) return;
+    for (size_t i = 0; i < n_bytes; i++) data[i] = i % 251;
+
+    char* reader_argv[] = { "shmpass_reader", name, NULL };
+    int pid = safe_p_spawn(shmpass_reader, reader_argv, F_STDIN, F_STDOUT);
+    while (p_waitpid(pid, NULL, false) == 0) {} // stay attached until the reader is done
+
+    unsigned long sum;
+    memcpy(&sum, &data[n_bytes], sizeof(sum));
+    char buffer[ERRBUFFER_SIZE];
+    snprintf(buffer, ERRBUFFER_SIZE, "passed %zu bytes through shared memory, reader's sum %lu\n", n_bytes, sum);
+    safe_f_write(F_STDOUT, buffer, strlen(buffer));
+    safe_p_shm_detach(data); // the region is freed with the last detach
+    p_exit();
+}
+
+#define MQPASS_BATCH 16 // messages moved per send or receive call
+
+// consumer of mqpass: opens the producer's queue by name & receives records in batches until the
+// empty end marker, then sends back its sum & how many receive calls it made
+void mqpass_reader(int argc, char* argv[]) {
+    int fd = safe_p_mq_open(argv[1], 0, 0);
+    if (fd == -1) return;
+    long records[MQPASS_BATCH][2]; // room for the queue's message size
+    mq_msg_t msgs[MQPASS_BATCH];
+    long result[2] = { 0, 0 }; // sum, receive calls
+    bool done = false;
+    while (!done) {
+        for (int i = 0; i < MQPASS_BATCH; i++) msgs[i] = (mq_msg_t) { records[i], sizeof(records[i]), 0 };
+        int n = safe_p_mq_recv_batch(fd, msgs, MQPASS_BATCH);
+        result[1]++;
+        for (int i = 0; i < n; i++) {
+            if (msgs[i].len == 0) done = true;
+            else result[0] += records[i][0];
+        }
+    }
+    safe_p_mq_send(fd, result, sizeof(result), 0);
+    safe_f_close(fd);
+    p_exit();
+}
+
+// producer/consumer demo: send numbered records to a child through a bounded message queue
+void shell_mqpass(int argc, char* argv[]) {
+    int n_msgs = (argc >= 2) ? atoi(argv[1]) : 10000;
+    char name[MQ_NAME_SIZE];
+    snprintf(name, MQ_NAME_SIZE, "mqpass_%d", current_pcb->pid);
+    int fd = safe_p_mq_open(name, 4 * MQPASS_BATCH, 2 * sizeof(long));
+    if (fd == -1) return;
+
+    char* reader_argv[] = { "mqpass_reader", name, NULL };
+    int pid = safe_p_spawn(mqpass_reader, reader_argv, F_STDIN, F_STDOUT);
+    long records[MQPASS_BATCH];
+    mq_msg_t msgs[MQPASS_BATCH];
+    for (int sent = 0; sent < n_msgs; ) {
+        int n = 0;
+        for (; n < MQPASS_BATCH && sent < n_msgs; n++, sent++) {
+            records[n] = sent;
+            msgs[n] = (mq_msg_t) { &records[n], sizeof(long), 0 };
+        }
+        safe_p_mq_send_batch(fd, msgs, n);
+    }
+    safe_p_mq_send(fd, NULL, 0, 0); // end marker
+    while (p_waitpid(pid, NULL, false) == 0) {} // the queue then holds only the reader's result
+
+    long result[2];
+    safe_p_mq_recv(fd, result, sizeof(result), NULL);
+    char buffer[ERRBUFFER_SIZE];
+    snprintf(buffer, ERRBUFFER_SIZE, "passed %d messages through a message queue in %ld receive calls, reader's sum %ld\n",
+        n_msgs, result[1], result[0]);
+    safe_f_write(F_STDOUT, buffer, strlen(buffer));
+    safe_f_close(fd); // the queue is freed with its last fd
+    p_exit();
+}
+
+#define LOCKCOUNT_ROUNDS 200
+
+typedef struct lockcount { // shared by lockcount & its workers
+    mutex_t lock; // protects `counter`
+    semaphore_t done; // posted by each worker when it finishes
+    long counter;
+} lockcount_t;
+
+// worker of lockcount: increments the shared counter under the mutex, slowly enough that it is
+// often preempted while holding it
+void lockcount_worker(int argc, char* argv[]) {
+    lockcount_t* shared = safe_p_shm_attach(argv[1], NULL);
+    if (shared == NULL) return;
+    for (int i = 0; i < LOCKCOUNT_ROUNDS; i++) {
+        safe_p_mutex_lock(&shared->lock);
+        long value = shared->counter;
+        for (volatile int spin = 0; spin < 100000; spin++) {}
+        shared->counter = value + 1;
+        safe_p_mutex_unlock(&shared->lock);
+    }
+    p_sem_post(&shared->done);
+    safe_p_shm_detach(shared);
+    p_exit();
+}
+
+// mutex/semaphore demo: workers contend for one counter; waiters are blocked rather than spinning
+void shell_lockcount(int argc, char* argv[]) {
+    int n_workers = (argc >= 2) ? atoi(argv[1]) : 4;
+    if (n_workers < 1) n_workers = 1;
+    char name[SHM_NAME_SIZE];
+    snprintf(name, SHM_NAME_SIZE, "lockcount_%d", current_pcb->pid);
+    lockcount_t* shared = safe_p_shm_create(name, sizeof(lockcount_t));
+    if (shared == NULL) return;
+    p_mutex_init(&shared->lock);
+    p_sem_init(&shared->done, 0);
+
+    char* worker_argv[] = { "lockcount_worker", name, NULL };
+    int* pids = malloc(n_workers * sizeof(int));
+    for (int i = 0; i < n_workers; i++) {
+        pids[i] = safe_p_spawn(lockcount_worker, worker_argv, F_STDIN, F_STDOUT);
+    }
+    for (int i = 0; i < n_workers; i++) p_sem_wait(&shared->done);
+    for (int i = 0; i < n_workers; i++) {
+        while (p_waitpid(pids[i], NULL, false) == 0) {}
+    }
+    free(pids);
+
+    char buffer[ERRBUFFER_SIZE];
+    snprintf(buffer, ERRBUFFER_SIZE, "%d workers counted to %ld (expected %d)\n",
+        n_workers, shared->counter, n_workers * LOCKCOUNT_ROUNDS);
+    safe_f_write(F_STDOUT, buffer, strlen(buffer));
+    safe_p_shm_detach(shared);
+    p_exit();
+}
+
 void zombie_child() {
    p_exit();
 }
@@ -281,8 +469,10 @@ void cull_helper(job_t* job) {
     }
 }
 
-// cull bg processes
+// cull bg processes, if any child changed state since the last cull
 void cull_background() {
+    if (!jobs_changed) return;
+    jobs_changed = false; // before culling, so that changes during the cull are seen next time
     cull_helper(*background);
 }
 
@@ -341,12 +531,26 @@ int spawn_command(char* command[], int in_fd, int out_fd) {
     else if (strcmp(command[0], "chmod") == 0) { // similar to chmod(1) in the VM
         return safe_p_spawn(shell_chmod, command, in_fd, out_fd);
     } 
+    else if (strcmp(command[0], "defrag") == 0) { // defragment the filesystem; runs at the lowest priority (start it with `&`)
+        int pid = safe_p_spawn(shell_defrag, command, in_fd, out_fd);
+        safe_p_nice(pid, 1);
+        return pid;
+    }
     else if (strcmp(command[0], "ps") == 0) { // list all processes on PennOS. Display pid, ppid, and priority.
         return safe_p_spawn(shell_ps, command, in_fd, out_fd);
     } 
     else if (strcmp(command[0], "kill") == 0) { // send specified signal or kill to the processes
         return safe_p_spawn(shell_kill, command, in_fd, out_fd);
     } 
+    else if (strcmp(command[0], "shmpass") == 0) { // pass a buffer to a child through shared memory
+        return safe_p_spawn(shell_shmpass, command, in_fd, out_fd);
+    }
+    else if (strcmp(command[0], "mqpass") == 0) { // pass records to a child through a message queue
+        return safe_p_spawn(shell_mqpass, command, in_fd, out_fd);
+    }
+    else if (strcmp(command[0], "lockcount") == 0) { // count with contending processes under a mutex
+        return safe_p_spawn(shell_lockcount, command, in_fd, out_fd);
+    }
     else if (strcmp(command[0], "zombify") == 0) { // execute the following code or its equivalent in your API using safe_p_spawn:
         return safe_p_spawn(shell_zombify, command, in_fd, out_fd);
     } 
@@ -379,17 +583,63 @@ int spawn_command(char* command[], int in_fd, int out_fd) {
 int execute_command(char* command[], const char* in_filename, const char* out_filename, bool append_mode) {
     int in_fd = F_STDIN;
     int out_fd = F_STDOUT;
-    // print_fileptr_pids_all();
+    // print_open_files();
     if (in_filename != NULL) in_fd = safe_f_open(in_filename, F_READ);
     if (out_filename != NULL) {
         if (append_mode) out_fd = safe_f_open(out_filename, F_APPEND);
         else out_fd = safe_f_open(out_filename, F_WRITE);
     }
-    // print_fileptr_pids_all();
+    // print_open_files();
 
     // printf("%d\n", in_fd);
 
-    return spawn_command(command, in_fd, out_fd);
+    int pid = spawn_command(command, in_fd, out_fd);
+    if (in_fd != F_STDIN) f_close(in_fd); // the child has its own descriptions of the files
+    if (out_fd != F_STDOUT) f_close(out_fd);
+    return pid;
+}
+
+/**
+ * start the stages of a pipeline (`cmd1 | cmd2 | ...`) as concurrent pennOS processes & return the
+ * pid of the last one; each stage writes to a pipe that the next stage reads, so the data is
+ * streamed between them without going through the file system; does not wait for the processes
+ * @param command the parsed pipeline; its input & output files are used by the first & last stages
+ * @param pids set to the pid of each stage, or `-1` for a stage that is not a recognized command
+ * (its neighbours see EOF or a closed pipe)
+ * @return the pid of the last stage that was spawned, or `-1` if none was
+*/
+int execute_pipeline(struct parsed_command* command, int pids[]) {
+    int n_stages = command->num_commands;
+    int in_fd = F_STDIN;
+    if (command->stdin_file != NULL) in_fd = safe_f_open(command->stdin_file, F_READ);
+
+    int last_pid = -1;
+    for (int i = 0; i < n_stages; i++) {
+        int fds[2] = { F_STDIN, F_STDOUT }; // pipe to the next stage
+        int out_fd = F_STDOUT;
+        if (i < n_stages - 1) {
+            safe_p_pipe(fds);
+            out_fd = fds[1];
+        } else if (command->stdout_file != NULL) {
+            if (command->is_file_append) out_fd = safe_f_open(command->stdout_file, F_APPEND);
+            else out_fd = safe_f_open(command->stdout_file, F_WRITE);
+        }
+
+        pids[i] = spawn_command(command->commands[i], in_fd, out_fd);
+        if (pids[i] == -1) {
+            safe_f_print("invalid command in pipeline: ");
+            safe_f_print(command->commands[i][0]);
+            safe_f_print("\n");
+        } else {
+            last_pid = pids[i];
+        }
+        // the stages keep their own references to the pipe ends; the shell must let go of
+        // its own for the readers to see EOF
+        if (in_fd != F_STDIN) f_close(in_fd);
+        if (out_fd != F_STDOUT) f_close(out_fd);
+        in_fd = fds[0];
+    }
+    return last_pid;
 }
 
 int execute_script(char* command_in[], const char* in_filename, const char* out_filename, bool append_mode) {
@@ -438,6 +688,9 @@ int execute_script(char* command_in[], const char* in_filename, const char* out_
         token = strtok(NULL, "\n");
     }
     free(command);
+    if (in_fd != F_STDIN) f_close(in_fd);
+    if (out_fd != F_STDOUT) f_close(out_fd);
+    f_close(script_fd);
     safe_f_print("\n");
     return 0;
 }
@@ -445,9 +698,11 @@ int execute_script(char* command_in[], const char* in_filename, const char* out_
 
 void pennos_shell(int argc, char* argv[]) {
     char line[IOBUFFER_SIZE]; // buffer for read
+    safe_p_signal(S_SIGCHLD, child_handler);
 
     while (1) {
-        // prompt & get input
+        // prompt & get input; whatever the last command changed is made durable first
+        f_sync();
         safe_f_print("$ ");
         int n_bytes = safe_f_read(STDIN_FILENO, IOBUFFER_SIZE, line);
 
@@ -612,11 +867,19 @@ void pennos_shell(int argc, char* argv[]) {
             const char* in_file = command->stdin_file;
             const char* out_file = command->stdout_file;
             bool append_mode = command->is_file_append;
-            int pid = execute_command(command->commands[0], in_file, out_file, append_mode);
+            int n_stages = command->num_commands;
+            int stage_pids[n_stages];
+            int pid;
+            if (n_stages > 1) { // pipeline: all stages run at once
+                pid = execute_pipeline(command, stage_pids);
+            } else {
+                pid = execute_command(command->commands[0], in_file, out_file, append_mode);
+                stage_pids[0] = pid;
+            }
 
             cull_background();
             if (pid == -1) { // not a recognized command
-                if (command_argc == 1) {
+                if (n_stages == 1 && command_argc == 1) {
                     execute_script(command->commands[0], in_file, out_file, append_mode);
                 }
                 empty_reaped();
@@ -629,9 +892,18 @@ void pennos_shell(int argc, char* argv[]) {
             if (!command->is_background) { // create fg process
                 jobs_push(&foreground_job, jobid_ctr++, pid, NOT_STOPPED);
                 int status;
-                safe_p_waitpid(pid, &status, false);
-            } else { // add bg process
-                jobs_push(background, jobid_ctr++, pid, stop_order++);
+                if (n_stages == 1) {
+                    safe_p_waitpid(pid, &status, false);
+                } else { // reap every stage; waits also return when another stage exits
+                    for (int i = 0; i < n_stages; i++) {
+                        if (stage_pids[i] == -1) continue;
+                        while (!stop_trigger && safe_p_waitpid(stage_pids[i], &status, false) == 0) {}
+                    }
+                }
+            } else { // add bg process, one job per stage of a pipeline
+                for (int i = 0; i < n_stages; i++) {
+                    if (stage_pids[i] != -1) jobs_push(background, jobid_ctr++, stage_pids[i], stop_order++);
+                }
             }
             debug_print_jobs();
 
@@ -12,7 +12,13 @@ extern uint16_t* fat; // FAT
 #define S_SIGSTOP 123 /* a thread receiving this signal should be stopped */
 #define S_SIGCONT 456 /* a thread receiving this signal should be continued */
 #define S_SIGTERM 789 /* a thread receiving this signal should be terminated */
-#define S_SIGCHLD 812 /* a thread receiving this signal should be terminated */
+#define S_SIGCHLD 812 /* a thread receiving this signal has a child that exited, stopped, or continued */
+#define S_SIGALRM 345 /* a thread receiving this signal has a timer (`p_alarm`/`p_setitimer`) that expired */
+#define S_NSIG    5   /* number of kernel signals */
+
+// bit of a kernel signal in the masks of `p_sigprocmask`, or 0 if `sig` isn't a kernel signal
+#define S_BIT(sig) ((sig) == S_SIGSTOP ? 0x01 : (sig) == S_SIGCONT ? 0x02 : (sig) == S_SIGTERM ? 0x04 : \
+                    (sig) == S_SIGCHLD ? 0x08 : (sig) == S_SIGALRM ? 0x10 : 0)
 
 // thread states
 #define T_RUNNING 111
@@ -16,21 +16,66 @@ char* err_string(int errno) {
     switch (errno) {
         case ERR_NONE                       : return "no error"; break;
         case ERR_FS_FILE_NOT_FOUND          : return "file does not exist"; break;
+        case ERR_FS_PIPE                    : return "not supported on a pipe"; break;
+        case ERR_FS_PIPE_END                : return "wrong end of the pipe for this operation"; break;
+        case ERR_FS_MQ                      : return "not supported on a message queue"; break;
+        case ERR_FS_CHILD_FD                : return "not supported on a child exit fd"; break;
         case ERR_F_OPEN_INVALID_PERMS       : return "permission denied"; break;
         case ERR_F_OPEN_WRITE_INUSE         : return "another process has write access"; break;
         case ERR_F_OPEN_CREATE_READ         : return "cannot create a file in read mode"; break;
         case ERR_F_OPEN_INVALID_MODE        : return "unknown mode (must be F_WRITE, F_READ, or F_APPEND)"; break;
+        case ERR_F_OPEN_NO_FDS              : return "too many open files in the process"; break;
         case ERR_F_READ_TERM_OUT            : return "cannot read from terminal output (F_STDOUT/F_STDERR)"; break;
+        case ERR_F_READ_CHECKSUM            : return "file data failed its checksum"; break;
         case ERR_F_WRITE_TERM_IN            : return "cannot write to terminal input (F_STDIN)"; break;
         case ERR_F_WRITE_RONLY              : return "current process does not have write access"; break;
+        case ERR_F_WRITE_PIPE_CLOSED        : return "pipe has no readers"; break;
+        case ERR_F_WRITE_NOSPACE            : return "not enough free space in the file system"; break;
         case ERR_F_LSEEK_TERMINAL           : return "cannot seek in a terminal file descriptor"; break;
         case ERR_F_LSEEK_OOB                : return "offset puts file pointer out of bounds"; break;
+        case ERR_F_FALLOCATE_TERMINAL       : return "cannot allocate space for a terminal file descriptor"; break;
+        case ERR_F_FALLOCATE_INVALID        : return "invalid offset or length"; break;
+        case ERR_F_FALLOCATE_RONLY          : return "current process does not have write access"; break;
+        case ERR_F_FALLOCATE_NOSPACE        : return "not enough free space in the file system"; break;
+        case ERR_F_COPY_RANGE_TERMINAL      : return "cannot copy to or from a terminal file descriptor"; break;
+        case ERR_F_COPY_RANGE_RONLY         : return "current process does not have write access"; break;
+        case ERR_F_COPY_RANGE_NOSPACE       : return "not enough free space in the file system"; break;
 
         case ERR_P_SPAWN_NULL_CHILD         : return "created a null child process"; break;
         case ERR_P_SPAWN_NULL_STACK         : return "stack was not allocated correctly"; break;
         case ERR_P_WAITPID_NULL_CHILD       : return "cannot wait on a pid that was not found"; break;
         case ERR_P_KILL_NULL_PROCESS        : return "cannot kill a pid that was not found"; break;
+        case ERR_P_KILL_INVALID_SIGNAL      : return "not a kernel signal"; break;
         case ERR_P_NICE_NULL_PROCESS        : return "cannot change priority of a pid that was not found"; break;
+        case ERR_P_PIPE_NULL_PIPE           : return "pipe buffer was not allocated correctly"; break;
+        case ERR_P_PIPE_NO_FDS              : return "too many open files in the process"; break;
+        case ERR_P_SHM_CREATE_INVALID       : return "invalid shared memory name or size"; break;
+        case ERR_P_SHM_CREATE_EXISTS        : return "a shared memory region with that name already exists"; break;
+        case ERR_P_SHM_CREATE_NULL_REGION   : return "shared memory region was not allocated correctly"; break;
+        case ERR_P_SHM_ATTACH_NOT_FOUND     : return "no shared memory region with that name"; break;
+        case ERR_P_SHM_ATTACH_NULL_ATTACHMENT : return "shared memory attachment was not allocated correctly"; break;
+        case ERR_P_SHM_DETACH_NOT_ATTACHED  : return "not attached to a shared memory region at that address"; break;
+        case ERR_P_MUTEX_LOCK_DEADLOCK      : return "mutex is already held by this process"; break;
+        case ERR_P_MUTEX_TRYLOCK_BUSY       : return "mutex is held"; break;
+        case ERR_P_MUTEX_UNLOCK_NOT_OWNER   : return "mutex is not held by this process"; break;
+        case ERR_P_SEM_INIT_INVALID         : return "invalid semaphore value"; break;
+        case ERR_P_SEM_TRYWAIT_BUSY         : return "semaphore has no units"; break;
+        case ERR_P_COND_WAIT_NOT_OWNER      : return "mutex is not held by this process"; break;
+        case ERR_P_MQ_OPEN_INVALID          : return "invalid message queue name, capacity, or message size"; break;
+        case ERR_P_MQ_OPEN_NOT_FOUND        : return "no message queue with that name"; break;
+        case ERR_P_MQ_OPEN_MISMATCH         : return "message queue exists with a different capacity or message size"; break;
+        case ERR_P_MQ_OPEN_NULL_QUEUE       : return "message queue was not allocated correctly"; break;
+        case ERR_P_MQ_OPEN_NO_FDS           : return "too many open files in the process"; break;
+        case ERR_P_MQ_SEND_NOT_MQ           : return "not a message queue"; break;
+        case ERR_P_MQ_SEND_INVALID          : return "message too long or priority out of range"; break;
+        case ERR_P_MQ_RECV_NOT_MQ           : return "not a message queue"; break;
+        case ERR_P_MQ_RECV_TOO_SMALL        : return "buffer smaller than the message queue's message size"; break;
+        case ERR_P_POLL_BAD_FD              : return "file descriptor to poll is not open"; break;
+        case ERR_P_CHILD_FD_NO_FDS          : return "too many open files in the process"; break;
+        case ERR_P_SETITIMER_INVALID        : return "negative timer delay or interval"; break;
+        case ERR_P_SIGNAL_INVALID           : return "signal cannot be handled"; break;
+        case ERR_P_SIGNAL_NULL_STACK        : return "signal handler stack could not be allocated"; break;
+        case ERR_P_SIGPROCMASK_INVALID      : return "invalid signal mask operation"; break;
 
         default: return "undefined error";
     }
@@ -8,23 +8,68 @@
 */
 // filesystem.c
 #define ERR_FS_FILE_NOT_FOUND       1000
+#define ERR_FS_PIPE                 1001
+#define ERR_FS_PIPE_END             1002
+#define ERR_FS_MQ                   1003
+#define ERR_FS_CHILD_FD             1004
 #define ERR_F_OPEN_INVALID_PERMS    1010
 #define ERR_F_OPEN_WRITE_INUSE      1011
 #define ERR_F_OPEN_CREATE_READ      1012
 #define ERR_F_OPEN_INVALID_MODE     1013
+#define ERR_F_OPEN_NO_FDS           1014
 #define ERR_F_READ_TERM_OUT         1020
+#define ERR_F_READ_CHECKSUM         1021
 #define ERR_F_WRITE_TERM_IN         1030
 #define ERR_F_WRITE_RONLY           1031
+#define ERR_F_WRITE_PIPE_CLOSED     1032
+#define ERR_F_WRITE_NOSPACE         1033
 #define ERR_F_CLOSE_TERMINAL        1040
 #define ERR_F_UNLINK_NOT_FOUND      1050
 #define ERR_F_LSEEK_TERMINAL        1060
 #define ERR_F_LSEEK_OOB             1061
+#define ERR_F_FALLOCATE_TERMINAL    1070
+#define ERR_F_FALLOCATE_INVALID     1071
+#define ERR_F_FALLOCATE_RONLY       1072
+#define ERR_F_FALLOCATE_NOSPACE     1073
+#define ERR_F_COPY_RANGE_TERMINAL   1080
+#define ERR_F_COPY_RANGE_RONLY      1081
+#define ERR_F_COPY_RANGE_NOSPACE    1082
 // puser-functions.c
 #define ERR_P_SPAWN_NULL_CHILD      2000
 #define ERR_P_SPAWN_NULL_STACK      2001
 #define ERR_P_WAITPID_NULL_CHILD    2010
 #define ERR_P_KILL_NULL_PROCESS     2020
+#define ERR_P_KILL_INVALID_SIGNAL   2021
 #define ERR_P_NICE_NULL_PROCESS     2030
+#define ERR_P_PIPE_NULL_PIPE        2040
+#define ERR_P_PIPE_NO_FDS           2041
+#define ERR_P_SHM_CREATE_INVALID    2050
+#define ERR_P_SHM_CREATE_EXISTS     2051
+#define ERR_P_SHM_CREATE_NULL_REGION 2052
+#define ERR_P_SHM_ATTACH_NOT_FOUND  2060
+#define ERR_P_SHM_ATTACH_NULL_ATTACHMENT 2061
+#define ERR_P_SHM_DETACH_NOT_ATTACHED 2070
+#define ERR_P_MUTEX_LOCK_DEADLOCK   2080
+#define ERR_P_MUTEX_TRYLOCK_BUSY    2090
+#define ERR_P_MUTEX_UNLOCK_NOT_OWNER 2100
+#define ERR_P_SEM_INIT_INVALID      2110
+#define ERR_P_SEM_TRYWAIT_BUSY      2120
+#define ERR_P_COND_WAIT_NOT_OWNER   2130
+#define ERR_P_MQ_OPEN_INVALID       2140
+#define ERR_P_MQ_OPEN_NOT_FOUND     2141
+#define ERR_P_MQ_OPEN_MISMATCH      2142
+#define ERR_P_MQ_OPEN_NULL_QUEUE    2143
+#define ERR_P_MQ_OPEN_NO_FDS        2144
+#define ERR_P_MQ_SEND_NOT_MQ        2150
+#define ERR_P_MQ_SEND_INVALID       2151
+#define ERR_P_MQ_RECV_NOT_MQ        2160
+#define ERR_P_MQ_RECV_TOO_SMALL     2161
+#define ERR_P_POLL_BAD_FD           2170
+#define ERR_P_CHILD_FD_NO_FDS       2180
+#define ERR_P_SETITIMER_INVALID     2190
+#define ERR_P_SIGNAL_INVALID        2200
+#define ERR_P_SIGNAL_NULL_STACK     2201
+#define ERR_P_SIGPROCMASK_INVALID   2210
 
 extern int ERRNO;
 
@@ -94,6 +94,15 @@ int safe_p_kill(pid_t pid, int sig) {
     return res;
 }
 
+p_sighandler_t safe_p_signal(int sig, p_sighandler_t handler) {
+    p_sighandler_t res = p_signal(sig, handler);
+    if (res == P_SIG_ERR) {
+        p_perror("p_signal");
+        p_exit();
+    }
+    return res;
+}
+
 int safe_p_nice(pid_t pid, int priority) {
     int res = p_nice(pid, priority);
     if (res == -1) {
@@ -101,4 +110,103 @@ int safe_p_nice(pid_t pid, int priority) {
         p_exit();
     }
     return res;
-}
\ No newline at end of file
+}
+
+int safe_p_pipe(int fds[2]) {
+    int res = p_pipe(fds);
+    if (res == -1) {
+        p_perror("p_pipe");
+        p_exit();
+    }
+    return res;
+}
+
+void* safe_p_shm_create(const char* name, size_t size) {
+    void* res = p_shm_create(name, size);
+    if (res == NULL) {
+        p_perror("p_shm_create");
+        p_exit();
+    }
+    return res;
+}
+
+void* safe_p_shm_attach(const char* name, size_t* size) {
+    void* res = p_shm_attach(name, size);
+    if (res == NULL) {
+        p_perror("p_shm_attach");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_shm_detach(void* addr) {
+    int res = p_shm_detach(addr);
+    if (res == -1) {
+        p_perror("p_shm_detach");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_mutex_lock(mutex_t* mutex) {
+    int res = p_mutex_lock(mutex);
+    if (res == -1) {
+        p_perror("p_mutex_lock");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_mutex_unlock(mutex_t* mutex) {
+    int res = p_mutex_unlock(mutex);
+    if (res == -1) {
+        p_perror("p_mutex_unlock");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_mq_open(const char* name, int capacity, int msg_size) {
+    int res = p_mq_open(name, capacity, msg_size);
+    if (res == -1) {
+        p_perror("p_mq_open");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_mq_send(int fd, const void* msg, int len, int priority) {
+    int res = p_mq_send(fd, msg, len, priority);
+    if (res == -1) {
+        p_perror("p_mq_send");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_mq_recv(int fd, void* buf, int size, int* priority) {
+    int res = p_mq_recv(fd, buf, size, priority);
+    if (res == -1) {
+        p_perror("p_mq_recv");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_mq_send_batch(int fd, const mq_msg_t msgs[], int n) {
+    int res = p_mq_send_batch(fd, msgs, n);
+    if (res == -1) {
+        p_perror("p_mq_send_batch");
+        p_exit();
+    }
+    return res;
+}
+
+int safe_p_mq_recv_batch(int fd, mq_msg_t msgs[], int n) {
+    int res = p_mq_recv_batch(fd, msgs, n);
+    if (res == -1) {
+        p_perror("p_mq_recv_batch");
+        p_exit();
+    }
+    return res;
+}
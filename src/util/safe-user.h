@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h>
+#include "../kernel/sync.h"
+#include "../kernel/mq.h"
 
 // error handling for f_open
 int safe_f_open(const char *fname, int mode);
@@ -32,5 +34,40 @@ pid_t safe_p_waitpid(pid_t pid, int *wstatus, bool nohang);
 // error handling for p_kill
 int safe_p_kill(pid_t pid, int sig);
 
+// error handling for p_signal
+p_sighandler_t safe_p_signal(int sig, p_sighandler_t handler);
+
 // error handling for p_nice
-int safe_p_nice(pid_t pid, int priority);
\ No newline at end of file
+int safe_p_nice(pid_t pid, int priority);
+// error handling for p_pipe
+int safe_p_pipe(int fds[2]);
+
+// error handling for p_shm_create
+void* safe_p_shm_create(const char* name, size_t size);
+
+// error handling for p_shm_attach
+void* safe_p_shm_attach(const char* name, size_t* size);
+
+// error handling for p_shm_detach
+int safe_p_shm_detach(void* addr);
+
+// error handling for p_mutex_lock
+int safe_p_mutex_lock(mutex_t* mutex);
+
+// error handling for p_mutex_unlock
+int safe_p_mutex_unlock(mutex_t* mutex);
+
+// error handling for p_mq_open
+int safe_p_mq_open(const char* name, int capacity, int msg_size);
+
+// error handling for p_mq_send
+int safe_p_mq_send(int fd, const void* msg, int len, int priority);
+
+// error handling for p_mq_recv
+int safe_p_mq_recv(int fd, void* buf, int size, int* priority);
+
+// error handling for p_mq_send_batch
+int safe_p_mq_send_batch(int fd, const mq_msg_t msgs[], int n);
+
+// error handling for p_mq_recv_batch
+int safe_p_mq_recv_batch(int fd, mq_msg_t msgs[], int n);